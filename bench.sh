@@ -0,0 +1,827 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+DEFAULT_METHODS="h264_sdl_preview"
+DEFAULT_RESOLUTIONS="1280x720"
+DEFAULT_FPS_LIST="30"
+DEFAULT_BITRATES="4000000"
+DEFAULT_DURATION="60"
+DEFAULT_WARMUP="10"
+DEFAULT_PAUSE="3"
+DEFAULT_SETTLE_TIMEOUT="600"
+# Thermal steady state: the SoC temperature moved by at most this much
+# (millidegrees) over the last window of samples.
+SETTLE_SPREAD_MC=500
+SETTLE_WINDOW=15
+SETTLE_INTERVAL=2
+THERMAL_ZONE="/sys/class/thermal/thermal_zone0/temp"
+
+SCRIPT_NAME=$(basename "$0")
+SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+PICAM="${SCRIPT_DIR}/picam.sh"
+METRICS=(fps cpu mem dropped jitter latency mbps pss cma temp arm peak)
+# --encoder-settings keys and the picam.sh options they set.
+declare -A ENCODER_KEYS=([idr]=--idr-period [profile]=--profile [level]=--level [slices]=--slices
+  [refresh]=--intra-refresh)
+
+die() {
+  local msg="$1"
+  echo "${SCRIPT_NAME}: ${msg}" >&2
+  exit 1
+}
+
+usage() {
+  cat <<USAGE
+Usage: ${SCRIPT_NAME} [options]
+
+Runs picam.sh unattended for every combination of the given values and
+summarises the per-second samples of each run.
+
+Options:
+  -m, --methods <list>        Comma-separated capture methods (default: ${DEFAULT_METHODS})
+  -r, --resolutions <list>    Comma-separated WxH values (default: ${DEFAULT_RESOLUTIONS})
+  -f, --fps <list>            Comma-separated frame rates (default: ${DEFAULT_FPS_LIST})
+  -b, --bitrates <list>       Comma-separated bitrates in bits per second (default: ${DEFAULT_BITRATES})
+  -d, --duration <seconds>    Length of each run (default: ${DEFAULT_DURATION})
+  -w, --warmup <seconds>      Samples before this point are discarded (default: ${DEFAULT_WARMUP})
+      --pause <seconds>       Idle time between runs so the camera is released (default: ${DEFAULT_PAUSE})
+      --daemon                Keep the camera open across runs (picam.sh --daemon) to measure warm starts
+      --camera-counts <list>  Comma-separated numbers of cameras to run at once (picam.sh --cameras
+                              0,1,...; h264_null or h264_native) to see how throughput scales
+                              (default: a single camera)
+      --capture-cpus <list>   Pin the capture thread of camera N to the Nth CPU of the list
+      --capture-priority <1-99> SCHED_FIFO priority for the capture threads
+      --encode-cpus <list>    Pin the encoder thread of camera N to the Nth CPU of the list
+      --encode-priority <1-99> SCHED_FIFO priority for the encoder threads
+      --display-cpus <cpus>   taskset CPU list for the stages reading the stream
+      --mlock                 Lock the memory of the picam-native stages
+      --sensor-mode <mode>    Pass --sensor-mode to every run (native methods only) and record the
+                              mode picked and its CSI-2 load per run
+      --capture-buffers <list> Comma-separated camera buffer counts to sweep (picam.sh
+                              --capture-buffers; native methods only) to find the smallest pool that
+                              holds the frame rate without drops
+      --settle                Before each run, wait until the SoC temperature is steady (within
+                              0.5 °C for 30 s) so every run starts from the same thermal state
+      --settle-temp <celsius> Like --settle, and also wait until the SoC has cooled to this
+      --settle-timeout <seconds> Longest wait for --settle; the run starts anyway, with a warning
+                              (default: ${DEFAULT_SETTLE_TIMEOUT})
+      --abort-throttled       Stop a run as soon as the firmware reports under-voltage, a capped ARM
+                              clock, throttling or the soft temperature limit, and mark it throttled
+      --encoder-settings <list> Comma-separated H.264 encoder settings to sweep, each 'default' or
+                              key=value pairs joined by '+' with the keys idr, profile, level, slices
+                              and refresh (picam.sh --idr-period, --profile, --level, --slices and
+                              --intra-refresh), e.g. default,idr=15,refresh=30+idr=600
+      --replay <file.h264>    Feed every run from this recording instead of the camera (picam.sh
+                              --replay, paced at each --fps), so decode, display and streaming
+                              compare on the same input on every Pi; native H.264 methods only,
+                              with --resolutions and --bitrates matching the recording
+  -o, --output-dir <path>     Where results go (default: ./bench-results/<timestamp>)
+  -h, --help                  Show this help message and exit
+
+Results:
+  <output-dir>/runs/<run>.csv   Raw samples (elapsed_s,fps,cpu_pct,mem_pct,dropped,first_frame_ms,
+                                jitter_ms,max_interval_ms,latency_ms,mbps,rss_mib,pss_mib,cma_mib,
+                                cache_mib,temp_c,arm_mhz,core_mhz,throttled,peak_kib)
+  <output-dir>/runs/<run>.log   Output of picam.sh for the run
+  <output-dir>/runs/<run>.mode.json  Sensor mode report of the run (with --sensor-mode)
+  <output-dir>/runs/<run>.buffers.json  Buffer pools of the run (with --capture-buffers, one camera)
+  <output-dir>/summary.csv      One row per run: time to first frame (ttff_ms, 0 when the method does
+                                not report it), sensor mode (WxH/bits) and its CSI-2 load (csi_mbps),
+                                both empty without --sensor-mode, number of cameras, camera buffers
+                                (empty without --capture-buffers), encoder setting (empty without
+                                --encoder-settings), SoC temperature at the start
+                                (temp_start_c), the throttling flags seen during the run (throttled,
+                                as in vcgencmd get_throttled; status 'throttled' with
+                                --abort-throttled), then mean, stddev, p5, p50, p95, p99 per metric
+                                (fps, cpu, mem, dropped, frame-interval jitter in ms, sensor-to-
+                                parser latency in ms, stream bandwidth in Mbit/s, PSS of the pipeline
+                                and CMA in use in MiB, SoC temperature in °C, ARM clock in MHz and
+                                the largest frame of each second in KiB); fps is the sum over all
+                                cameras
+  <output-dir>/scaling.csv      With --camera-counts: total and per-camera FPS per camera count, and
+                                the total as a share of the single-camera FPS times the count
+  <output-dir>/comparison.csv   Per resolution and frame rate, each method's FPS, CPU, latency and
+                                bandwidth next to each other (means over its single-camera runs),
+                                e.g. to weigh h264_native against mjpeg_native and yuv_native
+  <output-dir>/buffers.csv      With --capture-buffers: per configuration the smallest buffer count
+                                whose run kept 98% of the target FPS without drops, and its PSS and
+                                CMA use; empty when none did
+  <output-dir>/encoders.csv     With --encoder-settings: per configuration and setting the latency
+                                (mean, p95, p99), the bitrate (mean, stddev), the largest frame per
+                                second (mean, p95) and its burst factor, the mean of that peak over
+                                the average frame at the measured bitrate
+  <output-dir>/summary.json     The same data as JSON
+
+Examples:
+  ${SCRIPT_NAME} --methods h264_native,h264_drm_preview \\
+      --resolutions 1280x720,1920x1080 --bitrates 2000000,4000000,8000000 \\
+      --duration 120 --warmup 15
+  ${SCRIPT_NAME} --methods h264_native,mjpeg_native,yuv_native \\
+      --resolutions 640x480,1280x720,1920x1080
+  ${SCRIPT_NAME} --methods h264_native,h264_drm_preview,h264_null \\
+      --replay clip.h264 --resolutions 1920x1080 --fps 30,60
+  ${SCRIPT_NAME} --methods h264_drm_preview,h264_gl_preview \\
+      --replay clip.h264 --resolutions 1920x1080 --fps 60
+USAGE
+}
+
+parse_arguments() {
+  local parsed
+  parsed=$(getopt -o m:r:f:b:d:w:o:h \
+    --long methods:,resolutions:,fps:,bitrates:,duration:,warmup:,pause:,daemon,camera-counts:,capture-cpus:,capture-priority:,encode-cpus:,encode-priority:,display-cpus:,mlock,sensor-mode:,capture-buffers:,encoder-settings:,replay:,settle,settle-temp:,settle-timeout:,abort-throttled,output-dir:,help -- "$@") || {
+    usage
+    exit 1
+  }
+  eval set -- "$parsed"
+
+  while true; do
+    case "$1" in
+      -m|--methods)
+        METHODS="$2"
+        shift 2
+        ;;
+      -r|--resolutions)
+        RESOLUTIONS="$2"
+        shift 2
+        ;;
+      -f|--fps)
+        FPS_LIST="$2"
+        shift 2
+        ;;
+      -b|--bitrates)
+        BITRATES="$2"
+        shift 2
+        ;;
+      -d|--duration)
+        DURATION="$2"
+        shift 2
+        ;;
+      -w|--warmup)
+        WARMUP="$2"
+        shift 2
+        ;;
+      --pause)
+        PAUSE="$2"
+        shift 2
+        ;;
+      --daemon)
+        USE_DAEMON=1
+        shift
+        ;;
+      --camera-counts)
+        CAMERA_COUNTS="$2"
+        shift 2
+        ;;
+      --capture-cpus)
+        CAPTURE_CPUS="$2"
+        shift 2
+        ;;
+      --capture-priority)
+        CAPTURE_PRIORITY="$2"
+        shift 2
+        ;;
+      --encode-cpus)
+        ENCODE_CPUS="$2"
+        shift 2
+        ;;
+      --encode-priority)
+        ENCODE_PRIORITY="$2"
+        shift 2
+        ;;
+      --display-cpus)
+        DISPLAY_CPUS="$2"
+        shift 2
+        ;;
+      --mlock)
+        USE_MLOCK=1
+        shift
+        ;;
+      --sensor-mode)
+        SENSOR_MODE="$2"
+        shift 2
+        ;;
+      --capture-buffers)
+        CAPTURE_BUFFERS="$2"
+        shift 2
+        ;;
+      --encoder-settings)
+        ENCODER_SETTINGS="$2"
+        shift 2
+        ;;
+      --replay)
+        REPLAY="$2"
+        shift 2
+        ;;
+      --settle)
+        SETTLE=1
+        shift
+        ;;
+      --settle-temp)
+        SETTLE=1
+        SETTLE_TEMP="$2"
+        shift 2
+        ;;
+      --settle-timeout)
+        SETTLE_TIMEOUT="$2"
+        shift 2
+        ;;
+      --abort-throttled)
+        ABORT_THROTTLED=1
+        shift
+        ;;
+      -o|--output-dir)
+        OUTPUT_DIR="$2"
+        shift 2
+        ;;
+      -h|--help)
+        usage
+        exit 0
+        ;;
+      --)
+        shift
+        break
+        ;;
+      *)
+        die "Unexpected argument: $1"
+        ;;
+    esac
+  done
+}
+
+validate_numeric() {
+  local value="$1"
+  local label="$2"
+  if [[ ! "$value" =~ ^[0-9]+$ ]]; then
+    die "Invalid ${label}: '${value}'. Provide a positive integer."
+  fi
+}
+
+validate_configuration() {
+  validate_numeric "$DURATION" "duration"
+  validate_numeric "$WARMUP" "warm-up"
+  validate_numeric "$PAUSE" "pause"
+  if (( DURATION == 0 )); then
+    die "Duration must be greater than zero."
+  fi
+  if (( WARMUP >= DURATION )); then
+    die "Warm-up (${WARMUP}s) must be shorter than the run duration (${DURATION}s)."
+  fi
+  if [[ ! "$CAMERA_COUNTS" =~ ^[1-9][0-9]*(,[1-9][0-9]*)*$ ]]; then
+    die "Invalid camera counts: '${CAMERA_COUNTS}'. Provide comma-separated positive integers."
+  fi
+  if [[ -n "$CAPTURE_BUFFERS" && ! "$CAPTURE_BUFFERS" =~ ^[1-9][0-9]*(,[1-9][0-9]*)*$ ]]; then
+    die "Invalid buffer counts: '${CAPTURE_BUFFERS}'. Provide comma-separated positive integers."
+  fi
+  validate_numeric "$SETTLE_TIMEOUT" "settle timeout"
+  validate_encoder_settings
+  if [[ -n "$REPLAY" ]]; then
+    [[ -r "$REPLAY" ]] || die "Cannot read recording '${REPLAY}'."
+    # The rest would only fail in picam.sh, run after run.
+    [[ "$CAMERA_COUNTS" == 1 ]] || die "--replay stands in for one camera; drop --camera-counts."
+    [[ -z "$SENSOR_MODE$CAPTURE_BUFFERS$ENCODER_SETTINGS" ]] || \
+      die "--sensor-mode, --capture-buffers and --encoder-settings need the camera, not --replay."
+    (( ! USE_DAEMON )) || die "--daemon keeps the camera open; it cannot be combined with --replay."
+  fi
+  [[ -z "$SETTLE_TEMP" ]] || validate_numeric "$SETTLE_TEMP" "settle temperature"
+  if (( SETTLE )) && [[ ! -r "$THERMAL_ZONE" ]]; then
+    die "--settle needs the SoC temperature from ${THERMAL_ZONE}."
+  fi
+  local counts=() cpus=() count option
+  IFS=, read -ra counts <<<"$CAMERA_COUNTS"
+  for option in "capture:${CAPTURE_CPUS}" "encode:${ENCODE_CPUS}"; do
+    [[ -n "${option#*:}" ]] || continue
+    IFS=, read -ra cpus <<<"${option#*:}"
+    for count in "${counts[@]}"; do
+      (( ${#cpus[@]} >= count )) || die "--${option%%:*}-cpus lists ${#cpus[@]} CPUs for ${count} cameras."
+    done
+  done
+}
+
+# Only the shape of each setting; picam.sh checks the values against the
+# method of every run.
+validate_encoder_settings() {
+  [[ -n "$ENCODER_SETTINGS" ]] || return 0
+  local settings=() pairs=() setting pair
+  IFS=, read -ra settings <<<"$ENCODER_SETTINGS"
+  (( ${#settings[@]} > 0 )) || die "--encoder-settings needs at least one setting."
+  for setting in "${settings[@]}"; do
+    [[ "$setting" != default ]] || continue
+    IFS=+ read -ra pairs <<<"$setting"
+    for pair in "${pairs[@]}"; do
+      if [[ ! "$pair" =~ ^([a-z]+)=([A-Za-z0-9.]+)$ || -z "${ENCODER_KEYS[${BASH_REMATCH[1]}]:-}" ]]; then
+        die "Invalid encoder setting '${pair}' in '${setting}'. Use idr, profile, level, slices or refresh=<value>."
+      fi
+    done
+  done
+}
+
+# The picam.sh options of an encoder setting, one per line.
+encoder_args() {
+  local setting="$1"
+  [[ -n "$setting" && "$setting" != default ]] || return 0
+  local pairs=() pair
+  IFS=+ read -ra pairs <<<"$setting"
+  for pair in "${pairs[@]}"; do
+    printf '%s\n%s\n' "${ENCODER_KEYS[${pair%%=*}]}" "${pair#*=}"
+  done
+}
+
+# "0,1,...,n-1" for picam.sh --cameras, and the first n CPUs of a
+# --capture-cpus or --encode-cpus list.
+camera_list() {
+  local count="$1"
+  local i list=""
+  for (( i = 0; i < count; i++ )); do
+    list+="${list:+,}${i}"
+  done
+  echo "$list"
+}
+
+cpu_list() {
+  local count="$1"
+  local cpus=()
+  IFS=, read -ra cpus <<<"$2"
+  local IFS=,
+  echo "${cpus[*]:0:count}"
+}
+
+# Total FPS per camera count next to the one-camera figure of the same
+# configuration: a scaling of 100% means N cameras deliver N times as much.
+write_scaling_summary() {
+  local summary_csv="$1"
+  local scaling_csv="$2"
+  awk -F, '
+    NR == FNR {
+      if (FNR == 1) { for (i = 1; i <= NF; i++) col[$i] = i; next }
+      if ($col["cameras"] == 1 && $col["status"] == "ok") base[$2 "," $3 "," $4 "," $5] = $col["fps_mean"]
+      next
+    }
+    FNR == 1 { print "method,resolution,fps_target,bitrate,cameras,status,fps_total,fps_per_camera,scaling_pct"; next }
+    {
+      key = $2 "," $3 "," $4 "," $5
+      n = $col["cameras"]
+      total = $col["fps_mean"]
+      scaling = (key in base && base[key] > 0) ? sprintf("%.1f", total / (n * base[key]) * 100) : ""
+      printf "%s,%s,%s,%.3f,%.3f,%s\n", key, n, $col["status"], total, total / n, scaling
+    }' "$summary_csv" "$summary_csv" >"$scaling_csv"
+}
+
+# One row per resolution, frame rate and method with the means that decide
+# a codec: what it costs in CPU and latency against what it saves in
+# bandwidth. Bitrate sweeps are averaged; only single-camera runs count.
+write_codec_comparison() {
+  local summary_csv="$1"
+  local comparison_csv="$2"
+  awk -F, '
+    FNR == 1 { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    $col["status"] != "ok" || $col["cameras"] != 1 { next }
+    {
+      key = $col["resolution"] "," $col["fps_target"] "," $col["method"]
+      if (!(key in runs)) order[++n] = key
+      runs[key]++
+      fps[key] += $col["fps_mean"]
+      cpu[key] += $col["cpu_mean"]
+      latency[key] += $col["latency_mean"]
+      latency_p95[key] += $col["latency_p95"]
+      mbps[key] += $col["mbps_mean"]
+      dropped[key] += $col["dropped_mean"]
+    }
+    END {
+      print "resolution,fps_target,method,runs,fps_mean,cpu_mean,latency_ms_mean,latency_ms_p95,mbps_mean,dropped_mean"
+      for (i = 1; i <= n; i++) {
+        k = order[i]
+        r = runs[k]
+        printf "%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", k, r, fps[k] / r, cpu[k] / r, latency[k] / r,
+          latency_p95[k] / r, mbps[k] / r, dropped[k] / r
+      }
+    }' "$summary_csv" | { read -r header; echo "$header"; sort -t, -k1,1V -k2,2n -k3,3; } >"$comparison_csv"
+}
+
+# Latency and bitrate smoothness per encoder setting. H.264 spends most of
+# its bits on IDR frames, so the largest frame of each second, against the
+# average frame at the measured bitrate, is how bursty the stream is; what
+# that buys in latency shows next to it.
+write_encoder_summary() {
+  local summary_csv="$1"
+  local encoders_csv="$2"
+  awk -F, '
+    FNR == 1 {
+      for (i = 1; i <= NF; i++) col[$i] = i
+      print "method,resolution,fps_target,bitrate,cameras,encoder,status,latency_ms_mean,latency_ms_p95," \
+        "latency_ms_p99,mbps_mean,mbps_stddev,peak_kib_mean,peak_kib_p95,burst_factor"
+      next
+    }
+    {
+      average_kib = $col["mbps_mean"] * 1e6 / 8 / 1024 / $col["fps_target"]
+      burst = average_kib > 0 ? sprintf("%.2f", $col["peak_mean"] / average_kib) : ""
+      printf "%s,%s,%s,%s,%s,%s,%s,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%s\n", $col["method"], $col["resolution"],
+        $col["fps_target"], $col["bitrate"], $col["cameras"], $col["encoder"], $col["status"],
+        $col["latency_mean"], $col["latency_p95"], $col["latency_p99"], $col["mbps_mean"], $col["mbps_stddev"],
+        $col["peak_mean"], $col["peak_p95"], burst
+    }' "$summary_csv" >"$encoders_csv"
+}
+
+# The smallest camera pool per configuration that still keeps up: status
+# ok, no drops and at least 98% of the target FPS on every camera. Larger
+# pools only cost CMA from there on.
+write_buffer_summary() {
+  local summary_csv="$1"
+  local buffers_csv="$2"
+  awk -F, '
+    FNR == 1 { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    {
+      key = $col["method"] "," $col["resolution"] "," $col["fps_target"] "," $col["bitrate"] "," $col["cameras"]
+      if (!(key in seen)) { seen[key] = 1; order[++n] = key }
+      n_buffers = $col["buffers"] + 0
+      ok = $col["status"] == "ok" && $col["dropped_mean"] == 0 &&
+        $col["fps_mean"] >= 0.98 * $col["fps_target"] * $col["cameras"]
+      if (ok && (!(key in best) || n_buffers < best[key])) {
+        best[key] = n_buffers
+        fps[key] = $col["fps_mean"]
+        pss[key] = $col["pss_mean"]
+        cma[key] = $col["cma_mean"]
+      }
+    }
+    END {
+      print "method,resolution,fps_target,bitrate,cameras,min_buffers,fps_mean,pss_mib_mean,cma_mib_mean"
+      for (i = 1; i <= n; i++) {
+        k = order[i]
+        if (k in best) printf "%s,%d,%.3f,%.3f,%.3f\n", k, best[k], fps[k], pss[k], cma[k]
+        else printf "%s,,,,\n", k
+      }
+    }' "$summary_csv" >"$buffers_csv"
+}
+
+# SoC temperature in millidegrees Celsius, or nothing.
+soc_temperature() {
+  local millidegrees
+  read -r millidegrees 2>/dev/null <"$THERMAL_ZONE" && echo "$millidegrees"
+}
+
+# Waits until the last SETTLE_WINDOW readings lie within SETTLE_SPREAD_MC
+# of each other and, with --settle-temp, at or below it. Gives up after
+# --settle-timeout so one warm room does not stall the whole sweep.
+wait_for_thermal_steady_state() {
+  local deadline=$((SECONDS + SETTLE_TIMEOUT))
+  local limit=$(( ${SETTLE_TEMP:-1000} * 1000 ))
+  local window=() reading
+  while true; do
+    reading=$(soc_temperature) || die "Cannot read the SoC temperature from ${THERMAL_ZONE}."
+    window+=("$reading")
+    (( ${#window[@]} <= SETTLE_WINDOW )) || window=("${window[@]:1}")
+    if (( ${#window[@]} == SETTLE_WINDOW && reading <= limit )); then
+      local sorted=()
+      mapfile -t sorted < <(printf '%s\n' "${window[@]}" | sort -n)
+      (( sorted[-1] - sorted[0] > SETTLE_SPREAD_MC )) || return 0
+    fi
+    if (( SECONDS >= deadline )); then
+      echo "${SCRIPT_NAME}: SoC not settled after ${SETTLE_TIMEOUT}s ($((reading / 1000)) °C); starting anyway" >&2
+      return 0
+    fi
+    sleep "$SETTLE_INTERVAL"
+  done
+}
+
+# The throttling flags that were set now at any sample of a run, OR-ed
+# together as "0x..."; the since-boot bits say nothing about one run.
+run_throttle_flags() {
+  local samples_file="$1"
+  local flags=0 value
+  while read -r value; do
+    [[ ! "$value" =~ ^0x[0-9a-fA-F]+$ ]] || flags=$(( flags | (value & 0xf) ))
+  done < <(awk -F, 'NR > 1 && NF >= 18 { print $18 }' "$samples_file" 2>/dev/null | sort -u)
+  printf '0x%x\n' "$flags"
+}
+
+# Runs picam.sh in the background and, with --abort-throttled, stops it at
+# the first sample taken while throttled. Prints nothing; returns 2 for a
+# throttled run, 1 for a failed one.
+run_picam() {
+  local samples_file="$1"
+  shift
+  "$PICAM" "$@" &
+  local picam_pid=$!
+  local throttled=0
+  if (( ABORT_THROTTLED )); then
+    while kill -0 "$picam_pid" 2>/dev/null; do
+      sleep 1
+      if [[ "$(run_throttle_flags "$samples_file")" != 0x0 ]]; then
+        throttled=1
+        kill -TERM "$picam_pid" 2>/dev/null || true
+        break
+      fi
+    done
+  fi
+  local status=0
+  wait "$picam_pid" || status=1
+  if (( throttled )); then
+    return 2
+  fi
+  return "$status"
+}
+
+# Prints "mean stddev p5 p50 p95 p99" for one column of values on stdin,
+# using nearest-rank percentiles and the sample standard deviation.
+column_stats() {
+  sort -n | awk '
+    function pick(p,   rank) {
+      rank = int(p / 100 * n + 0.999999)
+      if (rank < 1) rank = 1
+      if (rank > n) rank = n
+      return v[rank]
+    }
+    { v[++n] = $1; sum += $1; sumsq += $1 * $1 }
+    END {
+      if (n == 0) { print "0 0 0 0 0 0"; exit }
+      mean = sum / n
+      var = n > 1 ? (sumsq - n * mean * mean) / (n - 1) : 0
+      if (var < 0) var = 0
+      printf "%.3f %.3f %.3f %.3f %.3f %.3f\n", mean, sqrt(var), pick(5), pick(50), pick(95), pick(99)
+    }'
+}
+
+# Keeps samples past the warm-up and turns the cumulative drop counter into
+# drops per sample: fps,cpu,mem,dropped,jitter,latency,mbps,pss,cma,temp,arm,peak. Columns older
+# sample files lack count as 0.
+measured_samples() {
+  local samples_file="$1"
+  awk -F, -v warmup="$WARMUP" '
+    NR == 1 { next }
+    {
+      drops = (have_prev && $5 >= prev) ? $5 - prev : 0
+      prev = $5
+      have_prev = 1
+      if ($1 >= warmup) print $2 "," $3 "," $4 "," drops "," ($7 + 0) "," ($9 + 0) "," ($10 + 0) "," ($12 + 0) "," ($13 + 0) "," ($15 + 0) "," ($16 + 0) "," ($19 + 0)
+    }' "$samples_file"
+}
+
+# Time to first frame of a run in ms: the last non-zero first_frame_ms, or 0.
+run_ttff() {
+  local samples_file="$1"
+  awk -F, 'NR > 1 && $6 > 0 { ttff = $6 } END { printf "%.1f\n", ttff + 0 }' "$samples_file" 2>/dev/null || echo 0
+}
+
+# Prints "WxH/bits csi_mbps" from a sensor mode report, or nothing.
+run_sensor_mode() {
+  local report="$1"
+  [[ -s "$report" ]] || return 0
+  sed -n 's/^  "\(width\|height\|bit_depth\|csi_mbps\)": \([0-9.]*\),*$/\1 \2/p' "$report" | awk '
+    { v[$1] = $2 }
+    END { if (v["width"]) printf "%sx%s/%s %s\n", v["width"], v["height"], v["bit_depth"], v["csi_mbps"] }'
+}
+
+summarise_run() {
+  local run_id="$1"
+  local method="$2"
+  local resolution="$3"
+  local fps="$4"
+  local bitrate="$5"
+  local status="$6"
+  local samples_file="$7"
+  local mode_report="$8"
+  local cameras="$9"
+  local buffers="${10}"
+  local temp_start="${11}"
+  local encoder="${12}"
+
+  local measured
+  measured=$(measured_samples "$samples_file" 2>/dev/null || true)
+  local count=0
+  if [[ -n "$measured" ]]; then
+    count=$(wc -l <<<"$measured")
+  fi
+  if (( count == 0 )) && [[ "$status" == "ok" ]]; then
+    status="no-samples"
+  fi
+
+  local ttff
+  ttff=$(run_ttff "$samples_file")
+
+  local sensor_mode="" csi_mbps=""
+  read -r sensor_mode csi_mbps <<<"$(run_sensor_mode "$mode_report")" || true
+  local json_mode="null" json_csi="null"
+  if [[ -n "$sensor_mode" ]]; then
+    json_mode="\"${sensor_mode}\""
+    json_csi="$csi_mbps"
+  fi
+
+  local throttled
+  throttled=$(run_throttle_flags "$samples_file")
+  local json_encoder="null"
+  [[ -z "$encoder" ]] || json_encoder="\"${encoder}\""
+
+  local csv_row="${run_id},${method},${resolution},${fps},${bitrate},${status},${count},${ttff}"
+  csv_row+=",${sensor_mode},${csi_mbps},${cameras},${buffers},${encoder},${temp_start},${throttled}"
+  local json_metrics=""
+  local column stats
+  for (( column = 1; column <= ${#METRICS[@]}; column++ )); do
+    if (( count > 0 )); then
+      stats=$(cut -d, -f"$column" <<<"$measured" | column_stats)
+    else
+      stats="0 0 0 0 0 0"
+    fi
+    local mean stddev p5 p50 p95 p99
+    read -r mean stddev p5 p50 p95 p99 <<<"$stats"
+    csv_row+=",${mean},${stddev},${p5},${p50},${p95},${p99}"
+    [[ -z "$json_metrics" ]] || json_metrics+=", "
+    json_metrics+="\"${METRICS[column - 1]}\": {\"mean\": ${mean}, \"stddev\": ${stddev}, \"p5\": ${p5}, \"p50\": ${p50}, \"p95\": ${p95}, \"p99\": ${p99}}"
+  done
+
+  echo "$csv_row" >>"$SUMMARY_CSV"
+  [[ "$JSON_ROWS" -eq 0 ]] || printf ",\n" >>"$SUMMARY_JSON"
+  printf '    {"run": "%s", "method": "%s", "resolution": "%s", "fps": %s, "bitrate": %s, "status": "%s", "samples": %s,\n     "ttff_ms": %s, "sensor_mode": %s, "csi_mbps": %s, "cameras": %s, "buffers": %s,\n     "encoder": %s, "temp_start_c": %s, "throttled": "%s", "metrics": {%s}}' \
+    "$run_id" "$method" "$resolution" "$fps" "$bitrate" "$status" "$count" "$ttff" "$json_mode" "$json_csi" \
+    "$cameras" "${buffers:-null}" "$json_encoder" "${temp_start:-null}" "$throttled" "$json_metrics" >>"$SUMMARY_JSON"
+  JSON_ROWS=$((JSON_ROWS + 1))
+}
+
+run_sweep() {
+  local methods=() resolutions=() fps_list=() bitrates=() camera_counts=() buffer_counts=("") encoders=("")
+  IFS=, read -ra methods <<<"$METHODS"
+  IFS=, read -ra resolutions <<<"$RESOLUTIONS"
+  IFS=, read -ra fps_list <<<"$FPS_LIST"
+  IFS=, read -ra bitrates <<<"$BITRATES"
+  IFS=, read -ra camera_counts <<<"$CAMERA_COUNTS"
+  [[ -z "$CAPTURE_BUFFERS" ]] || IFS=, read -ra buffer_counts <<<"$CAPTURE_BUFFERS"
+  [[ -z "$ENCODER_SETTINGS" ]] || IFS=, read -ra encoders <<<"$ENCODER_SETTINGS"
+
+  local method
+  for method in "${methods[@]}"; do
+    # Fail before the first run rather than half-way through the sweep.
+    "$PICAM" --check-deps --method "$method" >/dev/null || \
+      die "Dependencies for '${method}' are missing. Run '${SCRIPT_DIR}/dep.sh' first."
+  done
+
+  mkdir -p "${OUTPUT_DIR}/runs"
+  SUMMARY_CSV="${OUTPUT_DIR}/summary.csv"
+  SUMMARY_JSON="${OUTPUT_DIR}/summary.json"
+  JSON_ROWS=0
+
+  local header="run,method,resolution,fps_target,bitrate,status,samples,ttff_ms,sensor_mode,csi_mbps,cameras,buffers,encoder,temp_start_c,throttled"
+  local metric
+  for metric in "${METRICS[@]}"; do
+    header+=",${metric}_mean,${metric}_stddev,${metric}_p5,${metric}_p50,${metric}_p95,${metric}_p99"
+  done
+  echo "$header" >"$SUMMARY_CSV"
+  local input="camera"
+  [[ -z "$REPLAY" ]] || input=$(basename "$REPLAY")
+  printf '{\n  "duration_s": %s,\n  "warmup_s": %s,\n  "input": "%s",\n  "runs": [\n' "$DURATION" "$WARMUP" "$input" \
+    >"$SUMMARY_JSON"
+
+  local daemon_args=()
+  if (( USE_DAEMON )); then
+    daemon_args=(--daemon)
+  fi
+
+  local mode_args=()
+  if [[ -n "$SENSOR_MODE" ]]; then
+    mode_args=(--sensor-mode "$SENSOR_MODE")
+  fi
+
+  local placement_args=()
+  [[ -z "$CAPTURE_PRIORITY" ]] || placement_args+=(--capture-priority "$CAPTURE_PRIORITY")
+  [[ -z "$ENCODE_PRIORITY" ]] || placement_args+=(--encode-priority "$ENCODE_PRIORITY")
+  [[ -z "$DISPLAY_CPUS" ]] || placement_args+=(--display-cpus "$DISPLAY_CPUS")
+  (( ! USE_MLOCK )) || placement_args+=(--mlock)
+
+  local total=$(( ${#methods[@]} * ${#resolutions[@]} * ${#fps_list[@]} * ${#bitrates[@]} * ${#camera_counts[@]} * ${#buffer_counts[@]} \
+    * ${#encoders[@]} ))
+  local index=0
+  local resolution fps bitrate cameras buffers encoder
+  for method in "${methods[@]}"; do
+    for resolution in "${resolutions[@]}"; do
+      for fps in "${fps_list[@]}"; do
+        for bitrate in "${bitrates[@]}"; do
+          for cameras in "${camera_counts[@]}"; do
+            for buffers in "${buffer_counts[@]}"; do
+              for encoder in "${encoders[@]}"; do
+                index=$((index + 1))
+                local run_id="${method}_${resolution}_${fps}fps_${bitrate}"
+                if [[ "$CAMERA_COUNTS" != 1 ]]; then
+                  run_id+="_${cameras}cam"
+                fi
+                [[ -z "$buffers" ]] || run_id+="_${buffers}buf"
+                if [[ -n "$encoder" ]]; then
+                  run_id+="_$(tr '+=' '-_' <<<"$encoder")"
+                fi
+                local samples_file="${OUTPUT_DIR}/runs/${run_id}.csv"
+                local log_file="${OUTPUT_DIR}/runs/${run_id}.log"
+                local mode_report=""
+                local buffer_report=""
+                local run_args=("${daemon_args[@]}" "${mode_args[@]}" "${placement_args[@]}"
+                  --cameras "$(camera_list "$cameras")")
+                if [[ -n "$CAPTURE_CPUS" ]]; then
+                  run_args+=(--capture-cpus "$(cpu_list "$cameras" "$CAPTURE_CPUS")")
+                fi
+                if [[ -n "$ENCODE_CPUS" ]]; then
+                  run_args+=(--encode-cpus "$(cpu_list "$cameras" "$ENCODE_CPUS")")
+                fi
+                if [[ -n "$SENSOR_MODE" ]]; then
+                  mode_report="${OUTPUT_DIR}/runs/${run_id}.mode.json"
+                  run_args+=(--mode-report "$mode_report")
+                fi
+                # The report describes one pipeline; picam.sh refuses it for several.
+                if [[ -n "$buffers" ]]; then
+                  run_args+=(--capture-buffers "$buffers")
+                  if (( cameras == 1 )); then
+                    buffer_report="${OUTPUT_DIR}/runs/${run_id}.buffers.json"
+                    run_args+=(--buffer-report "$buffer_report")
+                  fi
+                fi
+                local encoder_opts=()
+                mapfile -t encoder_opts < <(encoder_args "$encoder")
+                run_args+=("${encoder_opts[@]}")
+                [[ -z "$REPLAY" ]] || run_args+=(--replay "$REPLAY" --replay-fps "$fps")
+                rm -f "$samples_file" "$mode_report" "$buffer_report"
+
+                if (( SETTLE )); then
+                  echo "[${index}/${total}] Waiting for the SoC temperature to settle"
+                  wait_for_thermal_steady_state
+                fi
+                local temp_start="" reading
+                if reading=$(soc_temperature); then
+                  temp_start=$(awk -v t="$reading" 'BEGIN{printf "%.1f", t / 1000}')
+                fi
+
+                local details="${cameras} camera(s)${buffers:+, ${buffers} buffers}${encoder:+, encoder ${encoder}}"
+                echo "[${index}/${total}] ${method} ${resolution} @ ${fps} fps, ${bitrate} bps, ${details} (${DURATION}s)"
+                local status="ok" result=0
+                run_picam "$samples_file" --no-menu --method "$method" --resolution "$resolution" --fps "$fps" \
+                  --bitrate "$bitrate" --duration "$DURATION" --samples "$samples_file" \
+                  "${run_args[@]}" </dev/null >"$log_file" 2>&1 || result=$?
+                if (( result == 2 )); then
+                  status="throttled"
+                  echo "${SCRIPT_NAME}: Run '${run_id}' throttled; stopped early" >&2
+                elif (( result != 0 )); then
+                  status="failed"
+                  echo "${SCRIPT_NAME}: Run '${run_id}' failed; see ${log_file}" >&2
+                fi
+                summarise_run "$run_id" "$method" "$resolution" "$fps" "$bitrate" "$status" "$samples_file" \
+                  "$mode_report" "$cameras" "$buffers" "$temp_start" "$encoder"
+
+                if (( index < total && PAUSE > 0 )); then
+                  sleep "$PAUSE"
+                fi
+              done
+            done
+          done
+        done
+      done
+    done
+  done
+
+  if (( USE_DAEMON )); then
+    "$PICAM" --stop-daemon >/dev/null 2>&1 || true
+  fi
+  printf '\n  ]\n}\n' >>"$SUMMARY_JSON"
+  echo "Summary written to ${SUMMARY_CSV} and ${SUMMARY_JSON}"
+  write_codec_comparison "$SUMMARY_CSV" "${OUTPUT_DIR}/comparison.csv"
+  echo "Method comparison written to ${OUTPUT_DIR}/comparison.csv"
+  if [[ "$CAMERA_COUNTS" != 1 ]]; then
+    write_scaling_summary "$SUMMARY_CSV" "${OUTPUT_DIR}/scaling.csv"
+    echo "Camera scaling written to ${OUTPUT_DIR}/scaling.csv"
+  fi
+  if [[ -n "$CAPTURE_BUFFERS" ]]; then
+    write_buffer_summary "$SUMMARY_CSV" "${OUTPUT_DIR}/buffers.csv"
+    echo "Smallest buffer pools written to ${OUTPUT_DIR}/buffers.csv"
+  fi
+  if [[ -n "$ENCODER_SETTINGS" ]]; then
+    write_encoder_summary "$SUMMARY_CSV" "${OUTPUT_DIR}/encoders.csv"
+    echo "Encoder settings compared in ${OUTPUT_DIR}/encoders.csv"
+  fi
+}
+
+main() {
+  METHODS="$DEFAULT_METHODS"
+  RESOLUTIONS="$DEFAULT_RESOLUTIONS"
+  FPS_LIST="$DEFAULT_FPS_LIST"
+  BITRATES="$DEFAULT_BITRATES"
+  DURATION="$DEFAULT_DURATION"
+  WARMUP="$DEFAULT_WARMUP"
+  PAUSE="$DEFAULT_PAUSE"
+  USE_DAEMON=0
+  SENSOR_MODE=""
+  CAPTURE_BUFFERS=""
+  ENCODER_SETTINGS=""
+  REPLAY=""
+  SETTLE=0
+  SETTLE_TEMP=""
+  SETTLE_TIMEOUT="$DEFAULT_SETTLE_TIMEOUT"
+  ABORT_THROTTLED=0
+  CAMERA_COUNTS=1
+  CAPTURE_CPUS=""
+  CAPTURE_PRIORITY=""
+  ENCODE_CPUS=""
+  ENCODE_PRIORITY=""
+  DISPLAY_CPUS=""
+  USE_MLOCK=0
+  OUTPUT_DIR="bench-results/$(date +%Y%m%d-%H%M%S)"
+
+  parse_arguments "$@"
+  validate_configuration
+
+  [[ -x "$PICAM" ]] || die "picam.sh not found or not executable at '$PICAM'"
+  run_sweep
+}
+
+main "$@"
@@ -10,12 +10,17 @@ Usage: ${SCRIPT_NAME} [options]
 Options:
   --check               Only verify dependencies and exit with the result
   --require-whiptail    Treat whiptail as a mandatory dependency
+  --require-native      Also require the toolchain used to build picam-native
+  --require-gl          Also require EGL, GLES and GBM for its GLES renderer
+                        (implies --require-native)
   -h, --help            Show this help message and exit
 USAGE
 }
 
 CHECK_ONLY=0
 REQUIRE_WHIPTAIL=0
+REQUIRE_NATIVE=0
+REQUIRE_GL=0
 
 while [[ $# -gt 0 ]]; do
   case "$1" in
@@ -27,6 +32,15 @@ while [[ $# -gt 0 ]]; do
       REQUIRE_WHIPTAIL=1
       shift
       ;;
+    --require-native)
+      REQUIRE_NATIVE=1
+      shift
+      ;;
+    --require-gl)
+      REQUIRE_NATIVE=1
+      REQUIRE_GL=1
+      shift
+      ;;
     -h|--help)
       usage
       exit 0
@@ -51,6 +65,24 @@ OPTIONAL_COMMANDS=(
   whiptail
 )
 
+NATIVE_COMMANDS=(
+  c++
+  pkg-config
+)
+
+NATIVE_PKGCONFIG_MODULES=(
+  libcamera
+  freetype2
+  libdrm
+)
+
+# Only the h264_gl_preview renderer links these; picam-native builds without.
+NATIVE_GL_PKGCONFIG_MODULES=(
+  egl
+  glesv2
+  gbm
+)
+
 declare -A COMMAND_PACKAGES=(
   [libcamera-vid]="libcamera-apps"
   [ffmpeg]="ffmpeg"
@@ -58,6 +90,17 @@ declare -A COMMAND_PACKAGES=(
   [ps]="procps"
   [stdbuf]="coreutils"
   [whiptail]="whiptail"
+  [c++]="g++"
+  [pkg-config]="pkg-config"
+)
+
+declare -A MODULE_PACKAGES=(
+  [libcamera]="libcamera-dev"
+  [freetype2]="libfreetype-dev"
+  [libdrm]="libdrm-dev"
+  [egl]="libegl-dev"
+  [glesv2]="libgles-dev"
+  [gbm]="libgbm-dev"
 )
 
 build_required_list() {
@@ -66,6 +109,24 @@ build_required_list() {
   if [[ "$REQUIRE_WHIPTAIL" -eq 1 ]]; then
     _out+=("whiptail")
   fi
+  if [[ "$REQUIRE_NATIVE" -eq 1 ]]; then
+    _out+=("${NATIVE_COMMANDS[@]}")
+  fi
+}
+
+build_module_list() {
+  local -n _out="$1"
+  _out=()
+  if [[ "$REQUIRE_NATIVE" -eq 1 ]]; then
+    _out=("${NATIVE_PKGCONFIG_MODULES[@]}")
+  fi
+  if [[ "$REQUIRE_GL" -eq 1 ]]; then
+    _out+=("${NATIVE_GL_PKGCONFIG_MODULES[@]}")
+  fi
+}
+
+module_present() {
+  command -v pkg-config >/dev/null 2>&1 && pkg-config --exists "$1"
 }
 
 build_optional_list() {
@@ -109,6 +170,7 @@ update_and_install() {
 check_commands() {
   local -n _required="$1"
   local -n _optional="$2"
+  local -n _modules="$3"
 
   local missing=()
 
@@ -127,6 +189,19 @@ check_commands() {
     fi
   done
 
+  if [[ ${#_modules[@]} -gt 0 ]]; then
+    echo
+    echo "Checking development libraries..."
+    for module in "${_modules[@]}"; do
+      if module_present "$module"; then
+        echo "[OK] $module"
+      else
+        echo "[MISSING] $module (install package: ${MODULE_PACKAGES[$module]})"
+        missing+=("$module")
+      fi
+    done
+  fi
+
   if [[ ${#_optional[@]} -gt 0 ]]; then
     echo
     echo "Checking optional commands..."
@@ -152,10 +227,12 @@ check_commands() {
 
 required_commands=()
 optional_commands=()
+required_modules=()
 build_required_list required_commands
 build_optional_list optional_commands
+build_module_list required_modules
 
-if check_commands required_commands optional_commands; then
+if check_commands required_commands optional_commands required_modules; then
   exit 0
 fi
 
@@ -180,6 +257,15 @@ for cmd in "${required_commands[@]}"; do
   fi
 done
 
+for module in "${required_modules[@]}"; do
+  module_present "$module" && continue
+  pkg="${MODULE_PACKAGES[$module]}"
+  if [[ -z "${seen[$pkg]+x}" ]]; then
+    dedup_packages+=("$pkg")
+    seen[$pkg]=1
+  fi
+done
+
 if [[ ${#missing_without_package[@]} -gt 0 ]]; then
   echo "${SCRIPT_NAME}: Missing required commands without known packages: ${missing_without_package[*]}" >&2
   exit 1
@@ -198,7 +284,7 @@ fi
 
 hash -r 2>/dev/null || true
 
-if check_commands required_commands optional_commands; then
+if check_commands required_commands optional_commands required_modules; then
   exit 0
 fi
 
@@ -0,0 +1,193 @@
+#include "async_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+template <typename T> T *ring_field(void *ring, unsigned offset) {
+  return reinterpret_cast<T *>(static_cast<uint8_t *>(ring) + offset);
+}
+
+unsigned load_acquire(const unsigned *value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void store_release(unsigned *value, unsigned next) {
+  __atomic_store_n(value, next, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+AsyncWriter::AsyncWriter(unsigned depth) : depth_(depth) {
+  io_uring_params params{};
+  int fd = io_uring_setup(depth, &params);
+  if (fd < 0) {
+    return;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    close(fd);
+    return;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      munmap(sq_ring_, sq_ring_size_);
+      sq_ring_ = nullptr;
+      close(fd);
+      return;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = nullptr;
+    if (cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = cq_ring_ = nullptr;
+    close(fd);
+    return;
+  }
+
+  sq_tail_ = ring_field<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = ring_field<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = ring_field<unsigned>(sq_ring_, params.sq_off.array);
+  cq_head_ = ring_field<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = ring_field<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = ring_field<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = ring_field<void>(cq_ring_, params.cq_off.cqes);
+  iovecs_.resize(params.sq_entries);
+  depth_ = std::min(depth, params.sq_entries);
+  ring_fd_ = fd;
+}
+
+AsyncWriter::~AsyncWriter() {
+  while (in_flight_.load() > 0) {
+    wait();
+  }
+  if (ring_fd_ < 0) {
+    return;
+  }
+  munmap(sqes_, sqes_size_);
+  if (cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  munmap(sq_ring_, sq_ring_size_);
+  close(ring_fd_);
+}
+
+void AsyncWriter::complete_now(uint64_t tag, long result) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  completed_.push_back({tag, result});
+  ++in_flight_;
+  completed_cv_.notify_one();
+}
+
+void AsyncWriter::push_sqe(uint8_t opcode, int fd, const void *data, size_t size, uint64_t offset,
+                           uint64_t tag) {
+  if (in_flight_.load() >= depth_) {
+    throw Error("io_uring submission queue is full");
+  }
+
+  // Only the submitting thread touches the SQ tail; the kernel reads up to it.
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = tag;
+  if (opcode == IORING_OP_WRITEV) {
+    iovecs_[index] = {const_cast<void *>(data), size};
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(&iovecs_[index]);
+    sqe->len = 1;
+  }
+  sq_array_[index] = index;
+  store_release(sq_tail_, tail + 1);
+  ++in_flight_;
+
+  for (;;) {
+    int submitted = io_uring_enter(ring_fd_, 1, 0, 0);
+    if (submitted >= 0) {
+      break;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      throw_errno("io_uring_enter failed");
+    }
+  }
+}
+
+void AsyncWriter::submit(int fd, const void *data, size_t size, uint64_t offset, uint64_t tag) {
+  if (ring_fd_ < 0) {
+    ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+    complete_now(tag, written < 0 ? -errno : written);
+    return;
+  }
+  push_sqe(IORING_OP_WRITEV, fd, data, size, offset, tag);
+}
+
+void AsyncWriter::submit_nop(uint64_t tag) {
+  if (ring_fd_ < 0) {
+    complete_now(tag, 0);
+    return;
+  }
+  push_sqe(IORING_OP_NOP, -1, nullptr, 0, 0, tag);
+}
+
+WriteCompletion AsyncWriter::wait() {
+  if (ring_fd_ < 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    completed_cv_.wait(lock, [this] { return !completed_.empty(); });
+    WriteCompletion completion = completed_.front();
+    completed_.pop_front();
+    --in_flight_;
+    return completion;
+  }
+
+  unsigned head = *cq_head_;
+  while (head == load_acquire(cq_tail_)) {
+    if (io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      throw_errno("io_uring_enter failed");
+    }
+  }
+  const io_uring_cqe *cqe = static_cast<const io_uring_cqe *>(cqes_) + (head & *cq_mask_);
+  WriteCompletion completion{cqe->user_data, cqe->res};
+  store_release(cq_head_, head + 1);
+  --in_flight_;
+  return completion;
+}
+
+} // namespace picam
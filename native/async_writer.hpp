@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace picam {
+
+struct WriteCompletion {
+  uint64_t tag = 0;
+  // Bytes written or -errno, as returned by pwrite().
+  long result = 0;
+};
+
+// Positional file writes through io_uring, so a stalled SD card only delays
+// completions instead of the thread that queues them. The ring is driven
+// with raw syscalls; kernels without io_uring (or with it disabled) fall back
+// to a plain pwrite() in submit(). One thread may submit while another one
+// waits for completions.
+class AsyncWriter {
+public:
+  explicit AsyncWriter(unsigned depth);
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  bool uses_io_uring() const { return ring_fd_ >= 0; }
+  // The buffer must stay untouched until the completion with this tag is reaped.
+  void submit(int fd, const void *data, size_t size, uint64_t offset, uint64_t tag);
+  // Queues a request that completes immediately, e.g. to wake the waiting thread.
+  void submit_nop(uint64_t tag);
+  // Blocks until one queued request finishes.
+  WriteCompletion wait();
+
+private:
+  void push_sqe(uint8_t opcode, int fd, const void *data, size_t size, uint64_t offset, uint64_t tag);
+  void complete_now(uint64_t tag, long result);
+
+  int ring_fd_ = -1;
+  unsigned depth_ = 0;
+  std::atomic<unsigned> in_flight_{0};
+
+  void *sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void *cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  void *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  void *cqes_ = nullptr;
+
+  // One iovec per submission slot; WRITEV works on every io_uring kernel (5.1+).
+  std::vector<iovec> iovecs_;
+  // Results of synchronous fallback writes, handed out by wait().
+  std::mutex mutex_;
+  std::condition_variable completed_cv_;
+  std::deque<WriteCompletion> completed_;
+};
+
+} // namespace picam
@@ -0,0 +1,61 @@
+#include "buffer_pools.hpp"
+
+#include <cstdio>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr double kMiB = 1024.0 * 1024.0;
+
+} // namespace
+
+size_t pool_bytes(const BufferPool &pool) {
+  return pool.bytes * pool.count;
+}
+
+std::string describe_buffer_pools(const std::vector<BufferPool> &pools) {
+  std::string text;
+  size_t total = 0;
+  size_t cma = 0;
+  for (const auto &pool : pools) {
+    char part[96];
+    if (pool.bytes > 0) {
+      std::snprintf(part, sizeof(part), "%s %u x %.2f MiB", pool.stage.c_str(), pool.count, pool.bytes / kMiB);
+    } else {
+      std::snprintf(part, sizeof(part), "%s %u (borrowed)", pool.stage.c_str(), pool.count);
+    }
+    text += text.empty() ? "" : ", ";
+    text += part;
+    total += pool_bytes(pool);
+    cma += pool.cma ? pool_bytes(pool) : 0;
+  }
+  char totals[64];
+  std::snprintf(totals, sizeof(totals), "; %.1f MiB, %.1f MiB CMA", total / kMiB, cma / kMiB);
+  return text + totals;
+}
+
+void write_buffer_report(const std::string &path, const std::vector<BufferPool> &pools) {
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw_errno("Cannot write buffer report '" + path + "'");
+  }
+  size_t total = 0;
+  size_t cma = 0;
+  std::fprintf(file, "{\n  \"pools\": [\n");
+  for (size_t i = 0; i < pools.size(); ++i) {
+    const BufferPool &pool = pools[i];
+    std::fprintf(file, "    {\"stage\": \"%s\", \"count\": %u, \"bytes\": %zu, \"cma\": %s}%s\n", pool.stage.c_str(),
+                 pool.count, pool.bytes, pool.cma ? "true" : "false", i + 1 < pools.size() ? "," : "");
+    total += pool_bytes(pool);
+    cma += pool.cma ? pool_bytes(pool) : 0;
+  }
+  std::fprintf(file, "  ],\n  \"total_bytes\": %zu,\n  \"cma_bytes\": %zu\n}\n", total, cma);
+  if (std::fclose(file) != 0) {
+    throw_errno("Cannot write buffer report '" + path + "'");
+  }
+}
+
+} // namespace picam
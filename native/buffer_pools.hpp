@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+// One set of equally sized buffers a pipeline stage holds for the whole run.
+struct BufferPool {
+  std::string stage;
+  unsigned count = 0;
+  // Per buffer; 0 when the stage only borrows another stage's buffers, as
+  // the encoder's input slots do with the camera dmabufs.
+  size_t bytes = 0;
+  // Contiguous memory from the CMA pool the ISP and codecs share, which on
+  // a 512 MB board runs out long before RAM does.
+  bool cma = false;
+};
+
+size_t pool_bytes(const BufferPool &pool);
+
+// "camera 6 x 1.3 MiB, encoder-output 12 x 1.0 MiB, ...; 22.3 MiB, 20.3 MiB CMA".
+std::string describe_buffer_pools(const std::vector<BufferPool> &pools);
+
+// Every pool plus the totals as JSON; throws on I/O errors.
+void write_buffer_report(const std::string &path, const std::vector<BufferPool> &pools);
+
+} // namespace picam
@@ -0,0 +1,302 @@
+#include "camera_source.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include <sys/mman.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+using namespace libcamera;
+
+namespace {
+
+uint64_t pack_crop(const CropRect &crop) {
+  return static_cast<uint64_t>(crop.x & 0xffff) << 48 | static_cast<uint64_t>(crop.y & 0xffff) << 32 |
+         static_cast<uint64_t>(crop.width & 0xffff) << 16 | (crop.height & 0xffff);
+}
+
+CropRect unpack_crop(uint64_t packed) {
+  return CropRect{static_cast<unsigned>(packed >> 48) & 0xffff, static_cast<unsigned>(packed >> 32) & 0xffff,
+                  static_cast<unsigned>(packed >> 16) & 0xffff, static_cast<unsigned>(packed) & 0xffff};
+}
+
+Rectangle to_rectangle(const CropRect &crop) {
+  return Rectangle(static_cast<int>(crop.x), static_cast<int>(crop.y), crop.width, crop.height);
+}
+
+} // namespace
+
+CameraSource::CameraSource(const CameraConfig &config) : config_(config) {
+  manager_ = std::make_unique<CameraManager>();
+  if (manager_->start() < 0) {
+    throw Error("Failed to start the libcamera camera manager");
+  }
+
+  auto cameras = manager_->cameras();
+  if (cameras.empty()) {
+    throw Error("No cameras were found by libcamera");
+  }
+  if (config.camera_index >= cameras.size()) {
+    throw Error("Camera index " + std::to_string(config.camera_index) + " is out of range (" +
+                std::to_string(cameras.size()) + " available)");
+  }
+  camera_ = cameras[config.camera_index];
+  if (camera_->acquire() < 0) {
+    throw Error("Camera '" + camera_->id() + "' is busy");
+  }
+
+  if (config.auto_sensor_mode || config.sensor_width > 0) {
+    std::vector<SensorMode> modes = list_sensor_modes(*camera_);
+    const SensorMode *mode =
+        config.auto_sensor_mode ? select_sensor_mode(modes, config.width, config.height, config.framerate)
+                                : find_sensor_mode(modes, config.sensor_width, config.sensor_height,
+                                                   config.sensor_bit_depth);
+    if (!mode && config.auto_sensor_mode) {
+      throw Error("Camera '" + camera_->id() + "' reports no sensor modes");
+    }
+    if (!mode) {
+      throw Error("Camera '" + camera_->id() + "' has no " + std::to_string(config.sensor_width) + "x" +
+                  std::to_string(config.sensor_height) + " sensor mode; see 'picam-native sensor-modes'");
+    }
+    sensor_mode_ = *mode;
+  }
+
+  const bool lores = config.lores_width > 0 && config.lores_height > 0;
+  if (lores) {
+    configuration_ = camera_->generateConfiguration({StreamRole::VideoRecording, StreamRole::Viewfinder});
+  } else {
+    configuration_ = camera_->generateConfiguration({StreamRole::VideoRecording});
+  }
+  if (!configuration_) {
+    throw Error(lores ? "Camera cannot add a low-resolution stream to VideoRecording"
+                      : "Camera does not support the VideoRecording role");
+  }
+  StreamConfiguration &stream_config = configuration_->at(0);
+  stream_config.pixelFormat = formats::YUV420;
+  stream_config.size = Size(config.width, config.height);
+  stream_config.bufferCount = config.buffer_count;
+  stream_config.colorSpace = config.full_range ? ColorSpace::Sycc : ColorSpace::Rec709;
+  if (sensor_mode_.width > 0) {
+    SensorConfiguration sensor;
+    sensor.bitDepth = sensor_mode_.bit_depth;
+    sensor.outputSize = Size(sensor_mode_.width, sensor_mode_.height);
+    configuration_->sensorConfig = sensor;
+  }
+  if (lores) {
+    StreamConfiguration &lores_config = configuration_->at(1);
+    lores_config.pixelFormat = formats::YUV420;
+    lores_config.size = Size(config.lores_width, config.lores_height);
+    lores_config.bufferCount = config.buffer_count;
+    lores_config.colorSpace = ColorSpace::Rec709;
+  }
+
+  if (configuration_->validate() == CameraConfiguration::Invalid) {
+    throw Error("Camera rejected the requested configuration " + stream_config.toString());
+  }
+  if (stream_config.pixelFormat != formats::YUV420) {
+    throw Error("Camera cannot produce YUV420 frames");
+  }
+  if (lores && configuration_->at(1).pixelFormat != formats::YUV420) {
+    throw Error("Camera cannot produce a YUV420 low-resolution stream");
+  }
+  if (camera_->configure(configuration_.get()) < 0) {
+    throw Error("Failed to configure camera with " + stream_config.toString());
+  }
+
+  stream_ = stream_config.stream();
+  width_ = stream_config.size.width;
+  height_ = stream_config.size.height;
+  stride_ = stream_config.stride;
+  frame_bytes_ = stream_config.frameSize;
+  // Known only once the sensor mode is configured.
+  const Rectangle maximum = camera_->properties().get(properties::ScalerCropMaximum).value_or(Rectangle());
+  crop_maximum_ = CropRect{static_cast<unsigned>(std::max(0, maximum.x)), static_cast<unsigned>(std::max(0, maximum.y)),
+                           maximum.width, maximum.height};
+  if (config.has_roi && crop_maximum_.empty()) {
+    throw Error("Camera '" + camera_->id() + "' reports no ScalerCropMaximum to place the region of interest in");
+  }
+
+  allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+  if (allocator_->allocate(stream_) < 0) {
+    throw Error("Failed to allocate camera buffers");
+  }
+  if (lores) {
+    const StreamConfiguration &lores_config = configuration_->at(1);
+    lores_stream_ = lores_config.stream();
+    lores_width_ = lores_config.size.width;
+    lores_height_ = lores_config.size.height;
+    lores_stride_ = lores_config.stride;
+    lores_frame_bytes_ = lores_config.frameSize;
+    if (allocator_->allocate(lores_stream_) < 0) {
+      throw Error("Failed to allocate low-resolution camera buffers");
+    }
+  }
+
+  const auto &buffers = allocator_->buffers(stream_);
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    std::unique_ptr<Request> request = camera_->createRequest(i);
+    if (!request || request->addBuffer(stream_, buffers[i].get()) < 0) {
+      throw Error("Failed to create camera request");
+    }
+    planes_.push_back(config.map_buffers ? map_buffer(buffers[i].get()) : std::array<uint8_t *, 3>{});
+    if (lores_stream_) {
+      const auto &lores_buffers = allocator_->buffers(lores_stream_);
+      if (i >= lores_buffers.size() || request->addBuffer(lores_stream_, lores_buffers[i].get()) < 0) {
+        throw Error("Failed to add the low-resolution buffer to a camera request");
+      }
+      lores_planes_.push_back(map_buffer(lores_buffers[i].get()));
+    }
+    requests_.push_back(std::move(request));
+  }
+
+  camera_->requestCompleted.connect(this, &CameraSource::on_request_completed);
+}
+
+CameraSource::~CameraSource() {
+  stop();
+  camera_->requestCompleted.disconnect(this, &CameraSource::on_request_completed);
+  requests_.clear();
+  for (const auto &mapping : mappings_) {
+    munmap(mapping.mem, mapping.length);
+  }
+  allocator_.reset();
+  camera_->release();
+  camera_.reset();
+  manager_->stop();
+}
+
+// The Pi ISP hands out all three YUV420 planes from a single dmabuf, so one
+// mapping per distinct fd covers every plane.
+std::array<uint8_t *, 3> CameraSource::map_buffer(FrameBuffer *buffer) {
+  std::array<uint8_t *, 3> planes{};
+  const auto &buffer_planes = buffer->planes();
+  for (size_t i = 0; i < buffer_planes.size() && i < planes.size(); ++i) {
+    int fd = buffer_planes[i].fd.get();
+    size_t length = 0;
+    for (const auto &plane : buffer_planes) {
+      if (plane.fd.get() == fd) {
+        length = std::max<size_t>(length, plane.offset + plane.length);
+      }
+    }
+    uint8_t *base = nullptr;
+    for (size_t j = 0; j < i; ++j) {
+      if (buffer_planes[j].fd.get() == fd) {
+        base = planes[j] - buffer_planes[j].offset;
+      }
+    }
+    if (!base) {
+      void *mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mem == MAP_FAILED) {
+        throw_errno("Cannot map camera buffer");
+      }
+      mappings_.push_back({mem, length});
+      base = static_cast<uint8_t *>(mem);
+    }
+    planes[i] = base + buffer_planes[i].offset;
+  }
+  return planes;
+}
+
+void CameraSource::start(FrameCallback on_frame) {
+  on_frame_ = std::move(on_frame);
+
+  ControlList controls(controls::controls);
+  int64_t frame_duration_us = 1000000 / config_.framerate;
+  controls.set(controls::FrameDurationLimits, Span<const int64_t, 2>({frame_duration_us, frame_duration_us}));
+  if (config_.has_roi) {
+    controls.set(controls::ScalerCrop, to_rectangle(roi_crop(config_.roi, crop_maximum_, width_, height_)));
+  }
+
+  if (camera_->start(&controls) < 0) {
+    throw Error("Failed to start camera");
+  }
+  running_ = true;
+  for (auto &request : requests_) {
+    if (camera_->queueRequest(request.get()) < 0) {
+      throw Error("Failed to queue camera request");
+    }
+  }
+}
+
+void CameraSource::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  camera_->stop();
+}
+
+void CameraSource::release(uint64_t id) {
+  if (!running_ || id >= requests_.size()) {
+    return;
+  }
+  Request *request = requests_[id].get();
+  request->reuse(Request::ReuseBuffers);
+  int64_t frame_duration_us = frame_duration_us_.load(std::memory_order_relaxed);
+  if (frame_duration_us > 0) {
+    request->controls().set(controls::FrameDurationLimits,
+                            Span<const int64_t, 2>({frame_duration_us, frame_duration_us}));
+  }
+  uint64_t pending = pending_crop_.exchange(0, std::memory_order_relaxed);
+  if (pending != 0) {
+    request->controls().set(controls::ScalerCrop, to_rectangle(unpack_crop(pending)));
+  }
+  camera_->queueRequest(request);
+}
+
+void CameraSource::set_framerate(unsigned framerate) {
+  if (framerate > 0) {
+    frame_duration_us_.store(1000000 / framerate, std::memory_order_relaxed);
+  }
+}
+
+CropRect CameraSource::set_roi(const Roi &roi) {
+  CropRect crop = roi_crop(roi, crop_maximum_, width_, height_);
+  pending_crop_.store(pack_crop(crop), std::memory_order_relaxed);
+  return crop;
+}
+
+CropRect CameraSource::crop() const {
+  return unpack_crop(crop_.load(std::memory_order_relaxed));
+}
+
+void CameraSource::on_request_completed(Request *request) {
+  if (request->status() == Request::RequestCancelled || !running_) {
+    return;
+  }
+
+  FrameBuffer *buffer = request->findBuffer(stream_);
+  CameraFrame frame;
+  frame.id = request->cookie();
+  frame.fd = buffer->planes()[0].fd.get();
+  for (const auto &plane : buffer->planes()) {
+    frame.size += plane.length;
+  }
+  frame.stride = stride_;
+  std::copy(planes_[frame.id].begin(), planes_[frame.id].end(), frame.planes);
+  if (lores_stream_) {
+    FrameBuffer *lores = request->findBuffer(lores_stream_);
+    if (lores) {
+      frame.lores_fd = lores->planes()[0].fd.get();
+      frame.lores_luma = lores_planes_[frame.id][0];
+      frame.lores_stride = lores_stride_;
+    }
+  }
+
+  auto sensor_timestamp = request->metadata().get(controls::SensorTimestamp);
+  uint64_t timestamp_ns = sensor_timestamp ? static_cast<uint64_t>(*sensor_timestamp) : buffer->metadata().timestamp;
+  frame.timestamp_us = static_cast<int64_t>(timestamp_ns / 1000);
+  frame.exposure_us = request->metadata().get(controls::ExposureTime).value_or(0);
+  if (auto scaler_crop = request->metadata().get(controls::ScalerCrop)) {
+    crop_.store(pack_crop(CropRect{static_cast<unsigned>(std::max(0, scaler_crop->x)),
+                                   static_cast<unsigned>(std::max(0, scaler_crop->y)), scaler_crop->width,
+                                   scaler_crop->height}),
+                std::memory_order_relaxed);
+  }
+
+  on_frame_(frame);
+}
+
+} // namespace picam
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "frame.hpp"
+#include "roi.hpp"
+#include "sensor_modes.hpp"
+
+namespace picam {
+
+struct CameraConfig {
+  unsigned camera_index = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned framerate = 30;
+  // Frames in flight between the sensor and the encoder; each one is a
+  // full-size dmabuf from the CMA pool, so fewer save the most memory.
+  unsigned buffer_count = 6;
+  bool map_buffers = false;
+  // Full-range sYCC instead of limited-range Rec.709, which is what JPEG expects.
+  bool full_range = false;
+  // A second, small YUV420 stream for analysis (motion detection); 0 for none.
+  unsigned lores_width = 0;
+  unsigned lores_height = 0;
+  // Sensor readout mode: the cheapest one covering width x height at the
+  // frame rate with auto_sensor_mode, the one of sensor_width x sensor_height
+  // (and sensor_bit_depth unless 0) when those are set, otherwise whatever
+  // the pipeline handler picks.
+  bool auto_sensor_mode = false;
+  unsigned sensor_width = 0;
+  unsigned sensor_height = 0;
+  unsigned sensor_bit_depth = 0;
+  // With has_roi the ISP crops its input to roi and scales that to
+  // width x height; otherwise it sees the mode's whole field of view.
+  bool has_roi = false;
+  Roi roi;
+};
+
+// VideoRecording stream in YUV420 with dmabuf-backed buffers, plus an optional
+// low-resolution Viewfinder stream the ISP scales down from the same frame.
+// Frames are handed out from libcamera's completion thread; the request
+// behind a frame is only queued back to the camera once release() is called
+// with its id.
+class CameraSource {
+public:
+  using FrameCallback = std::function<void(const CameraFrame &)>;
+
+  explicit CameraSource(const CameraConfig &config);
+  ~CameraSource();
+
+  CameraSource(const CameraSource &) = delete;
+  CameraSource &operator=(const CameraSource &) = delete;
+
+  unsigned width() const { return width_; }
+  unsigned height() const { return height_; }
+  unsigned stride() const { return stride_; }
+  unsigned lores_width() const { return lores_width_; }
+  unsigned lores_height() const { return lores_height_; }
+  // What was allocated, which libcamera may have raised above buffer_count.
+  unsigned buffer_count() const { return static_cast<unsigned>(requests_.size()); }
+  size_t frame_bytes() const { return frame_bytes_; }
+  size_t lores_frame_bytes() const { return lores_frame_bytes_; }
+  // The mode the sensor was configured for; null when it was left to libcamera.
+  const SensorMode *sensor_mode() const { return sensor_mode_.width > 0 ? &sensor_mode_ : nullptr; }
+
+  void start(FrameCallback on_frame);
+  void stop();
+  void release(uint64_t id);
+  // Changes the frame rate of a running camera. Requests carry the new
+  // FrameDurationLimits as they are queued again, so it takes effect a few
+  // frames later without restarting the pipeline.
+  void set_framerate(unsigned framerate);
+  // Largest ScalerCrop of the configured sensor mode, in sensor pixels.
+  const CropRect &crop_maximum() const { return crop_maximum_; }
+  // Moves the crop to roi from the next queued request on, like
+  // set_framerate(); returns the rectangle asked of the ISP.
+  CropRect set_roi(const Roi &roi);
+  // The crop the ISP reported for the latest frame; empty until a frame
+  // carried one.
+  CropRect crop() const;
+
+private:
+  struct Mapping {
+    void *mem = nullptr;
+    size_t length = 0;
+  };
+
+  std::array<uint8_t *, 3> map_buffer(libcamera::FrameBuffer *buffer);
+  void on_request_completed(libcamera::Request *request);
+
+  CameraConfig config_;
+  unsigned width_ = 0;
+  unsigned height_ = 0;
+  unsigned stride_ = 0;
+  unsigned lores_width_ = 0;
+  unsigned lores_height_ = 0;
+  unsigned lores_stride_ = 0;
+  size_t frame_bytes_ = 0;
+  size_t lores_frame_bytes_ = 0;
+  SensorMode sensor_mode_;
+
+  std::unique_ptr<libcamera::CameraManager> manager_;
+  std::shared_ptr<libcamera::Camera> camera_;
+  std::unique_ptr<libcamera::CameraConfiguration> configuration_;
+  std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+  libcamera::Stream *stream_ = nullptr;
+  libcamera::Stream *lores_stream_ = nullptr;
+  std::vector<std::unique_ptr<libcamera::Request>> requests_;
+  std::vector<Mapping> mappings_;
+  std::vector<std::array<uint8_t *, 3>> planes_;
+  std::vector<std::array<uint8_t *, 3>> lores_planes_;
+
+  FrameCallback on_frame_;
+  std::atomic<bool> running_{false};
+  // 0 until set_framerate() is called; from then on every request repeats it.
+  std::atomic<int64_t> frame_duration_us_{0};
+  CropRect crop_maximum_;
+  // Crops packed into 16 bits per field; 0 for none. The pending one goes
+  // out with the next request only, since ScalerCrop stays in effect.
+  std::atomic<uint64_t> pending_crop_{0};
+  std::atomic<uint64_t> crop_{0};
+};
+
+} // namespace picam
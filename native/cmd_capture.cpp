@@ -0,0 +1,1006 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "buffer_pools.hpp"
+#include "camera_source.hpp"
+#include "codec.hpp"
+#include "commands.hpp"
+#include "control_socket.hpp"
+#include "encode_stats.hpp"
+#include "fd_sink.hpp"
+#include "glyph_atlas.hpp"
+#include "h264.hpp"
+#include "latency.hpp"
+#include "motion.hpp"
+#include "overlay.hpp"
+#include "proc_stats.hpp"
+#include "rate_controller.hpp"
+#include "ring_sink.hpp"
+#include "roi.hpp"
+#include "sensor_modes.hpp"
+#include "stream_monitor.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "v4l2_encoder.hpp"
+
+namespace picam {
+
+namespace {
+
+struct CaptureOptions {
+  CameraConfig camera;
+  EncoderConfig encoder;
+  std::string output = "-";
+  bool encoder_device_set = false;
+  // Any of --idr-period, --profile, --level, --slices, --intra-refresh.
+  bool h264_shape_set = false;
+  std::string ring_socket;
+  // 0 until --ring-size: sized for the codec.
+  unsigned ring_size_mib = 0;
+  std::string overlay_stats;
+  std::string overlay_font;
+  std::string overlay_corner = "top-left";
+  unsigned overlay_size = 28;
+  bool latency_sei = false;
+  bool null_output = false;
+  std::string encode_report;
+  std::string counters;
+  bool motion = false;
+  MotionConfig motion_config;
+  bool adaptive = false;
+  RateLimits rate_limits;
+  std::string mode_report;
+  ThreadPlacement capture_thread;
+  std::string buffer_report;
+  std::string control_socket;
+};
+
+constexpr uint64_t kProgressIntervalNs = 1000000000ull;
+constexpr unsigned kDefaultRingMib = 8;
+// Raw pictures are large; the default ring still holds this many of them.
+constexpr unsigned kRawRingFrames = 4;
+// Width of the low-resolution stream motion detection runs on; the height follows the aspect ratio.
+constexpr unsigned kMotionWidth = 160;
+
+// Remembers when libcamera handed over each frame until its encoded access
+// unit comes back, matched by sensor timestamp.
+class DeliveryTimes {
+public:
+  void record(int64_t timestamp_us, uint64_t delivered_ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_[next_++ % slots_.size()] = {timestamp_us, delivered_ns};
+  }
+
+  uint64_t lookup(int64_t timestamp_us) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &slot : slots_) {
+      if (slot.first == timestamp_us) {
+        return slot.second;
+      }
+    }
+    return 0;
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::array<std::pair<int64_t, uint64_t>, 32> slots_{};
+  size_t next_ = 0;
+};
+
+void capture_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native capture [options]\n"
+               "\n"
+               "Options:\n"
+               "      --camera <index>        libcamera camera index (default: 0)\n"
+               "      --width <pixels>        Frame width\n"
+               "      --height <pixels>       Frame height\n"
+               "      --framerate <fps>       Frame rate (default: 30)\n"
+               "      --bitrate <bits>        Target bitrate in bits per second (default: 4000000)\n"
+               "      --codec <name>          h264, mjpeg (hardware JPEG per frame) or yuv (raw I420 frames,\n"
+               "                              no encoder) (default: h264)\n"
+               "      --quality <1-100>       JPEG quality for --codec mjpeg (default: 80)\n"
+               "      --idr-period <frames>   Frames between IDRs (default: one second's worth, or only the\n"
+               "                              first with --intra-refresh)\n"
+               "      --profile <name>        H.264 profile: baseline, main or high (default: high)\n"
+               "      --level <level>         H.264 level, 1.0 to 4.2 (default: 4.1)\n"
+               "      --slices <n>            Slices per picture (default: 1)\n"
+               "      --intra-refresh <frames> Refresh the picture with a sweep of intra macroblocks over this\n"
+               "                              many frames instead of periodic IDRs, which flattens the bitrate\n"
+               "      --encoder <device>      V4L2 M2M encoder node (default: /dev/video11, /dev/video31\n"
+               "                              for mjpeg)\n"
+               "  -o, --output <path>         Output file or FIFO, '-' for stdout (default: -)\n"
+               "      --ring-socket <path>    Publish into a shared-memory ring handed out on this socket\n"
+               "                              instead of writing to --output\n"
+               "      --ring-size <MiB>       Ring capacity (default: 8, or four frames for --codec yuv)\n"
+               "      --null                  Discard the encoded stream and print encoder throughput,\n"
+               "                              per-frame encode time and CPU once per second\n"
+               "      --encode-report <path>  Write frame rate, bitrate, CPU and encode-time percentiles\n"
+               "                              as JSON on exit\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --overlay-stats <path>  Burn the text of this stats file into the frames\n"
+               "      --overlay-font <path>   TrueType font for the overlay (required with --overlay-stats)\n"
+               "      --overlay-corner <pos>  top-left, top-right, bottom-left, bottom-right (default: top-left)\n"
+               "      --overlay-size <px>     Overlay font size in pixels (default: 28)\n"
+               "      --latency-sei           Stamp capture/encode times into an SEI NAL of every frame\n"
+               "      --motion                Detect motion on a 160-pixel-wide secondary stream and carry\n"
+               "                              the state to the stream consumers in an SEI NAL\n"
+               "      --motion-threshold <pct> Changed share of the picture that counts as motion (default: 2)\n"
+               "      --adaptive              Lower bitrate and frame rate while the ring backs up, the\n"
+               "                              encoder is saturated or the CPU is busy, and raise them again\n"
+               "                              once the pipeline keeps up; --bitrate/--framerate are the ceiling\n"
+               "      --min-bitrate <bits>    Floor for --adaptive (default: a quarter of --bitrate)\n"
+               "      --min-framerate <fps>   Floor for --adaptive (default: a third of --framerate)\n"
+               "      --sensor-mode <mode>    'auto' for the cheapest sensor mode covering the size and frame\n"
+               "                              rate (binned over full readout when it keeps up), or WxH[:bits]\n"
+               "      --mode-report <path>    Write the sensor mode, CSI-2 load and ISP scaling as JSON\n"
+               "      --cpu <index>           Pin the capture thread (frame completion, overlay, encoder\n"
+               "                              queueing) to this CPU\n"
+               "      --fifo-priority <1-99>  Run the capture thread under SCHED_FIFO at this priority\n"
+               "      --encoder-cpu <index>   Pin the encoder thread (dequeue, SEI, sink writes) to this CPU\n"
+               "      --encoder-fifo-priority <1-99> Run the encoder thread under SCHED_FIFO at this priority\n"
+               "      --buffers <n>           Camera frame buffers, each a full-size dmabuf (default: 6)\n"
+               "      --encoder-inputs <n>    Camera frames the encoder may hold at once (default: 6)\n"
+               "      --encoder-outputs <n>   Encoded-data buffers of the encoder (default: 12)\n"
+               "      --buffer-report <path>  Write the count and size of every stage's buffers as JSON\n"
+               "      --roi <x,y,w,h>         Have the ISP crop to this region (fractions of the sensor mode's\n"
+               "                              field of view) and scale it to --width x --height\n"
+               "      --control-socket <path> Take commands on this UNIX socket while running\n"
+               "                              (see 'picam-native control --help')\n");
+}
+
+std::string describe_h264_shape(const EncoderConfig &config) {
+  std::string shape = std::string("H.264 ") + h264_profile_name(config.profile) + " level " +
+                      std::to_string(config.level / 10) + "." + std::to_string(config.level % 10);
+  if (config.idr_period > 0) {
+    shape += ", IDR every " + std::to_string(config.idr_period) + " frames";
+  } else {
+    shape += config.intra_refresh > 0 ? ", only the first IDR" : ", IDR every second";
+  }
+  if (config.slices > 1) {
+    shape += ", " + std::to_string(config.slices) + " slices";
+  }
+  if (config.intra_refresh > 0) {
+    shape += ", intra refresh over " + std::to_string(config.intra_refresh) + " frames";
+  }
+  return shape;
+}
+
+// "auto", "WxH" or "WxH:bits".
+void parse_sensor_mode(const std::string &value, CameraConfig &camera) {
+  if (value == "auto") {
+    camera.auto_sensor_mode = true;
+    return;
+  }
+  size_t x = value.find('x');
+  size_t colon = value.find(':');
+  if (x == std::string::npos || (colon != std::string::npos && colon < x)) {
+    throw Error("Invalid sensor mode '" + value + "'; use auto, WxH or WxH:bits");
+  }
+  camera.sensor_width = parse_unsigned(value.substr(0, x).c_str(), "sensor mode width");
+  camera.sensor_height = parse_unsigned(value.substr(x + 1, colon - x - 1).c_str(), "sensor mode height");
+  if (colon != std::string::npos) {
+    camera.sensor_bit_depth = parse_unsigned(value.substr(colon + 1).c_str(), "sensor mode bit depth");
+  }
+}
+
+CaptureOptions parse_capture_options(int argc, char **argv) {
+  enum { kCamera = 256, kWidth, kHeight, kFramerate, kBitrate, kEncoder, kRingSocket, kRingSize,
+         kOverlayStats, kOverlayFont, kOverlayCorner, kOverlaySize, kLatencySei, kNull, kEncodeReport,
+         kCounters, kMotion, kMotionThreshold, kAdaptive, kMinBitrate, kMinFramerate,
+         kSensorMode, kModeReport, kCpu, kFifoPriority,
+         kEncoderCpu, kEncoderFifoPriority, kCodec, kQuality, kBuffers, kEncoderInputs, kEncoderOutputs,
+         kBufferReport, kIdrPeriod, kProfile, kLevel, kSlices, kIntraRefresh, kRoi, kControlSocket };
+  static const option long_options[] = {
+      {"camera", required_argument, nullptr, kCamera},
+      {"width", required_argument, nullptr, kWidth},
+      {"height", required_argument, nullptr, kHeight},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"bitrate", required_argument, nullptr, kBitrate},
+      {"encoder", required_argument, nullptr, kEncoder},
+      {"output", required_argument, nullptr, 'o'},
+      {"ring-socket", required_argument, nullptr, kRingSocket},
+      {"ring-size", required_argument, nullptr, kRingSize},
+      {"overlay-stats", required_argument, nullptr, kOverlayStats},
+      {"overlay-font", required_argument, nullptr, kOverlayFont},
+      {"overlay-corner", required_argument, nullptr, kOverlayCorner},
+      {"overlay-size", required_argument, nullptr, kOverlaySize},
+      {"latency-sei", no_argument, nullptr, kLatencySei},
+      {"null", no_argument, nullptr, kNull},
+      {"encode-report", required_argument, nullptr, kEncodeReport},
+      {"counters", required_argument, nullptr, kCounters},
+      {"motion", no_argument, nullptr, kMotion},
+      {"motion-threshold", required_argument, nullptr, kMotionThreshold},
+      {"adaptive", no_argument, nullptr, kAdaptive},
+      {"min-bitrate", required_argument, nullptr, kMinBitrate},
+      {"min-framerate", required_argument, nullptr, kMinFramerate},
+      {"sensor-mode", required_argument, nullptr, kSensorMode},
+      {"mode-report", required_argument, nullptr, kModeReport},
+      {"cpu", required_argument, nullptr, kCpu},
+      {"fifo-priority", required_argument, nullptr, kFifoPriority},
+      {"encoder-cpu", required_argument, nullptr, kEncoderCpu},
+      {"encoder-fifo-priority", required_argument, nullptr, kEncoderFifoPriority},
+      {"codec", required_argument, nullptr, kCodec},
+      {"quality", required_argument, nullptr, kQuality},
+      {"buffers", required_argument, nullptr, kBuffers},
+      {"encoder-inputs", required_argument, nullptr, kEncoderInputs},
+      {"encoder-outputs", required_argument, nullptr, kEncoderOutputs},
+      {"buffer-report", required_argument, nullptr, kBufferReport},
+      {"idr-period", required_argument, nullptr, kIdrPeriod},
+      {"profile", required_argument, nullptr, kProfile},
+      {"level", required_argument, nullptr, kLevel},
+      {"slices", required_argument, nullptr, kSlices},
+      {"intra-refresh", required_argument, nullptr, kIntraRefresh},
+      {"roi", required_argument, nullptr, kRoi},
+      {"control-socket", required_argument, nullptr, kControlSocket},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  CaptureOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kCamera:
+      opts.camera.camera_index = parse_unsigned(optarg, "camera index");
+      break;
+    case kWidth:
+      opts.camera.width = parse_unsigned(optarg, "width");
+      break;
+    case kHeight:
+      opts.camera.height = parse_unsigned(optarg, "height");
+      break;
+    case kFramerate:
+      opts.camera.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kBitrate:
+      opts.encoder.bitrate = parse_unsigned(optarg, "bitrate");
+      break;
+    case kEncoder:
+      opts.encoder.device = optarg;
+      opts.encoder_device_set = true;
+      break;
+    case 'o':
+      opts.output = optarg;
+      break;
+    case kRingSocket:
+      opts.ring_socket = optarg;
+      break;
+    case kRingSize:
+      opts.ring_size_mib = parse_unsigned(optarg, "ring size");
+      if (opts.ring_size_mib == 0) {
+        throw Error("Ring size must be greater than zero");
+      }
+      break;
+    case kOverlayStats:
+      opts.overlay_stats = optarg;
+      break;
+    case kOverlayFont:
+      opts.overlay_font = optarg;
+      break;
+    case kOverlayCorner:
+      opts.overlay_corner = optarg;
+      break;
+    case kOverlaySize:
+      opts.overlay_size = parse_unsigned(optarg, "overlay size");
+      break;
+    case kLatencySei:
+      opts.latency_sei = true;
+      break;
+    case kNull:
+      opts.null_output = true;
+      break;
+    case kEncodeReport:
+      opts.encode_report = optarg;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kMotion:
+      opts.motion = true;
+      break;
+    case kMotionThreshold:
+      opts.motion_config.trigger_pct = parse_unsigned(optarg, "motion threshold");
+      break;
+    case kAdaptive:
+      opts.adaptive = true;
+      break;
+    case kMinBitrate:
+      opts.rate_limits.min_bitrate = parse_unsigned(optarg, "minimum bitrate");
+      break;
+    case kMinFramerate:
+      opts.rate_limits.min_framerate = parse_unsigned(optarg, "minimum frame rate");
+      break;
+    case kSensorMode:
+      parse_sensor_mode(optarg, opts.camera);
+      break;
+    case kModeReport:
+      opts.mode_report = optarg;
+      break;
+    case kCpu:
+      opts.capture_thread.cpu = parse_cpu_index(optarg);
+      break;
+    case kFifoPriority:
+      opts.capture_thread.fifo_priority = parse_fifo_priority(optarg);
+      break;
+    case kEncoderCpu:
+      opts.encoder.placement.cpu = parse_cpu_index(optarg);
+      break;
+    case kEncoderFifoPriority:
+      opts.encoder.placement.fifo_priority = parse_fifo_priority(optarg);
+      break;
+    case kCodec:
+      opts.encoder.codec = parse_codec(optarg);
+      break;
+    case kQuality:
+      opts.encoder.quality = parse_unsigned(optarg, "JPEG quality");
+      break;
+    case kBuffers:
+      opts.camera.buffer_count = parse_unsigned(optarg, "camera buffer count");
+      break;
+    case kEncoderInputs:
+      opts.encoder.input_buffers = parse_unsigned(optarg, "encoder input buffer count");
+      break;
+    case kEncoderOutputs:
+      opts.encoder.output_buffers = parse_unsigned(optarg, "encoder output buffer count");
+      break;
+    case kBufferReport:
+      opts.buffer_report = optarg;
+      break;
+    case kIdrPeriod:
+      opts.encoder.idr_period = parse_unsigned(optarg, "IDR period");
+      opts.h264_shape_set = true;
+      break;
+    case kProfile:
+      opts.encoder.profile = parse_h264_profile(optarg);
+      opts.h264_shape_set = true;
+      break;
+    case kLevel:
+      opts.encoder.level = parse_h264_level(optarg);
+      opts.h264_shape_set = true;
+      break;
+    case kSlices:
+      opts.encoder.slices = parse_unsigned(optarg, "slice count");
+      opts.h264_shape_set = true;
+      break;
+    case kIntraRefresh:
+      opts.encoder.intra_refresh = parse_unsigned(optarg, "intra refresh period");
+      opts.h264_shape_set = true;
+      break;
+    case kRoi:
+      opts.camera.roi = parse_roi(optarg);
+      opts.camera.has_roi = true;
+      break;
+    case kControlSocket:
+      opts.control_socket = optarg;
+      break;
+    case 'h':
+      capture_usage();
+      std::exit(0);
+    default:
+      capture_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.camera.width == 0 || opts.camera.height == 0) {
+    throw Error("Both --width and --height are required");
+  }
+  if (opts.camera.framerate == 0) {
+    throw Error("Frame rate must be greater than zero");
+  }
+  if (!opts.overlay_stats.empty() && opts.overlay_font.empty()) {
+    throw Error("--overlay-font is required with --overlay-stats");
+  }
+  if (opts.null_output && !opts.ring_socket.empty()) {
+    throw Error("--null and --ring-socket are mutually exclusive");
+  }
+  if (!opts.mode_report.empty() && !opts.camera.auto_sensor_mode && opts.camera.sensor_width == 0) {
+    throw Error("--mode-report needs --sensor-mode");
+  }
+  if (opts.motion && (opts.motion_config.trigger_pct <= 0 || opts.motion_config.trigger_pct > 100)) {
+    throw Error("Motion threshold must be between 1 and 100");
+  }
+  const Codec codec = opts.encoder.codec;
+  // These travel in H.264 SEI or steer H.264 rate control.
+  if (codec != Codec::kH264 && (opts.latency_sei || opts.motion || opts.adaptive)) {
+    throw Error("--latency-sei, --motion and --adaptive need --codec h264");
+  }
+  if (codec != Codec::kH264 && opts.h264_shape_set) {
+    throw Error("--idr-period, --profile, --level, --slices and --intra-refresh need --codec h264");
+  }
+  if (opts.encoder.slices == 0) {
+    throw Error("Slice count must be greater than zero");
+  }
+  if (opts.camera.buffer_count == 0 || opts.encoder.input_buffers == 0 || opts.encoder.output_buffers == 0) {
+    throw Error("Buffer counts must be greater than zero");
+  }
+  if (opts.encoder.quality == 0 || opts.encoder.quality > 100) {
+    throw Error("JPEG quality must be between 1 and 100");
+  }
+  if (codec == Codec::kMjpeg && !opts.encoder_device_set) {
+    opts.encoder.device = "/dev/video31";
+  }
+  opts.camera.full_range = codec == Codec::kMjpeg;
+  if (opts.ring_size_mib == 0) {
+    opts.ring_size_mib = kDefaultRingMib;
+    if (codec == Codec::kYuv420) {
+      const uint64_t frame_bytes = static_cast<uint64_t>(opts.camera.width) * opts.camera.height * 3 / 2;
+      const uint64_t ring_mib = (frame_bytes * kRawRingFrames + (1u << 20) - 1) >> 20;
+      opts.ring_size_mib = std::max(kDefaultRingMib, static_cast<unsigned>(ring_mib));
+    }
+  }
+  // Raw frames are copied out of the dmabuf, so they have to be mapped too.
+  opts.camera.map_buffers = !opts.overlay_stats.empty() || codec == Codec::kYuv420;
+  if (opts.motion) {
+    opts.camera.lores_width = std::min(kMotionWidth, opts.camera.width);
+    opts.camera.lores_height = std::max(2u, opts.camera.lores_width * opts.camera.height / opts.camera.width) & ~1u;
+    // Motion stays on for a second after the picture settles.
+    opts.motion_config.hold_frames = opts.camera.framerate;
+  }
+  if (opts.adaptive) {
+    RateLimits &limits = opts.rate_limits;
+    limits.max_bitrate = opts.encoder.bitrate;
+    limits.max_framerate = opts.camera.framerate;
+    if (limits.min_bitrate == 0) {
+      limits.min_bitrate = std::max(1u, limits.max_bitrate / 4);
+    }
+    if (limits.min_framerate == 0) {
+      limits.min_framerate = std::max(1u, limits.max_framerate / 3);
+    }
+  }
+  return opts;
+}
+
+// Picture rows without the camera's stride padding: Y, then U and V at half
+// the width and height.
+void pack_i420(const CameraFrame &frame, unsigned width, unsigned height, std::vector<uint8_t> &out) {
+  const unsigned chroma_width = width / 2;
+  const unsigned chroma_height = height / 2;
+  out.resize(static_cast<size_t>(width) * height + 2 * static_cast<size_t>(chroma_width) * chroma_height);
+  uint8_t *dst = out.data();
+  for (unsigned row = 0; row < height; ++row, dst += width) {
+    std::memcpy(dst, frame.planes[0] + static_cast<size_t>(row) * frame.stride, width);
+  }
+  for (unsigned plane = 1; plane < 3; ++plane) {
+    for (unsigned row = 0; row < chroma_height; ++row, dst += chroma_width) {
+      std::memcpy(dst, frame.planes[plane] + static_cast<size_t>(row) * (frame.stride / 2), chroma_width);
+    }
+  }
+}
+
+uint64_t process_cpu_ns() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto to_ns = [](const timeval &tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000000ull + static_cast<uint64_t>(tv.tv_usec) * 1000;
+  };
+  return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+
+// The sensor side of a frame, known once libcamera completes it: exposure
+// from the first row's start, then readout and ISP until delivery.
+void trace_sensor_stages(const CameraFrame &frame, uint64_t delivered_ns) {
+  const uint64_t sensor_ns = static_cast<uint64_t>(frame.timestamp_us) * 1000;
+  const uint64_t exposed_ns = sensor_ns + static_cast<uint64_t>(frame.exposure_us) * 1000;
+  trace_begin("exposure", frame.timestamp_us, sensor_ns);
+  trace_end("exposure", frame.timestamp_us, exposed_ns);
+  trace_begin("isp", frame.timestamp_us, exposed_ns);
+  trace_end("isp", frame.timestamp_us, delivered_ns);
+}
+
+// ffmpeg-style line so the headless run reads like the other methods.
+void print_progress(const EncodeInterval &interval, uint64_t total, double elapsed_s, double cpu_pct,
+                    uint64_t dropped) {
+  double fps = elapsed_s > 0 ? interval.frames / elapsed_s : 0.0;
+  double kbps = elapsed_s > 0 ? interval.bytes * 8.0 / elapsed_s / 1000.0 : 0.0;
+  std::fprintf(stderr, "frame=%" PRIu64 " fps=%.1f bitrate=%.1fkbits/s enc=%.2f/%.2fms cpu=%.1f%% drop=%" PRIu64 "\r",
+               total, fps, kbps, interval.encode_p50_ms, interval.encode_p95_ms, cpu_pct, dropped);
+}
+
+void apply_rate(const RateSetting &setting, const char *reason, CameraSource &camera, V4l2Encoder &encoder) {
+  camera.set_framerate(setting.framerate);
+  bool applied = encoder.set_framerate(setting.framerate);
+  applied = encoder.set_bitrate(setting.bitrate) && applied;
+  std::fprintf(stderr, "picam-native: Rate %.0f kbit/s at %u fps (%s)%s\n", setting.bitrate / 1000.0,
+               setting.framerate, reason, applied ? "" : ", encoder refused part of it");
+}
+
+// What the control socket reaches; null where this capture has none.
+struct ControlTargets {
+  CameraSource &camera;
+  V4l2Encoder *encoder;
+  TextOverlay *overlay;
+  RingSink *ring;
+  bool adaptive;
+  // The setting the encoder thread stamps into the rate SEI.
+  std::atomic<unsigned> &bitrate;
+  std::atomic<unsigned> &framerate;
+  const std::atomic<uint64_t> &encoded;
+  const std::atomic<uint64_t> &dropped;
+};
+
+// One line in, one line out; see 'picam-native control --help'. Runs on the
+// control socket's thread.
+std::string handle_control(const std::string &command, ControlTargets &targets) {
+  const size_t space = command.find(' ');
+  const std::string verb = command.substr(0, space);
+  const size_t start = command.find_first_not_of(' ', space);
+  const std::string argument = space == std::string::npos || start == std::string::npos ? "" : command.substr(start);
+  if (verb == "help") {
+    return "ok bitrate <bits>, fps <n>, corner <pos>, idr, record start|stop, roi [x,y,w,h], metrics";
+  }
+  if (verb == "roi") {
+    CameraSource &camera = targets.camera;
+    if (camera.crop_maximum().empty()) {
+      return "error camera reports no ScalerCropMaximum";
+    }
+    CropRect crop;
+    if (argument.empty()) {
+      crop = camera.crop();
+      if (crop.empty()) {
+        crop = camera.crop_maximum();
+      }
+    } else {
+      crop = camera.set_roi(parse_roi(argument));
+      std::fprintf(stderr, "picam-native: ROI %s, crop %s\n", argument.c_str(), describe_crop(crop).c_str());
+    }
+    return "ok roi " + format_roi(crop_roi(crop, camera.crop_maximum())) + " crop " + describe_crop(crop);
+  }
+  if (verb == "bitrate" || verb == "fps") {
+    if (!targets.encoder) {
+      return "error raw output has no encoder";
+    }
+    if (targets.adaptive) {
+      return "error the rate is adaptive (--adaptive)";
+    }
+    if (argument.empty()) {
+      return "error '" + verb + "' needs a value";
+    }
+    RateSetting setting;
+    setting.bitrate = targets.bitrate.load();
+    setting.framerate = targets.framerate.load();
+    (verb == "bitrate" ? setting.bitrate : setting.framerate) = parse_unsigned(argument.c_str(), verb.c_str());
+    if (setting.bitrate == 0 || setting.framerate == 0) {
+      return "error " + verb + " must be greater than zero";
+    }
+    apply_rate(setting, "control socket", targets.camera, *targets.encoder);
+    targets.bitrate.store(setting.bitrate, std::memory_order_relaxed);
+    targets.framerate.store(setting.framerate, std::memory_order_relaxed);
+    return "ok bitrate " + std::to_string(setting.bitrate) + " fps " + std::to_string(setting.framerate);
+  }
+  if (verb == "corner") {
+    const OverlayCorner corner = parse_overlay_corner(argument);
+    if (targets.overlay) {
+      targets.overlay->set_corner(corner);
+      return "ok corner " + argument;
+    }
+    // 'drm-preview' draws the overlay on a plane of its own.
+    if (!targets.ring) {
+      return "error this capture draws no overlay (--overlay-stats)";
+    }
+    if (!(targets.ring->consumer_features() & kRingFollowsCorner)) {
+      return "error no stage behind the ring draws the overlay";
+    }
+    const auto message = static_cast<RingMessage>(static_cast<int>(RingMessage::kCornerTopLeft) +
+                                                  static_cast<int>(corner));
+    if (!targets.ring->send_message(message)) {
+      return "error no stage is attached to the ring";
+    }
+    return "ok corner " + argument + " (sent to the stage behind the ring)";
+  }
+  if (verb == "idr") {
+    if (!targets.encoder) {
+      return "error raw output has no encoder";
+    }
+    targets.encoder->request_keyframe();
+    return "ok idr";
+  }
+  if (verb == "record") {
+    if (argument != "start" && argument != "stop") {
+      return "error use 'record start' or 'record stop'";
+    }
+    if (!targets.ring) {
+      return "error recording is done by the stage behind the ring (--ring-socket)";
+    }
+    if (!(targets.ring->consumer_features() & kRingFollowsRecord)) {
+      return "error no stage behind the ring records (--record)";
+    }
+    const bool start = argument == "start";
+    if (!targets.ring->send_message(start ? RingMessage::kRecordStart : RingMessage::kRecordStop)) {
+      return "error no stage is attached to the ring";
+    }
+    // The recorder resumes at an IDR; this one spares it the rest of the GOP.
+    if (start && targets.encoder) {
+      targets.encoder->request_keyframe();
+    }
+    return "ok record " + argument;
+  }
+  if (verb == "metrics") {
+    char text[256];
+    int length = std::snprintf(text, sizeof(text), "ok frames=%" PRIu64 " dropped=%" PRIu64,
+                               targets.encoded.load(), targets.dropped.load());
+    if (targets.encoder) {
+      length += std::snprintf(text + length, sizeof(text) - length, " bitrate=%u fps=%u", targets.bitrate.load(),
+                              targets.framerate.load());
+    }
+    if (targets.ring) {
+      const ShmRing &ring = targets.ring->ring();
+      std::snprintf(text + length, sizeof(text) - length, " ring=%.0f%% ring_dropped=%" PRIu64,
+                    100.0 * static_cast<double>(ring.used()) / static_cast<double>(ring.capacity()),
+                    ring.dropped());
+    }
+    std::string reply = text;
+    const CropRect crop = targets.camera.crop();
+    if (!crop.empty()) {
+      reply += " crop=" + describe_crop(crop);
+    }
+    return reply;
+  }
+  return "error unknown command '" + verb + "'";
+}
+
+} // namespace
+
+int run_capture(int argc, char **argv) {
+  CaptureOptions opts = parse_capture_options(argc, argv);
+  block_stop_signals();
+
+  std::unique_ptr<FrameSink> sink;
+  const ShmRing *ring = nullptr;
+  RingSink *ring_sink = nullptr;
+  if (opts.null_output) {
+    sink = std::make_unique<NullSink>();
+  } else if (!opts.ring_socket.empty()) {
+    auto owned = std::make_unique<RingSink>(opts.ring_socket, static_cast<size_t>(opts.ring_size_mib) << 20);
+    ring_sink = owned.get();
+    ring = &owned->ring();
+    sink = std::move(owned);
+  } else {
+    sink = std::make_unique<FdSink>(opts.output);
+  }
+  CameraSource camera(opts.camera);
+  if (const SensorMode *mode = camera.sensor_mode()) {
+    std::fprintf(stderr, "picam-native: Sensor mode %s; CSI-2 %.1f Mbit/s at %u fps\n",
+                 describe_sensor_mode(*mode).c_str(), csi_bitrate(*mode, opts.camera.framerate) / 1e6,
+                 opts.camera.framerate);
+    if (mode->width != camera.width() || mode->height != camera.height()) {
+      std::fprintf(stderr, "picam-native: The ISP scales %ux%u to %ux%u\n", mode->width, mode->height, camera.width(),
+                   camera.height());
+    }
+    if (mode->max_fps < opts.camera.framerate) {
+      std::fprintf(stderr, "picam-native: The sensor mode tops out below the requested %u fps\n",
+                   opts.camera.framerate);
+    }
+    if (!opts.mode_report.empty()) {
+      write_sensor_mode_report(opts.mode_report, *mode, opts.camera.framerate, camera.width(), camera.height());
+    }
+  }
+  if (opts.camera.has_roi) {
+    const CropRect crop = roi_crop(opts.camera.roi, camera.crop_maximum(), camera.width(), camera.height());
+    std::fprintf(stderr, "picam-native: ROI %s, the ISP crops %s of %ux%u and scales it to %ux%u\n",
+                 format_roi(opts.camera.roi).c_str(), describe_crop(crop).c_str(), camera.crop_maximum().width,
+                 camera.crop_maximum().height, camera.width(), camera.height());
+  }
+
+  // Rasterised once here; per frame only the box is blended into the dmabuf.
+  std::unique_ptr<GlyphAtlas> atlas;
+  std::unique_ptr<TextOverlay> overlay;
+  std::unique_ptr<StatsFileFeed> overlay_feed;
+  if (!opts.overlay_stats.empty()) {
+    atlas = std::make_unique<GlyphAtlas>(opts.overlay_font, opts.overlay_size);
+    overlay = std::make_unique<TextOverlay>(*atlas, parse_overlay_corner(opts.overlay_corner));
+    overlay_feed = std::make_unique<StatsFileFeed>(opts.overlay_stats, *overlay);
+  }
+
+  opts.encoder.width = camera.width();
+  opts.encoder.height = camera.height();
+  opts.encoder.stride = camera.stride();
+  opts.encoder.framerate = opts.camera.framerate;
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, opts.camera.framerate, opts.encoder.codec);
+  }
+
+  std::atomic<uint64_t> encoded{0};
+  std::atomic<uint64_t> dropped{0};
+  const bool measure_encode = opts.null_output || !opts.encode_report.empty();
+  const bool track_delivery = opts.latency_sei || measure_encode;
+  DeliveryTimes delivery_times;
+  EncodeStats encode_stats;
+  std::vector<uint8_t> sei_messages;
+  std::vector<uint8_t> stamped;
+
+  // Runs on the camera thread; the encoder thread picks up the latest state.
+  std::unique_ptr<MotionDetector> motion;
+  std::atomic<bool> motion_active{false};
+  std::atomic<uint32_t> motion_score{0};
+  if (opts.motion) {
+    motion = std::make_unique<MotionDetector>(camera.lores_width(), camera.lores_height(), opts.motion_config);
+  }
+
+  // Driven from the main thread once per second, or set over the control
+  // socket; the encoder thread stamps the current setting into every frame.
+  std::unique_ptr<RateController> rate;
+  std::atomic<unsigned> rate_bitrate{opts.encoder.bitrate};
+  std::atomic<unsigned> rate_framerate{opts.camera.framerate};
+  if (opts.adaptive) {
+    rate = std::make_unique<RateController>(opts.rate_limits);
+    rate_bitrate.store(rate->setting().bitrate);
+    rate_framerate.store(rate->setting().framerate);
+  }
+  const bool rate_sei = rate || (opts.encoder.codec == Codec::kH264 && !opts.control_socket.empty());
+
+  // The crop travels in SEI whenever it is set or may be moved, so the
+  // overlay, composed downstream, can show it.
+  const bool roi_sei =
+      opts.encoder.codec == Codec::kH264 && (opts.camera.has_roi || !opts.control_socket.empty());
+
+  const bool tracing = tracing_enabled();
+  auto deliver = [&](const EncodedFrame &out) {
+    if (monitor) {
+      monitor->access_unit(out.data, out.size, out.timestamp_us);
+    }
+    const uint64_t write_start_ns = tracing ? monotonic_ns() : 0;
+    sink->write(out);
+    if (tracing) {
+      trace_slice("sink-write", write_start_ns, monotonic_ns(), out.timestamp_us);
+    }
+    ++encoded;
+  };
+
+  // Raw YUV is packed on the camera thread and needs no encoder.
+  const bool raw = opts.encoder.codec == Codec::kYuv420;
+  std::vector<uint8_t> raw_frame;
+  std::unique_ptr<V4l2Encoder> encoder;
+  if (!raw) {
+    encoder = std::make_unique<V4l2Encoder>(
+        opts.encoder,
+        [&](const EncodedFrame &frame) {
+          uint64_t delivered_ns = track_delivery ? delivery_times.lookup(frame.timestamp_us) : 0;
+          uint64_t encoded_ns = monotonic_ns();
+          if (measure_encode) {
+            encode_stats.add(frame.size, delivered_ns > 0 ? encoded_ns - delivered_ns : 0);
+          }
+          EncodedFrame out = frame;
+          if (opts.latency_sei || motion || rate_sei || roi_sei) {
+            sei_messages.clear();
+            if (opts.latency_sei) {
+              LatencyStamp stamp;
+              stamp.sensor_ns = static_cast<uint64_t>(frame.timestamp_us) * 1000;
+              stamp.delivered_ns = delivered_ns;
+              stamp.encoded_ns = encoded_ns;
+              append_latency_sei(sei_messages, stamp);
+            }
+            if (motion) {
+              MotionState state;
+              state.active = motion_active.load(std::memory_order_relaxed);
+              state.score_pct = motion_score.load(std::memory_order_relaxed) / 100.0;
+              append_motion_sei(sei_messages, state);
+            }
+            if (rate_sei) {
+              RateSetting setting;
+              setting.bitrate = rate_bitrate.load(std::memory_order_relaxed);
+              setting.framerate = rate_framerate.load(std::memory_order_relaxed);
+              append_rate_sei(sei_messages, setting);
+            }
+            if (roi_sei) {
+              const CropRect crop = camera.crop();
+              if (!crop.empty()) {
+                append_roi_sei(sei_messages, crop);
+              }
+            }
+            if (!sei_messages.empty()) {
+              h264::insert_sei(frame.data, frame.size, sei_messages, stamped);
+              out.data = stamped.data();
+              out.size = stamped.size();
+            }
+          }
+          deliver(out);
+        },
+        [&](uint64_t id) { camera.release(id); });
+  }
+
+  // A consumer that attaches, say to a long-running capture, reads from the
+  // ring's head on; a forced IDR spares it waiting out the rest of the GOP.
+  struct DetachEncoder {
+    RingSink *sink;
+    ~DetachEncoder() {
+      if (sink) {
+        sink->set_on_attach(nullptr);
+      }
+    }
+  } detach_encoder{ring_sink};
+  if (ring_sink && encoder) {
+    ring_sink->set_on_attach([&encoder] { encoder->request_keyframe(); });
+  }
+
+  // What the drivers actually allocated, which may be more than was asked for.
+  std::vector<BufferPool> pools;
+  pools.push_back({"camera", camera.buffer_count(), camera.frame_bytes(), true});
+  if (camera.lores_frame_bytes() > 0) {
+    pools.push_back({"lores", camera.buffer_count(), camera.lores_frame_bytes(), true});
+  }
+  if (encoder) {
+    pools.push_back({"encoder-input", encoder->input_slots(), 0, true});
+    pools.push_back({"encoder-output", encoder->output_buffers(), encoder->output_buffer_bytes(), true});
+  }
+  if (ring) {
+    pools.push_back({"ring", 1, ring->capacity(), false});
+  }
+  std::fprintf(stderr, "picam-native: Buffers %s\n", describe_buffer_pools(pools).c_str());
+  if (!opts.buffer_report.empty()) {
+    write_buffer_report(opts.buffer_report, pools);
+  }
+
+  if (encoder && opts.encoder.codec == Codec::kH264) {
+    std::fprintf(stderr, "picam-native: %s\n", describe_h264_shape(opts.encoder).c_str());
+  }
+
+  if (!opts.capture_thread.empty()) {
+    std::fprintf(stderr, "picam-native: Capture thread of camera %u on %s\n", opts.camera.camera_index,
+                 describe_placement(opts.capture_thread).c_str());
+  }
+  if (!opts.encoder.placement.empty() && encoder) {
+    std::fprintf(stderr, "picam-native: Encoder thread of camera %u on %s\n", opts.camera.camera_index,
+                 describe_placement(opts.encoder.placement).c_str());
+  }
+  bool capture_thread_placed = opts.capture_thread.empty();
+
+  ControlTargets control_targets{camera, encoder.get(), overlay.get(), ring_sink, opts.adaptive,
+                                 rate_bitrate, rate_framerate, encoded, dropped};
+  std::unique_ptr<ControlServer> control;
+  if (!opts.control_socket.empty()) {
+    control = std::make_unique<ControlServer>(opts.control_socket, [&control_targets](const std::string &command) {
+      return handle_control(command, control_targets);
+    });
+  }
+
+  // The camera has to stop delivering frames before the encoder goes away.
+  struct StopCamera {
+    CameraSource &camera;
+    ~StopCamera() { camera.stop(); }
+  } stop_camera{camera};
+
+  camera.start([&](const CameraFrame &frame) {
+    // Frames arrive on libcamera's thread, which only exists once the camera
+    // runs; it is placed from inside on the first one.
+    if (!capture_thread_placed) {
+      place_current_thread(opts.capture_thread, "capture");
+      capture_thread_placed = true;
+    }
+    const uint64_t delivered_ns = track_delivery || tracing ? monotonic_ns() : 0;
+    if (track_delivery) {
+      delivery_times.record(frame.timestamp_us, delivered_ns);
+    }
+    if (tracing) {
+      name_trace_thread("capture");
+      trace_sensor_stages(frame, delivered_ns);
+    }
+    if (motion && frame.lores_luma) {
+      dmabuf_begin_cpu_access(frame.lores_fd);
+      MotionState state = motion->update(frame.lores_luma, frame.lores_stride);
+      dmabuf_end_cpu_access(frame.lores_fd);
+      motion_active.store(state.active, std::memory_order_relaxed);
+      motion_score.store(static_cast<uint32_t>(state.score_pct * 100.0 + 0.5), std::memory_order_relaxed);
+    }
+    if (overlay) {
+      YuvPlanes planes;
+      planes.y = frame.planes[0];
+      planes.u = frame.planes[1];
+      planes.v = frame.planes[2];
+      planes.y_stride = frame.stride;
+      planes.uv_stride = frame.stride / 2;
+      planes.width = camera.width();
+      planes.height = camera.height();
+      const uint64_t blend_start_ns = tracing ? monotonic_ns() : 0;
+      dmabuf_begin_cpu_access(frame.fd);
+      overlay->blend(planes);
+      dmabuf_end_cpu_access(frame.fd);
+      if (tracing) {
+        trace_slice("overlay", blend_start_ns, monotonic_ns(), frame.timestamp_us);
+      }
+    }
+    if (raw) {
+      const uint64_t pack_start_ns = monotonic_ns();
+      dmabuf_begin_cpu_access(frame.fd);
+      pack_i420(frame, camera.width(), camera.height(), raw_frame);
+      dmabuf_end_cpu_access(frame.fd);
+      camera.release(frame.id);
+      const uint64_t packed_ns = monotonic_ns();
+      if (measure_encode) {
+        encode_stats.add(raw_frame.size(), packed_ns - pack_start_ns);
+      }
+      if (tracing) {
+        trace_slice("pack", pack_start_ns, packed_ns, frame.timestamp_us);
+      }
+      EncodedFrame out;
+      out.data = raw_frame.data();
+      out.size = raw_frame.size();
+      out.timestamp_us = frame.timestamp_us;
+      out.keyframe = true;
+      deliver(out);
+      return;
+    }
+    const uint64_t submit_start_ns = tracing ? monotonic_ns() : 0;
+    if (!encoder->encode(frame)) {
+      ++dropped;
+      camera.release(frame.id);
+    }
+    if (tracing) {
+      trace_slice("submit", submit_start_ns, monotonic_ns(), frame.timestamp_us);
+    }
+  });
+
+  const uint64_t start_ns = monotonic_ns();
+  const uint64_t start_cpu_ns = process_cpu_ns();
+  if (opts.null_output || rate) {
+    uint64_t last_ns = start_ns;
+    uint64_t last_cpu_ns = start_cpu_ns;
+    uint64_t last_dropped = 0;
+    uint64_t last_ring_dropped = ring ? ring->dropped() : 0;
+    SystemCpuStats system_cpu;
+    system_cpu.sample();
+    uint64_t deadline = start_ns + kProgressIntervalNs;
+    while (!wait_for_stop_until(deadline)) {
+      uint64_t now = monotonic_ns();
+      if (opts.null_output) {
+        uint64_t cpu_ns = process_cpu_ns();
+        double elapsed_s = static_cast<double>(now - last_ns) / 1e9;
+        double cpu_pct = now > last_ns ? static_cast<double>(cpu_ns - last_cpu_ns) / (now - last_ns) * 100.0 : 0.0;
+        print_progress(encode_stats.take_interval(), encoded.load(), elapsed_s, cpu_pct, dropped.load());
+        last_cpu_ns = cpu_ns;
+      }
+      if (rate) {
+        RateInputs inputs;
+        inputs.encoder_queue_pct = 100.0 * encoder->queued_inputs() / encoder->input_slots();
+        inputs.encoder_drops = dropped.load() - last_dropped;
+        if (ring) {
+          inputs.backlog_pct = 100.0 * static_cast<double>(ring->used()) / static_cast<double>(ring->capacity());
+          inputs.backlog_drops = ring->dropped() - last_ring_dropped;
+          last_ring_dropped = ring->dropped();
+        }
+        inputs.cpu_pct = system_cpu.sample();
+        last_dropped += inputs.encoder_drops;
+        if (rate->update(inputs)) {
+          apply_rate(rate->setting(), rate->reason(), camera, *encoder);
+          rate_bitrate.store(rate->setting().bitrate, std::memory_order_relaxed);
+          rate_framerate.store(rate->setting().framerate, std::memory_order_relaxed);
+        }
+      }
+      last_ns = now;
+      deadline += kProgressIntervalNs;
+    }
+    if (opts.null_output) {
+      std::fprintf(stderr, "\n");
+    }
+  } else {
+    wait_for_stop();
+  }
+
+  if (!opts.encode_report.empty()) {
+    uint64_t wall_ns = monotonic_ns() - start_ns;
+    double cpu_pct = wall_ns > 0 ? static_cast<double>(process_cpu_ns() - start_cpu_ns) / wall_ns * 100.0 : 0.0;
+    encode_stats.write_report(opts.encode_report, static_cast<double>(wall_ns) / 1e9, cpu_pct, dropped.load());
+  }
+
+  std::fprintf(stderr, "picam-native: %" PRIu64 " frames encoded, %" PRIu64 " dropped\n", encoded.load(),
+               dropped.load());
+  return 0;
+}
+
+} // namespace picam
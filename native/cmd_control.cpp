@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <getopt.h>
+
+#include "commands.hpp"
+#include "control_socket.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+struct ControlOptions {
+  std::string socket;
+  unsigned timeout_ms = 2000;
+  std::string command;
+};
+
+void control_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native control --socket <path> [options] <command>...\n"
+               "\n"
+               "Sends one command to the control socket of a running 'capture --control-socket' and\n"
+               "prints the reply. Exits with 1 when the reply is an error.\n"
+               "\n"
+               "Commands:\n"
+               "  bitrate <bits>              Set the encoder bitrate (not with --adaptive)\n"
+               "  fps <n>                     Set the camera and encoder frame rate (not with --adaptive)\n"
+               "  corner <pos>                Move the overlay: top-left, top-right, bottom-left, bottom-right\n"
+               "                              (where capture or the drm-preview behind it draws it)\n"
+               "  idr                         Start a new GOP with the next frame\n"
+               "  record start|stop           Start or stop the recording of the stage behind the ring\n"
+               "                              (its --record); starting waits for the next IDR\n"
+               "  roi                         Print the region of interest and the crop the ISP applies\n"
+               "  roi <x,y,w,h>               Crop to this region (fractions of the sensor's field of view)\n"
+               "  metrics                     Frames encoded and dropped, current rate, ring fill and crop\n"
+               "  help                        List the commands\n"
+               "\n"
+               "Options:\n"
+               "      --socket <path>         Control socket of the capture process\n"
+               "      --timeout <ms>          How long to wait for the reply (default: 2000)\n");
+}
+
+ControlOptions parse_control_options(int argc, char **argv) {
+  enum { kSocket = 256, kTimeout };
+  static const option long_options[] = {
+      {"socket", required_argument, nullptr, kSocket},
+      {"timeout", required_argument, nullptr, kTimeout},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  ControlOptions opts;
+  int opt;
+  // '+' stops at the first word of the command, which may look like an option.
+  while ((opt = getopt_long(argc, argv, "+h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kSocket:
+      opts.socket = optarg;
+      break;
+    case kTimeout:
+      opts.timeout_ms = parse_unsigned(optarg, "timeout");
+      break;
+    case 'h':
+      control_usage();
+      std::exit(0);
+    default:
+      control_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.socket.empty()) {
+    throw Error("--socket is required");
+  }
+  for (int i = optind; i < argc; ++i) {
+    opts.command += (opts.command.empty() ? "" : " ") + std::string(argv[i]);
+  }
+  if (opts.command.empty()) {
+    throw Error("No command given; see 'picam-native control --help'");
+  }
+  return opts;
+}
+
+} // namespace
+
+int run_control(int argc, char **argv) {
+  ControlOptions opts = parse_control_options(argc, argv);
+  const std::string reply = send_control_command(opts.socket, opts.command, static_cast<int>(opts.timeout_ms));
+  std::printf("%s\n", reply.c_str());
+  return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+}
+
+} // namespace picam
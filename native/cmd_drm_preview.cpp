@@ -0,0 +1,449 @@
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "drm_display.hpp"
+#if defined(PICAM_HAVE_GL)
+#include "gl_display.hpp"
+#endif
+#include "glyph_atlas.hpp"
+#include "latency.hpp"
+#include "overlay.hpp"
+#include "ring_socket.hpp"
+#include "shm_ring.hpp"
+#include "segment_recorder.hpp"
+#include "stream_monitor.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+#include "v4l2_decoder.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kConnectTimeoutMs = 10000;
+constexpr int kPollMs = 200;
+constexpr uint64_t kProgressIntervalNs = 1000000000ull;
+
+struct DrmPreviewOptions {
+  std::string socket_path;
+  std::string decoder = "/dev/video10";
+  std::string card;
+  std::string renderer = "planes";
+  unsigned width = 1920;
+  unsigned height = 1080;
+  std::string overlay_stats;
+  std::string overlay_font;
+  std::string overlay_corner = "top-left";
+  unsigned overlay_size = 28;
+  std::string latency_report;
+  std::string counters;
+  unsigned framerate = 30;
+  std::string record_dir;
+  unsigned segment_seconds = 60;
+};
+
+// Latency stamps of access units that went into the decoder, waiting for
+// their decoded frame. The decoder keeps the stream order and carries the
+// sensor timestamp through, so the queue is matched front to back.
+class PendingStamps {
+public:
+  struct Entry {
+    int64_t timestamp_us;
+    LatencyStamp stamp;
+    uint64_t received_ns;
+  };
+
+  void push(const Entry &entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.push_back(entry);
+    if (entries_.size() > kMaxPending) {
+      entries_.pop_front();
+    }
+  }
+
+  bool take(int64_t timestamp_us, Entry &entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!entries_.empty() && entries_.front().timestamp_us < timestamp_us) {
+      entries_.pop_front();
+    }
+    if (entries_.empty() || entries_.front().timestamp_us != timestamp_us) {
+      return false;
+    }
+    entry = entries_.front();
+    entries_.pop_front();
+    return true;
+  }
+
+private:
+  static constexpr size_t kMaxPending = 64;
+
+  std::mutex mutex_;
+  std::deque<Entry> entries_;
+};
+
+uint64_t elapsed(uint64_t from, uint64_t to) {
+  return from != 0 && to > from ? to - from : 0;
+}
+
+void drm_preview_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native drm-preview --socket <path> [options]\n"
+               "\n"
+               "Options:\n"
+               "      --socket <path>         Ring socket created by 'capture --ring-socket'\n"
+               "      --decoder <device>      V4L2 M2M decoder node (default: /dev/video10)\n"
+               "      --card <device>         DRM device (default: first card with a connected display)\n"
+               "      --renderer <name>       planes: scan the frames out on a YUV plane, the overlay on\n"
+               "                              an ARGB plane (default); gl: convert, scale and composite\n"
+               "                              the overlay in one GLES pass on the GPU\n"
+               "      --width <pixels>        Expected stream width (default: 1920)\n"
+               "      --height <pixels>       Expected stream height (default: 1080)\n"
+               "      --overlay-stats <path>  Show the text of this stats file on an overlay plane\n"
+               "      --overlay-font <path>   TrueType font for the overlay (required with --overlay-stats)\n"
+               "      --overlay-corner <pos>  top-left, top-right, bottom-left, bottom-right (default: top-left)\n"
+               "      --overlay-size <px>     Overlay font size in pixels (default: 28)\n"
+               "      --latency-report <path> Measure glass-to-glass latency from the SEI stamps of\n"
+               "                              'capture --latency-sei' and write percentiles as JSON\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --framerate <fps>       Nominal frame rate for drop detection (default: 30)\n"
+               "      --record <dir>          Also record IDR-aligned MPEG-TS segments into this directory\n"
+               "      --segment <seconds>     Segment length for --record (default: 60)\n"
+               "\n"
+               "Progress is printed to stderr in ffmpeg's 'frame= fps= bitrate= drop=' form, so\n"
+               "'picam-native metrics --ffmpeg-log' can follow it.\n");
+}
+
+DrmPreviewOptions parse_drm_preview_options(int argc, char **argv) {
+  enum { kSocket = 256, kDecoder, kCard, kRenderer, kWidth, kHeight, kOverlayStats, kOverlayFont, kOverlayCorner,
+         kOverlaySize, kLatencyReport, kCounters, kFramerate, kRecord, kSegment };
+  static const option long_options[] = {
+      {"socket", required_argument, nullptr, kSocket},
+      {"decoder", required_argument, nullptr, kDecoder},
+      {"card", required_argument, nullptr, kCard},
+      {"renderer", required_argument, nullptr, kRenderer},
+      {"width", required_argument, nullptr, kWidth},
+      {"height", required_argument, nullptr, kHeight},
+      {"overlay-stats", required_argument, nullptr, kOverlayStats},
+      {"overlay-font", required_argument, nullptr, kOverlayFont},
+      {"overlay-corner", required_argument, nullptr, kOverlayCorner},
+      {"overlay-size", required_argument, nullptr, kOverlaySize},
+      {"latency-report", required_argument, nullptr, kLatencyReport},
+      {"counters", required_argument, nullptr, kCounters},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"record", required_argument, nullptr, kRecord},
+      {"segment", required_argument, nullptr, kSegment},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  DrmPreviewOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kSocket:
+      opts.socket_path = optarg;
+      break;
+    case kDecoder:
+      opts.decoder = optarg;
+      break;
+    case kCard:
+      opts.card = optarg;
+      break;
+    case kRenderer:
+      opts.renderer = optarg;
+      break;
+    case kWidth:
+      opts.width = parse_unsigned(optarg, "width");
+      break;
+    case kHeight:
+      opts.height = parse_unsigned(optarg, "height");
+      break;
+    case kOverlayStats:
+      opts.overlay_stats = optarg;
+      break;
+    case kOverlayFont:
+      opts.overlay_font = optarg;
+      break;
+    case kOverlayCorner:
+      opts.overlay_corner = optarg;
+      break;
+    case kOverlaySize:
+      opts.overlay_size = parse_unsigned(optarg, "overlay size");
+      break;
+    case kLatencyReport:
+      opts.latency_report = optarg;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kRecord:
+      opts.record_dir = optarg;
+      break;
+    case kSegment:
+      opts.segment_seconds = parse_unsigned(optarg, "segment length");
+      break;
+    case 'h':
+      drm_preview_usage();
+      std::exit(0);
+    default:
+      drm_preview_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.socket_path.empty()) {
+    throw Error("--socket is required");
+  }
+  if (opts.renderer != "planes" && opts.renderer != "gl") {
+    throw Error("Unknown renderer '" + opts.renderer + "'; use planes or gl");
+  }
+#if !defined(PICAM_HAVE_GL)
+  if (opts.renderer == "gl") {
+    throw Error("This picam-native was built without EGL, GLES and GBM, so --renderer gl is unavailable; "
+                "install libegl-dev, libgles-dev and libgbm-dev and rebuild, or use --renderer planes");
+  }
+#endif
+  if (!opts.overlay_stats.empty() && opts.overlay_font.empty()) {
+    throw Error("--overlay-font is required with --overlay-stats");
+  }
+  return opts;
+}
+
+// What the capture forwards from its control socket.
+void follow_ring_message(RingMessage message, SegmentRecorder *recorder, TextOverlay *overlay) {
+  switch (message) {
+  case RingMessage::kNone:
+    break;
+  case RingMessage::kRecordStart:
+  case RingMessage::kRecordStop:
+    if (recorder) {
+      follow_record_message(message, *recorder);
+    }
+    break;
+  case RingMessage::kCornerTopLeft:
+  case RingMessage::kCornerTopRight:
+  case RingMessage::kCornerBottomLeft:
+  case RingMessage::kCornerBottomRight:
+    if (overlay) {
+      overlay->set_corner(static_cast<OverlayCorner>(static_cast<int>(message) -
+                                                     static_cast<int>(RingMessage::kCornerTopLeft)));
+    }
+    break;
+  }
+}
+
+// Ring -> decoder bitstream buffers. Runs on its own thread so a slow
+// SetPlane never holds up the decoder input.
+void feed_decoder(const std::string &socket_path, V4l2Decoder &decoder, std::atomic<uint64_t> &bytes,
+                  std::atomic<uint64_t> &dropped, PendingStamps *pending, StreamMonitor *monitor,
+                  SegmentRecorder *recorder, TextOverlay *overlay) {
+  name_trace_thread("feeder");
+  try {
+    RingConnection connection = connect_ring(socket_path, kConnectTimeoutMs);
+    ShmRing ring = ShmRing::attach(connection.ring_fd);
+    notify_ring_attached(connection.socket_fd,
+                         (recorder ? kRingFollowsRecord : 0u) | (overlay ? kRingFollowsCorner : 0u));
+
+    while (!stop_pending()) {
+      RingRecord record;
+      RingStatus status = ring.next(record, kPollMs);
+      if (status == RingStatus::kClosed) {
+        break;
+      }
+      if (status == RingStatus::kTimeout) {
+        if (ring_peer_gone(connection.socket_fd)) {
+          break;
+        }
+        continue;
+      }
+      if (recorder || overlay) {
+        follow_ring_message(read_ring_message(connection.socket_fd), recorder, overlay);
+      }
+      if (pending) {
+        PendingStamps::Entry entry{record.timestamp_us, {}, monotonic_ns()};
+        if (find_latency_sei(record.data, record.size, entry.stamp)) {
+          pending->push(entry);
+        }
+      }
+      // Before the decoder, which may wait; the recorder never does.
+      if (recorder) {
+        EncodedFrame frame;
+        frame.data = record.data;
+        frame.size = record.size;
+        frame.timestamp_us = record.timestamp_us;
+        frame.keyframe = record.keyframe;
+        recorder->write(frame);
+      }
+      // A decoder that falls behind backs up into the ring, where the
+      // producer drops whole GOPs rather than corrupting the stream.
+      while (!decoder.queue_bitstream(record.data, record.size, record.timestamp_us, kPollMs)) {
+        if (stop_pending()) {
+          break;
+        }
+      }
+      if (tracing_enabled()) {
+        trace_begin("decode", record.timestamp_us, monotonic_ns());
+      }
+      if (monitor) {
+        if (recorder) {
+          monitor->set_recording(recorder->status());
+        }
+        monitor->access_unit(record.data, record.size, record.timestamp_us);
+      }
+      bytes += record.size;
+      dropped = ring.dropped();
+      ring.consume(record);
+    }
+    close(connection.socket_fd);
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "picam-native: %s\n", e.what());
+  }
+  request_stop();
+}
+
+std::unique_ptr<PreviewDisplay> open_display(const DrmPreviewOptions &opts) {
+#if defined(PICAM_HAVE_GL)
+  if (opts.renderer == "gl") {
+    return std::make_unique<GlDisplay>(opts.card);
+  }
+#endif
+  return std::make_unique<DrmDisplay>(opts.card);
+}
+
+} // namespace
+
+int run_drm_preview(int argc, char **argv) {
+  DrmPreviewOptions opts = parse_drm_preview_options(argc, argv);
+  block_stop_signals();
+
+  std::unique_ptr<PreviewDisplay> display = open_display(opts);
+  V4l2Decoder decoder(opts.decoder, opts.width, opts.height);
+
+  std::unique_ptr<GlyphAtlas> atlas;
+  std::unique_ptr<TextOverlay> overlay;
+  std::unique_ptr<StatsFileFeed> overlay_feed;
+  if (!opts.overlay_stats.empty()) {
+    if (display->has_overlay()) {
+      atlas = std::make_unique<GlyphAtlas>(opts.overlay_font, opts.overlay_size);
+      overlay = std::make_unique<TextOverlay>(*atlas, parse_overlay_corner(opts.overlay_corner));
+      overlay_feed = std::make_unique<StatsFileFeed>(opts.overlay_stats, *overlay);
+    } else {
+      std::fprintf(stderr, "picam-native: Display has no free ARGB plane, running without the overlay\n");
+    }
+  }
+
+  std::unique_ptr<PendingStamps> pending;
+  std::unique_ptr<LatencyStats> latency;
+  if (!opts.latency_report.empty()) {
+    pending = std::make_unique<PendingStamps>();
+    latency = std::make_unique<LatencyStats>();
+  }
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, opts.framerate);
+  }
+  std::unique_ptr<SegmentRecorder> recorder;
+  if (!opts.record_dir.empty()) {
+    recorder = std::make_unique<SegmentRecorder>(opts.record_dir, opts.segment_seconds);
+  }
+
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> dropped{0};
+  std::thread feeder(feed_decoder, opts.socket_path, std::ref(decoder), std::ref(bytes), std::ref(dropped),
+                     pending.get(), monitor.get(), recorder.get(), overlay.get());
+
+  uint64_t frames = 0;
+  uint64_t last_frames = 0;
+  uint64_t last_bytes = 0;
+  uint64_t last_progress = monotonic_ns();
+  name_trace_thread("display");
+  try {
+    while (!stop_pending()) {
+      DecodedFrame frame;
+      switch (decoder.dequeue_frame(frame, kPollMs)) {
+      case V4l2Decoder::Result::kFormatChanged:
+        display->import_frames(decoder.frame_fds(), decoder.format());
+        break;
+      case V4l2Decoder::Result::kFrame: {
+        uint64_t decoded_ns = monotonic_ns();
+        int released = display->show_frame(frame.index);
+        uint64_t shown_ns = monotonic_ns();
+        if (tracing_enabled()) {
+          trace_end("decode", frame.timestamp_us, decoded_ns);
+          trace_slice("present", decoded_ns, shown_ns, frame.timestamp_us);
+        }
+        if (released >= 0) {
+          decoder.requeue_frame(static_cast<unsigned>(released));
+        }
+        ++frames;
+
+        PendingStamps::Entry entry;
+        if (pending && pending->take(frame.timestamp_us, entry)) {
+          uint64_t stages[kStageCount];
+          stages[kStageCapture] = elapsed(entry.stamp.sensor_ns, entry.stamp.delivered_ns);
+          stages[kStageEncode] = elapsed(entry.stamp.delivered_ns, entry.stamp.encoded_ns);
+          stages[kStageTransport] = elapsed(entry.stamp.encoded_ns, entry.received_ns);
+          stages[kStageDecode] = elapsed(entry.received_ns, decoded_ns);
+          stages[kStageDisplay] = elapsed(decoded_ns, shown_ns);
+          stages[kStageTotal] = elapsed(entry.stamp.sensor_ns, shown_ns);
+          latency->add(stages);
+        }
+        break;
+      }
+      case V4l2Decoder::Result::kTimeout:
+        break;
+      }
+
+      if (overlay) {
+        display->update_overlay(*overlay);
+      }
+
+      uint64_t now = monotonic_ns();
+      if (now - last_progress >= kProgressIntervalNs) {
+        double seconds = (now - last_progress) / 1e9;
+        uint64_t total_bytes = bytes.load();
+        std::fprintf(stderr, "frame=%6" PRIu64 " fps=%.1f bitrate=%.1fkbits/s drop=%" PRIu64 "\r", frames,
+                     (frames - last_frames) / seconds, (total_bytes - last_bytes) * 8 / seconds / 1000.0,
+                     dropped.load());
+        last_frames = frames;
+        last_bytes = total_bytes;
+        last_progress = now;
+        if (latency && overlay_feed) {
+          overlay_feed->set_suffix(latency->overlay_text());
+        }
+      }
+    }
+  } catch (...) {
+    request_stop();
+    feeder.join();
+    throw;
+  }
+
+  feeder.join();
+  std::fprintf(stderr, "\npicam-native: %" PRIu64 " frames shown\n", frames);
+  if (latency) {
+    latency->write_report(opts.latency_report);
+    std::fprintf(stderr, "picam-native: %zu latency samples written to %s\n", latency->count(),
+                 opts.latency_report.c_str());
+  }
+  return 0;
+}
+
+} // namespace picam
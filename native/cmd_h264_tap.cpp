@@ -0,0 +1,223 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "event_recorder.hpp"
+#include "fd_sink.hpp"
+#include "h264.hpp"
+#include "segment_recorder.hpp"
+#include "stream_monitor.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr size_t kChunkSize = 64 << 10;
+constexpr int kPollMs = 200;
+
+struct TapOptions {
+  std::string input = "-";
+  std::string output = "-";
+  std::string counters;
+  unsigned framerate = 30;
+  std::string record_dir;
+  unsigned segment_seconds = 60;
+  EventConfig dvr;
+};
+
+void tap_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native h264-tap --counters <path> [options]\n"
+               "\n"
+               "Copies an H.264 byte stream unchanged while counting it into a shared\n"
+               "counter block for 'picam-native metrics --counters'.\n"
+               "\n"
+               "Options:\n"
+               "  -i, --input <path>          Input file or FIFO, '-' for stdin (default: -)\n"
+               "  -o, --output <path>         Output file or FIFO, '-' for stdout (default: -)\n"
+               "      --counters <path>       Counter block to publish into (normally on /dev/shm)\n"
+               "      --framerate <fps>       Nominal frame rate (default: 30)\n"
+               "      --record <dir>          Also record IDR-aligned MPEG-TS segments into this directory\n"
+               "      --segment <seconds>     Segment length for --record (default: 60)\n"
+               "      --dvr <dir>             Keep the last --pre-event seconds in RAM and save them, plus\n"
+               "                              --post-event seconds, into this directory on SIGUSR1 or GPIO\n"
+               "      --pre-event <seconds>   Stream kept before the trigger (default: 10)\n"
+               "      --post-event <seconds>  Stream saved after the last trigger (default: 10)\n"
+               "      --dvr-arena <MiB>       Fixed memory for the pre-event GOPs (default: 32)\n"
+               "      --trigger-gpio <path>   sysfs GPIO value file whose rising edge saves an event\n");
+}
+
+TapOptions parse_tap_options(int argc, char **argv) {
+  enum { kCounters = 256, kFramerate, kRecord, kSegment, kDvr, kPreEvent, kPostEvent, kDvrArena, kTriggerGpio };
+  static const option long_options[] = {
+      {"input", required_argument, nullptr, 'i'},
+      {"output", required_argument, nullptr, 'o'},
+      {"counters", required_argument, nullptr, kCounters},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"record", required_argument, nullptr, kRecord},
+      {"segment", required_argument, nullptr, kSegment},
+      {"dvr", required_argument, nullptr, kDvr},
+      {"pre-event", required_argument, nullptr, kPreEvent},
+      {"post-event", required_argument, nullptr, kPostEvent},
+      {"dvr-arena", required_argument, nullptr, kDvrArena},
+      {"trigger-gpio", required_argument, nullptr, kTriggerGpio},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  TapOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "i:o:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case 'i':
+      opts.input = optarg;
+      break;
+    case 'o':
+      opts.output = optarg;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kRecord:
+      opts.record_dir = optarg;
+      break;
+    case kSegment:
+      opts.segment_seconds = parse_unsigned(optarg, "segment length");
+      break;
+    case kDvr:
+      opts.dvr.directory = optarg;
+      break;
+    case kPreEvent:
+      opts.dvr.pre_seconds = parse_unsigned(optarg, "pre-event length");
+      break;
+    case kPostEvent:
+      opts.dvr.post_seconds = parse_unsigned(optarg, "post-event length");
+      break;
+    case kDvrArena:
+      opts.dvr.arena_bytes = static_cast<size_t>(parse_unsigned(optarg, "DVR arena size")) << 20;
+      break;
+    case kTriggerGpio:
+      opts.dvr.trigger_gpio = optarg;
+      break;
+    case 'h':
+      tap_usage();
+      std::exit(0);
+    default:
+      tap_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.counters.empty()) {
+    throw Error("--counters is required");
+  }
+  if (opts.dvr.arena_bytes == 0) {
+    throw Error("DVR arena size must be greater than zero");
+  }
+  opts.dvr.framerate = opts.framerate;
+  return opts;
+}
+
+} // namespace
+
+int run_h264_tap(int argc, char **argv) {
+  TapOptions opts = parse_tap_options(argc, argv);
+  block_stop_signals();
+  if (!opts.dvr.directory.empty()) {
+    block_event_signal();
+  }
+
+  StreamMonitor monitor(opts.counters, opts.framerate);
+
+  int input = STDIN_FILENO;
+  if (opts.input != "-") {
+    input = open(opts.input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0) {
+      throw_errno("Cannot open input '" + opts.input + "'");
+    }
+  }
+  FdSink sink(opts.output);
+
+  // The byte stream carries no timestamps, so recorded units are stamped on arrival.
+  std::unique_ptr<SegmentRecorder> recorder;
+  std::unique_ptr<EventRecorder> dvr;
+  h264::AccessUnitAssembler assembler;
+  const h264::AccessUnitAssembler::Emit record_unit = [&recorder, &dvr](const uint8_t *data, size_t size,
+                                                                        bool keyframe) {
+    EncodedFrame unit;
+    unit.data = data;
+    unit.size = size;
+    unit.timestamp_us = static_cast<int64_t>(monotonic_ns() / 1000);
+    unit.keyframe = keyframe;
+    if (recorder) {
+      recorder->write(unit);
+    }
+    if (dvr) {
+      dvr->write(unit);
+    }
+  };
+  if (!opts.record_dir.empty()) {
+    recorder = std::make_unique<SegmentRecorder>(opts.record_dir, opts.segment_seconds);
+  }
+  if (!opts.dvr.directory.empty()) {
+    dvr = std::make_unique<EventRecorder>(opts.dvr);
+  }
+
+  // Forward first, count second: the tap must never delay the stream.
+  std::vector<uint8_t> buffer(kChunkSize);
+  while (!stop_pending()) {
+    pollfd pfd{input, POLLIN, 0};
+    int ready = poll(&pfd, 1, kPollMs);
+    if (ready < 0 && errno != EINTR) {
+      throw_errno("Cannot poll tap input");
+    }
+    if (ready <= 0) {
+      continue;
+    }
+    ssize_t length = read(input, buffer.data(), buffer.size());
+    if (length < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      throw_errno("Cannot read tap input");
+    }
+    if (length == 0) {
+      break;
+    }
+
+    EncodedFrame chunk;
+    chunk.data = buffer.data();
+    chunk.size = static_cast<size_t>(length);
+    sink.write(chunk);
+    if (recorder || dvr) {
+      assembler.feed(buffer.data(), static_cast<size_t>(length), record_unit);
+    }
+    if (recorder) {
+      monitor.set_recording(recorder->status());
+    }
+    monitor.feed(buffer.data(), static_cast<size_t>(length));
+  }
+  if (recorder || dvr) {
+    assembler.flush(record_unit);
+  }
+
+  if (input != STDIN_FILENO) {
+    close(input);
+  }
+  return 0;
+}
+
+} // namespace picam
@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "proc_stats.hpp"
+#include "soak_report.hpp"
+#include "soc_stats.hpp"
+#include "stream_counters.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr uint64_t kIntervalNs = 1000000000ull;
+constexpr size_t kLogTailBytes = 1024;
+
+struct MetricsOptions {
+  std::string stats_file;
+  std::string ffmpeg_log;
+  // One counter block per camera pipeline, in camera order.
+  std::vector<std::string> counters;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned bitrate = 0;
+  unsigned fps = 0;
+  std::string samples;
+  std::string soak_dir;
+  unsigned rollup_seconds = 3600;
+  std::vector<pid_t> pids;
+};
+
+// Newest values from an ffmpeg-style progress line.
+struct Progress {
+  std::string fps;
+  std::string bitrate;
+  uint64_t frame = 0;
+  uint64_t dropped = 0;
+  bool has_frame = false;
+  // Time to first frame from the stream monitor; 0 without counters.
+  double first_frame_ms = 0.0;
+  // Frame-interval jitter and longest interval over the last second.
+  double jitter_ms = 0.0;
+  double max_interval_ms = 0.0;
+  // Stream bytes so far and the sensor-to-monitor latency; 0 without counters.
+  uint64_t bytes = 0;
+  double latency_ms = 0.0;
+  uint64_t frame_peak_bytes = 0;
+  // Overlay lines for the rate controller, the ISP crop, the motion
+  // detector and the segment recorder, empty when they are not running.
+  std::string rate;
+  std::string roi;
+  std::string motion;
+  std::string record;
+  // One overlay line per camera when several pipelines are aggregated.
+  std::string cameras;
+};
+
+// A camera's counter block and its frame count as of the previous sample.
+struct CameraCounters {
+  explicit CameraCounters(const std::string &block)
+      : path(block), counters(StreamCounters::open_existing(block)) {}
+
+  std::string path;
+  StreamCounters counters;
+  StreamSnapshot snapshot;
+  bool has_snapshot = false;
+  uint64_t last_frame = 0;
+};
+
+void metrics_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native metrics --stats-file <path> [options] --pid <pid>...\n"
+               "\n"
+               "Options:\n"
+               "      --stats-file <path>     Overlay text file rewritten once per second\n"
+               "      --ffmpeg-log <path>     ffmpeg -stats log to take FPS and bitrate from\n"
+               "      --counters <path>       Stream monitor counter block; preferred over --ffmpeg-log. Repeat\n"
+               "                              once per camera to add several pipelines up, with a line and\n"
+               "                              sample columns per camera (CAM0, CAM1, ... in the order given)\n"
+               "      --width <pixels>        Reported resolution width\n"
+               "      --height <pixels>       Reported resolution height\n"
+               "      --bitrate <bits>        Target bitrate shown until ffmpeg reports one\n"
+               "      --fps <number>          Target FPS shown until ffmpeg reports one\n"
+               "      --samples <path>        Append one CSV row per second (elapsed_s,fps,cpu_pct,mem_pct,dropped,\n"
+               "                              first_frame_ms,jitter_ms,max_interval_ms,latency_ms,mbps,\n"
+               "                              rss_mib,pss_mib,cma_mib,cache_mib,temp_c,arm_mhz,core_mhz,\n"
+               "                              throttled,peak_kib)\n"
+               "      --soak <dir>            Keep FPS, latency, CPU and bitrate histograms in fixed memory and\n"
+               "                              append their distribution to <dir>/rollups.csv every rollup\n"
+               "                              period, with the whole run's in <dir>/soak.json\n"
+               "      --rollup <seconds>      Soak rollup period (default: 3600)\n"
+               "      --pid <pid>             Process to account CPU and memory for (repeatable)\n");
+}
+
+MetricsOptions parse_metrics_options(int argc, char **argv) {
+  enum { kStatsFile = 256, kFfmpegLog, kCounters, kWidth, kHeight, kBitrate, kFps, kSamples, kSoak, kRollup, kPid };
+  static const option long_options[] = {
+      {"stats-file", required_argument, nullptr, kStatsFile},
+      {"ffmpeg-log", required_argument, nullptr, kFfmpegLog},
+      {"counters", required_argument, nullptr, kCounters},
+      {"width", required_argument, nullptr, kWidth},
+      {"height", required_argument, nullptr, kHeight},
+      {"bitrate", required_argument, nullptr, kBitrate},
+      {"fps", required_argument, nullptr, kFps},
+      {"samples", required_argument, nullptr, kSamples},
+      {"soak", required_argument, nullptr, kSoak},
+      {"rollup", required_argument, nullptr, kRollup},
+      {"pid", required_argument, nullptr, kPid},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  MetricsOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kStatsFile:
+      opts.stats_file = optarg;
+      break;
+    case kFfmpegLog:
+      opts.ffmpeg_log = optarg;
+      break;
+    case kCounters:
+      opts.counters.push_back(optarg);
+      break;
+    case kWidth:
+      opts.width = parse_unsigned(optarg, "width");
+      break;
+    case kHeight:
+      opts.height = parse_unsigned(optarg, "height");
+      break;
+    case kBitrate:
+      opts.bitrate = parse_unsigned(optarg, "bitrate");
+      break;
+    case kFps:
+      opts.fps = parse_unsigned(optarg, "FPS");
+      break;
+    case kSamples:
+      opts.samples = optarg;
+      break;
+    case kSoak:
+      opts.soak_dir = optarg;
+      break;
+    case kRollup:
+      opts.rollup_seconds = parse_unsigned(optarg, "rollup period");
+      break;
+    case kPid:
+      opts.pids.push_back(static_cast<pid_t>(parse_unsigned(optarg, "pid")));
+      break;
+    case 'h':
+      metrics_usage();
+      std::exit(0);
+    default:
+      metrics_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.stats_file.empty()) {
+    throw Error("--stats-file is required");
+  }
+  if (opts.pids.empty()) {
+    throw Error("At least one --pid is required");
+  }
+  if (opts.rollup_seconds == 0) {
+    throw Error("Rollup period must be greater than zero");
+  }
+  return opts;
+}
+
+// Copies the value after "key=" (ffmpeg pads it with spaces) up to the next space.
+bool extract_field(const std::string &line, const char *key, std::string &value) {
+  size_t pos = line.rfind(key);
+  if (pos == std::string::npos) {
+    return false;
+  }
+  pos += std::strlen(key);
+  while (pos < line.size() && line[pos] == ' ') {
+    ++pos;
+  }
+  size_t end = line.find(' ', pos);
+  std::string found = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+  if (found.empty()) {
+    return false;
+  }
+  value = found;
+  return true;
+}
+
+// ffmpeg rewrites its progress line with '\r'; only the newest one matters.
+void read_ffmpeg_progress(int fd, Progress &progress) {
+  struct stat st{};
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+    return;
+  }
+  char buf[kLogTailBytes + 1];
+  off_t offset = st.st_size > static_cast<off_t>(kLogTailBytes) ? st.st_size - static_cast<off_t>(kLogTailBytes) : 0;
+  ssize_t len = pread(fd, buf, kLogTailBytes, offset);
+  if (len <= 0) {
+    return;
+  }
+  std::string tail(buf, static_cast<size_t>(len));
+  size_t fps_pos = tail.rfind("fps=");
+  if (fps_pos == std::string::npos) {
+    return;
+  }
+  size_t line_start = tail.find_last_of("\r\n", fps_pos);
+  size_t line_end = tail.find_first_of("\r\n", fps_pos);
+  std::string line = tail.substr(line_start == std::string::npos ? 0 : line_start + 1,
+                                 line_end == std::string::npos ? std::string::npos : line_end - line_start - 1);
+
+  std::string value;
+  if (extract_field(line, "fps=", value) && value.find_first_not_of("0123456789.") == std::string::npos) {
+    progress.fps = value;
+  }
+  if (extract_field(line, "bitrate=", value)) {
+    progress.bitrate = value;
+  }
+  if (extract_field(line, "frame=", value) && value.find_first_not_of("0123456789") == std::string::npos) {
+    progress.frame = std::strtoull(value.c_str(), nullptr, 10);
+    progress.has_frame = true;
+  }
+  if (extract_field(line, "drop=", value) && value.find_first_not_of("0123456789") == std::string::npos) {
+    progress.dropped = std::strtoull(value.c_str(), nullptr, 10);
+  }
+}
+
+// The monitor publishes after every picture, so this is always current.
+bool read_stream_counters(const StreamCounters &counters, Progress &progress) {
+  StreamSnapshot snapshot;
+  if (!counters.valid() || !counters.read(snapshot) || snapshot.access_units == 0) {
+    return false;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f", snapshot.fps_window);
+  progress.fps = buf;
+  if (snapshot.gop_bitrate > 0) {
+    std::snprintf(buf, sizeof(buf), "%.1fkbits/s", snapshot.gop_bitrate / 1000.0);
+    progress.bitrate = buf;
+  }
+  progress.frame = snapshot.access_units;
+  progress.dropped = snapshot.dropped_frames;
+  progress.has_frame = true;
+  progress.first_frame_ms = snapshot.first_frame_ms;
+  progress.jitter_ms = snapshot.interval_jitter_ms;
+  progress.max_interval_ms = snapshot.interval_max_ms;
+  progress.bytes = snapshot.bytes;
+  progress.latency_ms = snapshot.delivery_latency_ms;
+  progress.frame_peak_bytes = snapshot.frame_peak_bytes;
+  if (snapshot.rate_framerate > 0) {
+    std::snprintf(buf, sizeof(buf), "RATE: %.0fkbits/s %llu fps\n", snapshot.rate_bitrate / 1000.0,
+                  static_cast<unsigned long long>(snapshot.rate_framerate));
+    progress.rate = buf;
+  }
+  if (snapshot.roi_width > 0) {
+    std::snprintf(buf, sizeof(buf), "ROI: %llux%llu+%llu+%llu\n", static_cast<unsigned long long>(snapshot.roi_width),
+                  static_cast<unsigned long long>(snapshot.roi_height), static_cast<unsigned long long>(snapshot.roi_x),
+                  static_cast<unsigned long long>(snapshot.roi_y));
+    progress.roi = buf;
+  }
+  if (snapshot.motion_frames > 0) {
+    std::snprintf(buf, sizeof(buf), "MOTION: %s %.1f%%%%\n", snapshot.motion_active ? "yes" : "no",
+                  snapshot.motion_score_pct);
+    progress.motion = buf;
+  }
+  if (snapshot.record_paused) {
+    progress.record = "REC: stopped\n";
+  } else if (snapshot.record_segments > 0) {
+    std::snprintf(buf, sizeof(buf), "REC: %.1f ms Q %.0f%%%%\n", snapshot.record_write_ms,
+                  snapshot.record_queue_peak_pct);
+    progress.record = buf;
+  }
+  return true;
+}
+
+// Several pipelines add up: frames, drops, bytes and bitrate are summed,
+// jitter and latency are the worst camera's, and the first frame counts once
+// every camera has delivered one.
+bool read_camera_counters(std::vector<CameraCounters> &cameras, Progress &progress) {
+  double fps = 0.0;
+  double bitrate = 0.0;
+  uint64_t frames = 0;
+  uint64_t dropped = 0;
+  double first_frame_ms = 0.0;
+  double jitter_ms = 0.0;
+  double max_interval_ms = 0.0;
+  uint64_t bytes = 0;
+  double latency_ms = 0.0;
+  uint64_t frame_peak_bytes = 0;
+  bool all_started = true;
+  bool any = false;
+  progress.cameras.clear();
+  for (size_t i = 0; i < cameras.size(); ++i) {
+    CameraCounters &camera = cameras[i];
+    char line[96];
+    if (!camera.counters.valid() || !camera.counters.read(camera.snapshot) || camera.snapshot.access_units == 0) {
+      all_started = false;
+      std::snprintf(line, sizeof(line), "CAM%zu: waiting\n", i);
+      progress.cameras += line;
+      continue;
+    }
+    const StreamSnapshot &snapshot = camera.snapshot;
+    camera.has_snapshot = true;
+    any = true;
+    fps += snapshot.fps_window;
+    bitrate += snapshot.gop_bitrate;
+    frames += snapshot.access_units;
+    dropped += snapshot.dropped_frames;
+    first_frame_ms = std::max(first_frame_ms, snapshot.first_frame_ms);
+    jitter_ms = std::max(jitter_ms, snapshot.interval_jitter_ms);
+    max_interval_ms = std::max(max_interval_ms, snapshot.interval_max_ms);
+    bytes += snapshot.bytes;
+    latency_ms = std::max(latency_ms, snapshot.delivery_latency_ms);
+    frame_peak_bytes = std::max(frame_peak_bytes, snapshot.frame_peak_bytes);
+    char roi[48] = "";
+    if (snapshot.roi_width > 0) {
+      std::snprintf(roi, sizeof(roi), " ROI %llux%llu+%llu+%llu", static_cast<unsigned long long>(snapshot.roi_width),
+                    static_cast<unsigned long long>(snapshot.roi_height),
+                    static_cast<unsigned long long>(snapshot.roi_x), static_cast<unsigned long long>(snapshot.roi_y));
+    }
+    std::snprintf(line, sizeof(line), "CAM%zu: %.1f fps %.1fkbits/s drop %llu%s%s\n", i, snapshot.fps_window,
+                  snapshot.gop_bitrate / 1000.0, static_cast<unsigned long long>(snapshot.dropped_frames),
+                  snapshot.motion_active ? " MOTION" : "", roi);
+    progress.cameras += line;
+  }
+  if (!any) {
+    return false;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f", fps);
+  progress.fps = buf;
+  if (bitrate > 0) {
+    std::snprintf(buf, sizeof(buf), "%.1fkbits/s", bitrate / 1000.0);
+    progress.bitrate = buf;
+  }
+  progress.frame = frames;
+  progress.dropped = dropped;
+  progress.has_frame = true;
+  progress.first_frame_ms = all_started ? first_frame_ms : 0.0;
+  progress.jitter_ms = jitter_ms;
+  progress.max_interval_ms = max_interval_ms;
+  progress.bytes = bytes;
+  progress.latency_ms = latency_ms;
+  progress.frame_peak_bytes = frame_peak_bytes;
+  return true;
+}
+
+} // namespace
+
+int run_metrics(int argc, char **argv) {
+  MetricsOptions opts = parse_metrics_options(argc, argv);
+  block_stop_signals();
+
+  int stats_fd = open(opts.stats_file.c_str(), O_WRONLY | O_CLOEXEC);
+  if (stats_fd < 0) {
+    throw_errno("Cannot open stats file '" + opts.stats_file + "'");
+  }
+  int log_fd = opts.ffmpeg_log.empty() ? -1 : open(opts.ffmpeg_log.c_str(), O_RDONLY | O_CLOEXEC);
+
+  std::vector<ProcessStats> processes;
+  std::vector<ProcessSample> previous;
+  for (pid_t pid : opts.pids) {
+    processes.emplace_back(pid);
+    previous.push_back(processes.back().sample());
+  }
+
+  const double ticks_per_second = static_cast<double>(clock_ticks_per_second());
+  const double page_bytes = static_cast<double>(sysconf(_SC_PAGESIZE));
+  const double memory_total = static_cast<double>(memory_total_bytes());
+  SystemMemoryStats system_memory;
+  SocStats soc_stats;
+
+  FILE *samples = nullptr;
+  if (!opts.samples.empty()) {
+    samples = std::fopen(opts.samples.c_str(), "a");
+    if (!samples) {
+      throw_errno("Cannot open samples file '" + opts.samples + "'");
+    }
+    if (std::ftell(samples) == 0) {
+      std::fprintf(samples,
+                   "elapsed_s,fps,cpu_pct,mem_pct,dropped,first_frame_ms,jitter_ms,max_interval_ms,latency_ms,mbps,"
+                   "rss_mib,pss_mib,cma_mib,cache_mib,temp_c,arm_mhz,core_mhz,throttled,peak_kib");
+      for (size_t i = 0; opts.counters.size() > 1 && i < opts.counters.size(); ++i) {
+        std::fprintf(samples, ",cam%zu_fps,cam%zu_dropped", i, i);
+      }
+      std::fprintf(samples, "\n");
+    }
+  }
+
+  std::unique_ptr<SoakReport> soak;
+  if (!opts.soak_dir.empty()) {
+    soak = std::make_unique<SoakReport>(opts.soak_dir, opts.rollup_seconds);
+  }
+
+  Progress progress;
+  progress.fps = std::to_string(opts.fps);
+  char bitrate_buf[32];
+  std::snprintf(bitrate_buf, sizeof(bitrate_buf), "%.1f Mbps", opts.bitrate / 1000000.0);
+  progress.bitrate = bitrate_buf;
+  double cpu_usage = 0.0;
+  double mem_usage = 0.0;
+  // Of the watched processes, and system-wide for CMA and the page cache.
+  double rss_mib = 0.0;
+  double pss_mib = 0.0;
+  MemorySample memory;
+  SocSample soc = soc_stats.sample();
+  size_t last_length = 0;
+
+  const uint64_t start_ns = monotonic_ns();
+  uint64_t last_sample_ns = start_ns;
+  uint64_t last_frame = 0;
+  uint64_t last_bytes = 0;
+  bool have_last_frame = false;
+  double elapsed = 0.0;
+  bool measured = false;
+  uint64_t deadline = last_sample_ns;
+  std::vector<CameraCounters> cameras;
+  for (const auto &path : opts.counters) {
+    cameras.emplace_back(path);
+  }
+  for (;;) {
+    // The monitors may start after us; keep trying until their blocks are there.
+    for (auto &camera : cameras) {
+      if (!camera.counters.valid()) {
+        camera.counters = StreamCounters::open_existing(camera.path);
+      }
+    }
+    bool counted = cameras.size() > 1 ? read_camera_counters(cameras, progress)
+                                      : !cameras.empty() && read_stream_counters(cameras[0].counters, progress);
+    if (!counted) {
+      read_ffmpeg_progress(log_fd, progress);
+    }
+
+    // ffmpeg's fps= is averaged over the whole run; samples use the frame
+    // and byte counter deltas so every row describes just the last second.
+    double sample_fps = std::strtod(progress.fps.c_str(), nullptr);
+    double sample_mbps = 0.0;
+    if (progress.has_frame && have_last_frame && elapsed > 0 && progress.frame >= last_frame) {
+      sample_fps = static_cast<double>(progress.frame - last_frame) / elapsed;
+    }
+    if (have_last_frame && elapsed > 0 && progress.bytes >= last_bytes) {
+      sample_mbps = static_cast<double>(progress.bytes - last_bytes) * 8.0 / elapsed / 1e6;
+    }
+    if (soak && measured) {
+      SoakSample sample;
+      sample.fps = sample_fps;
+      sample.latency_ms = progress.latency_ms;
+      sample.cpu_pct = cpu_usage;
+      sample.mbps = sample_mbps;
+      sample.temperature_c = soc.temperature_c;
+      sample.dropped = progress.dropped;
+      sample.throttled = soc.throttled;
+      soak->add(sample, static_cast<double>(last_sample_ns - start_ns) / 1e9);
+    }
+    if (samples && measured) {
+      std::fprintf(samples, "%.3f,%.2f,%.2f,%.2f,%llu,%.1f,%.3f,%.2f,%.2f,%.3f,%.1f,%.1f,%.1f,%.1f",
+                   static_cast<double>(last_sample_ns - start_ns) / 1e9, sample_fps, cpu_usage, mem_usage,
+                   static_cast<unsigned long long>(progress.dropped), progress.first_frame_ms, progress.jitter_ms,
+                   progress.max_interval_ms, progress.latency_ms, sample_mbps, rss_mib, pss_mib,
+                   (memory.cma_total_kib - memory.cma_free_kib) / 1024.0, memory.cached_kib / 1024.0);
+      std::fprintf(samples, ",%.1f,%u,%u,0x%x,%.1f", soc.temperature_c, soc.arm_mhz, soc.core_mhz, soc.throttled,
+                   progress.frame_peak_bytes / 1024.0);
+      for (size_t i = 0; cameras.size() > 1 && i < cameras.size(); ++i) {
+        CameraCounters &camera = cameras[i];
+        double camera_fps = 0.0;
+        if (camera.has_snapshot && elapsed > 0 && camera.snapshot.access_units >= camera.last_frame) {
+          camera_fps = static_cast<double>(camera.snapshot.access_units - camera.last_frame) / elapsed;
+        }
+        std::fprintf(samples, ",%.2f,%llu", camera_fps,
+                     static_cast<unsigned long long>(camera.snapshot.dropped_frames));
+      }
+      std::fprintf(samples, "\n");
+      std::fflush(samples);
+    }
+    if (progress.has_frame) {
+      last_frame = progress.frame;
+      last_bytes = progress.bytes;
+      have_last_frame = true;
+    }
+    for (auto &camera : cameras) {
+      camera.last_frame = camera.snapshot.access_units;
+    }
+
+    // drawtext expands '%', hence the doubled percent signs in the file.
+    char jitter[64] = "";
+    if (progress.max_interval_ms > 0) {
+      std::snprintf(jitter, sizeof(jitter), "JITTER: %.2f ms max %.1f ms\n", progress.jitter_ms,
+                    progress.max_interval_ms);
+    }
+    char latency[32] = "";
+    if (progress.latency_ms > 0) {
+      std::snprintf(latency, sizeof(latency), "LATENCY: %.1f ms\n", progress.latency_ms);
+    }
+    char footprint[64] = "";
+    if (pss_mib > 0 || memory.cma_total_kib > 0) {
+      std::snprintf(footprint, sizeof(footprint), "PSS: %.1f MiB CMA: %.0f/%.0f MiB\n", pss_mib,
+                    (memory.cma_total_kib - memory.cma_free_kib) / 1024.0, memory.cma_total_kib / 1024.0);
+    }
+    // Throttling is what silently drags a long run down, so it is spelled out.
+    char thermal[128] = "";
+    if (soc.temperature_c > 0 || soc.arm_mhz > 0) {
+      const std::string throttle = describe_throttle_flags(soc.throttled & kThrottleNowMask);
+      std::snprintf(thermal, sizeof(thermal), "SOC: %.1f C ARM %u MHz CORE %u MHz\n%s%s%s", soc.temperature_c,
+                    soc.arm_mhz, soc.core_mhz, throttle.empty() ? "" : "THROTTLED: ", throttle.c_str(),
+                    throttle.empty() ? "" : "\n");
+    }
+    char text[896];
+    int length = std::snprintf(text, sizeof(text),
+                               "FPS: %s\nRES: %ux%u\nBitRate: %s\nCPU: %.1f%%%%\nMEM: %.1f%%%%\n%s%s%s%s%s%s%s%s%s",
+                               progress.fps.c_str(), opts.width, opts.height, progress.bitrate.c_str(), cpu_usage,
+                               mem_usage, footprint, thermal, jitter, latency, progress.rate.c_str(),
+                               progress.roi.c_str(), progress.motion.c_str(), progress.record.c_str(),
+                               progress.cameras.c_str());
+    size_t text_length = std::min(static_cast<size_t>(length), sizeof(text) - 1);
+    if (pwrite(stats_fd, text, text_length, 0) < 0) {
+      warn_errno("Cannot write stats file");
+    }
+    if (text_length < last_length && ftruncate(stats_fd, static_cast<off_t>(text_length)) < 0) {
+      warn_errno("Cannot truncate stats file");
+    }
+    last_length = text_length;
+
+    deadline += kIntervalNs;
+    if (wait_for_stop_until(deadline)) {
+      break;
+    }
+
+    // The pipeline removes the stats file on cleanup; stop with it.
+    struct stat st{};
+    if (fstat(stats_fd, &st) < 0 || st.st_nlink == 0) {
+      break;
+    }
+
+    uint64_t now = monotonic_ns();
+    elapsed = static_cast<double>(now - last_sample_ns) / 1e9;
+    last_sample_ns = now;
+
+    bool any_alive = false;
+    uint64_t cpu_ticks = 0;
+    uint64_t rss_pages = 0;
+    uint64_t pss_kib = 0;
+    for (size_t i = 0; i < processes.size(); ++i) {
+      ProcessSample sample = processes[i].sample();
+      if (!sample.alive) {
+        continue;
+      }
+      any_alive = true;
+      if (previous[i].alive && sample.cpu_ticks >= previous[i].cpu_ticks) {
+        cpu_ticks += sample.cpu_ticks - previous[i].cpu_ticks;
+      }
+      rss_pages += sample.rss_pages;
+      pss_kib += sample.pss_kib;
+      previous[i] = sample;
+    }
+    if (!any_alive) {
+      break;
+    }
+
+    cpu_usage = elapsed > 0 ? static_cast<double>(cpu_ticks) / ticks_per_second / elapsed * 100.0 : 0.0;
+    mem_usage = memory_total > 0 ? static_cast<double>(rss_pages) * page_bytes / memory_total * 100.0 : 0.0;
+    rss_mib = static_cast<double>(rss_pages) * page_bytes / (1024.0 * 1024.0);
+    pss_mib = pss_kib / 1024.0;
+    memory = system_memory.sample();
+    soc = soc_stats.sample();
+    measured = true;
+  }
+
+  if (soak) {
+    soak->finish(static_cast<double>(last_sample_ns - start_ns) / 1e9);
+  }
+  if (samples) {
+    std::fclose(samples);
+  }
+  if (log_fd >= 0) {
+    close(log_fd);
+  }
+  close(stats_fd);
+  return 0;
+}
+
+} // namespace picam
@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codec.hpp"
+#include "commands.hpp"
+#include "fd_sink.hpp"
+#include "h264.hpp"
+#include "latency.hpp"
+#include "ring_sink.hpp"
+#include "stream_monitor.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr unsigned kDefaultRingMib = 8;
+constexpr unsigned kDefaultFramerate = 30;
+constexpr size_t kTsPacketSize = 188;
+constexpr uint8_t kTsSyncByte = 0x47;
+constexpr size_t kTsProbePackets = 4;
+
+struct ReplayOptions {
+  std::string input;
+  // 0: the stream's own rate.
+  unsigned framerate = 0;
+  // 0: until stopped.
+  unsigned loops = 1;
+  std::string output = "-";
+  std::string ring_socket;
+  unsigned ring_size_mib = kDefaultRingMib;
+  bool null_output = false;
+  std::string counters;
+  bool latency_sei = false;
+  bool print_framerate = false;
+};
+
+void replay_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native replay --input <file> [options]\n"
+               "\n"
+               "Plays a recorded H.264 elementary stream in place of 'capture', with no camera. The file\n"
+               "is mapped, cut into access units up front and published one per frame interval, so\n"
+               "the decode, display and streaming stages behind it see the same input on every run.\n"
+               "\n"
+               "Options:\n"
+               "  -i, --input <path>          Annex B elementary stream, e.g. from 'libcamera-vid -o x.h264'\n"
+               "      --framerate <fps>       Pace at this rate (default: the SPS timing info, else 30)\n"
+               "      --loops <n>             Times to play the file, 0 for until stopped (default: 1)\n"
+               "  -o, --output <path>         Output file or FIFO, '-' for stdout (default: -)\n"
+               "      --ring-socket <path>    Publish into a shared-memory ring handed out on this socket\n"
+               "                              instead of writing to --output; starts once a consumer attaches\n"
+               "      --ring-size <MiB>       Ring capacity (default: 8)\n"
+               "      --null                  Discard the stream; only the pacing is measured\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --latency-sei           Stamp each access unit with its scheduled and actual publish\n"
+               "                              time, as capture does with the sensor and encoder times\n"
+               "      --print-framerate       Print the frame rate the file would be paced at, rounded, and exit\n");
+}
+
+ReplayOptions parse_replay_options(int argc, char **argv) {
+  enum { kFramerate = 256, kLoops, kRingSocket, kRingSize, kNull, kCounters, kLatencySei, kPrintFramerate };
+  static const option long_options[] = {
+      {"input", required_argument, nullptr, 'i'},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"loops", required_argument, nullptr, kLoops},
+      {"output", required_argument, nullptr, 'o'},
+      {"ring-socket", required_argument, nullptr, kRingSocket},
+      {"ring-size", required_argument, nullptr, kRingSize},
+      {"null", no_argument, nullptr, kNull},
+      {"counters", required_argument, nullptr, kCounters},
+      {"latency-sei", no_argument, nullptr, kLatencySei},
+      {"print-framerate", no_argument, nullptr, kPrintFramerate},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  ReplayOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "i:o:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case 'i':
+      opts.input = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "frame rate");
+      if (opts.framerate == 0) {
+        throw Error("Frame rate must be greater than zero");
+      }
+      break;
+    case kLoops:
+      opts.loops = parse_unsigned(optarg, "loops");
+      break;
+    case 'o':
+      opts.output = optarg;
+      break;
+    case kRingSocket:
+      opts.ring_socket = optarg;
+      break;
+    case kRingSize:
+      opts.ring_size_mib = parse_unsigned(optarg, "ring size");
+      if (opts.ring_size_mib == 0) {
+        throw Error("Ring size must be greater than zero");
+      }
+      break;
+    case kNull:
+      opts.null_output = true;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kLatencySei:
+      opts.latency_sei = true;
+      break;
+    case kPrintFramerate:
+      opts.print_framerate = true;
+      break;
+    case 'h':
+      replay_usage();
+      std::exit(0);
+    default:
+      replay_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.input.empty()) {
+    throw Error("--input is required");
+  }
+  if (opts.null_output && !opts.ring_socket.empty()) {
+    throw Error("--null and --ring-socket exclude each other");
+  }
+  return opts;
+}
+
+// The recording, mapped read-only for the whole run.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw_errno("Cannot open '" + path + "'");
+    }
+    struct stat st{};
+    if (fstat(fd, &st) < 0) {
+      int saved = errno;
+      close(fd);
+      errno = saved;
+      throw_errno("Cannot stat '" + path + "'");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+      close(fd);
+      throw Error("'" + path + "' is empty");
+    }
+    // Populated up front, so no run waits on the SD card mid-stream.
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw_errno("Cannot map '" + path + "'");
+    }
+    data_ = static_cast<const uint8_t *>(data);
+    madvise(const_cast<uint8_t *>(data_), size_, MADV_WILLNEED);
+  }
+
+  ~MappedFile() { munmap(const_cast<uint8_t *>(data_), size_); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+struct AccessUnit {
+  size_t offset = 0;
+  size_t size = 0;
+  bool keyframe = false;
+};
+
+// --record and the DVR write MPEG-TS; its PES headers would pass for NAL
+// units and its packet headers would end up inside the slices.
+bool looks_like_ts(const uint8_t *data, size_t size) {
+  if (size < kTsPacketSize * kTsProbePackets) {
+    return size >= 1 && size % kTsPacketSize == 0 && data[0] == kTsSyncByte;
+  }
+  for (size_t i = 0; i < kTsProbePackets; ++i) {
+    if (data[i * kTsPacketSize] != kTsSyncByte) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Access unit boundaries by the rule h264::AccessUnitAssembler uses, but as
+// offsets into the mapping so nothing is copied before the ring. The first
+// SPS yields the stream's frame rate.
+std::vector<AccessUnit> index_access_units(const uint8_t *data, size_t size, h264::SpsInfo &sps) {
+  std::vector<AccessUnit> units;
+  h264::NalReader reader(data, size);
+  h264::NalUnit nal;
+  bool has_vcl = false;
+  while (reader.next(nal)) {
+    const bool vcl = nal.type == h264::kNalSlice || nal.type == h264::kNalIdrSlice;
+    // first_mb_in_slice is ue(v); 0 codes as a single 1 bit.
+    const bool first_slice = vcl && nal.size > 1 && (nal.data[1] & 0x80) != 0;
+    const bool opens = first_slice || nal.type == h264::kNalAud || nal.type == h264::kNalSei ||
+                       nal.type == h264::kNalSps || nal.type == h264::kNalPps;
+    if (units.empty() || (has_vcl && opens)) {
+      if (!units.empty()) {
+        units.back().size = nal.start_code_offset - units.back().offset;
+      }
+      units.push_back({nal.start_code_offset, 0, false});
+      has_vcl = false;
+    }
+    has_vcl = has_vcl || vcl;
+    if (nal.type == h264::kNalIdrSlice) {
+      units.back().keyframe = true;
+    }
+    if (nal.type == h264::kNalSps && !sps.valid) {
+      h264::parse_sps(nal, sps);
+    }
+  }
+  if (!units.empty()) {
+    units.back().size = size - units.back().offset;
+  }
+  // Parameter sets or SEI left after the last picture are no access unit.
+  if (!units.empty() && !has_vcl) {
+    units.pop_back();
+  }
+  return units;
+}
+
+// The first IDR at or after `from`, wrapping around to the top of the file;
+// `units` has to hold one.
+size_t next_keyframe(const std::vector<AccessUnit> &units, size_t from) {
+  for (size_t i = 0; i < units.size(); ++i) {
+    const size_t index = (from + i) % units.size();
+    if (units[index].keyframe) {
+      return index;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+int run_replay(int argc, char **argv) {
+  ReplayOptions opts = parse_replay_options(argc, argv);
+  block_stop_signals();
+
+  MappedFile file(opts.input);
+  if (looks_like_ts(file.data(), file.size())) {
+    throw Error("'" + opts.input + "' is MPEG-TS; replay takes a raw H.264 stream (Annex B), e.g. from "
+                "'ffmpeg -i " + opts.input + " -c:v copy -f h264 out.h264'");
+  }
+  h264::SpsInfo sps;
+  const std::vector<AccessUnit> units = index_access_units(file.data(), file.size(), sps);
+  if (std::none_of(units.begin(), units.end(), [](const AccessUnit &unit) { return unit.keyframe; })) {
+    throw Error("'" + opts.input + "' holds no H.264 IDR picture");
+  }
+  const size_t first = next_keyframe(units, 0);
+  double framerate = opts.framerate;
+  const char *rate_source = "--framerate";
+  if (framerate == 0) {
+    framerate = sps.framerate > 0 ? sps.framerate : kDefaultFramerate;
+    rate_source = sps.framerate > 0 ? "the stream's timing info" : "the default, the stream has no timing info";
+  }
+  // For picam.sh, which hands the rate on to the stages behind the ring.
+  if (opts.print_framerate) {
+    std::printf("%ld\n", std::lround(framerate));
+    return 0;
+  }
+  const uint64_t interval_ns = static_cast<uint64_t>(1e9 / framerate + 0.5);
+  std::fprintf(stderr, "picam-native: Replaying %s: %zu access units, %zu IDR, %.1f MiB at %.2f fps (%s)\n",
+               opts.input.c_str(), units.size(),
+               static_cast<size_t>(std::count_if(units.begin(), units.end(),
+                                                 [](const AccessUnit &unit) { return unit.keyframe; })),
+               file.size() / 1048576.0, framerate, rate_source);
+
+  std::unique_ptr<FrameSink> sink;
+  RingSink *ring_sink = nullptr;
+  if (opts.null_output) {
+    sink = std::make_unique<NullSink>();
+  } else if (!opts.ring_socket.empty()) {
+    auto owned = std::make_unique<RingSink>(opts.ring_socket, static_cast<size_t>(opts.ring_size_mib) << 20);
+    ring_sink = owned.get();
+    sink = std::move(owned);
+  } else {
+    sink = std::make_unique<FdSink>(opts.output);
+  }
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, static_cast<unsigned>(framerate + 0.5), Codec::kH264);
+  }
+
+  // A consumer reads from the ring's head on. The first one is waited for,
+  // so every run starts at the top of the file; any later one is served
+  // from the next IDR instead of the rest of the GOP, as with capture.
+  std::atomic<bool> attached{ring_sink == nullptr};
+  std::atomic<bool> seek_keyframe{false};
+  struct DetachReplay {
+    RingSink *sink;
+    ~DetachReplay() {
+      if (sink) {
+        sink->set_on_attach(nullptr);
+      }
+    }
+  } detach_replay{ring_sink};
+  if (ring_sink) {
+    ring_sink->set_on_attach([&attached, &seek_keyframe] {
+      if (attached.exchange(true)) {
+        seek_keyframe.store(true);
+      }
+    });
+    std::fprintf(stderr, "picam-native: Waiting for a consumer on %s\n", opts.ring_socket.c_str());
+    while (!attached.load() && !wait_for_stop_until(monotonic_ns() + 50000000ull)) {
+    }
+  }
+
+  std::vector<uint8_t> sei_messages;
+  std::vector<uint8_t> stamped;
+  uint64_t published = 0;
+  uint64_t late = 0;
+  uint64_t max_late_ns = 0;
+  unsigned loop = 0;
+  size_t index = first;
+  const uint64_t start_ns = monotonic_ns();
+  uint64_t deadline_ns = start_ns;
+  while (attached.load() && !wait_for_stop_until(deadline_ns)) {
+    if (seek_keyframe.exchange(false)) {
+      index = next_keyframe(units, index);
+    }
+    // Lateness is what the sink's back-pressure (a FIFO, say) did to the schedule.
+    const uint64_t now_ns = monotonic_ns();
+    if (now_ns > deadline_ns) {
+      max_late_ns = std::max(max_late_ns, now_ns - deadline_ns);
+      if (now_ns - deadline_ns >= interval_ns) {
+        ++late;
+      }
+    }
+
+    const AccessUnit &unit = units[index];
+    EncodedFrame frame;
+    frame.data = file.data() + unit.offset;
+    frame.size = unit.size;
+    // Stamped with the schedule, like a sensor timestamp, so the stages
+    // behind see an even cadence and measure their latency from it.
+    frame.timestamp_us = static_cast<int64_t>(deadline_ns / 1000);
+    frame.keyframe = unit.keyframe;
+    if (opts.latency_sei) {
+      // Capture and encode collapse into the schedule; what the stages
+      // behind add is measured as it is for the camera.
+      LatencyStamp stamp;
+      stamp.sensor_ns = deadline_ns;
+      stamp.delivered_ns = deadline_ns;
+      stamp.encoded_ns = monotonic_ns();
+      sei_messages.clear();
+      append_latency_sei(sei_messages, stamp);
+      h264::insert_sei(frame.data, frame.size, sei_messages, stamped);
+      frame.data = stamped.data();
+      frame.size = stamped.size();
+    }
+    if (monitor) {
+      monitor->access_unit(frame.data, frame.size, frame.timestamp_us);
+    }
+    sink->write(frame);
+    ++published;
+
+    if (++index == units.size()) {
+      index = first;
+      if (++loop == opts.loops) {
+        break;
+      }
+    }
+    deadline_ns += interval_ns;
+  }
+
+  const double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+  std::fprintf(stderr,
+               "picam-native: %" PRIu64 " access units replayed in %.1f s (%.2f fps), %" PRIu64
+               " late by a frame interval or more, worst %.1f ms\n",
+               published, elapsed_s, elapsed_s > 0 ? published / elapsed_s : 0.0, late, max_late_ns / 1e6);
+  return 0;
+}
+
+} // namespace picam
@@ -0,0 +1,226 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "codec.hpp"
+#include "commands.hpp"
+#include "event_recorder.hpp"
+#include "fd_sink.hpp"
+#include "ring_socket.hpp"
+#include "segment_recorder.hpp"
+#include "shm_ring.hpp"
+#include "stream_monitor.hpp"
+#include "trace.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kConnectTimeoutMs = 10000;
+constexpr int kPipeSize = 1 << 20;
+
+struct RingCatOptions {
+  std::string socket_path;
+  std::string output = "-";
+  std::string counters;
+  unsigned framerate = 30;
+  Codec codec = Codec::kH264;
+  std::string record_dir;
+  unsigned segment_seconds = 60;
+  EventConfig dvr;
+};
+
+void ring_cat_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native ring-cat --socket <path> [options]\n"
+               "\n"
+               "Options:\n"
+               "      --socket <path>         Ring socket created by 'capture --ring-socket'\n"
+               "  -o, --output <path>         Output file or FIFO, '-' for stdout (default: -)\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --framerate <fps>       Nominal frame rate for drop detection (default: 30)\n"
+               "      --codec <name>          What the ring carries: h264, mjpeg or yuv, as given to\n"
+               "                              'capture --codec' (default: h264; --record and --dvr need it)\n"
+               "      --record <dir>          Also record IDR-aligned MPEG-TS segments into this directory\n"
+               "      --segment <seconds>     Segment length for --record (default: 60)\n"
+               "      --dvr <dir>             Keep the last --pre-event seconds in RAM and save them, plus\n"
+               "                              --post-event seconds, into this directory on SIGUSR1 or GPIO\n"
+               "      --pre-event <seconds>   Stream kept before the trigger (default: 10)\n"
+               "      --post-event <seconds>  Stream saved after the last trigger (default: 10)\n"
+               "      --dvr-arena <MiB>       Fixed memory for the pre-event GOPs (default: 32)\n"
+               "      --trigger-gpio <path>   sysfs GPIO value file whose rising edge saves an event\n"
+               "      --motion-trigger        Save an event while 'capture --motion' reports motion\n");
+}
+
+RingCatOptions parse_ring_cat_options(int argc, char **argv) {
+  enum { kSocket = 256, kCounters, kFramerate, kRecord, kSegment, kDvr, kPreEvent, kPostEvent, kDvrArena, kTriggerGpio,
+         kMotionTrigger, kCodec };
+  static const option long_options[] = {
+      {"socket", required_argument, nullptr, kSocket},
+      {"counters", required_argument, nullptr, kCounters},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"record", required_argument, nullptr, kRecord},
+      {"segment", required_argument, nullptr, kSegment},
+      {"dvr", required_argument, nullptr, kDvr},
+      {"pre-event", required_argument, nullptr, kPreEvent},
+      {"post-event", required_argument, nullptr, kPostEvent},
+      {"dvr-arena", required_argument, nullptr, kDvrArena},
+      {"trigger-gpio", required_argument, nullptr, kTriggerGpio},
+      {"motion-trigger", no_argument, nullptr, kMotionTrigger},
+      {"codec", required_argument, nullptr, kCodec},
+      {"output", required_argument, nullptr, 'o'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  RingCatOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kSocket:
+      opts.socket_path = optarg;
+      break;
+    case 'o':
+      opts.output = optarg;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kRecord:
+      opts.record_dir = optarg;
+      break;
+    case kSegment:
+      opts.segment_seconds = parse_unsigned(optarg, "segment length");
+      break;
+    case kDvr:
+      opts.dvr.directory = optarg;
+      break;
+    case kPreEvent:
+      opts.dvr.pre_seconds = parse_unsigned(optarg, "pre-event length");
+      break;
+    case kPostEvent:
+      opts.dvr.post_seconds = parse_unsigned(optarg, "post-event length");
+      break;
+    case kDvrArena:
+      opts.dvr.arena_bytes = static_cast<size_t>(parse_unsigned(optarg, "DVR arena size")) << 20;
+      break;
+    case kTriggerGpio:
+      opts.dvr.trigger_gpio = optarg;
+      break;
+    case kMotionTrigger:
+      opts.dvr.motion_trigger = true;
+      break;
+    case kCodec:
+      opts.codec = parse_codec(optarg);
+      break;
+    case 'h':
+      ring_cat_usage();
+      std::exit(0);
+    default:
+      ring_cat_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.socket_path.empty()) {
+    throw Error("--socket is required");
+  }
+  if (opts.dvr.motion_trigger && opts.dvr.directory.empty()) {
+    throw Error("--motion-trigger requires --dvr");
+  }
+  if (opts.codec != Codec::kH264 && (!opts.record_dir.empty() || !opts.dvr.directory.empty())) {
+    throw Error("--record and --dvr mux H.264; they need --codec h264");
+  }
+  if (opts.dvr.arena_bytes == 0) {
+    throw Error("DVR arena size must be greater than zero");
+  }
+  opts.dvr.framerate = opts.framerate;
+  return opts;
+}
+
+} // namespace
+
+int run_ring_cat(int argc, char **argv) {
+  RingCatOptions opts = parse_ring_cat_options(argc, argv);
+  block_stop_signals();
+  if (!opts.dvr.directory.empty()) {
+    block_event_signal();
+  }
+
+  RingConnection connection = connect_ring(opts.socket_path, kConnectTimeoutMs);
+  ShmRing ring = ShmRing::attach(connection.ring_fd);
+  notify_ring_attached(connection.socket_fd, opts.record_dir.empty() ? 0u : kRingFollowsRecord);
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, opts.framerate, opts.codec);
+  }
+  std::unique_ptr<SegmentRecorder> recorder;
+  if (!opts.record_dir.empty()) {
+    recorder = std::make_unique<SegmentRecorder>(opts.record_dir, opts.segment_seconds);
+  }
+  std::unique_ptr<EventRecorder> dvr;
+  if (!opts.dvr.directory.empty()) {
+    dvr = std::make_unique<EventRecorder>(opts.dvr);
+  }
+
+  FdSink sink(opts.output);
+  if (opts.output == "-") {
+    // Fewer, larger wakeups for ffmpeg; ignored when stdout is not a pipe.
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, kPipeSize);
+  }
+
+  while (!stop_pending()) {
+    RingRecord record;
+    RingStatus status = ring.next(record, 200);
+    if (status == RingStatus::kClosed) {
+      break;
+    }
+    if (status == RingStatus::kTimeout) {
+      if (ring_peer_gone(connection.socket_fd)) {
+        break;
+      }
+      continue;
+    }
+
+    EncodedFrame frame;
+    frame.data = record.data;
+    frame.size = record.size;
+    frame.timestamp_us = record.timestamp_us;
+    frame.keyframe = record.keyframe;
+    // Blocks while ffmpeg, which decodes and presents, is behind.
+    const uint64_t write_start_ns = tracing_enabled() ? monotonic_ns() : 0;
+    sink.write(frame);
+    if (write_start_ns > 0) {
+      trace_slice("fifo-write", write_start_ns, monotonic_ns(), frame.timestamp_us);
+    }
+    if (recorder) {
+      follow_record_message(read_ring_message(connection.socket_fd), *recorder);
+      recorder->write(frame);
+    }
+    if (dvr) {
+      dvr->write(frame);
+    }
+    if (monitor) {
+      if (recorder) {
+        monitor->set_recording(recorder->status());
+      }
+      monitor->access_unit(record.data, record.size, record.timestamp_us);
+    }
+    ring.consume(record);
+  }
+
+  close(connection.socket_fd);
+  return 0;
+}
+
+} // namespace picam
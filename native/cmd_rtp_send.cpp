@@ -0,0 +1,246 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "ring_socket.hpp"
+#include "rtp_sender.hpp"
+#include "segment_recorder.hpp"
+#include "shm_ring.hpp"
+#include "stream_monitor.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kConnectTimeoutMs = 10000;
+constexpr uint64_t kProgressIntervalNs = 1000000000ull;
+
+struct RtpSendOptions {
+  std::string socket_path;
+  RtpConfig rtp;
+  std::string sdp_path;
+  std::string counters;
+  unsigned framerate = 30;
+  std::string record_dir;
+  unsigned segment_seconds = 60;
+};
+
+void rtp_send_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native rtp-send --socket <path> --dest <host:port> [options]\n"
+               "\n"
+               "Sends the ring's access units as RTP (RFC 6184, packetization-mode=1) over UDP.\n"
+               "\n"
+               "Options:\n"
+               "      --socket <path>         Ring socket created by 'capture --ring-socket'\n"
+               "      --dest <host:port>      Receiver address; IPv6 as [addr]:port\n"
+               "      --packet-size <bytes>   Largest UDP payload including the RTP header (default: 1400)\n"
+               "      --payload-type <n>      RTP payload type (default: 96)\n"
+               "      --pace <bits>           Spread packets out to at most this many bits per second\n"
+               "                              (default: 0, send each frame at once)\n"
+               "      --no-gso                Do not batch fragments with UDP GSO\n"
+               "      --sdp <path>            Write a session description for the receiver\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --framerate <fps>       Nominal frame rate for drop detection (default: 30)\n"
+               "      --record <dir>          Also record IDR-aligned MPEG-TS segments into this directory\n"
+               "      --segment <seconds>     Segment length for --record (default: 60)\n");
+}
+
+void parse_destination(const std::string &dest, RtpConfig &rtp) {
+  size_t colon = dest.rfind(':');
+  if (colon == std::string::npos || colon == 0 || colon + 1 == dest.size()) {
+    throw Error("Invalid destination '" + dest + "'. Use host:port.");
+  }
+  std::string host = dest.substr(0, colon);
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  unsigned port = parse_unsigned(dest.c_str() + colon + 1, "port");
+  if (port == 0 || port > 65535) {
+    throw Error("Port must be between 1 and 65535");
+  }
+  rtp.host = host;
+  rtp.port = static_cast<uint16_t>(port);
+}
+
+RtpSendOptions parse_rtp_send_options(int argc, char **argv) {
+  enum { kSocket = 256, kDest, kPacketSize, kPayloadType, kPace, kNoGso, kSdp, kCounters, kFramerate, kRecord, kSegment };
+  static const option long_options[] = {
+      {"socket", required_argument, nullptr, kSocket},
+      {"dest", required_argument, nullptr, kDest},
+      {"packet-size", required_argument, nullptr, kPacketSize},
+      {"payload-type", required_argument, nullptr, kPayloadType},
+      {"pace", required_argument, nullptr, kPace},
+      {"no-gso", no_argument, nullptr, kNoGso},
+      {"sdp", required_argument, nullptr, kSdp},
+      {"counters", required_argument, nullptr, kCounters},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"record", required_argument, nullptr, kRecord},
+      {"segment", required_argument, nullptr, kSegment},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  RtpSendOptions opts;
+  unsigned payload_type = opts.rtp.payload_type;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kSocket:
+      opts.socket_path = optarg;
+      break;
+    case kDest:
+      parse_destination(optarg, opts.rtp);
+      break;
+    case kPacketSize:
+      opts.rtp.packet_size = parse_unsigned(optarg, "packet size");
+      break;
+    case kPayloadType:
+      payload_type = parse_unsigned(optarg, "payload type");
+      break;
+    case kPace:
+      opts.rtp.pace_bps = parse_unsigned(optarg, "pacing rate");
+      break;
+    case kNoGso:
+      opts.rtp.gso = false;
+      break;
+    case kSdp:
+      opts.sdp_path = optarg;
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kRecord:
+      opts.record_dir = optarg;
+      break;
+    case kSegment:
+      opts.segment_seconds = parse_unsigned(optarg, "segment length");
+      break;
+    case 'h':
+      rtp_send_usage();
+      std::exit(0);
+    default:
+      rtp_send_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.socket_path.empty()) {
+    throw Error("--socket is required");
+  }
+  if (opts.rtp.host.empty()) {
+    throw Error("--dest is required");
+  }
+  // 96-127 is the dynamic range; anything below clashes with static types.
+  if (payload_type < 96 || payload_type > 127) {
+    throw Error("Payload type must be between 96 and 127");
+  }
+  opts.rtp.payload_type = static_cast<uint8_t>(payload_type);
+  return opts;
+}
+
+void write_sdp(const std::string &path, const std::string &sdp) {
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw_errno("Cannot write SDP file '" + path + "'");
+  }
+  std::fputs(sdp.c_str(), file);
+  if (std::fclose(file) != 0) {
+    throw_errno("Cannot write SDP file '" + path + "'");
+  }
+}
+
+} // namespace
+
+int run_rtp_send(int argc, char **argv) {
+  RtpSendOptions opts = parse_rtp_send_options(argc, argv);
+  block_stop_signals();
+
+  RtpSender sender(opts.rtp);
+  if (!opts.sdp_path.empty()) {
+    write_sdp(opts.sdp_path, sender.sdp());
+  }
+  std::fprintf(stderr, "picam-native: RTP to %s:%u, UDP GSO %s, pacing %s\n", opts.rtp.host.c_str(),
+               opts.rtp.port, sender.gso_active() ? "on" : "off", opts.rtp.pace_bps ? "on" : "off");
+
+  RingConnection connection = connect_ring(opts.socket_path, kConnectTimeoutMs);
+  ShmRing ring = ShmRing::attach(connection.ring_fd);
+  notify_ring_attached(connection.socket_fd, opts.record_dir.empty() ? 0u : kRingFollowsRecord);
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, opts.framerate);
+  }
+  std::unique_ptr<SegmentRecorder> recorder;
+  if (!opts.record_dir.empty()) {
+    recorder = std::make_unique<SegmentRecorder>(opts.record_dir, opts.segment_seconds);
+  }
+
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t last_frames = 0;
+  uint64_t last_bytes = 0;
+  uint64_t last_progress = monotonic_ns();
+  while (!stop_pending()) {
+    RingRecord record;
+    RingStatus status = ring.next(record, 200);
+    if (status == RingStatus::kClosed) {
+      break;
+    }
+    if (status == RingStatus::kTimeout) {
+      if (ring_peer_gone(connection.socket_fd)) {
+        break;
+      }
+      continue;
+    }
+
+    // Sent straight out of the ring; the record is only released afterwards.
+    sender.send_access_unit(record.data, record.size, record.timestamp_us);
+    if (recorder) {
+      EncodedFrame frame;
+      frame.data = record.data;
+      frame.size = record.size;
+      frame.timestamp_us = record.timestamp_us;
+      frame.keyframe = record.keyframe;
+      follow_record_message(read_ring_message(connection.socket_fd), *recorder);
+      recorder->write(frame);
+    }
+    if (monitor) {
+      if (recorder) {
+        monitor->set_recording(recorder->status());
+      }
+      monitor->access_unit(record.data, record.size, record.timestamp_us);
+    }
+    ++frames;
+    bytes += record.size;
+    ring.consume(record);
+
+    uint64_t now = monotonic_ns();
+    if (now - last_progress >= kProgressIntervalNs) {
+      double seconds = (now - last_progress) / 1e9;
+      std::fprintf(stderr, "frame=%6" PRIu64 " fps=%.1f bitrate=%.1fkbits/s pkts=%" PRIu64 " drop=%" PRIu64 "\r",
+                   frames, (frames - last_frames) / seconds, (bytes - last_bytes) * 8 / seconds / 1000.0,
+                   sender.packets_sent(), ring.dropped());
+      last_frames = frames;
+      last_bytes = bytes;
+      last_progress = now;
+    }
+  }
+
+  close(connection.socket_fd);
+  std::fprintf(stderr, "\npicam-native: %" PRIu64 " frames sent in %" PRIu64 " packets, %" PRIu64 " send errors\n",
+               frames, sender.packets_sent(), sender.send_errors());
+  return 0;
+}
+
+} // namespace picam
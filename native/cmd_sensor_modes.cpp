@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <getopt.h>
+
+#include <libcamera/libcamera.h>
+
+#include "commands.hpp"
+#include "sensor_modes.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+struct SensorModesOptions {
+  unsigned camera_index = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned framerate = 30;
+};
+
+void sensor_modes_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native sensor-modes [options]\n"
+               "\n"
+               "Lists the sensor's readout modes with their frame-rate ceiling, field of view and CSI-2 load.\n"
+               "\n"
+               "Options:\n"
+               "      --camera <index>        libcamera camera index (default: 0)\n"
+               "      --width <pixels>        With --height, mark the mode 'capture --sensor-mode auto' picks\n"
+               "      --height <pixels>\n"
+               "      --framerate <fps>       Frame rate the load is given for (default: 30)\n");
+}
+
+SensorModesOptions parse_sensor_modes_options(int argc, char **argv) {
+  enum { kCamera = 256, kWidth, kHeight, kFramerate };
+  static const option long_options[] = {
+      {"camera", required_argument, nullptr, kCamera},
+      {"width", required_argument, nullptr, kWidth},
+      {"height", required_argument, nullptr, kHeight},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  SensorModesOptions opts;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kCamera:
+      opts.camera_index = parse_unsigned(optarg, "camera index");
+      break;
+    case kWidth:
+      opts.width = parse_unsigned(optarg, "width");
+      break;
+    case kHeight:
+      opts.height = parse_unsigned(optarg, "height");
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case 'h':
+      sensor_modes_usage();
+      std::exit(0);
+    default:
+      sensor_modes_usage();
+      std::exit(1);
+    }
+  }
+
+  if ((opts.width == 0) != (opts.height == 0)) {
+    throw Error("--width and --height go together");
+  }
+  if (opts.framerate == 0) {
+    throw Error("Frame rate must be greater than zero");
+  }
+  return opts;
+}
+
+} // namespace
+
+int run_sensor_modes(int argc, char **argv) {
+  SensorModesOptions opts = parse_sensor_modes_options(argc, argv);
+
+  // The camera has to be released and dropped before the manager goes away.
+  struct Session {
+    libcamera::CameraManager manager;
+    std::shared_ptr<libcamera::Camera> camera;
+    bool acquired = false;
+    ~Session() {
+      if (acquired) {
+        camera->release();
+      }
+      camera.reset();
+    }
+  } session;
+  if (session.manager.start() < 0) {
+    throw Error("Failed to start the libcamera camera manager");
+  }
+  auto cameras = session.manager.cameras();
+  if (opts.camera_index >= cameras.size()) {
+    throw Error("Camera index " + std::to_string(opts.camera_index) + " is out of range (" +
+                std::to_string(cameras.size()) + " available)");
+  }
+  session.camera = cameras[opts.camera_index];
+  libcamera::Camera &camera = *session.camera;
+  if (camera.acquire() < 0) {
+    throw Error("Camera '" + camera.id() + "' is busy");
+  }
+  session.acquired = true;
+
+  std::vector<SensorMode> modes = list_sensor_modes(camera);
+  const SensorMode *chosen =
+      opts.width > 0 ? select_sensor_mode(modes, opts.width, opts.height, opts.framerate) : nullptr;
+  std::printf("Sensor modes of '%s' (CSI-2 load at %u fps):\n",
+              camera.properties().get(libcamera::properties::Model).value_or(camera.id()).c_str(), opts.framerate);
+  for (const auto &mode : modes) {
+    std::printf("%s %s; %.1f Mbit/s\n", &mode == chosen ? "*" : " ", describe_sensor_mode(mode).c_str(),
+                csi_bitrate(mode, opts.framerate) / 1e6);
+  }
+  return 0;
+}
+
+} // namespace picam
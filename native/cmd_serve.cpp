@@ -0,0 +1,222 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "ring_socket.hpp"
+#include "segment_recorder.hpp"
+#include "shm_ring.hpp"
+#include "stream_monitor.hpp"
+#include "stream_server.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kConnectTimeoutMs = 10000;
+constexpr uint64_t kProgressIntervalNs = 1000000000ull;
+// Longest wait for a frame before the sockets are serviced anyway.
+constexpr int kServiceIntervalMs = 20;
+constexpr unsigned kBacklogSeconds = 2;
+
+struct ServeOptions {
+  std::string socket_path;
+  StreamServerConfig server;
+  std::string counters;
+  unsigned framerate = 30;
+  std::string record_dir;
+  unsigned segment_seconds = 60;
+};
+
+void serve_usage() {
+  std::fprintf(stderr,
+               "Usage: picam-native serve --socket <path> [options]\n"
+               "\n"
+               "Serves the ring's stream to many HTTP viewers at once as MPEG-TS, from one encode.\n"
+               "\n"
+               "Options:\n"
+               "      --socket <path>         Ring socket created by 'capture --ring-socket'\n"
+               "      --listen <[host:]port>  Address to listen on; IPv6 as [addr]:port (default: 8080)\n"
+               "      --max-clients <n>       Viewers served at once; more get 503 (default: 10)\n"
+               "      --backlog <frames>      Frames buffered for slow viewers before they skip to the\n"
+               "                              next IDR (default: two seconds' worth)\n"
+               "      --counters <path>       Count frames, drops and GOP bitrate into this counter block\n"
+               "      --framerate <fps>       Nominal frame rate for drop detection (default: 30)\n"
+               "      --record <dir>          Also record IDR-aligned MPEG-TS segments into this directory\n"
+               "      --segment <seconds>     Segment length for --record (default: 60)\n");
+}
+
+void parse_listen(const std::string &listen, StreamServerConfig &server) {
+  size_t colon = listen.rfind(':');
+  std::string host;
+  std::string port = listen;
+  if (colon != std::string::npos) {
+    host = listen.substr(0, colon);
+    port = listen.substr(colon + 1);
+  }
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  unsigned value = parse_unsigned(port.c_str(), "port");
+  if (value == 0 || value > 65535) {
+    throw Error("Port must be between 1 and 65535");
+  }
+  server.host = host;
+  server.port = static_cast<uint16_t>(value);
+}
+
+ServeOptions parse_serve_options(int argc, char **argv) {
+  enum { kSocket = 256, kListen, kMaxClients, kBacklog, kCounters, kFramerate, kRecord, kSegment };
+  static const option long_options[] = {
+      {"socket", required_argument, nullptr, kSocket},
+      {"listen", required_argument, nullptr, kListen},
+      {"max-clients", required_argument, nullptr, kMaxClients},
+      {"backlog", required_argument, nullptr, kBacklog},
+      {"counters", required_argument, nullptr, kCounters},
+      {"framerate", required_argument, nullptr, kFramerate},
+      {"record", required_argument, nullptr, kRecord},
+      {"segment", required_argument, nullptr, kSegment},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  ServeOptions opts;
+  opts.server.backlog_frames = 0;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+    switch (opt) {
+    case kSocket:
+      opts.socket_path = optarg;
+      break;
+    case kListen:
+      parse_listen(optarg, opts.server);
+      break;
+    case kMaxClients:
+      opts.server.max_clients = parse_unsigned(optarg, "client limit");
+      break;
+    case kBacklog:
+      opts.server.backlog_frames = parse_unsigned(optarg, "backlog");
+      break;
+    case kCounters:
+      opts.counters = optarg;
+      break;
+    case kFramerate:
+      opts.framerate = parse_unsigned(optarg, "framerate");
+      break;
+    case kRecord:
+      opts.record_dir = optarg;
+      break;
+    case kSegment:
+      opts.segment_seconds = parse_unsigned(optarg, "segment length");
+      break;
+    case 'h':
+      serve_usage();
+      std::exit(0);
+    default:
+      serve_usage();
+      std::exit(1);
+    }
+  }
+
+  if (opts.socket_path.empty()) {
+    throw Error("--socket is required");
+  }
+  if (opts.server.max_clients == 0) {
+    throw Error("Client limit must be greater than zero");
+  }
+  if (opts.server.backlog_frames == 0) {
+    opts.server.backlog_frames = opts.framerate * kBacklogSeconds;
+  }
+  return opts;
+}
+
+} // namespace
+
+int run_serve(int argc, char **argv) {
+  ServeOptions opts = parse_serve_options(argc, argv);
+  block_stop_signals();
+
+  StreamServer server(opts.server);
+  std::fprintf(stderr, "picam-native: Serving http://%s/stream.ts to up to %u viewers\n", server.address().c_str(),
+               opts.server.max_clients);
+
+  RingConnection connection = connect_ring(opts.socket_path, kConnectTimeoutMs);
+  ShmRing ring = ShmRing::attach(connection.ring_fd);
+  notify_ring_attached(connection.socket_fd, opts.record_dir.empty() ? 0u : kRingFollowsRecord);
+
+  std::unique_ptr<StreamMonitor> monitor;
+  if (!opts.counters.empty()) {
+    monitor = std::make_unique<StreamMonitor>(opts.counters, opts.framerate);
+  }
+  std::unique_ptr<SegmentRecorder> recorder;
+  if (!opts.record_dir.empty()) {
+    recorder = std::make_unique<SegmentRecorder>(opts.record_dir, opts.segment_seconds);
+  }
+
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t last_frames = 0;
+  uint64_t last_bytes = 0;
+  uint64_t last_progress = monotonic_ns();
+  while (!stop_pending()) {
+    RingRecord record;
+    RingStatus status = ring.next(record, kServiceIntervalMs);
+    if (status == RingStatus::kClosed) {
+      break;
+    }
+    if (status == RingStatus::kRecord) {
+      EncodedFrame frame;
+      frame.data = record.data;
+      frame.size = record.size;
+      frame.timestamp_us = record.timestamp_us;
+      frame.keyframe = record.keyframe;
+      // Muxed once into the server's pool; the ring record is released right after.
+      server.write(frame);
+      if (recorder) {
+        follow_record_message(read_ring_message(connection.socket_fd), *recorder);
+        recorder->write(frame);
+      }
+      if (monitor) {
+        if (recorder) {
+          monitor->set_recording(recorder->status());
+        }
+        monitor->access_unit(record.data, record.size, record.timestamp_us);
+      }
+      ++frames;
+      bytes += record.size;
+      ring.consume(record);
+    } else if (ring_peer_gone(connection.socket_fd)) {
+      break;
+    }
+    server.service();
+
+    uint64_t now = monotonic_ns();
+    if (now - last_progress >= kProgressIntervalNs) {
+      double seconds = (now - last_progress) / 1e9;
+      const StreamServerStats &stats = server.stats();
+      std::fprintf(stderr,
+                   "frame=%6" PRIu64 " fps=%.1f bitrate=%.1fkbits/s clients=%u skips=%" PRIu64 " drop=%" PRIu64 "\r",
+                   frames, (frames - last_frames) / seconds, (bytes - last_bytes) * 8 / seconds / 1000.0,
+                   stats.clients, stats.skips, ring.dropped());
+      last_frames = frames;
+      last_bytes = bytes;
+      last_progress = now;
+    }
+  }
+
+  close(connection.socket_fd);
+  const StreamServerStats &stats = server.stats();
+  std::fprintf(stderr,
+               "\npicam-native: %" PRIu64 " frames served to %" PRIu64 " viewers, %" PRIu64 " skips, %" PRIu64
+               " refused\n",
+               frames, stats.served, stats.skips, stats.refused);
+  return 0;
+}
+
+} // namespace picam
@@ -0,0 +1,76 @@
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "util.hpp"
+
+namespace picam {
+
+Codec parse_codec(const std::string &name) {
+  if (name == "h264") {
+    return Codec::kH264;
+  }
+  if (name == "mjpeg") {
+    return Codec::kMjpeg;
+  }
+  if (name == "yuv") {
+    return Codec::kYuv420;
+  }
+  throw Error("Unknown codec '" + name + "'; use h264, mjpeg or yuv");
+}
+
+const char *codec_name(Codec codec) {
+  switch (codec) {
+  case Codec::kMjpeg:
+    return "mjpeg";
+  case Codec::kYuv420:
+    return "yuv";
+  case Codec::kH264:
+    break;
+  }
+  return "h264";
+}
+
+H264Profile parse_h264_profile(const std::string &name) {
+  if (name == "baseline") {
+    return H264Profile::kBaseline;
+  }
+  if (name == "main") {
+    return H264Profile::kMain;
+  }
+  if (name == "high") {
+    return H264Profile::kHigh;
+  }
+  throw Error("Unknown H.264 profile '" + name + "'; use baseline, main or high");
+}
+
+const char *h264_profile_name(H264Profile profile) {
+  switch (profile) {
+  case H264Profile::kBaseline:
+    return "baseline";
+  case H264Profile::kMain:
+    return "main";
+  case H264Profile::kHigh:
+    break;
+  }
+  return "high";
+}
+
+unsigned parse_h264_level(const std::string &name) {
+  static const unsigned kLevels[] = {10, 11, 12, 13, 20, 21, 22, 30, 31, 32, 40, 41, 42};
+  std::string digits = name;
+  digits.erase(std::remove(digits.begin(), digits.end(), '.'), digits.end());
+  char *end = nullptr;
+  unsigned long level = std::strtoul(digits.c_str(), &end, 10);
+  if (name.find('.') == std::string::npos && level < 10) {
+    level *= 10;
+  }
+  if (!digits.empty() && *end == '\0' &&
+      std::find(std::begin(kLevels), std::end(kLevels), level) != std::end(kLevels)) {
+    return static_cast<unsigned>(level);
+  }
+  throw Error("Unknown H.264 level '" + name + "'; use 1.0 to 4.2, e.g. 4.1");
+}
+
+} // namespace picam
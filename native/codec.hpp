@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+namespace picam {
+
+// What the capture pipeline puts into its sink, ring or file. H.264 is the
+// default; MJPEG and raw YUV420 exist to weigh the encode against what it
+// saves in bandwidth.
+enum class Codec {
+  kH264,
+  kMjpeg,
+  // Packed I420 (no row padding), one picture per record.
+  kYuv420,
+};
+
+// "h264", "mjpeg" or "yuv"; throws Error for anything else.
+Codec parse_codec(const std::string &name);
+const char *codec_name(Codec codec);
+
+enum class H264Profile {
+  kBaseline,
+  kMain,
+  kHigh,
+};
+
+// "baseline", "main" or "high"; throws Error for anything else.
+H264Profile parse_h264_profile(const std::string &name);
+const char *h264_profile_name(H264Profile profile);
+// "4.1" or "41" as tenths (41), for the levels 1.0 to 4.2 the Pi's encoder
+// can be asked for; throws Error for anything else.
+unsigned parse_h264_level(const std::string &name);
+
+// Every picture stands on its own: no GOP, no frame_num to follow, and a
+// consumer may start at any record.
+inline bool codec_intra_only(Codec codec) {
+  return codec != Codec::kH264;
+}
+
+} // namespace picam
@@ -0,0 +1,16 @@
+#pragma once
+
+namespace picam {
+
+int run_capture(int argc, char **argv);
+int run_ring_cat(int argc, char **argv);
+int run_metrics(int argc, char **argv);
+int run_drm_preview(int argc, char **argv);
+int run_h264_tap(int argc, char **argv);
+int run_rtp_send(int argc, char **argv);
+int run_serve(int argc, char **argv);
+int run_sensor_modes(int argc, char **argv);
+int run_control(int argc, char **argv);
+int run_replay(int argc, char **argv);
+
+} // namespace picam
@@ -0,0 +1,182 @@
+#include "control_socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr size_t kMaxClients = 4;
+// Longest request; a client sending more without a newline is dropped.
+constexpr size_t kMaxLine = 512;
+
+sockaddr_un make_address(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw Error("Socket path '" + path + "' is too long");
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+bool send_all(int fd, const std::string &text) {
+  size_t sent = 0;
+  while (sent < text.size()) {
+    ssize_t ret = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(ret);
+  }
+  return true;
+}
+
+} // namespace
+
+ControlServer::ControlServer(const std::string &path, Handler handler) : path_(path), handler_(std::move(handler)) {
+  sockaddr_un addr = make_address(path);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    throw_errno("Cannot create control socket");
+  }
+  unlink(path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(listen_fd_, 4) < 0) {
+    int saved = errno;
+    close(listen_fd_);
+    errno = saved;
+    throw_errno("Cannot listen on '" + path + "'");
+  }
+  thread_ = std::thread(&ControlServer::run, this);
+}
+
+ControlServer::~ControlServer() {
+  abort_ = true;
+  thread_.join();
+  for (const Client &client : clients_) {
+    close(client.fd);
+  }
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+void ControlServer::run() {
+  std::vector<pollfd> pfds;
+  while (!abort_) {
+    pfds.assign(1, {listen_fd_, POLLIN, 0});
+    for (const Client &client : clients_) {
+      pfds.push_back({client.fd, POLLIN, 0});
+    }
+    if (poll(pfds.data(), pfds.size(), 200) <= 0) {
+      continue;
+    }
+    for (size_t i = clients_.size(); i-- > 0;) {
+      if (pfds[i + 1].revents && !serve(clients_[i])) {
+        close(clients_[i].fd);
+        clients_.erase(clients_.begin() + static_cast<long>(i));
+      }
+    }
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+      if (clients_.size() >= kMaxClients) {
+        send_all(fd, "error too many control clients\n");
+        close(fd);
+        continue;
+      }
+      clients_.push_back({fd, {}});
+    }
+  }
+}
+
+bool ControlServer::serve(Client &client) {
+  char buf[256];
+  ssize_t len = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+  if (len < 0) {
+    return errno == EAGAIN || errno == EINTR;
+  }
+  if (len == 0) {
+    return false;
+  }
+  client.pending.append(buf, static_cast<size_t>(len));
+  size_t newline;
+  while ((newline = client.pending.find('\n')) != std::string::npos) {
+    std::string command = client.pending.substr(0, newline);
+    client.pending.erase(0, newline + 1);
+    if (!command.empty() && command.back() == '\r') {
+      command.pop_back();
+    }
+    std::string reply;
+    try {
+      reply = handler_(command);
+    } catch (const std::exception &e) {
+      reply = std::string("error ") + e.what();
+    }
+    if (!send_all(client.fd, reply + "\n")) {
+      return false;
+    }
+  }
+  if (client.pending.size() > kMaxLine) {
+    send_all(client.fd, "error request too long\n");
+    return false;
+  }
+  return true;
+}
+
+std::string send_control_command(const std::string &path, const std::string &command, int timeout_ms) {
+  sockaddr_un addr = make_address(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw_errno("Cannot create control socket");
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    throw_errno("Cannot connect to control socket '" + path + "'");
+  }
+  if (!send_all(fd, command + "\n")) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    throw_errno("Cannot send to control socket '" + path + "'");
+  }
+
+  std::string reply;
+  const uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ull;
+  while (reply.find('\n') == std::string::npos) {
+    const uint64_t now = monotonic_ns();
+    pollfd pfd{fd, POLLIN, 0};
+    if (now >= deadline || poll(&pfd, 1, static_cast<int>((deadline - now) / 1000000) + 1) == 0) {
+      close(fd);
+      throw Error("No reply from control socket '" + path + "'");
+    }
+    char buf[256];
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      close(fd);
+      throw Error("Control socket '" + path + "' closed without a reply");
+    }
+    reply.append(buf, static_cast<size_t>(len));
+  }
+  close(fd);
+  return reply.substr(0, reply.find('\n'));
+}
+
+} // namespace picam
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace picam {
+
+// Control socket of a running capture. Requests are single lines of text
+// and every one gets a single line back, starting with "ok" or "error", so
+// a client may keep the connection open for a series of commands or use
+// one per command. A few clients are served at once; commands run one at a
+// time on the server thread.
+class ControlServer {
+public:
+  using Handler = std::function<std::string(const std::string &command)>;
+
+  // Throws when the socket cannot be created.
+  ControlServer(const std::string &path, Handler handler);
+  ~ControlServer();
+
+  ControlServer(const ControlServer &) = delete;
+  ControlServer &operator=(const ControlServer &) = delete;
+
+private:
+  struct Client {
+    int fd = -1;
+    std::string pending;
+  };
+
+  void run();
+  // False once the client has to be dropped.
+  bool serve(Client &client);
+
+  std::string path_;
+  Handler handler_;
+  int listen_fd_ = -1;
+  std::vector<Client> clients_;
+  std::atomic<bool> abort_{false};
+  std::thread thread_;
+};
+
+// Sends one command and returns the reply without its newline. Throws when
+// the socket does not answer within timeout_ms.
+std::string send_control_command(const std::string &path, const std::string &command, int timeout_ms);
+
+} // namespace picam
@@ -0,0 +1,385 @@
+#include "drm_display.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <drm_fourcc.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kMaxCards = 8;
+
+uint64_t object_property(int fd, uint32_t object, uint32_t type, const char *name, uint32_t *prop_id) {
+  uint64_t value = 0;
+  drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object, type);
+  if (!props) {
+    return value;
+  }
+  for (uint32_t i = 0; i < props->count_props; ++i) {
+    drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+    if (prop && std::strcmp(prop->name, name) == 0) {
+      value = props->prop_values[i];
+      if (prop_id) {
+        *prop_id = prop->prop_id;
+      }
+    }
+    drmModeFreeProperty(prop);
+  }
+  drmModeFreeObjectProperties(props);
+  return value;
+}
+
+bool open_card(const std::string &path, KmsOutput &output) {
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+  // GPU-only nodes (v3d on the Pi) expose no KMS resources at all.
+  drmModeRes *res = drmModeGetResources(fd);
+  if (!res) {
+    close(fd);
+    return false;
+  }
+
+  bool found = false;
+  for (int i = 0; i < res->count_connectors && !found; ++i) {
+    drmModeConnector *connector = drmModeGetConnector(fd, res->connectors[i]);
+    if (!connector) {
+      continue;
+    }
+    if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0) {
+      // Keep whatever mode the console already runs; otherwise take the preferred one.
+      uint32_t crtc_id = 0;
+      if (connector->encoder_id) {
+        drmModeEncoder *encoder = drmModeGetEncoder(fd, connector->encoder_id);
+        if (encoder) {
+          crtc_id = encoder->crtc_id;
+          drmModeFreeEncoder(encoder);
+        }
+      }
+      for (int e = 0; e < connector->count_encoders && crtc_id == 0; ++e) {
+        drmModeEncoder *encoder = drmModeGetEncoder(fd, connector->encoders[e]);
+        if (!encoder) {
+          continue;
+        }
+        for (int c = 0; c < res->count_crtcs; ++c) {
+          if (encoder->possible_crtcs & (1u << c)) {
+            crtc_id = res->crtcs[c];
+            break;
+          }
+        }
+        drmModeFreeEncoder(encoder);
+      }
+
+      if (crtc_id != 0) {
+        drmModeCrtc *crtc = drmModeGetCrtc(fd, crtc_id);
+        if (crtc && crtc->mode_valid) {
+          output.mode = crtc->mode;
+        } else {
+          output.mode = connector->modes[0];
+          for (int m = 0; m < connector->count_modes; ++m) {
+            if (connector->modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+              output.mode = connector->modes[m];
+              break;
+            }
+          }
+        }
+        drmModeFreeCrtc(crtc);
+        for (int c = 0; c < res->count_crtcs; ++c) {
+          if (res->crtcs[c] == crtc_id) {
+            output.crtc_index = static_cast<unsigned>(c);
+          }
+        }
+        output.connector_id = connector->connector_id;
+        output.crtc_id = crtc_id;
+        found = true;
+      }
+    }
+    drmModeFreeConnector(connector);
+  }
+  drmModeFreeResources(res);
+
+  if (!found) {
+    close(fd);
+    return false;
+  }
+  output.fd = fd;
+  return true;
+}
+
+} // namespace
+
+KmsOutput open_kms_output(const std::string &card) {
+  KmsOutput output;
+  if (card.empty()) {
+    for (int i = 0; i < kMaxCards && output.fd < 0; ++i) {
+      open_card("/dev/dri/card" + std::to_string(i), output);
+    }
+    if (output.fd < 0) {
+      throw Error("No DRM device with a connected display was found");
+    }
+  } else if (!open_card(card, output)) {
+    throw Error("DRM device '" + card + "' has no connected display");
+  }
+  return output;
+}
+
+ScreenRect fit_to_screen(unsigned width, unsigned height, const drmModeModeInfo &mode) {
+  ScreenRect rect;
+  rect.width = mode.hdisplay;
+  rect.height = static_cast<uint32_t>(static_cast<uint64_t>(mode.hdisplay) * height / width);
+  if (rect.height > mode.vdisplay) {
+    rect.height = mode.vdisplay;
+    rect.width = static_cast<uint32_t>(static_cast<uint64_t>(mode.vdisplay) * width / height);
+  }
+  rect.x = static_cast<int32_t>((mode.hdisplay - rect.width) / 2);
+  rect.y = static_cast<int32_t>((mode.vdisplay - rect.height) / 2);
+  return rect;
+}
+
+DrmDisplay::DrmDisplay(const std::string &card) {
+  const KmsOutput output = open_kms_output(card);
+  fd_ = output.fd;
+  connector_id_ = output.connector_id;
+  crtc_id_ = output.crtc_id;
+  crtc_index_ = output.crtc_index;
+  mode_ = output.mode;
+
+  try {
+    saved_crtc_ = drmModeGetCrtc(fd_, crtc_id_);
+
+    // A black primary plane hides the console around a letterboxed picture.
+    background_ = create_dumb(mode_.hdisplay, mode_.vdisplay, DRM_FORMAT_XRGB8888);
+    if (drmModeSetCrtc(fd_, crtc_id_, background_.fb_id, 0, 0, &connector_id_, 1, &mode_) < 0) {
+      throw_errno("Cannot set display mode (is another program holding the display?)");
+    }
+
+    video_plane_ = find_plane(DRM_FORMAT_YUV420, 0);
+    if (video_plane_ == 0) {
+      throw Error("Display has no plane that can scan out YUV420");
+    }
+    overlay_plane_ = find_plane(DRM_FORMAT_ARGB8888, video_plane_);
+    if (overlay_plane_ != 0) {
+      set_zpos(video_plane_, 1);
+      set_zpos(overlay_plane_, 2);
+      for (auto &buffer : overlay_buffers_) {
+        buffer = create_dumb(mode_.hdisplay, mode_.vdisplay, DRM_FORMAT_ARGB8888);
+      }
+    }
+  } catch (...) {
+    for (auto &buffer : overlay_buffers_) {
+      destroy_dumb(buffer);
+    }
+    destroy_dumb(background_);
+    drmModeFreeCrtc(saved_crtc_);
+    close(fd_);
+    throw;
+  }
+}
+
+DrmDisplay::~DrmDisplay() {
+  drmModeSetPlane(fd_, video_plane_, crtc_id_, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  if (overlay_plane_ != 0) {
+    drmModeSetPlane(fd_, overlay_plane_, crtc_id_, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  }
+  release_frames();
+  for (auto &buffer : overlay_buffers_) {
+    destroy_dumb(buffer);
+  }
+  if (saved_crtc_) {
+    drmModeSetCrtc(fd_, saved_crtc_->crtc_id, saved_crtc_->buffer_id, saved_crtc_->x, saved_crtc_->y, &connector_id_,
+                   1, &saved_crtc_->mode);
+    drmModeFreeCrtc(saved_crtc_);
+  }
+  destroy_dumb(background_);
+  close(fd_);
+}
+
+uint32_t DrmDisplay::find_plane(uint32_t format, uint32_t exclude) const {
+  drmModePlaneRes *planes = drmModeGetPlaneResources(fd_);
+  if (!planes) {
+    return 0;
+  }
+  uint32_t found = 0;
+  for (uint32_t i = 0; i < planes->count_planes && found == 0; ++i) {
+    uint32_t id = planes->planes[i];
+    if (id == exclude) {
+      continue;
+    }
+    drmModePlane *plane = drmModeGetPlane(fd_, id);
+    if (!plane) {
+      continue;
+    }
+    uint64_t type = object_property(fd_, id, DRM_MODE_OBJECT_PLANE, "type", nullptr);
+    if ((plane->possible_crtcs & (1u << crtc_index_)) && type == DRM_PLANE_TYPE_OVERLAY) {
+      for (uint32_t f = 0; f < plane->count_formats; ++f) {
+        if (plane->formats[f] == format) {
+          found = id;
+          break;
+        }
+      }
+    }
+    drmModeFreePlane(plane);
+  }
+  drmModeFreePlaneResources(planes);
+  return found;
+}
+
+// Best effort: drivers without a mutable zpos stack overlay planes by id,
+// which already puts the later (overlay) plane on top.
+void DrmDisplay::set_zpos(uint32_t plane, uint64_t zpos) const {
+  uint32_t prop_id = 0;
+  object_property(fd_, plane, DRM_MODE_OBJECT_PLANE, "zpos", &prop_id);
+  if (prop_id != 0) {
+    drmModeObjectSetProperty(fd_, plane, DRM_MODE_OBJECT_PLANE, prop_id, zpos);
+  }
+}
+
+DrmDisplay::DumbBuffer DrmDisplay::create_dumb(uint32_t width, uint32_t height, uint32_t format) {
+  drm_mode_create_dumb create{};
+  create.width = width;
+  create.height = height;
+  create.bpp = 32;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+    throw_errno("Cannot allocate a display buffer");
+  }
+
+  DumbBuffer buffer;
+  buffer.handle = create.handle;
+  buffer.pitch = create.pitch;
+  buffer.size = create.size;
+
+  uint32_t handles[4] = {buffer.handle};
+  uint32_t pitches[4] = {buffer.pitch};
+  uint32_t offsets[4] = {0};
+  if (drmModeAddFB2(fd_, width, height, format, handles, pitches, offsets, &buffer.fb_id, 0) < 0) {
+    int saved_errno = errno;
+    destroy_dumb(buffer);
+    errno = saved_errno;
+    throw_errno("Cannot create a display framebuffer");
+  }
+
+  drm_mode_map_dumb map{};
+  map.handle = buffer.handle;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_MAP_DUMB, &map) == 0) {
+    void *mem = mmap(nullptr, buffer.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, map.offset);
+    if (mem != MAP_FAILED) {
+      buffer.mem = mem;
+      std::memset(mem, 0, buffer.size);
+    }
+  }
+  if (!buffer.mem) {
+    int saved_errno = errno;
+    destroy_dumb(buffer);
+    errno = saved_errno;
+    throw_errno("Cannot map a display buffer");
+  }
+  return buffer;
+}
+
+void DrmDisplay::destroy_dumb(DumbBuffer &buffer) {
+  if (buffer.mem) {
+    munmap(buffer.mem, buffer.size);
+  }
+  if (buffer.fb_id) {
+    drmModeRmFB(fd_, buffer.fb_id);
+  }
+  if (buffer.handle) {
+    drm_mode_destroy_dumb destroy{};
+    destroy.handle = buffer.handle;
+    drmIoctl(fd_, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+  }
+  buffer = DumbBuffer{};
+}
+
+void DrmDisplay::release_frames() {
+  for (auto &frame : frames_) {
+    if (frame.fb_id) {
+      drmModeRmFB(fd_, frame.fb_id);
+    }
+    if (frame.handle) {
+      drm_gem_close close_handle{};
+      close_handle.handle = frame.handle;
+      drmIoctl(fd_, DRM_IOCTL_GEM_CLOSE, &close_handle);
+    }
+  }
+  frames_.clear();
+  shown_ = -1;
+}
+
+void DrmDisplay::import_frames(const std::vector<int> &fds, const DecoderFormat &format) {
+  drmModeSetPlane(fd_, video_plane_, crtc_id_, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  release_frames();
+  format_ = format;
+
+  // The decoder writes all three planes into one buffer, back to back.
+  const uint32_t luma_size = format.stride * format.coded_height;
+  const uint32_t chroma_size = (format.stride / 2) * (format.coded_height / 2);
+  for (int fd : fds) {
+    ImportedFrame frame;
+    if (drmPrimeFDToHandle(fd_, fd, &frame.handle) < 0) {
+      throw_errno("Cannot import a decoded frame into DRM");
+    }
+    frames_.push_back(frame);
+
+    uint32_t handles[4] = {frame.handle, frame.handle, frame.handle};
+    uint32_t pitches[4] = {format.stride, format.stride / 2, format.stride / 2};
+    uint32_t offsets[4] = {0, luma_size, luma_size + chroma_size};
+    if (drmModeAddFB2(fd_, format.width, format.height, DRM_FORMAT_YUV420, handles, pitches, offsets,
+                      &frames_.back().fb_id, 0) < 0) {
+      throw_errno("Cannot create a framebuffer for a decoded frame");
+    }
+  }
+}
+
+int DrmDisplay::show_frame(unsigned index) {
+  if (index >= frames_.size()) {
+    return static_cast<int>(index);
+  }
+
+  const ScreenRect dst = fit_to_screen(format_.width, format_.height, mode_);
+
+  // Legacy SetPlane returns once the new framebuffer is latched, so the
+  // previous one is off screen afterwards.
+  if (drmModeSetPlane(fd_, video_plane_, crtc_id_, frames_[index].fb_id, 0, dst.x, dst.y, dst.width, dst.height, 0,
+                      0, format_.width << 16, format_.height << 16) < 0) {
+    throw_errno("Cannot show a decoded frame");
+  }
+  int previous = shown_;
+  shown_ = static_cast<int>(index);
+  return previous;
+}
+
+void DrmDisplay::update_overlay(TextOverlay &overlay) {
+  if (overlay_plane_ == 0) {
+    return;
+  }
+  uint64_t version = overlay.version();
+  if (version == overlay_version_) {
+    return;
+  }
+  overlay_version_ = version;
+
+  DumbBuffer &buffer = overlay_buffers_[overlay_back_];
+  overlay.render_argb(static_cast<uint32_t *>(buffer.mem), buffer.pitch / 4, mode_.hdisplay, mode_.vdisplay);
+  if (drmModeSetPlane(fd_, overlay_plane_, crtc_id_, buffer.fb_id, 0, 0, 0, mode_.hdisplay, mode_.vdisplay, 0, 0,
+                      static_cast<uint32_t>(mode_.hdisplay) << 16, static_cast<uint32_t>(mode_.vdisplay) << 16) < 0) {
+    warn_errno("Cannot update the overlay plane");
+    return;
+  }
+  overlay_back_ = 1 - overlay_back_;
+}
+
+} // namespace picam
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <xf86drmMode.h>
+
+#include "overlay.hpp"
+#include "v4l2_decoder.hpp"
+
+namespace picam {
+
+// Connector, CRTC and mode of the display a preview takes over.
+struct KmsOutput {
+  int fd = -1;
+  uint32_t connector_id = 0;
+  uint32_t crtc_id = 0;
+  unsigned crtc_index = 0;
+  drmModeModeInfo mode{};
+};
+
+// Opens `card`, or with an empty path the first /dev/dri/card* with a
+// connected output, and keeps the mode the console already runs. Throws when
+// there is no connected display.
+KmsOutput open_kms_output(const std::string &card);
+
+// Where a width x height picture lands when scaled to fit the screen with its
+// aspect ratio kept.
+struct ScreenRect {
+  int32_t x = 0;
+  int32_t y = 0;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+ScreenRect fit_to_screen(unsigned width, unsigned height, const drmModeModeInfo &mode);
+
+// What 'drm-preview' needs from the code that puts decoded frames on screen.
+class PreviewDisplay {
+public:
+  virtual ~PreviewDisplay() = default;
+
+  virtual bool has_overlay() const = 0;
+
+  // Replaces previously imported frames; call after every decoder format change.
+  virtual void import_frames(const std::vector<int> &fds, const DecoderFormat &format) = 0;
+
+  // Puts imported frame `index` on screen. Returns the index of the frame that
+  // just left the screen (and can go back to the decoder), or -1.
+  virtual int show_frame(unsigned index) = 0;
+
+  // Redraws the overlay when its text or corner changed since the last call.
+  virtual void update_overlay(TextOverlay &overlay) = 0;
+};
+
+// Full-screen KMS output for the preview. Decoded dmabufs are imported as
+// framebuffers and scanned out by a YUV plane (the display controller does the
+// scaling); the stats box lives on a separate ARGB plane above it, so the video
+// path never touches pixels on the CPU.
+class DrmDisplay : public PreviewDisplay {
+public:
+  // An empty card path picks the first /dev/dri/card* with a connected output.
+  explicit DrmDisplay(const std::string &card);
+  ~DrmDisplay() override;
+
+  DrmDisplay(const DrmDisplay &) = delete;
+  DrmDisplay &operator=(const DrmDisplay &) = delete;
+
+  bool has_overlay() const override { return overlay_plane_ != 0; }
+  void import_frames(const std::vector<int> &fds, const DecoderFormat &format) override;
+  int show_frame(unsigned index) override;
+  void update_overlay(TextOverlay &overlay) override;
+
+private:
+  struct DumbBuffer {
+    uint32_t handle = 0;
+    uint32_t pitch = 0;
+    uint32_t fb_id = 0;
+    uint64_t size = 0;
+    void *mem = nullptr;
+  };
+
+  struct ImportedFrame {
+    uint32_t handle = 0;
+    uint32_t fb_id = 0;
+  };
+
+  uint32_t find_plane(uint32_t format, uint32_t exclude) const;
+  void set_zpos(uint32_t plane, uint64_t zpos) const;
+  DumbBuffer create_dumb(uint32_t width, uint32_t height, uint32_t format);
+  void destroy_dumb(DumbBuffer &buffer);
+  void release_frames();
+
+  int fd_ = -1;
+  uint32_t connector_id_ = 0;
+  uint32_t crtc_id_ = 0;
+  unsigned crtc_index_ = 0;
+  drmModeModeInfo mode_{};
+  drmModeCrtc *saved_crtc_ = nullptr;
+
+  DumbBuffer background_;
+  uint32_t video_plane_ = 0;
+  std::vector<ImportedFrame> frames_;
+  DecoderFormat format_;
+  int shown_ = -1;
+
+  uint32_t overlay_plane_ = 0;
+  DumbBuffer overlay_buffers_[2];
+  int overlay_back_ = 0;
+  uint64_t overlay_version_ = UINT64_MAX;
+};
+
+} // namespace picam
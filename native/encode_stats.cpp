@@ -0,0 +1,70 @@
+#include "encode_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "sample_stats.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+void EncodeStats::add(size_t bytes, uint64_t encode_ns) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  frames_ += 1;
+  bytes_ += bytes;
+  interval_frames_ += 1;
+  interval_bytes_ += bytes;
+  if (encode_ns > 0) {
+    encode_ms_.push_back(static_cast<float>(encode_ns / 1e6));
+  }
+}
+
+EncodeInterval EncodeStats::take_interval() {
+  EncodeInterval interval;
+  std::vector<float> sorted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interval.frames = interval_frames_;
+    interval.bytes = interval_bytes_;
+    sorted.assign(encode_ms_.begin() + static_cast<std::ptrdiff_t>(interval_first_sample_), encode_ms_.end());
+    interval_frames_ = 0;
+    interval_bytes_ = 0;
+    interval_first_sample_ = encode_ms_.size();
+  }
+  std::sort(sorted.begin(), sorted.end());
+  interval.encode_p50_ms = percentile(sorted, 50);
+  interval.encode_p95_ms = percentile(sorted, 95);
+  return interval;
+}
+
+void EncodeStats::write_report(const std::string &path, double duration_s, double cpu_pct, uint64_t dropped) const {
+  std::vector<float> sorted;
+  uint64_t frames;
+  uint64_t bytes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sorted = encode_ms_;
+    frames = frames_;
+    bytes = bytes_;
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  double fps = duration_s > 0 ? frames / duration_s : 0.0;
+  double kbps = duration_s > 0 ? bytes * 8.0 / duration_s / 1000.0 : 0.0;
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw_errno("Cannot write encode report '" + path + "'");
+  }
+  std::fprintf(file,
+               "{\n  \"frames\": %llu,\n  \"dropped\": %llu,\n  \"duration_s\": %.3f,\n  \"fps\": %.2f,\n"
+               "  \"bitrate_kbps\": %.1f,\n  \"cpu_pct\": %.2f,\n"
+               "  \"encode_ms\": {\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"mean\": %.3f, \"max\": %.3f}\n}\n",
+               static_cast<unsigned long long>(frames), static_cast<unsigned long long>(dropped), duration_s, fps,
+               kbps, cpu_pct, percentile(sorted, 50), percentile(sorted, 95), percentile(sorted, 99), mean(sorted),
+               sorted.empty() ? 0.0 : sorted.back());
+  if (std::fclose(file) != 0) {
+    throw_errno("Cannot write encode report '" + path + "'");
+  }
+}
+
+} // namespace picam
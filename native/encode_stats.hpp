@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+// Encoder output over one progress interval.
+struct EncodeInterval {
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  double encode_p50_ms = 0.0;
+  double encode_p95_ms = 0.0;
+};
+
+// Per-frame encoder cost for headless benchmarks: every encode time (frame
+// delivered by libcamera -> access unit dequeued) is kept for the report.
+class EncodeStats {
+public:
+  // encode_ns is 0 when the frame's delivery time is unknown.
+  void add(size_t bytes, uint64_t encode_ns);
+
+  // Frames, bytes and encode times since the previous call.
+  EncodeInterval take_interval();
+  // Writes throughput, CPU and encode-time percentiles as JSON; throws on I/O errors.
+  void write_report(const std::string &path, double duration_s, double cpu_pct, uint64_t dropped) const;
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<float> encode_ms_;
+  uint64_t frames_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t interval_frames_ = 0;
+  uint64_t interval_bytes_ = 0;
+  size_t interval_first_sample_ = 0;
+};
+
+} // namespace picam
@@ -0,0 +1,211 @@
+#include "event_recorder.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "motion.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr uint64_t kRecording = std::numeric_limits<uint64_t>::max();
+constexpr size_t kPacketReserve = 1 << 20;
+
+// Descriptors for the whole event at twice the nominal rate, plus slack.
+size_t arena_frames(const EventConfig &config) {
+  return static_cast<size_t>(config.framerate) * (config.pre_seconds + config.post_seconds) * 2 + 64;
+}
+
+} // namespace
+
+EventRecorder::EventRecorder(const EventConfig &config)
+    : config_(config), pre_us_(static_cast<int64_t>(config.pre_seconds) * 1000000),
+      post_us_(static_cast<int64_t>(config.post_seconds) * 1000000),
+      arena_(config.arena_bytes, arena_frames(config)) {
+  struct stat st{};
+  if (stat(config_.directory.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+    throw Error("Event directory '" + config_.directory + "' does not exist");
+  }
+  if (!config_.trigger_gpio.empty()) {
+    gpio_ = std::make_unique<GpioTrigger>(config_.trigger_gpio);
+  }
+  packets_.reserve(kPacketReserve);
+
+  std::fprintf(stderr, "picam-native: DVR keeps %u s in a %zu MiB arena%s; 'kill -USR1 %d' saves an event\n",
+               config_.pre_seconds, arena_.capacity_bytes() >> 20,
+               arena_.locked() ? "" : " (not locked, RLIMIT_MEMLOCK too low)", static_cast<int>(getpid()));
+  thread_ = std::thread(&EventRecorder::run, this);
+}
+
+EventRecorder::~EventRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void EventRecorder::trigger() {
+  trigger_requested_.store(true, std::memory_order_relaxed);
+}
+
+void EventRecorder::write(const EncodedFrame &frame) {
+  if (take_event_signal() || (gpio_ && gpio_->fired())) {
+    trigger();
+  }
+  if (config_.motion_trigger) {
+    // Every frame with motion re-arms the trigger, so the event runs until
+    // post_seconds after the motion has settled.
+    MotionState motion;
+    if (find_motion_sei(frame.data, frame.size, motion) && motion.active) {
+      trigger();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (trigger_requested_.load(std::memory_order_relaxed)) {
+    if (!saving_) {
+      trigger_requested_.store(false, std::memory_order_relaxed);
+      saving_ = true;
+      save_next_ = arena_.first();
+      save_end_ = kRecording;
+      deadline_us_ = frame.timestamp_us + post_us_;
+      lost_frames_ = 0;
+    } else if (save_end_ == kRecording) {
+      // A trigger during the post-event window extends it.
+      trigger_requested_.store(false, std::memory_order_relaxed);
+      deadline_us_ = frame.timestamp_us + post_us_;
+    }
+    // Otherwise the previous event is still being flushed; start once it is.
+  }
+  if (saving_ && save_end_ == kRecording && frame.timestamp_us > deadline_us_) {
+    save_end_ = arena_.end();
+  }
+
+  const bool recording = saving_ && save_end_ == kRecording;
+  const uint64_t keep_from = saving_ ? save_next_ : kRecording;
+  if (skipping_ && !frame.keyframe) {
+    lost_frames_ += recording;
+  } else {
+    // Refused frames break the GOP, so everything up to the next IDR goes too.
+    skipping_ = !arena_.push(frame, keep_from);
+    lost_frames_ += recording && skipping_;
+  }
+  arena_.trim(pre_us_, keep_from);
+
+  if (saving_) {
+    wake_.notify_one();
+  }
+}
+
+void EventRecorder::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] {
+      return stopping_ || (saving_ && (save_next_ < arena_.end() || save_next_ >= save_end_));
+    });
+    if (!saving_) {
+      if (stopping_) {
+        return;
+      }
+      continue;
+    }
+    if (stopping_ && save_end_ == kRecording) {
+      save_end_ = arena_.end();
+    }
+    if (save_next_ >= save_end_) {
+      uint64_t lost = lost_frames_;
+      lock.unlock();
+      close_event();
+      if (lost > 0) {
+        std::fprintf(stderr, "picam-native: %" PRIu64 " frames of the event were lost while the card caught up\n",
+                     lost);
+      }
+      lock.lock();
+      saving_ = false;
+      continue;
+    }
+
+    // Pinned by save_next_: the writer does not evict it while we are unlocked.
+    ArenaFrame frame = arena_.at(save_next_);
+    lock.unlock();
+    bool saved = true;
+    try {
+      if (fd_ < 0) {
+        open_event(frame.timestamp_us);
+      }
+      packets_.clear();
+      muxer_.write(frame.data, frame.size, frame.timestamp_us, frame.keyframe, packets_);
+      write_file(packets_.data(), packets_.size());
+      ++saved_frames_;
+      last_us_ = frame.timestamp_us;
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "picam-native: Event not saved: %s\n", e.what());
+      saved = false;
+    }
+    lock.lock();
+    ++save_next_;
+    if (!saved) {
+      // Give up on this event; the arena is released and the DVR stays armed.
+      save_end_ = save_next_;
+    }
+  }
+}
+
+void EventRecorder::open_event(int64_t first_timestamp_us) {
+  char stamp[32];
+  time_t now = time(nullptr);
+  tm local{};
+  localtime_r(&now, &local);
+  std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+  char name[64];
+  std::snprintf(name, sizeof(name), "event-%s-%04u.ts", stamp, sequence_++);
+  path_ = config_.directory + "/" + name;
+
+  fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw_errno("Cannot create event file '" + path_ + "'");
+  }
+  muxer_.reset();
+  saved_frames_ = 0;
+  first_us_ = last_us_ = first_timestamp_us;
+  std::fprintf(stderr, "picam-native: Saving event to %s\n", path_.c_str());
+}
+
+void EventRecorder::write_file(const uint8_t *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd_, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("Cannot write event file '" + path_ + "'");
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void EventRecorder::close_event() {
+  if (fd_ < 0) {
+    return;
+  }
+  close(fd_);
+  fd_ = -1;
+  std::fprintf(stderr, "picam-native: Event saved to %s: %" PRIu64 " frames, %.1f s\n", path_.c_str(),
+               saved_frames_, (last_us_ - first_us_) / 1e6);
+}
+
+} // namespace picam
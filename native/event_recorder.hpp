@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame.hpp"
+#include "gop_arena.hpp"
+#include "gpio_trigger.hpp"
+#include "ts_muxer.hpp"
+
+namespace picam {
+
+struct EventConfig {
+  std::string directory;
+  unsigned pre_seconds = 10;
+  unsigned post_seconds = 10;
+  size_t arena_bytes = 32 << 20;
+  // sysfs GPIO value file; empty for SIGUSR1 (and trigger()) only.
+  std::string trigger_gpio;
+  // Trigger on the motion SEI of 'capture --motion' while it reports motion.
+  bool motion_trigger = false;
+  unsigned framerate = 30;
+};
+
+// Pre-event recorder ("motion DVR"). write() keeps the last pre_seconds of
+// the stream in a GopArena; on a trigger a background thread saves those
+// GOPs plus post_seconds of live stream as one MPEG-TS file that starts at
+// an IDR. Frames being saved are pinned in the arena, so a slow card means
+// lost frames at the end of the event, never a stalled preview.
+class EventRecorder : public FrameSink {
+public:
+  explicit EventRecorder(const EventConfig &config);
+  ~EventRecorder() override;
+
+  EventRecorder(const EventRecorder &) = delete;
+  EventRecorder &operator=(const EventRecorder &) = delete;
+
+  // Also polls SIGUSR1 (see block_event_signal()), the GPIO and, with
+  // motion_trigger, the motion SEI of the frame.
+  void write(const EncodedFrame &frame) override;
+  // Safe from any thread; the event starts with the next frame.
+  void trigger();
+
+private:
+  void run();
+  void open_event(int64_t first_timestamp_us);
+  void write_file(const uint8_t *data, size_t size);
+  void close_event();
+
+  EventConfig config_;
+  int64_t pre_us_;
+  int64_t post_us_;
+  std::unique_ptr<GpioTrigger> gpio_;
+  std::atomic<bool> trigger_requested_{false};
+
+  // Guarded by mutex_: the arena and the state of the event being saved.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  GopArena arena_;
+  bool saving_ = false;
+  uint64_t save_next_ = 0;
+  uint64_t save_end_ = 0;
+  int64_t deadline_us_ = 0;
+  bool skipping_ = false;
+  uint64_t lost_frames_ = 0;
+  bool stopping_ = false;
+
+  // Saver thread only.
+  TsMuxer muxer_;
+  std::vector<uint8_t> packets_;
+  int fd_ = -1;
+  std::string path_;
+  unsigned sequence_ = 0;
+  uint64_t saved_frames_ = 0;
+  int64_t first_us_ = 0;
+  int64_t last_us_ = 0;
+
+  std::thread thread_;
+};
+
+} // namespace picam
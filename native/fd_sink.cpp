@@ -0,0 +1,53 @@
+#include "fd_sink.hpp"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+FdSink::FdSink(const std::string &path) {
+  if (path == "-") {
+    fd_ = STDOUT_FILENO;
+    return;
+  }
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw_errno("Cannot open output '" + path + "'");
+  }
+  owned_ = true;
+}
+
+FdSink::~FdSink() {
+  if (owned_) {
+    close(fd_);
+  }
+}
+
+void FdSink::write(const EncodedFrame &frame) {
+  if (failed_) {
+    return;
+  }
+  const uint8_t *data = frame.data;
+  size_t left = frame.size;
+  while (left > 0) {
+    ssize_t written = ::write(fd_, data, left);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The reader went away (ffmpeg closed the FIFO); shut the pipeline down.
+      warn_errno("Output write failed");
+      failed_ = true;
+      request_stop();
+      return;
+    }
+    data += written;
+    left -= static_cast<size_t>(written);
+  }
+}
+
+} // namespace picam
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "frame.hpp"
+
+namespace picam {
+
+// Writes the elementary stream to a file, FIFO or stdout ("-").
+class FdSink : public FrameSink {
+public:
+  explicit FdSink(const std::string &path);
+  ~FdSink() override;
+
+  FdSink(const FdSink &) = delete;
+  FdSink &operator=(const FdSink &) = delete;
+
+  void write(const EncodedFrame &frame) override;
+
+private:
+  int fd_ = -1;
+  bool owned_ = false;
+  bool failed_ = false;
+};
+
+} // namespace picam
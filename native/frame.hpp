@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace picam {
+
+// One YUV420 frame owned by the camera until released back to it. The plane
+// pointers are only set when the camera was asked to map its buffers.
+struct CameraFrame {
+  uint64_t id = 0;
+  int fd = -1;
+  size_t size = 0;
+  unsigned stride = 0;
+  int64_t timestamp_us = 0;
+  // Exposure of this frame as the AGC set it; 0 when libcamera did not say.
+  int64_t exposure_us = 0;
+  uint8_t *planes[3] = {nullptr, nullptr, nullptr};
+  // Luma of the low-resolution stream, when one was configured; always mapped.
+  int lores_fd = -1;
+  const uint8_t *lores_luma = nullptr;
+  unsigned lores_stride = 0;
+};
+
+// One encoded access unit; the data is only valid for the duration of the callback.
+struct EncodedFrame {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  int64_t timestamp_us = 0;
+  bool keyframe = false;
+};
+
+class FrameSink {
+public:
+  virtual ~FrameSink() = default;
+  virtual void write(const EncodedFrame &frame) = 0;
+};
+
+// Discards every access unit in-process, leaving only capture and encode
+// cost in the measurement.
+class NullSink : public FrameSink {
+public:
+  void write(const EncodedFrame &) override {}
+};
+
+} // namespace picam
@@ -0,0 +1,464 @@
+// Built only when picam.sh finds egl, glesv2 and gbm (it then defines
+// PICAM_HAVE_GL); otherwise drm-preview offers just the plane renderer.
+#if defined(PICAM_HAVE_GL)
+
+#include "gl_display.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <drm_fourcc.h>
+#include <gbm.h>
+#include <poll.h>
+#include <unistd.h>
+#include <xf86drm.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int kFlipTimeoutMs = 1000;
+// Longer than a frame at any rate the camera runs, so a live stream never
+// gets an extra flip between two of its frames.
+constexpr uint64_t kIdleRedrawNs = 250000000ull;
+
+// The quad covers the screen; v_screen is in pixels from the top-left corner,
+// like the rectangles below.
+const char kVertexShader[] = R"(
+attribute vec2 a_position;
+uniform vec2 u_screen_size;
+varying vec2 v_screen;
+void main() {
+  v_screen = a_position * u_screen_size;
+  gl_Position = vec4(a_position.x * 2.0 - 1.0, 1.0 - a_position.y * 2.0, 0.0, 1.0);
+}
+)";
+
+// Limited-range BT.709, which is what the capture (and libcamera-vid) tags
+// the stream with. The box is premultiplied ARGB, as on the DRM overlay plane.
+const char kFragmentShader[] = R"(
+precision highp float;
+uniform sampler2D u_y;
+uniform sampler2D u_u;
+uniform sampler2D u_v;
+uniform sampler2D u_box;
+uniform vec4 u_video;
+uniform vec4 u_box_rect;
+varying vec2 v_screen;
+void main() {
+  vec3 rgb = vec3(0.0);
+  vec2 uv = (v_screen - u_video.xy) / u_video.zw;
+  if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0)))) {
+    float y = 1.1644 * (texture2D(u_y, uv).r - 0.0627);
+    float cb = texture2D(u_u, uv).r - 0.5020;
+    float cr = texture2D(u_v, uv).r - 0.5020;
+    rgb = clamp(vec3(y + 1.7927 * cr, y - 0.2132 * cb - 0.5329 * cr, y + 2.1124 * cb), 0.0, 1.0);
+  }
+  if (u_box_rect.z > 0.0) {
+    vec2 box_uv = (v_screen - u_box_rect.xy) / u_box_rect.zw;
+    if (all(greaterThanEqual(box_uv, vec2(0.0))) && all(lessThan(box_uv, vec2(1.0)))) {
+      vec4 box = texture2D(u_box, box_uv);
+      rgb = box.rgb + rgb * (1.0 - box.a);
+    }
+  }
+  gl_FragColor = vec4(rgb, 1.0);
+}
+)";
+
+[[noreturn]] void throw_egl(const std::string &what) {
+  char code[32];
+  std::snprintf(code, sizeof(code), " (EGL error 0x%04x)", static_cast<unsigned>(eglGetError()));
+  throw Error(what + code);
+}
+
+bool has_extension(const char *list, const char *name) {
+  const size_t length = std::strlen(name);
+  for (const char *at = list; at && (at = std::strstr(at, name)) != nullptr; at += length) {
+    if ((at == list || at[-1] == ' ') && (at[length] == ' ' || at[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+GLuint compile_shader(GLenum type, const char *source) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+  GLint compiled = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if (!compiled) {
+    char log[512] = "";
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    glDeleteShader(shader);
+    throw Error(std::string("Cannot compile the preview shader: ") + log);
+  }
+  return shader;
+}
+
+void set_texture_filtering() {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// KMS framebuffer of a GBM buffer, created the first time the buffer comes
+// round and removed with it.
+struct BoFramebuffer {
+  int fd;
+  uint32_t fb_id;
+};
+
+void destroy_bo_framebuffer(gbm_bo *, void *data) {
+  auto *framebuffer = static_cast<BoFramebuffer *>(data);
+  drmModeRmFB(framebuffer->fd, framebuffer->fb_id);
+  delete framebuffer;
+}
+
+void flip_done(int, unsigned, unsigned, unsigned, void *data) {
+  *static_cast<bool *>(data) = false;
+}
+
+} // namespace
+
+GlDisplay::GlDisplay(const std::string &card) : output_(open_kms_output(card)) {
+  try {
+    saved_crtc_ = drmModeGetCrtc(output_.fd, output_.crtc_id);
+    init_egl();
+    init_program();
+
+    // A black first frame sets the mode and hides the console.
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    present();
+  } catch (...) {
+    teardown();
+    throw;
+  }
+}
+
+GlDisplay::~GlDisplay() {
+  teardown();
+}
+
+void GlDisplay::init_egl() {
+  gbm_ = gbm_create_device(output_.fd);
+  if (!gbm_) {
+    throw Error("Cannot create a GBM device on the display");
+  }
+  surface_ = gbm_surface_create(gbm_, output_.mode.hdisplay, output_.mode.vdisplay, GBM_FORMAT_XRGB8888,
+                                GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+  if (!surface_) {
+    throw Error("Cannot create a GBM scanout surface");
+  }
+
+  egl_display_ = eglGetDisplay(reinterpret_cast<EGLNativeDisplayType>(gbm_));
+  if (egl_display_ == EGL_NO_DISPLAY || !eglInitialize(egl_display_, nullptr, nullptr)) {
+    egl_display_ = EGL_NO_DISPLAY;
+    throw_egl("Cannot initialise EGL on the display");
+  }
+  if (!has_extension(eglQueryString(egl_display_, EGL_EXTENSIONS), "EGL_EXT_image_dma_buf_import")) {
+    throw Error("EGL cannot import dmabufs (no EGL_EXT_image_dma_buf_import)");
+  }
+  eglBindAPI(EGL_OPENGL_ES_API);
+
+  // The config has to render in the surface's own pixel format.
+  static const EGLint config_attribs[] = {
+      EGL_SURFACE_TYPE, EGL_WINDOW_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 0,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT, EGL_NONE};
+  EGLint count = 0;
+  eglChooseConfig(egl_display_, config_attribs, nullptr, 0, &count);
+  std::vector<EGLConfig> configs(static_cast<size_t>(count));
+  eglChooseConfig(egl_display_, config_attribs, configs.data(), count, &count);
+  EGLConfig config = nullptr;
+  for (EGLint i = 0; i < count && !config; ++i) {
+    EGLint visual = 0;
+    if (eglGetConfigAttrib(egl_display_, configs[i], EGL_NATIVE_VISUAL_ID, &visual) && visual == GBM_FORMAT_XRGB8888) {
+      config = configs[i];
+    }
+  }
+  if (!config) {
+    throw Error("EGL has no config for an XRGB8888 scanout surface");
+  }
+
+  static const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  context_ = eglCreateContext(egl_display_, config, EGL_NO_CONTEXT, context_attribs);
+  if (context_ == EGL_NO_CONTEXT) {
+    throw_egl("Cannot create an OpenGL ES 2 context");
+  }
+  egl_surface_ = eglCreateWindowSurface(egl_display_, config, reinterpret_cast<EGLNativeWindowType>(surface_), nullptr);
+  if (egl_surface_ == EGL_NO_SURFACE) {
+    throw_egl("Cannot create an EGL surface for the display");
+  }
+  if (!eglMakeCurrent(egl_display_, egl_surface_, egl_surface_, context_)) {
+    throw_egl("Cannot make the EGL context current");
+  }
+
+  if (!has_extension(reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS)), "GL_OES_EGL_image")) {
+    throw Error("OpenGL ES cannot sample EGL images (no GL_OES_EGL_image)");
+  }
+  create_image_ = reinterpret_cast<PFNEGLCREATEIMAGEKHRPROC>(eglGetProcAddress("eglCreateImageKHR"));
+  destroy_image_ = reinterpret_cast<PFNEGLDESTROYIMAGEKHRPROC>(eglGetProcAddress("eglDestroyImageKHR"));
+  image_target_texture_ =
+      reinterpret_cast<PFNGLEGLIMAGETARGETTEXTURE2DOESPROC>(eglGetProcAddress("glEGLImageTargetTexture2DOES"));
+  if (!create_image_ || !destroy_image_ || !image_target_texture_) {
+    throw Error("EGL image entry points are missing");
+  }
+}
+
+void GlDisplay::init_program() {
+  GLuint vertex = compile_shader(GL_VERTEX_SHADER, kVertexShader);
+  GLuint fragment;
+  try {
+    fragment = compile_shader(GL_FRAGMENT_SHADER, kFragmentShader);
+  } catch (...) {
+    glDeleteShader(vertex);
+    throw;
+  }
+  program_ = glCreateProgram();
+  glAttachShader(program_, vertex);
+  glAttachShader(program_, fragment);
+  glBindAttribLocation(program_, 0, "a_position");
+  glLinkProgram(program_);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program_, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    char log[512] = "";
+    glGetProgramInfoLog(program_, sizeof(log), nullptr, log);
+    throw Error(std::string("Cannot link the preview shader: ") + log);
+  }
+
+  glUseProgram(program_);
+  glUniform1i(glGetUniformLocation(program_, "u_y"), 0);
+  glUniform1i(glGetUniformLocation(program_, "u_u"), 1);
+  glUniform1i(glGetUniformLocation(program_, "u_v"), 2);
+  glUniform1i(glGetUniformLocation(program_, "u_box"), 3);
+  glUniform2f(glGetUniformLocation(program_, "u_screen_size"), output_.mode.hdisplay, output_.mode.vdisplay);
+  video_rect_ = glGetUniformLocation(program_, "u_video");
+  box_rect_ = glGetUniformLocation(program_, "u_box_rect");
+  glUniform4f(video_rect_, 0.0f, 0.0f, 0.0f, 0.0f);
+  glUniform4f(box_rect_, 0.0f, 0.0f, 0.0f, 0.0f);
+  glViewport(0, 0, output_.mode.hdisplay, output_.mode.vdisplay);
+
+  static const GLfloat corners[] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+  glGenBuffers(1, &quad_);
+  glBindBuffer(GL_ARRAY_BUFFER, quad_);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glEnableVertexAttribArray(0);
+
+  glGenTextures(1, &overlay_texture_);
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_2D, overlay_texture_);
+  set_texture_filtering();
+}
+
+void GlDisplay::teardown() {
+  if (saved_crtc_) {
+    drmModeSetCrtc(output_.fd, saved_crtc_->crtc_id, saved_crtc_->buffer_id, saved_crtc_->x, saved_crtc_->y,
+                   &output_.connector_id, 1, &saved_crtc_->mode);
+    drmModeFreeCrtc(saved_crtc_);
+    saved_crtc_ = nullptr;
+  }
+  if (egl_display_ != EGL_NO_DISPLAY) {
+    if (context_ != EGL_NO_CONTEXT && eglGetCurrentContext() == context_) {
+      release_frames();
+      glDeleteTextures(1, &overlay_texture_);
+      glDeleteBuffers(1, &quad_);
+      glDeleteProgram(program_);
+    }
+    eglMakeCurrent(egl_display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_surface_ != EGL_NO_SURFACE) {
+      eglDestroySurface(egl_display_, egl_surface_);
+    }
+    if (context_ != EGL_NO_CONTEXT) {
+      eglDestroyContext(egl_display_, context_);
+    }
+    eglTerminate(egl_display_);
+  }
+  if (front_bo_) {
+    gbm_surface_release_buffer(surface_, front_bo_);
+  }
+  if (surface_) {
+    gbm_surface_destroy(surface_);
+  }
+  if (gbm_) {
+    gbm_device_destroy(gbm_);
+  }
+  close(output_.fd);
+}
+
+void GlDisplay::release_frames() {
+  for (auto &frame : frames_) {
+    glDeleteTextures(3, frame.textures);
+    for (EGLImageKHR image : frame.images) {
+      if (image != EGL_NO_IMAGE_KHR) {
+        destroy_image_(egl_display_, image);
+      }
+    }
+  }
+  frames_.clear();
+  shown_ = -1;
+}
+
+void GlDisplay::import_frames(const std::vector<int> &fds, const DecoderFormat &format) {
+  release_frames();
+
+  // The decoder writes all three planes into one buffer, back to back; each
+  // becomes a single-channel image so the shader does the conversion itself.
+  const uint32_t luma_size = format.stride * format.coded_height;
+  const uint32_t chroma_size = (format.stride / 2) * (format.coded_height / 2);
+  const EGLint widths[3] = {static_cast<EGLint>(format.width), static_cast<EGLint>(format.width / 2),
+                            static_cast<EGLint>(format.width / 2)};
+  const EGLint heights[3] = {static_cast<EGLint>(format.height), static_cast<EGLint>(format.height / 2),
+                             static_cast<EGLint>(format.height / 2)};
+  const EGLint pitches[3] = {static_cast<EGLint>(format.stride), static_cast<EGLint>(format.stride / 2),
+                             static_cast<EGLint>(format.stride / 2)};
+  const EGLint offsets[3] = {0, static_cast<EGLint>(luma_size), static_cast<EGLint>(luma_size + chroma_size)};
+  for (int fd : fds) {
+    frames_.emplace_back();
+    ImportedFrame &frame = frames_.back();
+    glGenTextures(3, frame.textures);
+    for (int plane = 0; plane < 3; ++plane) {
+      const EGLint attribs[] = {
+          EGL_WIDTH, widths[plane], EGL_HEIGHT, heights[plane], EGL_LINUX_DRM_FOURCC_EXT,
+          static_cast<EGLint>(DRM_FORMAT_R8), EGL_DMA_BUF_PLANE0_FD_EXT, fd, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+          offsets[plane], EGL_DMA_BUF_PLANE0_PITCH_EXT, pitches[plane], EGL_NONE};
+      frame.images[plane] = create_image_(egl_display_, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+      if (frame.images[plane] == EGL_NO_IMAGE_KHR) {
+        throw_egl("Cannot import a decoded frame into EGL");
+      }
+      glActiveTexture(GL_TEXTURE0 + plane);
+      glBindTexture(GL_TEXTURE_2D, frame.textures[plane]);
+      set_texture_filtering();
+      image_target_texture_(GL_TEXTURE_2D, frame.images[plane]);
+    }
+  }
+
+  const ScreenRect rect = fit_to_screen(format.width, format.height, output_.mode);
+  glUniform4f(video_rect_, rect.x, rect.y, rect.width, rect.height);
+}
+
+int GlDisplay::show_frame(unsigned index) {
+  if (index >= frames_.size()) {
+    return static_cast<int>(index);
+  }
+  draw(index);
+  present();
+  // The flip waited for the render, so the GPU is done with the previous frame.
+  int previous = shown_;
+  shown_ = static_cast<int>(index);
+  return previous;
+}
+
+void GlDisplay::update_overlay(TextOverlay &overlay) {
+  uint64_t version = overlay.version();
+  if (version == overlay_version_) {
+    return;
+  }
+  overlay_version_ = version;
+
+  int x0, y0, box_width, box_height;
+  if (overlay.render_box(overlay_pixels_, output_.mode.hdisplay, output_.mode.vdisplay, x0, y0, box_width,
+                         box_height)) {
+    // The box is grey, so ARGB8888 in memory (B, G, R, A) uploads as RGBA unchanged.
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, overlay_texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, box_width, box_height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 overlay_pixels_.data());
+    glUniform4f(box_rect_, x0, y0, box_width, box_height);
+  } else {
+    glUniform4f(box_rect_, 0.0f, 0.0f, 0.0f, 0.0f);
+  }
+
+  if (shown_ >= 0 && monotonic_ns() - presented_ns_ >= kIdleRedrawNs) {
+    draw(static_cast<unsigned>(shown_));
+    present();
+  }
+}
+
+void GlDisplay::draw(unsigned index) {
+  const ImportedFrame &frame = frames_[index];
+  for (int plane = 0; plane < 3; ++plane) {
+    glActiveTexture(GL_TEXTURE0 + plane);
+    glBindTexture(GL_TEXTURE_2D, frame.textures[plane]);
+  }
+  glActiveTexture(GL_TEXTURE3);
+  glBindTexture(GL_TEXTURE_2D, overlay_texture_);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void GlDisplay::present() {
+  if (!eglSwapBuffers(egl_display_, egl_surface_)) {
+    throw_egl("Cannot finish a preview frame");
+  }
+  gbm_bo *bo = gbm_surface_lock_front_buffer(surface_);
+  if (!bo) {
+    throw Error("GBM returned no rendered buffer");
+  }
+
+  try {
+    const uint32_t fb_id = framebuffer_for(bo);
+    if (!mode_set_) {
+      if (drmModeSetCrtc(output_.fd, output_.crtc_id, fb_id, 0, 0, &output_.connector_id, 1, &output_.mode) < 0) {
+        throw_errno("Cannot set display mode (is another program holding the display?)");
+      }
+      mode_set_ = true;
+    } else {
+      bool pending = true;
+      if (drmModePageFlip(output_.fd, output_.crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, &pending) < 0) {
+        throw_errno("Cannot flip to a rendered frame");
+      }
+      drmEventContext events{};
+      events.version = 2;
+      events.page_flip_handler = flip_done;
+      while (pending) {
+        pollfd pfd{output_.fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, kFlipTimeoutMs);
+        if (ret < 0 && errno == EINTR) {
+          continue;
+        }
+        if (ret <= 0) {
+          throw Error("The display did not complete a page flip");
+        }
+        drmHandleEvent(output_.fd, &events);
+      }
+    }
+  } catch (...) {
+    gbm_surface_release_buffer(surface_, bo);
+    throw;
+  }
+
+  if (front_bo_) {
+    gbm_surface_release_buffer(surface_, front_bo_);
+  }
+  front_bo_ = bo;
+  presented_ns_ = monotonic_ns();
+}
+
+uint32_t GlDisplay::framebuffer_for(gbm_bo *bo) {
+  const auto *cached = static_cast<BoFramebuffer *>(gbm_bo_get_user_data(bo));
+  if (cached) {
+    return cached->fb_id;
+  }
+  uint32_t handles[4] = {gbm_bo_get_handle(bo).u32};
+  uint32_t pitches[4] = {gbm_bo_get_stride(bo)};
+  uint32_t offsets[4] = {0};
+  uint32_t fb_id = 0;
+  if (drmModeAddFB2(output_.fd, gbm_bo_get_width(bo), gbm_bo_get_height(bo), DRM_FORMAT_XRGB8888, handles, pitches,
+                    offsets, &fb_id, 0) < 0) {
+    throw_errno("Cannot create a framebuffer for a rendered frame");
+  }
+  gbm_bo_set_user_data(bo, new BoFramebuffer{output_.fd, fb_id}, destroy_bo_framebuffer);
+  return fb_id;
+}
+
+} // namespace picam
+
+#endif // PICAM_HAVE_GL
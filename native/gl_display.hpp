@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "drm_display.hpp"
+
+struct gbm_bo;
+struct gbm_device;
+struct gbm_surface;
+
+namespace picam {
+
+// Full-screen KMS output drawn by the GPU (v3d on the Pi 4 and 5). Each plane
+// of a decoded dmabuf is imported as its own EGLImage, and one fragment shader
+// converts the YUV to RGB, letterboxes the picture and blends the stats box
+// over it in the same pass. The result is page-flipped onto the primary plane,
+// so the display needs neither a YUV nor a spare ARGB plane and the CPU never
+// touches a pixel of the video.
+class GlDisplay : public PreviewDisplay {
+public:
+  // An empty card path picks the first /dev/dri/card* with a connected output.
+  explicit GlDisplay(const std::string &card);
+  ~GlDisplay() override;
+
+  GlDisplay(const GlDisplay &) = delete;
+  GlDisplay &operator=(const GlDisplay &) = delete;
+
+  bool has_overlay() const override { return true; }
+  void import_frames(const std::vector<int> &fds, const DecoderFormat &format) override;
+  // Returns once the new frame is latched, like DrmDisplay.
+  int show_frame(unsigned index) override;
+  // The box is composited with the next frame; while the stream stalls the
+  // frame on screen is drawn again so the text keeps updating.
+  void update_overlay(TextOverlay &overlay) override;
+
+private:
+  struct ImportedFrame {
+    EGLImageKHR images[3] = {EGL_NO_IMAGE_KHR, EGL_NO_IMAGE_KHR, EGL_NO_IMAGE_KHR};
+    GLuint textures[3] = {0, 0, 0};
+  };
+
+  void init_egl();
+  void init_program();
+  void teardown();
+  void release_frames();
+  void draw(unsigned index);
+  void present();
+  uint32_t framebuffer_for(gbm_bo *bo);
+
+  KmsOutput output_;
+  drmModeCrtc *saved_crtc_ = nullptr;
+  gbm_device *gbm_ = nullptr;
+  gbm_surface *surface_ = nullptr;
+  gbm_bo *front_bo_ = nullptr;
+  bool mode_set_ = false;
+  uint64_t presented_ns_ = 0;
+
+  EGLDisplay egl_display_ = EGL_NO_DISPLAY;
+  EGLContext context_ = EGL_NO_CONTEXT;
+  EGLSurface egl_surface_ = EGL_NO_SURFACE;
+  PFNEGLCREATEIMAGEKHRPROC create_image_ = nullptr;
+  PFNEGLDESTROYIMAGEKHRPROC destroy_image_ = nullptr;
+  PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_ = nullptr;
+
+  GLuint program_ = 0;
+  GLuint quad_ = 0;
+  GLint video_rect_ = -1;
+  GLint box_rect_ = -1;
+  std::vector<ImportedFrame> frames_;
+  int shown_ = -1;
+
+  GLuint overlay_texture_ = 0;
+  std::vector<uint32_t> overlay_pixels_;
+  uint64_t overlay_version_ = UINT64_MAX;
+};
+
+} // namespace picam
@@ -0,0 +1,65 @@
+#include "glyph_atlas.hpp"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "util.hpp"
+
+namespace picam {
+
+GlyphAtlas::GlyphAtlas(const std::string &font_path, unsigned pixel_size) {
+  FT_Library library;
+  if (FT_Init_FreeType(&library) != 0) {
+    throw Error("Cannot initialise FreeType");
+  }
+  FT_Face face;
+  if (FT_New_Face(library, font_path.c_str(), 0, &face) != 0) {
+    FT_Done_FreeType(library);
+    throw Error("Cannot load font '" + font_path + "'");
+  }
+  FT_Set_Pixel_Sizes(face, 0, pixel_size);
+
+  ascender_ = static_cast<int>(face->size->metrics.ascender >> 6);
+  line_height_ = static_cast<int>(face->size->metrics.height >> 6);
+
+  for (char c = kFirst; c <= kLast; ++c) {
+    Glyph &glyph = glyphs_[static_cast<size_t>(c - kFirst)];
+    if (FT_Load_Char(face, static_cast<FT_ULong>(c), FT_LOAD_RENDER) != 0) {
+      continue;
+    }
+    const FT_GlyphSlot slot = face->glyph;
+    const FT_Bitmap &bitmap = slot->bitmap;
+    glyph.width = static_cast<int>(bitmap.width);
+    glyph.height = static_cast<int>(bitmap.rows);
+    glyph.bearing_x = slot->bitmap_left;
+    glyph.bearing_y = slot->bitmap_top;
+    glyph.advance = static_cast<int>(slot->advance.x >> 6);
+    glyph.offset = pixels_.size();
+    for (unsigned row = 0; row < bitmap.rows; ++row) {
+      const uint8_t *src = bitmap.buffer + static_cast<ptrdiff_t>(row) * bitmap.pitch;
+      pixels_.insert(pixels_.end(), src, src + bitmap.width);
+    }
+  }
+
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+}
+
+const Glyph *GlyphAtlas::glyph(char c) const {
+  if (c < kFirst || c > kLast) {
+    return nullptr;
+  }
+  return &glyphs_[static_cast<size_t>(c - kFirst)];
+}
+
+int GlyphAtlas::text_width(const std::string &text) const {
+  int width = 0;
+  for (char c : text) {
+    if (const Glyph *g = glyph(c)) {
+      width += g->advance;
+    }
+  }
+  return width;
+}
+
+} // namespace picam
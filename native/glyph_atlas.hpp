@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+struct Glyph {
+  int width = 0;
+  int height = 0;
+  int bearing_x = 0;
+  int bearing_y = 0;
+  int advance = 0;
+  size_t offset = 0;
+};
+
+// Printable ASCII rasterised once with FreeType into one coverage bitmap.
+// After construction no FreeType state is kept; drawing is plain table lookups.
+class GlyphAtlas {
+public:
+  GlyphAtlas(const std::string &font_path, unsigned pixel_size);
+
+  const Glyph *glyph(char c) const;
+  const uint8_t *bitmap(const Glyph &glyph) const { return pixels_.data() + glyph.offset; }
+
+  int ascender() const { return ascender_; }
+  int line_height() const { return line_height_; }
+  int text_width(const std::string &text) const;
+
+private:
+  static constexpr char kFirst = 0x20;
+  static constexpr char kLast = 0x7e;
+
+  std::array<Glyph, kLast - kFirst + 1> glyphs_{};
+  std::vector<uint8_t> pixels_;
+  int ascender_ = 0;
+  int line_height_ = 0;
+};
+
+} // namespace picam
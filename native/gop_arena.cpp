@@ -0,0 +1,138 @@
+#include "gop_arena.hpp"
+
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+GopArena::GopArena(size_t bytes, size_t max_frames) : bytes_(bytes), frames_(max_frames) {
+  if (bytes_ == 0 || max_frames == 0) {
+    throw Error("The DVR arena needs room for at least one frame");
+  }
+  // Populated up front and locked if the limit allows, so the steady state
+  // neither allocates nor takes page faults.
+  void *mem = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw_errno("Cannot map the DVR arena");
+  }
+  base_ = static_cast<uint8_t *>(mem);
+  locked_ = mlock(base_, bytes_) == 0;
+}
+
+GopArena::~GopArena() {
+  munmap(base_, bytes_);
+}
+
+uint8_t *GopArena::allocate(size_t size) {
+  if (count_ == 0) {
+    tail_ = head_ = 0;
+    return size <= bytes_ ? base_ : nullptr;
+  }
+  // Payloads sit in capture order in [tail_, head_), possibly wrapped. The
+  // gap left at the end when a frame wraps is reclaimed with the tail.
+  if (head_ > tail_) {
+    if (size <= bytes_ - head_) {
+      return base_ + head_;
+    }
+    return size <= tail_ ? base_ : nullptr;
+  }
+  if (head_ < tail_ && size <= tail_ - head_) {
+    return base_ + head_;
+  }
+  return nullptr;
+}
+
+uint64_t GopArena::second_gop() const {
+  for (uint64_t sequence = first_ + 1; sequence < end(); ++sequence) {
+    if (at(sequence).keyframe) {
+      return sequence;
+    }
+  }
+  return end();
+}
+
+bool GopArena::evict_gop(uint64_t keep_from) {
+  if (count_ == 0) {
+    return false;
+  }
+  uint64_t next = second_gop();
+  if (next > keep_from) {
+    return false;
+  }
+  count_ -= static_cast<size_t>(next - first_);
+  first_ = next;
+  if (count_ == 0) {
+    tail_ = head_ = 0;
+  } else {
+    tail_ = static_cast<size_t>(at(first_).data - base_);
+  }
+  return true;
+}
+
+bool GopArena::push(const EncodedFrame &frame, uint64_t keep_from) {
+  if (frame.size == 0 || frame.size > bytes_) {
+    return false;
+  }
+  while (count_ == frames_.size()) {
+    if (!evict_gop(keep_from)) {
+      return false;
+    }
+  }
+  uint8_t *dst = nullptr;
+  while (count_ > 0 && !(dst = allocate(frame.size))) {
+    if (!evict_gop(keep_from)) {
+      return false;
+    }
+  }
+  // Evicting can empty the arena; it only ever restarts at an IDR.
+  if (count_ == 0) {
+    if (!frame.keyframe) {
+      return false;
+    }
+    dst = allocate(frame.size);
+  }
+
+  std::memcpy(dst, frame.data, frame.size);
+  ArenaFrame &slot = frames_[end() % frames_.size()];
+  slot.data = dst;
+  slot.size = frame.size;
+  slot.timestamp_us = frame.timestamp_us;
+  slot.keyframe = frame.keyframe;
+  ++count_;
+  head_ = static_cast<size_t>(dst - base_) + frame.size;
+  return true;
+}
+
+void GopArena::trim(int64_t span_us, uint64_t keep_from) {
+  while (count_ > 0) {
+    uint64_t next = second_gop();
+    if (next == end() || at(end() - 1).timestamp_us - at(next).timestamp_us < span_us) {
+      return;
+    }
+    if (!evict_gop(keep_from)) {
+      return;
+    }
+  }
+}
+
+void GopArena::clear() {
+  first_ += count_;
+  count_ = 0;
+  tail_ = head_ = 0;
+}
+
+size_t GopArena::used_bytes() const {
+  if (count_ == 0) {
+    return 0;
+  }
+  return head_ > tail_ ? head_ - tail_ : bytes_ - tail_ + head_;
+}
+
+int64_t GopArena::span_us() const {
+  return count_ == 0 ? 0 : at(end() - 1).timestamp_us - at(first_).timestamp_us;
+}
+
+} // namespace picam
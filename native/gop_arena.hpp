@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame.hpp"
+
+namespace picam {
+
+struct ArenaFrame {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  int64_t timestamp_us = 0;
+  bool keyframe = false;
+};
+
+// Fixed-size store for the most recent whole GOPs. One mapping, locked into
+// RAM, holds the payloads back to back and a preallocated table holds their
+// descriptors, so push() never allocates. Room is made by evicting the
+// oldest GOP, hence the oldest frame kept is always an IDR.
+//
+// Frames are addressed by a sequence number that keeps counting across
+// evictions. Callers that read frames outside the arena's own thread pass
+// the first sequence they still need as `keep_from`; nothing at or after it
+// is evicted, and push() refuses the frame instead.
+class GopArena {
+public:
+  GopArena(size_t bytes, size_t max_frames);
+  ~GopArena();
+
+  GopArena(const GopArena &) = delete;
+  GopArena &operator=(const GopArena &) = delete;
+
+  // Copies the frame in. Returns false, storing nothing, before the first
+  // keyframe or when the room is held by frames at or after `keep_from`.
+  bool push(const EncodedFrame &frame, uint64_t keep_from);
+  // Evicts old GOPs while the rest still covers at least `span_us`.
+  void trim(int64_t span_us, uint64_t keep_from);
+  void clear();
+
+  uint64_t first() const { return first_; }
+  uint64_t end() const { return first_ + count_; }
+  bool empty() const { return count_ == 0; }
+  const ArenaFrame &at(uint64_t sequence) const { return frames_[sequence % frames_.size()]; }
+
+  size_t used_bytes() const;
+  size_t capacity_bytes() const { return bytes_; }
+  bool locked() const { return locked_; }
+  // Capture time covered, oldest to newest frame.
+  int64_t span_us() const;
+
+private:
+  uint8_t *allocate(size_t size);
+  // Sequence of the keyframe after the oldest one, or end() if there is none.
+  uint64_t second_gop() const;
+  bool evict_gop(uint64_t keep_from);
+
+  uint8_t *base_ = nullptr;
+  size_t bytes_;
+  bool locked_ = false;
+  std::vector<ArenaFrame> frames_;
+  uint64_t first_ = 0;
+  size_t count_ = 0;
+  // Byte offsets of the oldest frame and of the next free byte.
+  size_t tail_ = 0;
+  size_t head_ = 0;
+};
+
+} // namespace picam
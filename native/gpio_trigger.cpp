@@ -0,0 +1,56 @@
+#include "gpio_trigger.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+GpioTrigger::GpioTrigger(const std::string &value_path) {
+  fd_ = open(value_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw_errno("Cannot open GPIO '" + value_path + "'");
+  }
+
+  size_t slash = value_path.rfind('/');
+  std::string edge_path = (slash == std::string::npos ? std::string() : value_path.substr(0, slash + 1)) + "edge";
+  int edge_fd = open(edge_path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (edge_fd >= 0) {
+    edge_ = ::write(edge_fd, "rising", 6) == 6;
+    close(edge_fd);
+  }
+  // Reading clears the event sysfs reports for a freshly opened file.
+  level_ = read_level();
+}
+
+GpioTrigger::~GpioTrigger() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool GpioTrigger::read_level() {
+  char value = '0';
+  if (pread(fd_, &value, 1, 0) != 1) {
+    return level_;
+  }
+  return value == '1';
+}
+
+bool GpioTrigger::fired() {
+  if (edge_) {
+    pollfd pfd{fd_, POLLPRI | POLLERR, 0};
+    if (poll(&pfd, 1, 0) <= 0) {
+      return false;
+    }
+    level_ = read_level();
+    return true;
+  }
+  bool previous = level_;
+  level_ = read_level();
+  return level_ && !previous;
+}
+
+} // namespace picam
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+namespace picam {
+
+// Rising-edge input on a sysfs GPIO value file (/sys/class/gpio/gpioN/value,
+// exported by the user). The edge is armed when the kernel allows it, so
+// fired() is a zero-timeout poll that still catches pulses shorter than a
+// frame; otherwise it falls back to sampling the level on every call.
+class GpioTrigger {
+public:
+  explicit GpioTrigger(const std::string &value_path);
+  ~GpioTrigger();
+
+  GpioTrigger(const GpioTrigger &) = delete;
+  GpioTrigger &operator=(const GpioTrigger &) = delete;
+
+  // True once per rising edge since the previous call.
+  bool fired();
+
+private:
+  bool read_level();
+
+  int fd_ = -1;
+  bool edge_ = false;
+  bool level_ = false;
+};
+
+} // namespace picam
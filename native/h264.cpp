@@ -0,0 +1,398 @@
+#include "h264.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace picam {
+
+namespace h264 {
+
+NalReader::NalReader(const uint8_t *data, size_t size) : data_(data), size_(size), pos_(0) {
+  size_t code_length = 0;
+  pos_ = find_start_code(0, code_length);
+}
+
+size_t NalReader::find_start_code(size_t from, size_t &code_length) const {
+  for (size_t i = from; i + 3 <= size_; ++i) {
+    if (data_[i] == 0 && data_[i + 1] == 0 && data_[i + 2] == 1) {
+      // Report zero_byte + 00 00 01 as one four-byte start code.
+      if (i > from && data_[i - 1] == 0) {
+        code_length = 4;
+        return i - 1;
+      }
+      code_length = 3;
+      return i;
+    }
+  }
+  code_length = 0;
+  return size_;
+}
+
+bool NalReader::next(NalUnit &nal) {
+  if (pos_ >= size_) {
+    return false;
+  }
+  size_t code_length = data_[pos_ + 2] == 1 ? 3 : 4;
+  size_t begin = pos_ + code_length;
+  size_t next_length = 0;
+  size_t end = find_start_code(begin, next_length);
+  if (begin >= end) {
+    pos_ = end;
+    return next(nal);
+  }
+
+  nal.data = data_ + begin;
+  nal.size = end - begin;
+  nal.type = data_[begin] & 0x1f;
+  nal.start_code_offset = pos_;
+  pos_ = end;
+  return true;
+}
+
+void append_escaped(std::vector<uint8_t> &out, const uint8_t *rbsp, size_t size) {
+  unsigned zeros = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (zeros >= 2 && rbsp[i] <= 3) {
+      out.push_back(3);
+      zeros = 0;
+    }
+    out.push_back(rbsp[i]);
+    zeros = rbsp[i] == 0 ? zeros + 1 : 0;
+  }
+}
+
+std::vector<uint8_t> unescape(const uint8_t *data, size_t size) {
+  std::vector<uint8_t> out;
+  out.reserve(size);
+  unsigned zeros = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (zeros >= 2 && data[i] == 3) {
+      zeros = 0;
+      continue;
+    }
+    out.push_back(data[i]);
+    zeros = data[i] == 0 ? zeros + 1 : 0;
+  }
+  return out;
+}
+
+namespace {
+
+constexpr uint8_t kSeiUserDataUnregistered = 5;
+// SEI NALs are parsed from a stack copy; ours are far smaller than this.
+constexpr size_t kMaxSeiRbsp = 512;
+
+void append_sei_value(std::vector<uint8_t> &out, size_t value) {
+  while (value >= 255) {
+    out.push_back(0xff);
+    value -= 255;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+bool read_sei_value(const uint8_t *rbsp, size_t size, size_t &pos, size_t &value) {
+  value = 0;
+  while (pos < size && rbsp[pos] == 0xff) {
+    value += 255;
+    ++pos;
+  }
+  if (pos >= size) {
+    return false;
+  }
+  value += rbsp[pos++];
+  return true;
+}
+
+} // namespace
+
+void append_user_data_sei(std::vector<uint8_t> &messages, const uint8_t (&uuid)[16], const uint8_t *payload,
+                          size_t size) {
+  messages.push_back(kSeiUserDataUnregistered);
+  append_sei_value(messages, sizeof(uuid) + size);
+  messages.insert(messages.end(), std::begin(uuid), std::end(uuid));
+  messages.insert(messages.end(), payload, payload + size);
+}
+
+void insert_sei(const uint8_t *data, size_t size, const std::vector<uint8_t> &messages, std::vector<uint8_t> &out) {
+  size_t split = size;
+  NalReader reader(data, size);
+  NalUnit nal;
+  while (reader.next(nal)) {
+    if (nal.type == kNalSlice || nal.type == kNalIdrSlice) {
+      split = nal.start_code_offset;
+      break;
+    }
+  }
+
+  out.clear();
+  out.reserve(size + messages.size() + messages.size() / 2 + 16);
+  out.insert(out.end(), data, data + split);
+  const uint8_t header[] = {0, 0, 0, 1, kNalSei};
+  out.insert(out.end(), std::begin(header), std::end(header));
+  append_escaped(out, messages.data(), messages.size());
+  out.push_back(0x80); // rbsp_trailing_bits
+  out.insert(out.end(), data + split, data + size);
+}
+
+bool find_user_data_sei(const uint8_t *data, size_t size, const uint8_t (&uuid)[16], uint8_t *payload,
+                        size_t capacity, size_t &payload_size) {
+  NalReader reader(data, size);
+  NalUnit nal;
+  while (reader.next(nal)) {
+    if (nal.type == kNalSlice || nal.type == kNalIdrSlice) {
+      return false;
+    }
+    if (nal.type != kNalSei || nal.size < 2) {
+      continue;
+    }
+
+    uint8_t rbsp[kMaxSeiRbsp];
+    size_t length = 0;
+    unsigned zeros = 0;
+    for (size_t i = 1; i < nal.size && length < sizeof(rbsp); ++i) {
+      if (zeros >= 2 && nal.data[i] == 3) {
+        zeros = 0;
+        continue;
+      }
+      rbsp[length++] = nal.data[i];
+      zeros = nal.data[i] == 0 ? zeros + 1 : 0;
+    }
+
+    size_t pos = 0;
+    while (pos < length && rbsp[pos] != 0x80) {
+      size_t type = 0;
+      size_t message_size = 0;
+      if (!read_sei_value(rbsp, length, pos, type) || !read_sei_value(rbsp, length, pos, message_size) ||
+          pos + message_size > length) {
+        break;
+      }
+      if (type == kSeiUserDataUnregistered && message_size >= sizeof(uuid) &&
+          std::memcmp(rbsp + pos, uuid, sizeof(uuid)) == 0) {
+        payload_size = std::min(capacity, message_size - sizeof(uuid));
+        std::memcpy(payload, rbsp + pos + sizeof(uuid), payload_size);
+        return true;
+      }
+      pos += message_size;
+    }
+  }
+  return false;
+}
+
+uint32_t BitReader::bits(unsigned count) {
+  uint32_t value = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    uint32_t bit = 0;
+    if (bit_ / 8 < size_) {
+      bit = (data_[bit_ / 8] >> (7 - bit_ % 8)) & 1;
+    } else {
+      overrun_ = true;
+    }
+    ++bit_;
+    value = value << 1 | bit;
+  }
+  return value;
+}
+
+uint32_t BitReader::ue() {
+  unsigned zeros = 0;
+  while (bits(1) == 0) {
+    if (++zeros > 31 || overrun_) {
+      overrun_ = true;
+      return 0;
+    }
+  }
+  return ((1u << zeros) - 1) + bits(zeros);
+}
+
+int32_t BitReader::se() {
+  uint32_t code = ue();
+  return code & 1 ? static_cast<int32_t>((code + 1) / 2) : -static_cast<int32_t>(code / 2);
+}
+
+namespace {
+
+void skip_scaling_list(BitReader &reader, unsigned size) {
+  int32_t last = 8;
+  int32_t next = 8;
+  for (unsigned i = 0; i < size; ++i) {
+    if (next != 0) {
+      next = (last + reader.se() + 256) % 256;
+    }
+    last = next == 0 ? last : next;
+  }
+}
+
+// Reads on from pic_order_cnt_type to the VUI's timing_info (7.3.2.1.1, E.1.1).
+void parse_vui_timing(BitReader &reader, SpsInfo &info) {
+  const unsigned poc_type = reader.ue();
+  if (poc_type == 0) {
+    reader.ue(); // log2_max_pic_order_cnt_lsb_minus4
+  } else if (poc_type == 1) {
+    reader.bits(1); // delta_pic_order_always_zero_flag
+    reader.se();    // offset_for_non_ref_pic
+    reader.se();    // offset_for_top_to_bottom_field
+    const unsigned cycle = reader.ue();
+    for (unsigned i = 0; i < cycle && !reader.overrun(); ++i) {
+      reader.se();
+    }
+  }
+  reader.ue();    // max_num_ref_frames
+  reader.bits(1); // gaps_in_frame_num_value_allowed_flag
+  reader.ue();    // pic_width_in_mbs_minus1
+  reader.ue();    // pic_height_in_map_units_minus1
+  if (!reader.bits(1)) {
+    reader.bits(1); // mb_adaptive_frame_field_flag
+  }
+  reader.bits(1); // direct_8x8_inference_flag
+  if (reader.bits(1)) {
+    for (int i = 0; i < 4; ++i) {
+      reader.ue(); // frame_crop_*_offset
+    }
+  }
+  if (!reader.bits(1)) {
+    return; // no VUI
+  }
+  if (reader.bits(1) && reader.bits(8) == 255) {
+    reader.bits(32); // sar_width, sar_height
+  }
+  if (reader.bits(1)) {
+    reader.bits(1); // overscan_appropriate_flag
+  }
+  if (reader.bits(1)) {
+    reader.bits(4); // video_format, video_full_range_flag
+    if (reader.bits(1)) {
+      reader.bits(24); // colour_primaries, transfer_characteristics, matrix_coefficients
+    }
+  }
+  if (reader.bits(1)) {
+    reader.ue(); // chroma_sample_loc_type_top_field
+    reader.ue(); // chroma_sample_loc_type_bottom_field
+  }
+  if (!reader.bits(1)) {
+    return;
+  }
+  const uint32_t num_units_in_tick = reader.bits(32);
+  const uint32_t time_scale = reader.bits(32);
+  // A tick is a field: two of them make a frame.
+  if (!reader.overrun() && num_units_in_tick > 0 && time_scale > 0) {
+    info.framerate = time_scale / (2.0 * num_units_in_tick);
+  }
+}
+
+} // namespace
+
+bool parse_sps(const NalUnit &nal, SpsInfo &sps) {
+  if (nal.type != kNalSps || nal.size < 4) {
+    return false;
+  }
+  std::vector<uint8_t> rbsp = unescape(nal.data + 1, nal.size - 1);
+  BitReader reader(rbsp.data(), rbsp.size());
+
+  unsigned profile_idc = reader.bits(8);
+  reader.bits(16); // constraint flags, level_idc
+  reader.ue();     // seq_parameter_set_id
+
+  SpsInfo info;
+  switch (profile_idc) {
+  case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128: case 138: case 139:
+  case 134: case 135: {
+    unsigned chroma_format_idc = reader.ue();
+    if (chroma_format_idc == 3) {
+      info.separate_colour_plane = reader.bits(1);
+    }
+    reader.ue();   // bit_depth_luma_minus8
+    reader.ue();   // bit_depth_chroma_minus8
+    reader.bits(1); // qpprime_y_zero_transform_bypass_flag
+    if (reader.bits(1)) {
+      unsigned lists = chroma_format_idc == 3 ? 12 : 8;
+      for (unsigned i = 0; i < lists; ++i) {
+        if (reader.bits(1)) {
+          skip_scaling_list(reader, i < 6 ? 16 : 64);
+        }
+      }
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  info.log2_max_frame_num = reader.ue() + 4;
+  if (reader.overrun() || info.log2_max_frame_num > 16) {
+    return false;
+  }
+  info.valid = true;
+  parse_vui_timing(reader, info);
+  sps = info;
+  return true;
+}
+
+bool parse_slice_header(const NalUnit &nal, const SpsInfo &sps, SliceInfo &slice) {
+  if ((nal.type != kNalSlice && nal.type != kNalIdrSlice) || nal.size < 2) {
+    return false;
+  }
+  // Everything up to frame_num fits comfortably in the first bytes.
+  std::vector<uint8_t> rbsp = unescape(nal.data + 1, std::min<size_t>(nal.size - 1, 32));
+  BitReader reader(rbsp.data(), rbsp.size());
+  slice.first_mb = reader.ue();
+  slice.slice_type = reader.ue();
+  reader.ue(); // pic_parameter_set_id
+  if (sps.separate_colour_plane) {
+    reader.bits(2);
+  }
+  slice.frame_num = sps.valid ? reader.bits(sps.log2_max_frame_num) : 0;
+  return !reader.overrun();
+}
+
+void AccessUnitAssembler::feed(const uint8_t *data, size_t size, const Emit &emit) {
+  pending_.insert(pending_.end(), data, data + size);
+
+  size_t pos = search_;
+  while (pos + 3 <= pending_.size()) {
+    const uint8_t *bytes = pending_.data();
+    if (bytes[pos] != 0 || bytes[pos + 1] != 0 || bytes[pos + 2] != 1) {
+      ++pos;
+      continue;
+    }
+    size_t header = pos + 3;
+    // The NAL header plus the first slice byte decide where the access unit starts.
+    if (header + 2 > pending_.size()) {
+      break;
+    }
+    size_t start = pos > 0 && bytes[pos - 1] == 0 ? pos - 1 : pos;
+    uint8_t type = bytes[header] & 0x1f;
+    bool vcl = type == kNalSlice || type == kNalIdrSlice;
+    // first_mb_in_slice is ue(v); a leading 1 bit means 0.
+    bool first_slice = vcl && (bytes[header + 1] & 0x80) != 0;
+    bool opens_unit = first_slice || type == kNalAud || type == kNalSei || type == kNalSps || type == kNalPps ||
+                      (type >= 14 && type <= 18);
+
+    if (opens_unit && has_vcl_ && start > 0) {
+      emit(bytes, start, keyframe_);
+      pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(start));
+      header -= start;
+      has_vcl_ = false;
+      keyframe_ = false;
+    }
+    if (vcl) {
+      has_vcl_ = true;
+      keyframe_ = keyframe_ || type == kNalIdrSlice;
+    }
+    pos = header;
+  }
+  search_ = pos;
+}
+
+void AccessUnitAssembler::flush(const Emit &emit) {
+  if (has_vcl_ && !pending_.empty()) {
+    emit(pending_.data(), pending_.size(), keyframe_);
+  }
+  pending_.clear();
+  search_ = 0;
+  has_vcl_ = false;
+  keyframe_ = false;
+}
+
+} // namespace h264
+
+} // namespace picam
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace picam {
+
+namespace h264 {
+
+constexpr uint8_t kNalSlice = 1;
+constexpr uint8_t kNalIdrSlice = 5;
+constexpr uint8_t kNalSei = 6;
+constexpr uint8_t kNalSps = 7;
+constexpr uint8_t kNalPps = 8;
+constexpr uint8_t kNalAud = 9;
+
+// One NAL unit of an Annex B access unit. `data` starts at the NAL header
+// byte (after the start code) and still contains emulation prevention bytes.
+struct NalUnit {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  uint8_t type = 0;
+  size_t start_code_offset = 0;
+};
+
+class NalReader {
+public:
+  NalReader(const uint8_t *data, size_t size);
+
+  bool next(NalUnit &nal);
+
+private:
+  size_t find_start_code(size_t from, size_t &code_length) const;
+
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+};
+
+// Appends RBSP bytes with emulation prevention (00 00 0x -> 00 00 03 0x).
+void append_escaped(std::vector<uint8_t> &out, const uint8_t *rbsp, size_t size);
+// Strips emulation prevention bytes.
+std::vector<uint8_t> unescape(const uint8_t *data, size_t size);
+
+// user_data_unregistered SEI messages (D.1.6) identified by a 16-byte UUID.
+// `messages` collects sei_message() RBSP; insert_sei() copies the access unit
+// into `out` with one SEI NAL carrying them in front of the first slice (SEI
+// must not follow VCL NAL units).
+void append_user_data_sei(std::vector<uint8_t> &messages, const uint8_t (&uuid)[16], const uint8_t *payload,
+                          size_t size);
+void insert_sei(const uint8_t *data, size_t size, const std::vector<uint8_t> &messages, std::vector<uint8_t> &out);
+// Looks through the SEI NALs ahead of the first slice without allocating and
+// copies up to `capacity` payload bytes following the UUID.
+bool find_user_data_sei(const uint8_t *data, size_t size, const uint8_t (&uuid)[16], uint8_t *payload,
+                        size_t capacity, size_t &payload_size);
+
+// MSB-first reader over an RBSP, with Exp-Golomb codes. Reads past the end
+// yield zeros and set overrun().
+class BitReader {
+public:
+  BitReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+  uint32_t bits(unsigned count);
+  uint32_t ue();
+  int32_t se();
+  bool overrun() const { return overrun_; }
+
+private:
+  const uint8_t *data_;
+  size_t size_;
+  size_t bit_ = 0;
+  bool overrun_ = false;
+};
+
+// The few SPS fields needed to get at frame_num in slice headers, and the
+// frame rate from the VUI timing info.
+struct SpsInfo {
+  bool valid = false;
+  unsigned log2_max_frame_num = 4;
+  bool separate_colour_plane = false;
+  // 0 when the stream carries no timing info.
+  double framerate = 0.0;
+};
+
+struct SliceInfo {
+  unsigned first_mb = 0;
+  unsigned slice_type = 0;
+  unsigned frame_num = 0;
+};
+
+bool parse_sps(const NalUnit &nal, SpsInfo &sps);
+bool parse_slice_header(const NalUnit &nal, const SpsInfo &sps, SliceInfo &slice);
+
+// Cuts an Annex B byte stream of arbitrary chunks back into access units
+// (7.4.1.2.3: an AUD, SEI, SPS or PPS, or a slice with first_mb_in_slice 0,
+// after a VCL NAL unit opens the next one). An access unit is emitted as soon
+// as the first NAL header of the following one has arrived.
+class AccessUnitAssembler {
+public:
+  using Emit = std::function<void(const uint8_t *data, size_t size, bool keyframe)>;
+
+  void feed(const uint8_t *data, size_t size, const Emit &emit);
+  // Emits whatever is left at the end of the stream.
+  void flush(const Emit &emit);
+
+private:
+  std::vector<uint8_t> pending_;
+  size_t search_ = 0;
+  bool has_vcl_ = false;
+  bool keyframe_ = false;
+};
+
+} // namespace h264
+
+} // namespace picam
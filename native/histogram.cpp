@@ -0,0 +1,90 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace picam {
+
+Histogram::Histogram(double unit) : unit_(unit) {}
+
+size_t Histogram::bucket_of(uint64_t units) {
+  if (units < kExactBuckets) {
+    return static_cast<size_t>(units);
+  }
+  units = std::min<uint64_t>(units, (1ull << (kMaxShift + 6)) - 1);
+  // Leaves the top seven bits, 64..127, as the sub-bucket.
+  unsigned shift = 63 - static_cast<unsigned>(__builtin_clzll(units)) - 6;
+  uint64_t sub_bucket = (units >> shift) - kSubBuckets;
+  return kExactBuckets + (shift - 1) * kSubBuckets + static_cast<size_t>(sub_bucket);
+}
+
+double Histogram::bucket_middle(size_t bucket) {
+  if (bucket < kExactBuckets) {
+    return static_cast<double>(bucket);
+  }
+  size_t offset = bucket - kExactBuckets;
+  unsigned shift = static_cast<unsigned>(offset / kSubBuckets) + 1;
+  uint64_t lowest = (offset % kSubBuckets + kSubBuckets) << shift;
+  return static_cast<double>(lowest) + static_cast<double>((1ull << shift) - 1) / 2.0;
+}
+
+void Histogram::record(double value) {
+  value = std::max(value, 0.0);
+  double units = std::round(value / unit_);
+  counts_[bucket_of(units < 1.8e19 ? static_cast<uint64_t>(units) : ~0ull)] += 1;
+  min_ = count_ == 0 ? value : std::min(min_, value);
+  max_ = count_ == 0 ? value : std::max(max_, value);
+  sum_ += value;
+  count_ += 1;
+}
+
+void Histogram::merge(const Histogram &other) {
+  if (other.count_ == 0) {
+    return;
+  }
+  for (size_t i = 0; i < kBuckets; ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  min_ = count_ == 0 ? other.min_ : std::min(min_, other.min_);
+  max_ = count_ == 0 ? other.max_ : std::max(max_, other.max_);
+  sum_ += other.sum_;
+  count_ += other.count_;
+}
+
+void Histogram::reset() {
+  counts_.fill(0);
+  count_ = 0;
+  sum_ = 0.0;
+  min_ = 0.0;
+  max_ = 0.0;
+}
+
+double Histogram::min() const {
+  return min_;
+}
+
+double Histogram::max() const {
+  return max_;
+}
+
+double Histogram::mean() const {
+  return count_ > 0 ? sum_ / static_cast<double>(count_) : 0.0;
+}
+
+double Histogram::percentile(double p) const {
+  if (count_ == 0) {
+    return 0.0;
+  }
+  uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(count_)));
+  rank = std::min(count_, std::max<uint64_t>(rank, 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(max_, std::max(min_, bucket_middle(i) * unit_));
+    }
+  }
+  return max_;
+}
+
+} // namespace picam
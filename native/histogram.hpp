@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace picam {
+
+// Streaming histogram in fixed memory, bucketed the way HdrHistogram does:
+// values are counted in multiples of a unit, exactly below 128 units and
+// above that in 64 linear sub-buckets per power of two, so every value is
+// kept to within 1.6% however long the run. Values past 2^40 units count as
+// the top bucket; negative values as zero.
+class Histogram {
+public:
+  explicit Histogram(double unit);
+
+  void record(double value);
+  void merge(const Histogram &other);
+  void reset();
+
+  uint64_t count() const { return count_; }
+  double min() const;
+  double max() const;
+  double mean() const;
+  // Nearest-rank percentile (p in 0..100), as the middle of its bucket and
+  // never outside the recorded range; 0 when empty.
+  double percentile(double p) const;
+
+private:
+  static constexpr unsigned kExactBuckets = 128;
+  static constexpr unsigned kSubBuckets = 64;
+  static constexpr unsigned kMaxShift = 34;
+  static constexpr size_t kBuckets = kExactBuckets + (kMaxShift - 1) * kSubBuckets;
+
+  static size_t bucket_of(uint64_t units);
+  static double bucket_middle(size_t bucket);
+
+  double unit_;
+  std::array<uint32_t, kBuckets> counts_{};
+  uint64_t count_ = 0;
+  double sum_ = 0.0;
+  double min_ = 0.0;
+  double max_ = 0.0;
+};
+
+} // namespace picam
@@ -0,0 +1,130 @@
+#include "latency.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "h264.hpp"
+#include "sample_stats.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// user_data_unregistered UUID identifying picam latency stamps.
+constexpr uint8_t kLatencyUuid[16] = {0x70, 0x69, 0x63, 0x61, 0x6d, 0x2d, 0x6c, 0x61,
+                                      0x74, 0x65, 0x6e, 0x63, 0x79, 0x2d, 0x76, 0x31};
+constexpr uint8_t kStampVersion = 1;
+constexpr size_t kStampPayloadSize = 1 + 3 * 8;
+
+const char *const kStageNames[kStageCount] = {"capture", "encode", "transport", "decode", "display", "total"};
+
+void put_u64(std::vector<uint8_t> &out, uint64_t value) {
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out.push_back(static_cast<uint8_t>(value >> shift));
+  }
+}
+
+uint64_t get_u64(const uint8_t *data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value = value << 8 | data[i];
+  }
+  return value;
+}
+
+} // namespace
+
+void append_latency_sei(std::vector<uint8_t> &messages, const LatencyStamp &stamp) {
+  std::vector<uint8_t> payload;
+  payload.push_back(kStampVersion);
+  put_u64(payload, stamp.sensor_ns);
+  put_u64(payload, stamp.delivered_ns);
+  put_u64(payload, stamp.encoded_ns);
+  h264::append_user_data_sei(messages, kLatencyUuid, payload.data(), payload.size());
+}
+
+bool find_latency_sei(const uint8_t *data, size_t size, LatencyStamp &stamp) {
+  uint8_t payload[kStampPayloadSize];
+  size_t payload_size = 0;
+  if (!h264::find_user_data_sei(data, size, kLatencyUuid, payload, sizeof(payload), payload_size) ||
+      payload_size < kStampPayloadSize || payload[0] != kStampVersion) {
+    return false;
+  }
+  stamp.sensor_ns = get_u64(payload + 1);
+  stamp.delivered_ns = get_u64(payload + 9);
+  stamp.encoded_ns = get_u64(payload + 17);
+  return true;
+}
+
+void LatencyStats::add(const uint64_t (&stage_ns)[kStageCount]) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (unsigned stage = 0; stage < kStageCount; ++stage) {
+    float ms = static_cast<float>(stage_ns[stage] / 1e6);
+    samples_[stage].push_back(ms);
+    recent_[stage].push_back(ms);
+    if (recent_[stage].size() > kWindow) {
+      recent_[stage].pop_front();
+    }
+  }
+}
+
+size_t LatencyStats::count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return samples_[kStageTotal].size();
+}
+
+std::string LatencyStats::overlay_text() const {
+  std::vector<float> window[kStageCount];
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (recent_[kStageTotal].empty()) {
+      return "G2G: waiting for stamped frames\n";
+    }
+    for (unsigned stage = 0; stage < kStageCount; ++stage) {
+      window[stage].assign(recent_[stage].begin(), recent_[stage].end());
+    }
+  }
+  for (auto &values : window) {
+    std::sort(values.begin(), values.end());
+  }
+
+  char text[256];
+  std::snprintf(text, sizeof(text),
+                "G2G p50/95/99: %.1f/%.1f/%.1f ms\nCAP %.1f ENC %.1f IPC %.1f DEC %.1f DSP %.1f\n",
+                percentile(window[kStageTotal], 50), percentile(window[kStageTotal], 95),
+                percentile(window[kStageTotal], 99), percentile(window[kStageCapture], 50),
+                percentile(window[kStageEncode], 50), percentile(window[kStageTransport], 50),
+                percentile(window[kStageDecode], 50), percentile(window[kStageDisplay], 50));
+  return text;
+}
+
+void LatencyStats::write_report(const std::string &path) const {
+  std::vector<float> sorted[kStageCount];
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (unsigned stage = 0; stage < kStageCount; ++stage) {
+      sorted[stage] = samples_[stage];
+    }
+  }
+
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw_errno("Cannot write latency report '" + path + "'");
+  }
+  std::fprintf(file, "{\n  \"frames\": %zu,\n  \"stages_ms\": {\n", sorted[kStageTotal].size());
+  for (unsigned stage = 0; stage < kStageCount; ++stage) {
+    std::sort(sorted[stage].begin(), sorted[stage].end());
+    std::fprintf(file, "    \"%s\": {\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"mean\": %.3f}%s\n",
+                 kStageNames[stage], percentile(sorted[stage], 50), percentile(sorted[stage], 95),
+                 percentile(sorted[stage], 99), mean(sorted[stage]), stage + 1 < kStageCount ? "," : "");
+  }
+  std::fprintf(file, "  }\n}\n");
+  if (std::fclose(file) != 0) {
+    throw_errno("Cannot write latency report '" + path + "'");
+  }
+}
+
+} // namespace picam
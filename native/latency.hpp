@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+// Capture-side timestamps carried to the display in an SEI user-data NAL.
+// All values are CLOCK_MONOTONIC nanoseconds, which is also the clock the
+// kernel stamps sensor frames with, so both processes share one timebase.
+struct LatencyStamp {
+  uint64_t sensor_ns = 0;
+  uint64_t delivered_ns = 0;
+  uint64_t encoded_ns = 0;
+};
+
+// Adds the stamp to the SEI messages h264::insert_sei() puts in front of the
+// access unit's first slice.
+void append_latency_sei(std::vector<uint8_t> &messages, const LatencyStamp &stamp);
+bool find_latency_sei(const uint8_t *data, size_t size, LatencyStamp &stamp);
+
+enum LatencyStage : unsigned {
+  kStageCapture,   // sensor -> frame delivered by libcamera
+  kStageEncode,    // delivered -> encoded access unit dequeued
+  kStageTransport, // encoded -> read from the ring by the display process
+  kStageDecode,    // read -> decoded frame dequeued
+  kStageDisplay,   // decoded -> latched on the display plane
+  kStageTotal,     // sensor -> display
+  kStageCount,
+};
+
+// Per-stage latency samples. The whole run is kept for the report; the
+// overlay summarises only the recent window.
+class LatencyStats {
+public:
+  void add(const uint64_t (&stage_ns)[kStageCount]);
+
+  size_t count() const;
+  std::string overlay_text() const;
+  // Writes p50/p95/p99/mean per stage as JSON; throws on I/O errors.
+  void write_report(const std::string &path) const;
+
+private:
+  static constexpr size_t kWindow = 300;
+
+  mutable std::mutex mutex_;
+  std::vector<float> samples_[kStageCount];
+  std::deque<float> recent_[kStageCount];
+};
+
+} // namespace picam
@@ -0,0 +1,77 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#include <unistd.h>
+
+#include "commands.hpp"
+#include "thread_placement.hpp"
+#include "trace.hpp"
+
+namespace {
+
+struct Command {
+  const char *name;
+  int (*run)(int argc, char **argv);
+  const char *summary;
+};
+
+const Command kCommands[] = {
+    {"capture", picam::run_capture, "libcamera -> V4L2 M2M H.264 encoder -> elementary stream"},
+    {"ring-cat", picam::run_ring_cat, "Copy a capture ring to a file, FIFO or stdout"},
+    {"metrics", picam::run_metrics, "Sample /proc for the overlay stats file without forking"},
+    {"h264-tap", picam::run_h264_tap, "Pass an H.264 byte stream through while counting frames into shared memory"},
+    {"rtp-send", picam::run_rtp_send, "Send the ring's H.264 stream as RTP over UDP"},
+    {"serve", picam::run_serve, "Serve the ring's stream to many viewers over HTTP as MPEG-TS"},
+    {"sensor-modes", picam::run_sensor_modes, "List the camera sensor's readout modes and their CSI-2 load"},
+    {"drm-preview", picam::run_drm_preview, "Decode a capture ring on /dev/video10 onto KMS planes or through GLES"},
+    {"control", picam::run_control, "Send a command to a running capture's control socket"},
+    {"replay", picam::run_replay, "Play a recorded H.264 file into the ring in place of capture"},
+};
+
+void usage() {
+  std::fprintf(stderr, "Usage: picam-native <command> [options]\n\nCommands:\n");
+  for (const auto &command : kCommands) {
+    std::fprintf(stderr, "  %-20s %s\n", command.name, command.summary);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2 || std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
+    usage();
+    return argc < 2 ? 1 : 0;
+  }
+
+  for (const auto &command : kCommands) {
+    if (std::strcmp(argv[1], command.name) != 0) {
+      continue;
+    }
+    // Set by 'picam.sh --mlock' for every stage, so commands need no option of their own.
+    const char *mlock = std::getenv("PICAM_MLOCK");
+    if (mlock && std::strcmp(mlock, "1") == 0) {
+      picam::lock_memory();
+    }
+    // Set by 'picam.sh --trace' to a directory every stage writes its own trace into.
+    const char *trace_dir = std::getenv("PICAM_TRACE");
+    if (trace_dir && *trace_dir) {
+      picam::start_tracing(std::string(trace_dir) + "/" + command.name + "-" + std::to_string(getpid()) + ".json",
+                           command.name);
+    }
+    int status = 1;
+    try {
+      status = command.run(argc - 1, argv + 1);
+    } catch (const std::exception &e) {
+      std::fprintf(stderr, "picam-native: %s\n", e.what());
+    }
+    picam::write_trace();
+    return status;
+  }
+
+  std::fprintf(stderr, "picam-native: Unknown command '%s'\n", argv[1]);
+  usage();
+  return 1;
+}
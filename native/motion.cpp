@@ -0,0 +1,108 @@
+#include "motion.hpp"
+
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "h264.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// user_data_unregistered UUID identifying picam motion state.
+constexpr uint8_t kMotionUuid[16] = {0x70, 0x69, 0x63, 0x61, 0x6d, 0x2d, 0x6d, 0x6f,
+                                     0x74, 0x69, 0x6f, 0x6e, 0x2d, 0x76, 0x30, 0x31};
+constexpr uint8_t kMotionVersion = 1;
+constexpr size_t kMotionPayloadSize = 4;
+
+// Counts pixels whose luma moved by more than `threshold`, and copies the
+// row into `previous` for the next frame.
+unsigned changed_pixels(const uint8_t *row, uint8_t *previous, unsigned count, uint8_t threshold) {
+  unsigned changed = 0;
+  unsigned i = 0;
+#if defined(__ARM_NEON)
+  const uint8x16_t limit = vdupq_n_u8(threshold);
+  uint16x8_t total = vdupq_n_u16(0);
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t current = vld1q_u8(row + i);
+    uint8x16_t mask = vcgtq_u8(vabdq_u8(current, vld1q_u8(previous + i)), limit);
+    total = vpadalq_u8(total, vshrq_n_u8(mask, 7));
+    vst1q_u8(previous + i, current);
+  }
+  uint32x4_t wide = vpaddlq_u16(total);
+  changed = vgetq_lane_u32(wide, 0) + vgetq_lane_u32(wide, 1) + vgetq_lane_u32(wide, 2) + vgetq_lane_u32(wide, 3);
+#endif
+  for (; i < count; ++i) {
+    int difference = row[i] - previous[i];
+    changed += (difference > threshold || difference < -threshold) ? 1 : 0;
+    previous[i] = row[i];
+  }
+  return changed;
+}
+
+} // namespace
+
+MotionDetector::MotionDetector(unsigned width, unsigned height, const MotionConfig &config)
+    : width_(width), height_(height), config_(config), previous_(static_cast<size_t>(width) * height) {
+  if (width_ == 0 || height_ == 0) {
+    throw Error("Motion detection needs a non-empty picture");
+  }
+}
+
+MotionState MotionDetector::update(const uint8_t *luma, unsigned stride) {
+  const uint8_t threshold = static_cast<uint8_t>(config_.pixel_threshold > 255 ? 255 : config_.pixel_threshold);
+  if (!have_previous_) {
+    for (unsigned y = 0; y < height_; ++y) {
+      std::memcpy(previous_.data() + static_cast<size_t>(y) * width_, luma + static_cast<size_t>(y) * stride, width_);
+    }
+    have_previous_ = true;
+    return state_;
+  }
+
+  uint64_t changed = 0;
+  for (unsigned y = 0; y < height_; ++y) {
+    changed += changed_pixels(luma + static_cast<size_t>(y) * stride, previous_.data() + static_cast<size_t>(y) * width_,
+                              width_, threshold);
+  }
+  state_.score_pct = 100.0 * static_cast<double>(changed) / (static_cast<double>(width_) * height_);
+
+  // Debounced both ways: a single noisy frame neither starts nor ends motion.
+  if (state_.score_pct >= config_.trigger_pct) {
+    below_ = 0;
+    if (++above_ >= config_.start_frames) {
+      state_.active = true;
+    }
+  } else {
+    above_ = 0;
+    if (++below_ >= config_.hold_frames) {
+      state_.active = false;
+    }
+  }
+  return state_;
+}
+
+void append_motion_sei(std::vector<uint8_t> &messages, const MotionState &state) {
+  unsigned score = static_cast<unsigned>(state.score_pct * 100.0 + 0.5);
+  score = score > 0xffff ? 0xffff : score;
+  const uint8_t payload[kMotionPayloadSize] = {kMotionVersion, static_cast<uint8_t>(state.active ? 1 : 0),
+                                               static_cast<uint8_t>(score >> 8), static_cast<uint8_t>(score)};
+  h264::append_user_data_sei(messages, kMotionUuid, payload, sizeof(payload));
+}
+
+bool find_motion_sei(const uint8_t *data, size_t size, MotionState &state) {
+  uint8_t payload[kMotionPayloadSize];
+  size_t payload_size = 0;
+  if (!h264::find_user_data_sei(data, size, kMotionUuid, payload, sizeof(payload), payload_size) ||
+      payload_size < kMotionPayloadSize || payload[0] != kMotionVersion) {
+    return false;
+  }
+  state.active = payload[1] != 0;
+  state.score_pct = (payload[2] << 8 | payload[3]) / 100.0;
+  return true;
+}
+
+} // namespace picam
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace picam {
+
+struct MotionState {
+  bool active = false;
+  // Share of the picture that changed since the previous frame.
+  double score_pct = 0.0;
+};
+
+struct MotionConfig {
+  // Luma difference a pixel needs to count as changed; above sensor noise.
+  unsigned pixel_threshold = 24;
+  // Changed share of the picture that counts as motion.
+  double trigger_pct = 2.0;
+  // Frames above the trigger before motion starts, and below it before it ends.
+  unsigned start_frames = 2;
+  unsigned hold_frames = 30;
+};
+
+// Frame differencing on the luma plane of the camera's low-resolution
+// stream, so nothing at full resolution is read or decoded. The changed-pixel
+// count uses NEON where available; the scalar loop is still only a few
+// hundred microseconds for a 160x120 picture on an ARMv6 core.
+class MotionDetector {
+public:
+  MotionDetector(unsigned width, unsigned height, const MotionConfig &config);
+
+  MotionState update(const uint8_t *luma, unsigned stride);
+
+private:
+  unsigned width_;
+  unsigned height_;
+  MotionConfig config_;
+  std::vector<uint8_t> previous_;
+  bool have_previous_ = false;
+  unsigned above_ = 0;
+  unsigned below_ = 0;
+  MotionState state_;
+};
+
+// Carries the detector's state to the stream consumers (overlay, DVR) in a
+// user-data SEI of each access unit.
+void append_motion_sei(std::vector<uint8_t> &messages, const MotionState &state);
+bool find_motion_sei(const uint8_t *data, size_t size, MotionState &state);
+
+} // namespace picam
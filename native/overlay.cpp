@@ -0,0 +1,355 @@
+#include "overlay.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// Same geometry as the drawtext filter used by the ffmpeg preview.
+constexpr int kMargin = 10;
+constexpr int kBorder = 8;
+constexpr int kLineSpacing = 6;
+constexpr uint8_t kBoxAlpha = 0xaa;
+constexpr float kBlackLuma = 16.0f;
+constexpr float kWhiteLuma = 235.0f;
+constexpr size_t kMaxChromaWidth = 4096;
+
+int even(int value) {
+  return (value + 1) & ~1;
+}
+
+std::vector<std::string> split_lines(const std::string &text) {
+  std::vector<std::string> lines;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    if (end == std::string::npos) {
+      end = text.size();
+    }
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+}
+
+// dst = (dst * (255 - alpha) + value * alpha) / 255, rounded.
+void blend_row(uint8_t *dst, const uint8_t *alpha, const uint8_t *value, int count) {
+  int i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t d = vld1q_u8(dst + i);
+    uint8x16_t a = vld1q_u8(alpha + i);
+    uint8x16_t v = vld1q_u8(value + i);
+    uint8x16_t ia = vmvnq_u8(a);
+    uint16x8_t lo = vmull_u8(vget_low_u8(d), vget_low_u8(ia));
+    uint16x8_t hi = vmull_u8(vget_high_u8(d), vget_high_u8(ia));
+    lo = vmlal_u8(lo, vget_low_u8(v), vget_low_u8(a));
+    hi = vmlal_u8(hi, vget_high_u8(v), vget_high_u8(a));
+    lo = vrsraq_n_u16(lo, lo, 8);
+    hi = vrsraq_n_u16(hi, hi, 8);
+    vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+  }
+#endif
+  for (; i < count; ++i) {
+    unsigned x = dst[i] * (255u - alpha[i]) + value[i] * alpha[i] + 128u;
+    dst[i] = static_cast<uint8_t>((x + (x >> 8)) >> 8);
+  }
+}
+
+} // namespace
+
+OverlayCorner parse_overlay_corner(const std::string &name) {
+  if (name == "top-left") {
+    return OverlayCorner::kTopLeft;
+  }
+  if (name == "top-right") {
+    return OverlayCorner::kTopRight;
+  }
+  if (name == "bottom-left") {
+    return OverlayCorner::kBottomLeft;
+  }
+  if (name == "bottom-right") {
+    return OverlayCorner::kBottomRight;
+  }
+  throw Error("Invalid overlay corner '" + name +
+              "'. Use one of: top-left, top-right, bottom-left, bottom-right.");
+}
+
+TextOverlay::TextOverlay(const GlyphAtlas &atlas, OverlayCorner corner)
+    : atlas_(atlas), corner_(corner), neutral_chroma_(kMaxChromaWidth, 128) {}
+
+void TextOverlay::set_corner(OverlayCorner corner) {
+  corner_ = corner;
+  ++version_;
+}
+
+int TextOverlay::line_top(size_t index) const {
+  return kBorder + static_cast<int>(index) * (atlas_.line_height() + kLineSpacing);
+}
+
+void TextOverlay::resize(Layer &layer, int width, int height) const {
+  layer.width = width;
+  layer.height = height;
+  layer.alpha.assign(static_cast<size_t>(width) * height, kBoxAlpha);
+  layer.luma.assign(static_cast<size_t>(width) * height, static_cast<uint8_t>(kBlackLuma));
+  layer.chroma_alpha.assign(static_cast<size_t>(width / 2) * (height / 2), kBoxAlpha);
+}
+
+void TextOverlay::compose_line(Layer &layer, size_t index) const {
+  const int line_height = atlas_.line_height();
+  const int top = line_top(index);
+  const int bottom = std::min(top + line_height, layer.height);
+  if (top >= bottom) {
+    return;
+  }
+
+  std::vector<uint8_t> coverage(static_cast<size_t>(layer.width) * (bottom - top), 0);
+  int pen_x = kBorder;
+  for (char c : layer.lines[index]) {
+    const Glyph *glyph = atlas_.glyph(c);
+    if (!glyph) {
+      continue;
+    }
+    const uint8_t *bitmap = atlas_.bitmap(*glyph);
+    for (int gy = 0; gy < glyph->height; ++gy) {
+      int y = atlas_.ascender() - glyph->bearing_y + gy;
+      if (y < 0 || y >= bottom - top) {
+        continue;
+      }
+      for (int gx = 0; gx < glyph->width; ++gx) {
+        int x = pen_x + glyph->bearing_x + gx;
+        if (x < 0 || x >= layer.width) {
+          continue;
+        }
+        uint8_t &cell = coverage[static_cast<size_t>(y) * layer.width + x];
+        cell = std::max(cell, bitmap[gy * glyph->width + gx]);
+      }
+    }
+    pen_x += glyph->advance;
+  }
+
+  // Fold "text over box over video" into one alpha/value pair per pixel.
+  const float box = kBoxAlpha / 255.0f;
+  for (int y = top; y < bottom; ++y) {
+    for (int x = 0; x < layer.width; ++x) {
+      float text = coverage[static_cast<size_t>(y - top) * layer.width + x] / 255.0f;
+      float alpha = 1.0f - (1.0f - box) * (1.0f - text);
+      float value = (kBlackLuma * box * (1.0f - text) + kWhiteLuma * text) / alpha;
+      size_t offset = static_cast<size_t>(y) * layer.width + x;
+      layer.alpha[offset] = static_cast<uint8_t>(alpha * 255.0f + 0.5f);
+      layer.luma[offset] = static_cast<uint8_t>(value + 0.5f);
+    }
+  }
+
+  const int chroma_width = layer.width / 2;
+  for (int cy = top / 2; cy < (bottom + 1) / 2 && cy < layer.height / 2; ++cy) {
+    const uint8_t *row0 = &layer.alpha[static_cast<size_t>(cy * 2) * layer.width];
+    const uint8_t *row1 = row0 + layer.width;
+    for (int cx = 0; cx < chroma_width; ++cx) {
+      unsigned sum = row0[cx * 2] + row0[cx * 2 + 1] + row1[cx * 2] + row1[cx * 2 + 1];
+      layer.chroma_alpha[static_cast<size_t>(cy) * chroma_width + cx] = static_cast<uint8_t>((sum + 2) / 4);
+    }
+  }
+}
+
+void TextOverlay::set_text(const std::string &text) {
+  std::vector<std::string> lines = split_lines(text);
+  const Layer &front = layers_[front_];
+  if (lines == front.lines) {
+    return;
+  }
+
+  int text_width = 0;
+  for (const auto &line : lines) {
+    text_width = std::max(text_width, atlas_.text_width(line));
+  }
+  int count = static_cast<int>(lines.size());
+  int width = even(text_width + 2 * kBorder);
+  int height = even(count * atlas_.line_height() + std::max(count - 1, 0) * kLineSpacing + 2 * kBorder);
+  // Keep the box from shrinking with every digit while the layout is stable.
+  if (lines.size() == front.lines.size()) {
+    width = std::max(width, front.width);
+  }
+
+  Layer &back = layers_[1 - front_];
+  if (width != front.width || height != front.height) {
+    resize(back, width, height);
+    back.lines = std::move(lines);
+    for (size_t i = 0; i < back.lines.size(); ++i) {
+      compose_line(back, i);
+    }
+  } else {
+    back = front;
+    for (size_t i = 0; i < lines.size(); ++i) {
+      if (lines[i] != front.lines[i]) {
+        back.lines[i] = lines[i];
+        compose_line(back, i);
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  front_ = 1 - front_;
+  ++version_;
+}
+
+bool TextOverlay::place(const Layer &layer, unsigned width, unsigned height, int &x0, int &y0, int &box_width,
+                        int &box_height) const {
+  if (layer.width == 0) {
+    return false;
+  }
+  box_width = std::min(layer.width, static_cast<int>(width) - kMargin) & ~1;
+  box_height = std::min(layer.height, static_cast<int>(height) - kMargin) & ~1;
+  if (box_width <= 0 || box_height <= 0) {
+    return false;
+  }
+
+  OverlayCorner corner = corner_;
+  bool right = corner == OverlayCorner::kTopRight || corner == OverlayCorner::kBottomRight;
+  bool bottom = corner == OverlayCorner::kBottomLeft || corner == OverlayCorner::kBottomRight;
+  x0 = right ? (static_cast<int>(width) - box_width - kMargin) & ~1 : kMargin;
+  y0 = bottom ? (static_cast<int>(height) - box_height - kMargin) & ~1 : kMargin;
+  return true;
+}
+
+void TextOverlay::blend(const YuvPlanes &frame) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Layer &layer = layers_[front_];
+  int x0, y0, width, height;
+  if (frame.y == nullptr || !place(layer, frame.width, frame.height, x0, y0, width, height)) {
+    return;
+  }
+
+  for (int row = 0; row < height; ++row) {
+    blend_row(frame.y + static_cast<size_t>(y0 + row) * frame.y_stride + x0,
+              &layer.alpha[static_cast<size_t>(row) * layer.width], &layer.luma[static_cast<size_t>(row) * layer.width],
+              width);
+  }
+
+  const int chroma_width = std::min(width / 2, static_cast<int>(kMaxChromaWidth));
+  const int layer_chroma_width = layer.width / 2;
+  for (int row = 0; row < height / 2; ++row) {
+    const uint8_t *alpha = &layer.chroma_alpha[static_cast<size_t>(row) * layer_chroma_width];
+    size_t offset = static_cast<size_t>(y0 / 2 + row) * frame.uv_stride + x0 / 2;
+    blend_row(frame.u + offset, alpha, neutral_chroma_.data(), chroma_width);
+    blend_row(frame.v + offset, alpha, neutral_chroma_.data(), chroma_width);
+  }
+}
+
+void TextOverlay::render_argb(uint32_t *pixels, unsigned stride_pixels, unsigned width, unsigned height) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (unsigned row = 0; row < height; ++row) {
+    std::fill_n(pixels + static_cast<size_t>(row) * stride_pixels, width, 0u);
+  }
+
+  const Layer &layer = layers_[front_];
+  int x0, y0, box_width, box_height;
+  if (!place(layer, width, height, x0, y0, box_width, box_height)) {
+    return;
+  }
+  argb_rows(layer, box_width, box_height, pixels + static_cast<size_t>(y0) * stride_pixels + x0, stride_pixels);
+}
+
+bool TextOverlay::render_box(std::vector<uint32_t> &pixels, unsigned width, unsigned height, int &x0, int &y0,
+                             int &box_width, int &box_height) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Layer &layer = layers_[front_];
+  if (!place(layer, width, height, x0, y0, box_width, box_height)) {
+    return false;
+  }
+  pixels.resize(static_cast<size_t>(box_width) * box_height);
+  argb_rows(layer, box_width, box_height, pixels.data(), static_cast<unsigned>(box_width));
+  return true;
+}
+
+void TextOverlay::argb_rows(const Layer &layer, int box_width, int box_height, uint32_t *pixels,
+                            unsigned stride_pixels) const {
+  // The layer holds limited-range luma; planes are composited in full range.
+  for (int row = 0; row < box_height; ++row) {
+    const uint8_t *alpha = &layer.alpha[static_cast<size_t>(row) * layer.width];
+    const uint8_t *luma = &layer.luma[static_cast<size_t>(row) * layer.width];
+    uint32_t *dst = pixels + static_cast<size_t>(row) * stride_pixels;
+    for (int x = 0; x < box_width; ++x) {
+      int full = (std::clamp<int>(luma[x], 16, 235) - 16) * 255 / 219;
+      uint32_t grey = static_cast<uint32_t>(full * alpha[x] + 127) / 255;
+      dst[x] = static_cast<uint32_t>(alpha[x]) << 24 | grey << 16 | grey << 8 | grey;
+    }
+  }
+}
+
+StatsFileFeed::StatsFileFeed(const std::string &path, TextOverlay &overlay) : path_(path), overlay_(overlay) {
+  thread_ = std::thread(&StatsFileFeed::run, this);
+}
+
+StatsFileFeed::~StatsFileFeed() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abort_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+void StatsFileFeed::set_suffix(const std::string &suffix) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  suffix_ = suffix;
+}
+
+void StatsFileFeed::run() {
+  int fd = -1;
+  timespec last_mtime{};
+  off_t last_size = -1;
+  std::string file_text;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!abort_) {
+    if (fd < 0) {
+      fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    struct stat st{};
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        (st.st_size != last_size || st.st_mtim.tv_sec != last_mtime.tv_sec ||
+         st.st_mtim.tv_nsec != last_mtime.tv_nsec)) {
+      last_size = st.st_size;
+      last_mtime = st.st_mtim;
+      char buf[1024];
+      ssize_t len = pread(fd, buf, sizeof(buf), 0);
+      if (len > 0) {
+        // The file is written for drawtext, which needs '%' escaped as '%%'.
+        file_text.clear();
+        for (ssize_t i = 0; i < len; ++i) {
+          file_text.push_back(buf[i]);
+          if (buf[i] == '%' && i + 1 < len && buf[i + 1] == '%') {
+            ++i;
+          }
+        }
+      }
+    }
+    if (!file_text.empty() || !suffix_.empty()) {
+      std::string text = file_text;
+      if (!text.empty() && text.back() != '\n') {
+        text.push_back('\n');
+      }
+      overlay_.set_text(text + suffix_);
+    }
+    wake_.wait_for(lock, std::chrono::milliseconds(250));
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+} // namespace picam
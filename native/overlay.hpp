@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glyph_atlas.hpp"
+
+namespace picam {
+
+// In the order of RingMessage::kCorner*, which carry it to 'drm-preview'.
+enum class OverlayCorner { kTopLeft, kTopRight, kBottomLeft, kBottomRight };
+
+OverlayCorner parse_overlay_corner(const std::string &name);
+
+struct YuvPlanes {
+  uint8_t *y = nullptr;
+  uint8_t *u = nullptr;
+  uint8_t *v = nullptr;
+  unsigned y_stride = 0;
+  unsigned uv_stride = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+};
+
+// Stats box drawn the way the drawtext filter drew it (white text on a
+// translucent black box) but straight into YUV420 frames. Text changes are
+// composed, line by line, into a per-pixel alpha/value layer; blend() then only
+// touches the box and needs no font code.
+class TextOverlay {
+public:
+  TextOverlay(const GlyphAtlas &atlas, OverlayCorner corner);
+
+  // Only lines that differ from the current text are re-rendered.
+  void set_text(const std::string &text);
+  void set_corner(OverlayCorner corner);
+  void blend(const YuvPlanes &frame);
+
+  // Bumped on every text or corner change, so plane-based consumers only
+  // redraw when something actually moved.
+  uint64_t version() const { return version_; }
+  // Draws the box as premultiplied ARGB8888 into its corner of a width x height
+  // canvas and clears the rest to transparent.
+  void render_argb(uint32_t *pixels, unsigned stride_pixels, unsigned width, unsigned height);
+  // Draws just the box, box_width pixels per row, and reports where it sits on
+  // a width x height canvas. False while there is nothing to show.
+  bool render_box(std::vector<uint32_t> &pixels, unsigned width, unsigned height, int &x0, int &y0, int &box_width,
+                  int &box_height);
+
+private:
+  struct Layer {
+    int width = 0;
+    int height = 0;
+    std::vector<std::string> lines;
+    std::vector<uint8_t> alpha;
+    std::vector<uint8_t> luma;
+    std::vector<uint8_t> chroma_alpha;
+  };
+
+  void resize(Layer &layer, int width, int height) const;
+  void compose_line(Layer &layer, size_t index) const;
+  int line_top(size_t index) const;
+  bool place(const Layer &layer, unsigned width, unsigned height, int &x0, int &y0, int &box_width,
+             int &box_height) const;
+  void argb_rows(const Layer &layer, int box_width, int box_height, uint32_t *pixels, unsigned stride_pixels) const;
+
+  const GlyphAtlas &atlas_;
+  std::atomic<OverlayCorner> corner_;
+  std::atomic<uint64_t> version_{0};
+  std::vector<uint8_t> neutral_chroma_;
+
+  std::mutex mutex_;
+  Layer layers_[2];
+  int front_ = 0;
+};
+
+// Follows the stats file written by 'picam-native metrics' and pushes changes
+// into the overlay from a background thread.
+class StatsFileFeed {
+public:
+  StatsFileFeed(const std::string &path, TextOverlay &overlay);
+  ~StatsFileFeed();
+
+  StatsFileFeed(const StatsFileFeed &) = delete;
+  StatsFileFeed &operator=(const StatsFileFeed &) = delete;
+
+  // Extra lines shown below the file's text (e.g. live latency figures).
+  void set_suffix(const std::string &suffix);
+
+private:
+  void run();
+
+  std::string path_;
+  TextOverlay &overlay_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool abort_ = false;
+  std::string suffix_;
+  std::thread thread_;
+};
+
+} // namespace picam
@@ -0,0 +1,180 @@
+#include "proc_stats.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace picam {
+
+namespace {
+
+int open_proc_file(pid_t pid, const char *name) {
+  std::string path = "/proc/" + std::to_string(pid) + "/" + name;
+  return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+ssize_t read_whole(int fd, char *buf, size_t size) {
+  ssize_t len = pread(fd, buf, size - 1, 0);
+  if (len >= 0) {
+    buf[len] = '\0';
+  }
+  return len;
+}
+
+} // namespace
+
+ProcessStats::ProcessStats(pid_t pid) : pid_(pid) {
+  stat_fd_ = open_proc_file(pid, "stat");
+  statm_fd_ = open_proc_file(pid, "statm");
+  smaps_fd_ = open_proc_file(pid, "smaps_rollup");
+}
+
+ProcessStats::ProcessStats(ProcessStats &&other) noexcept
+    : pid_(other.pid_), stat_fd_(other.stat_fd_), statm_fd_(other.statm_fd_), smaps_fd_(other.smaps_fd_) {
+  other.stat_fd_ = -1;
+  other.statm_fd_ = -1;
+  other.smaps_fd_ = -1;
+}
+
+ProcessStats::~ProcessStats() {
+  if (stat_fd_ >= 0) {
+    close(stat_fd_);
+  }
+  if (statm_fd_ >= 0) {
+    close(statm_fd_);
+  }
+  if (smaps_fd_ >= 0) {
+    close(smaps_fd_);
+  }
+}
+
+ProcessSample ProcessStats::sample() {
+  ProcessSample result;
+  if (stat_fd_ < 0 || statm_fd_ < 0) {
+    return result;
+  }
+
+  // Reading a dead process' files fails with ESRCH even on a kept fd.
+  char buf[1024];
+  if (read_whole(stat_fd_, buf, sizeof(buf)) <= 0) {
+    return result;
+  }
+  // comm may contain spaces and parentheses; fields resume after the last ')'.
+  const char *fields = std::strrchr(buf, ')');
+  if (!fields) {
+    return result;
+  }
+  unsigned long long utime = 0;
+  unsigned long long stime = 0;
+  if (std::sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+    return result;
+  }
+
+  char statm[128];
+  unsigned long long size = 0;
+  unsigned long long resident = 0;
+  if (read_whole(statm_fd_, statm, sizeof(statm)) <= 0 || std::sscanf(statm, "%llu %llu", &size, &resident) != 2) {
+    return result;
+  }
+
+  result.alive = true;
+  result.cpu_ticks = utime + stime;
+  result.rss_pages = resident;
+
+  char smaps[1024];
+  if (smaps_fd_ >= 0 && read_whole(smaps_fd_, smaps, sizeof(smaps)) > 0) {
+    const char *pss = std::strstr(smaps, "\nPss:");
+    unsigned long long pss_kib = 0;
+    if (pss && std::sscanf(pss, "\nPss: %llu kB", &pss_kib) == 1) {
+      result.pss_kib = pss_kib;
+    }
+  }
+  return result;
+}
+
+SystemCpuStats::SystemCpuStats() {
+  fd_ = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+}
+
+SystemCpuStats::~SystemCpuStats() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+double SystemCpuStats::sample() {
+  char buf[256];
+  if (fd_ < 0 || read_whole(fd_, buf, sizeof(buf)) <= 0) {
+    return 0.0;
+  }
+  unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+  if (std::sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait, &irq,
+                  &softirq, &steal) < 4) {
+    return 0.0;
+  }
+  uint64_t idle_all = idle + iowait;
+  uint64_t total = user + nice + system + irq + softirq + steal + idle_all;
+  uint64_t busy = total - idle_all;
+  double pct = 0.0;
+  if (last_total_ > 0 && total > last_total_) {
+    pct = static_cast<double>(busy - last_busy_) * 100.0 / static_cast<double>(total - last_total_);
+  }
+  last_busy_ = busy;
+  last_total_ = total;
+  return pct;
+}
+
+SystemMemoryStats::SystemMemoryStats() {
+  fd_ = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+}
+
+SystemMemoryStats::~SystemMemoryStats() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+MemorySample SystemMemoryStats::sample() {
+  MemorySample result;
+  char buf[4096];
+  if (fd_ < 0 || read_whole(fd_, buf, sizeof(buf)) <= 0) {
+    return result;
+  }
+  auto field = [&buf](const char *name) -> uint64_t {
+    const char *line = std::strstr(buf, name);
+    unsigned long long kib = 0;
+    return line && std::sscanf(line + std::strlen(name), " %llu", &kib) == 1 ? kib : 0;
+  };
+  result.cached_kib = field("\nCached:");
+  result.cma_total_kib = field("\nCmaTotal:");
+  result.cma_free_kib = field("\nCmaFree:");
+  return result;
+}
+
+long clock_ticks_per_second() {
+  static const long ticks = sysconf(_SC_CLK_TCK);
+  return ticks;
+}
+
+uint64_t memory_total_bytes() {
+  FILE *meminfo = std::fopen("/proc/meminfo", "re");
+  if (!meminfo) {
+    return 0;
+  }
+  char line[256];
+  uint64_t total_kib = 0;
+  while (std::fgets(line, sizeof(line), meminfo)) {
+    if (std::sscanf(line, "MemTotal: %" SCNu64 " kB", &total_kib) == 1) {
+      break;
+    }
+  }
+  std::fclose(meminfo);
+  return total_kib * 1024;
+}
+
+} // namespace picam
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <sys/types.h>
+
+namespace picam {
+
+struct ProcessSample {
+  bool alive = false;
+  uint64_t cpu_ticks = 0;
+  uint64_t rss_pages = 0;
+  // Resident set with shared pages split between their users; 0 on kernels
+  // without smaps_rollup.
+  uint64_t pss_kib = 0;
+};
+
+// Keeps /proc/<pid>/stat, statm and smaps_rollup open and re-reads them with
+// pread, so sampling costs two syscalls per file and never forks.
+class ProcessStats {
+public:
+  explicit ProcessStats(pid_t pid);
+  ~ProcessStats();
+
+  ProcessStats(ProcessStats &&other) noexcept;
+  ProcessStats(const ProcessStats &) = delete;
+  ProcessStats &operator=(const ProcessStats &) = delete;
+
+  pid_t pid() const { return pid_; }
+  ProcessSample sample();
+
+private:
+  pid_t pid_;
+  int stat_fd_ = -1;
+  int statm_fd_ = -1;
+  int smaps_fd_ = -1;
+};
+
+// Busy share of all CPUs from the first line of /proc/stat, between two
+// calls to sample(); the file stays open like ProcessStats' ones.
+class SystemCpuStats {
+public:
+  SystemCpuStats();
+  ~SystemCpuStats();
+
+  SystemCpuStats(const SystemCpuStats &) = delete;
+  SystemCpuStats &operator=(const SystemCpuStats &) = delete;
+
+  // Percent of all CPUs busy since the previous call; 0 on the first one.
+  double sample();
+
+private:
+  int fd_ = -1;
+  uint64_t last_busy_ = 0;
+  uint64_t last_total_ = 0;
+};
+
+struct MemorySample {
+  uint64_t cached_kib = 0;
+  // The contiguous pool camera, ISP and codec buffers come from.
+  uint64_t cma_total_kib = 0;
+  uint64_t cma_free_kib = 0;
+};
+
+// Page cache and CMA usage from /proc/meminfo, kept open like the others.
+class SystemMemoryStats {
+public:
+  SystemMemoryStats();
+  ~SystemMemoryStats();
+
+  SystemMemoryStats(const SystemMemoryStats &) = delete;
+  SystemMemoryStats &operator=(const SystemMemoryStats &) = delete;
+
+  MemorySample sample();
+
+private:
+  int fd_ = -1;
+};
+
+long clock_ticks_per_second();
+uint64_t memory_total_bytes();
+
+} // namespace picam
@@ -0,0 +1,116 @@
+#include "rate_controller.hpp"
+
+#include <algorithm>
+
+#include "h264.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// Ring fill that means the reader is falling behind rather than absorbing
+// an IDR burst.
+constexpr double kBacklogHighPct = 25.0;
+constexpr double kCpuHighPct = 90.0;
+// CPU below which a frame-rate probe is allowed.
+constexpr double kCpuProbePct = 75.0;
+constexpr double kEncoderQueueHighPct = 80.0;
+// Quiet seconds before the first probe, and between probes after that.
+constexpr unsigned kRecoverSeconds = 5;
+constexpr unsigned kProbeSeconds = 2;
+// Seconds a cut gets to show its effect before the next one, unless frames
+// are still being lost.
+constexpr unsigned kCooldownSeconds = 2;
+
+// user_data_unregistered UUID identifying the picam rate setting.
+constexpr uint8_t kRateUuid[16] = {0x70, 0x69, 0x63, 0x61, 0x6d, 0x2d, 0x72, 0x61,
+                                   0x74, 0x65, 0x63, 0x74, 0x6c, 0x2d, 0x76, 0x31};
+constexpr uint8_t kRateVersion = 1;
+constexpr size_t kRatePayloadSize = 1 + 2 + 4;
+
+} // namespace
+
+RateController::RateController(const RateLimits &limits) : limits_(limits) {
+  if (limits_.min_bitrate == 0 || limits_.min_bitrate > limits_.max_bitrate) {
+    throw Error("Minimum bitrate must be between 1 and the bitrate");
+  }
+  if (limits_.min_framerate == 0 || limits_.min_framerate > limits_.max_framerate) {
+    throw Error("Minimum frame rate must be between 1 and the frame rate");
+  }
+  setting_.bitrate = limits_.max_bitrate;
+  setting_.framerate = limits_.max_framerate;
+}
+
+bool RateController::update(const RateInputs &inputs) {
+  const bool losing = inputs.backlog_drops > 0 || inputs.encoder_drops > 0;
+  const bool congested = inputs.backlog_drops > 0 || inputs.backlog_pct >= kBacklogHighPct;
+  const bool overloaded = inputs.encoder_drops > 0 || inputs.cpu_pct >= kCpuHighPct ||
+                          inputs.encoder_queue_pct >= kEncoderQueueHighPct;
+  if (cooldown_ > 0) {
+    --cooldown_;
+  }
+
+  RateSetting next = setting_;
+  if (congested || overloaded) {
+    calm_ = 0;
+    if (cooldown_ > 0 && !losing) {
+      return false;
+    }
+    cooldown_ = kCooldownSeconds;
+    bool cut_bitrate = congested;
+    if (overloaded) {
+      if (next.framerate > limits_.min_framerate) {
+        next.framerate = std::max(limits_.min_framerate, next.framerate - std::max(1u, next.framerate / 6));
+      } else {
+        // At the floor: fewer bits still means less for the decoder and the
+        // network stack to chew on.
+        cut_bitrate = true;
+      }
+    }
+    if (cut_bitrate) {
+      next.bitrate = std::max(limits_.min_bitrate, next.bitrate / 4 * 3);
+    }
+    reason_ = congested && overloaded ? "send backlog and CPU" : congested ? "send backlog" : "CPU";
+  } else if (++calm_ >= kRecoverSeconds) {
+    calm_ = kRecoverSeconds - kProbeSeconds;
+    if (next.framerate < limits_.max_framerate && inputs.cpu_pct < kCpuProbePct) {
+      next.framerate = std::min(limits_.max_framerate, next.framerate + std::max(1u, limits_.max_framerate / 10));
+    } else if (next.bitrate < limits_.max_bitrate) {
+      next.bitrate = std::min(limits_.max_bitrate, next.bitrate + std::max(1u, limits_.max_bitrate / 10));
+    }
+    reason_ = "probing";
+  }
+
+  bool changed = next.bitrate != setting_.bitrate || next.framerate != setting_.framerate;
+  setting_ = next;
+  return changed;
+}
+
+void append_rate_sei(std::vector<uint8_t> &messages, const RateSetting &setting) {
+  const uint8_t payload[kRatePayloadSize] = {
+      kRateVersion,
+      static_cast<uint8_t>(setting.framerate >> 8),
+      static_cast<uint8_t>(setting.framerate),
+      static_cast<uint8_t>(setting.bitrate >> 24),
+      static_cast<uint8_t>(setting.bitrate >> 16),
+      static_cast<uint8_t>(setting.bitrate >> 8),
+      static_cast<uint8_t>(setting.bitrate),
+  };
+  h264::append_user_data_sei(messages, kRateUuid, payload, sizeof(payload));
+}
+
+bool find_rate_sei(const uint8_t *data, size_t size, RateSetting &setting) {
+  uint8_t payload[kRatePayloadSize];
+  size_t payload_size = 0;
+  if (!h264::find_user_data_sei(data, size, kRateUuid, payload, sizeof(payload), payload_size) ||
+      payload_size < kRatePayloadSize || payload[0] != kRateVersion) {
+    return false;
+  }
+  setting.framerate = static_cast<unsigned>(payload[1]) << 8 | payload[2];
+  setting.bitrate = static_cast<unsigned>(payload[3]) << 24 | static_cast<unsigned>(payload[4]) << 16 |
+                    static_cast<unsigned>(payload[5]) << 8 | payload[6];
+  return true;
+}
+
+} // namespace picam
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace picam {
+
+struct RateSetting {
+  unsigned bitrate = 0;
+  unsigned framerate = 0;
+};
+
+struct RateLimits {
+  unsigned max_bitrate = 0;
+  unsigned min_bitrate = 0;
+  unsigned max_framerate = 0;
+  unsigned min_framerate = 0;
+};
+
+// What the capture process sees of the pipeline over one interval.
+struct RateInputs {
+  // Encoder input slots still owned by the encoder, and frames it refused
+  // because every slot was taken.
+  double encoder_queue_pct = 0.0;
+  uint64_t encoder_drops = 0;
+  // Ring fill and overwrites: the stage behind it (decoder, RTP sender on
+  // Wi-Fi) is not keeping up.
+  double backlog_pct = 0.0;
+  uint64_t backlog_drops = 0;
+  double cpu_pct = 0.0;
+};
+
+// Closed-loop bitrate and frame-rate control, updated once per second. A
+// send backlog cuts the bitrate multiplicatively; CPU or encoder saturation
+// cuts the frame rate first, then the bitrate once the rate is at its floor.
+// After a few quiet seconds both are probed back up in small steps, frame
+// rate first while the CPU has headroom.
+class RateController {
+public:
+  explicit RateController(const RateLimits &limits);
+
+  // Returns true when setting() changed; reason() says why.
+  bool update(const RateInputs &inputs);
+
+  const RateSetting &setting() const { return setting_; }
+  const char *reason() const { return reason_; }
+
+private:
+  RateLimits limits_;
+  RateSetting setting_;
+  const char *reason_ = "";
+  unsigned calm_ = 0;
+  unsigned cooldown_ = 0;
+};
+
+// Carries the current setting to the stream consumers in a user-data SEI
+// of each access unit, so drop detection follows the frame rate.
+void append_rate_sei(std::vector<uint8_t> &messages, const RateSetting &setting);
+bool find_rate_sei(const uint8_t *data, size_t size, RateSetting &setting);
+
+} // namespace picam
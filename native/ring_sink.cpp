@@ -0,0 +1,16 @@
+#include "ring_sink.hpp"
+
+namespace picam {
+
+RingSink::RingSink(const std::string &socket_path, size_t capacity)
+    : ring_(ShmRing::create(capacity)), server_(socket_path, ring_.fd()) {}
+
+RingSink::~RingSink() {
+  ring_.close();
+}
+
+void RingSink::write(const EncodedFrame &frame) {
+  ring_.publish(frame);
+}
+
+} // namespace picam
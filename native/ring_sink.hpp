@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "frame.hpp"
+#include "ring_socket.hpp"
+#include "shm_ring.hpp"
+
+namespace picam {
+
+class RingSink : public FrameSink {
+public:
+  RingSink(const std::string &socket_path, size_t capacity);
+  ~RingSink() override;
+
+  void write(const EncodedFrame &frame) override;
+
+  const ShmRing &ring() const { return ring_; }
+  void set_on_attach(std::function<void()> on_attach) { server_.set_on_attach(std::move(on_attach)); }
+  bool send_message(RingMessage message) { return server_.send_message(message); }
+  unsigned consumer_features() const { return server_.consumer_features(); }
+
+private:
+  ShmRing ring_;
+  RingServer server_;
+};
+
+} // namespace picam
@@ -0,0 +1,227 @@
+#include "ring_socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+sockaddr_un make_address(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    throw Error("Socket path '" + path + "' is too long");
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+void send_fd(int socket_fd, int fd) {
+  char byte = 'R';
+  iovec iov{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) < 0) {
+    throw_errno("Cannot pass the ring to the consumer");
+  }
+}
+
+int receive_fd(int socket_fd) {
+  char byte = 0;
+  iovec iov{&byte, 1};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t ret;
+  do {
+    ret = recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+  if (ret <= 0) {
+    throw Error("Producer closed the ring socket before sending the ring");
+  }
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+    throw Error("Producer did not send a ring descriptor");
+  }
+  int fd;
+  std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  return fd;
+}
+
+} // namespace
+
+RingServer::RingServer(const std::string &path, int ring_fd) : path_(path), ring_fd_(ring_fd) {
+  sockaddr_un addr = make_address(path);
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    throw_errno("Cannot create ring socket");
+  }
+  unlink(path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 || listen(listen_fd_, 4) < 0) {
+    int saved = errno;
+    close(listen_fd_);
+    errno = saved;
+    throw_errno("Cannot listen on '" + path + "'");
+  }
+  thread_ = std::thread(&RingServer::accept_loop, this);
+}
+
+RingServer::~RingServer() {
+  abort_ = true;
+  thread_.join();
+  if (client_fd_ >= 0) {
+    close(client_fd_);
+  }
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+void RingServer::set_on_attach(std::function<void()> on_attach) {
+  std::lock_guard<std::mutex> lock(on_attach_mutex_);
+  on_attach_ = std::move(on_attach);
+}
+
+bool RingServer::send_message(RingMessage message) {
+  std::lock_guard<std::mutex> lock(client_mutex_);
+  const char byte = static_cast<char>(message);
+  return client_fd_ >= 0 && send(client_fd_, &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL) == 1;
+}
+
+void RingServer::accept_loop() {
+  while (!abort_) {
+    pollfd pfds[2] = {{listen_fd_, POLLIN, 0}, {client_fd_, POLLIN, 0}};
+    if (poll(pfds, client_fd_ >= 0 ? 2 : 1, 200) <= 0) {
+      continue;
+    }
+    if (client_fd_ >= 0 && pfds[1].revents) {
+      read_client();
+    }
+    if (!(pfds[0].revents & POLLIN)) {
+      continue;
+    }
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    try {
+      send_fd(fd, ring_fd_);
+    } catch (const Error &) {
+      close(fd);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    if (client_fd_ >= 0) {
+      close(client_fd_);
+    }
+    client_fd_ = fd;
+    consumer_features_ = 0;
+  }
+}
+
+void RingServer::read_client() {
+  char byte;
+  ssize_t len = recv(client_fd_, &byte, 1, MSG_DONTWAIT);
+  if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+    std::lock_guard<std::mutex> lock(client_mutex_);
+    close(client_fd_);
+    client_fd_ = -1;
+    consumer_features_ = 0;
+    return;
+  }
+  if (len == 1) {
+    // Bit 0 marks the attach byte; the rest are the consumer's features.
+    consumer_features_ = static_cast<unsigned char>(byte) & ~1u;
+    std::lock_guard<std::mutex> lock(on_attach_mutex_);
+    if (on_attach_) {
+      on_attach_();
+    }
+  }
+}
+
+RingConnection connect_ring(const std::string &path, int timeout_ms) {
+  sockaddr_un addr = make_address(path);
+  uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ull;
+
+  for (;;) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw_errno("Cannot create ring socket");
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+      RingConnection connection;
+      connection.socket_fd = fd;
+      try {
+        connection.ring_fd = receive_fd(fd);
+      } catch (...) {
+        close(fd);
+        throw;
+      }
+      return connection;
+    }
+    int saved = errno;
+    close(fd);
+    if ((saved != ENOENT && saved != ECONNREFUSED) || monotonic_ns() >= deadline) {
+      errno = saved;
+      throw_errno("Cannot connect to ring socket '" + path + "'");
+    }
+    usleep(50000);
+  }
+}
+
+void notify_ring_attached(int socket_fd, unsigned features) {
+  const char byte = static_cast<char>(1u | features);
+  send(socket_fd, &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+bool ring_peer_gone(int socket_fd) {
+  pollfd pfd{socket_fd, POLLIN, 0};
+  if (poll(&pfd, 1, 0) <= 0) {
+    return false;
+  }
+  if (pfd.revents & (POLLHUP | POLLERR)) {
+    return true;
+  }
+  // Peeked, so a message from the producer stays for read_ring_message().
+  char byte;
+  return recv(socket_fd, &byte, 1, MSG_DONTWAIT | MSG_PEEK) == 0;
+}
+
+RingMessage read_ring_message(int socket_fd) {
+  char byte;
+  if (recv(socket_fd, &byte, 1, MSG_DONTWAIT) != 1) {
+    return RingMessage::kNone;
+  }
+  switch (static_cast<RingMessage>(byte)) {
+  case RingMessage::kRecordStart:
+  case RingMessage::kRecordStop:
+  case RingMessage::kCornerTopLeft:
+  case RingMessage::kCornerTopRight:
+  case RingMessage::kCornerBottomLeft:
+  case RingMessage::kCornerBottomRight:
+    return static_cast<RingMessage>(byte);
+  default:
+    return RingMessage::kNone;
+  }
+}
+
+} // namespace picam
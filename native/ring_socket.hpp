@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace picam {
+
+// Bytes the producer sends down the ring socket to steer the consumer.
+enum class RingMessage : char {
+  kNone = 0,
+  kRecordStart = 'r',
+  kRecordStop = 's',
+  // Where a consumer that draws the overlay puts it.
+  kCornerTopLeft = '1',
+  kCornerTopRight = '2',
+  kCornerBottomLeft = '3',
+  kCornerBottomRight = '4',
+};
+
+// What a consumer tells the producer it follows when it attaches, so the
+// control socket does not promise what nobody behind the ring carries out.
+enum RingFeature : unsigned {
+  kRingFollowsRecord = 1u << 1,
+  kRingFollowsCorner = 1u << 2,
+};
+
+// Hands the ring's memfd to a consumer over a UNIX socket (SCM_RIGHTS). The
+// connection stays open so each side notices when the other one goes away; a
+// new consumer replaces the previous one, keeping the ring single-consumer.
+class RingServer {
+public:
+  RingServer(const std::string &path, int ring_fd);
+  ~RingServer();
+
+  RingServer(const RingServer &) = delete;
+  RingServer &operator=(const RingServer &) = delete;
+
+  // Runs on the server thread once a consumer has attached to the ring (see
+  // notify_ring_attached()), e.g. to have the encoder start a new GOP.
+  void set_on_attach(std::function<void()> on_attach);
+  // False when no consumer is attached.
+  bool send_message(RingMessage message);
+  // RingFeature bits of the attached consumer; 0 while none has attached.
+  unsigned consumer_features() const { return consumer_features_; }
+
+private:
+  void accept_loop();
+  void read_client();
+
+  std::string path_;
+  int ring_fd_;
+  int listen_fd_ = -1;
+  // Written by the server thread under client_mutex_, which send_message() holds.
+  int client_fd_ = -1;
+  std::mutex client_mutex_;
+  std::atomic<unsigned> consumer_features_{0};
+  std::mutex on_attach_mutex_;
+  std::function<void()> on_attach_;
+  std::atomic<bool> abort_{false};
+  std::thread thread_;
+};
+
+struct RingConnection {
+  int socket_fd = -1;
+  int ring_fd = -1;
+};
+
+// Retries until the producer has created the socket or the timeout expires.
+RingConnection connect_ring(const std::string &path, int timeout_ms);
+
+// Tells the producer that the ring is attached and the consumer reads from
+// the current head on, so whatever it publishes next is seen. `features` are
+// the RingFeature bits of the messages the consumer acts on.
+void notify_ring_attached(int socket_fd, unsigned features = 0);
+
+bool ring_peer_gone(int socket_fd);
+
+// Consumer side: the next message the producer sent, kNone when there is
+// none. Never blocks, so it can be asked once per frame.
+RingMessage read_ring_message(int socket_fd);
+
+} // namespace picam
@@ -0,0 +1,123 @@
+#include "roi.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "h264.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// user_data_unregistered UUID identifying the picam crop rectangle.
+constexpr uint8_t kRoiUuid[16] = {0x70, 0x69, 0x63, 0x61, 0x6d, 0x2d, 0x72, 0x6f,
+                                  0x69, 0x63, 0x72, 0x6f, 0x70, 0x2d, 0x76, 0x31};
+constexpr uint8_t kRoiVersion = 1;
+constexpr size_t kRoiPayloadSize = 1 + 4 * 2;
+
+unsigned even(double value) {
+  return static_cast<unsigned>(std::max(0.0, value)) & ~1u;
+}
+
+} // namespace
+
+Roi parse_roi(const std::string &value) {
+  double fields[4];
+  const char *cursor = value.c_str();
+  for (int i = 0; i < 4; ++i) {
+    char *end = nullptr;
+    fields[i] = std::strtod(cursor, &end);
+    if (end == cursor || *end != (i < 3 ? ',' : '\0') || fields[i] < 0.0 || fields[i] > 1.0) {
+      throw Error("Invalid region of interest '" + value + "'; use x,y,w,h as fractions between 0 and 1");
+    }
+    cursor = end + 1;
+  }
+  Roi roi{fields[0], fields[1], fields[2], fields[3]};
+  if (roi.width <= 0.0 || roi.height <= 0.0 || roi.x + roi.width > 1.0 + 1e-9 || roi.y + roi.height > 1.0 + 1e-9) {
+    throw Error("Region of interest '" + value + "' does not lie inside the frame");
+  }
+  return roi;
+}
+
+std::string format_roi(const Roi &roi) {
+  char text[64];
+  std::snprintf(text, sizeof(text), "%.3f,%.3f,%.3f,%.3f", roi.x, roi.y, roi.width, roi.height);
+  return text;
+}
+
+CropRect roi_crop(const Roi &roi, const CropRect &maximum, unsigned output_width, unsigned output_height) {
+  const double aspect = static_cast<double>(output_width) / output_height;
+  double width = roi.width * maximum.width;
+  double height = roi.height * maximum.height;
+  if (width < height * aspect) {
+    width = height * aspect;
+  } else {
+    height = width / aspect;
+  }
+  if (width > maximum.width) {
+    width = maximum.width;
+    height = width / aspect;
+  }
+  if (height > maximum.height) {
+    height = maximum.height;
+    width = height * aspect;
+  }
+  const double centre_x = (roi.x + roi.width / 2.0) * maximum.width;
+  const double centre_y = (roi.y + roi.height / 2.0) * maximum.height;
+
+  CropRect crop;
+  crop.width = std::max(2u, even(width));
+  crop.height = std::max(2u, even(height));
+  const double left = std::clamp(centre_x - crop.width / 2.0, 0.0, static_cast<double>(maximum.width - crop.width));
+  const double top = std::clamp(centre_y - crop.height / 2.0, 0.0, static_cast<double>(maximum.height - crop.height));
+  crop.x = maximum.x + even(left);
+  crop.y = maximum.y + even(top);
+  return crop;
+}
+
+Roi crop_roi(const CropRect &crop, const CropRect &maximum) {
+  Roi roi;
+  if (maximum.empty()) {
+    return roi;
+  }
+  roi.x = static_cast<double>(crop.x - std::min(crop.x, maximum.x)) / maximum.width;
+  roi.y = static_cast<double>(crop.y - std::min(crop.y, maximum.y)) / maximum.height;
+  roi.width = static_cast<double>(crop.width) / maximum.width;
+  roi.height = static_cast<double>(crop.height) / maximum.height;
+  return roi;
+}
+
+std::string describe_crop(const CropRect &crop) {
+  return std::to_string(crop.width) + "x" + std::to_string(crop.height) + "+" + std::to_string(crop.x) + "+" +
+         std::to_string(crop.y);
+}
+
+void append_roi_sei(std::vector<uint8_t> &messages, const CropRect &crop) {
+  const unsigned fields[4] = {crop.x, crop.y, crop.width, crop.height};
+  uint8_t payload[kRoiPayloadSize] = {kRoiVersion};
+  for (int i = 0; i < 4; ++i) {
+    payload[1 + 2 * i] = static_cast<uint8_t>(fields[i] >> 8);
+    payload[2 + 2 * i] = static_cast<uint8_t>(fields[i]);
+  }
+  h264::append_user_data_sei(messages, kRoiUuid, payload, sizeof(payload));
+}
+
+bool find_roi_sei(const uint8_t *data, size_t size, CropRect &crop) {
+  uint8_t payload[kRoiPayloadSize];
+  size_t payload_size = 0;
+  if (!h264::find_user_data_sei(data, size, kRoiUuid, payload, sizeof(payload), payload_size) ||
+      payload_size < kRoiPayloadSize || payload[0] != kRoiVersion) {
+    return false;
+  }
+  unsigned fields[4];
+  for (int i = 0; i < 4; ++i) {
+    fields[i] = static_cast<unsigned>(payload[1 + 2 * i]) << 8 | payload[2 + 2 * i];
+  }
+  crop = CropRect{fields[0], fields[1], fields[2], fields[3]};
+  return true;
+}
+
+} // namespace picam
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+// Region of interest as fractions of the sensor mode's largest crop, the
+// way libcamera-vid --roi takes it: x, y of the top-left corner, then the
+// width and height.
+struct Roi {
+  double x = 0.0;
+  double y = 0.0;
+  double width = 1.0;
+  double height = 1.0;
+};
+
+// ScalerCrop rectangle in sensor pixels.
+struct CropRect {
+  unsigned x = 0;
+  unsigned y = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+
+  bool empty() const { return width == 0 || height == 0; }
+};
+
+// "x,y,w,h" with every value between 0 and 1 and the region inside the
+// frame; throws otherwise.
+Roi parse_roi(const std::string &value);
+std::string format_roi(const Roi &roi);
+
+// The crop of `maximum` covering roi, grown around its centre to the output
+// aspect ratio (and shrunk only where the maximum ends) so the ISP scales
+// it to output_width x output_height without stretching. Even-aligned.
+CropRect roi_crop(const Roi &roi, const CropRect &maximum, unsigned output_width, unsigned output_height);
+// roi_crop() backwards: the region a crop covers.
+Roi crop_roi(const CropRect &crop, const CropRect &maximum);
+
+// "WxH+X+Y".
+std::string describe_crop(const CropRect &crop);
+
+// The crop the ISP reported for a frame travels to the stream consumers in
+// an SEI message, since the overlay text is composed from their counters.
+void append_roi_sei(std::vector<uint8_t> &messages, const CropRect &crop);
+bool find_roi_sei(const uint8_t *data, size_t size, CropRect &crop);
+
+} // namespace picam
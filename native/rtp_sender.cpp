@@ -0,0 +1,313 @@
+#include "rtp_sender.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "h264.hpp"
+#include "util.hpp"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace picam {
+
+namespace {
+
+constexpr size_t kRtpHeaderSize = 12;
+constexpr uint8_t kFuA = 28;
+constexpr size_t kMinPacketSize = 128;
+constexpr size_t kMaxPacketSize = 65000;
+// Kernel limits for one UDP_SEGMENT send.
+constexpr size_t kMaxGsoSegments = 64;
+constexpr size_t kMaxGsoBytes = 65000;
+constexpr int kSendBufferBytes = 1 << 20;
+// With pacing on, packets leave in bursts of about this much send time.
+constexpr uint64_t kPaceBurstNs = 2000000;
+
+void put_u16(uint8_t *out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value >> 8);
+  out[1] = static_cast<uint8_t>(value);
+}
+
+void put_u32(uint8_t *out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+  }
+}
+
+void sleep_until_ns(uint64_t deadline_ns) {
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(deadline_ns / 1000000000ull);
+  ts.tv_nsec = static_cast<long>(deadline_ns % 1000000000ull);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+  }
+}
+
+bool gso_unsupported(int error) {
+  return error == EIO || error == EINVAL || error == ENOPROTOOPT || error == EOPNOTSUPP;
+}
+
+} // namespace
+
+RtpSender::RtpSender(const RtpConfig &config) : config_(config) {
+  if (config_.packet_size < kMinPacketSize || config_.packet_size > kMaxPacketSize) {
+    throw Error("RTP packet size must be between " + std::to_string(kMinPacketSize) + " and " +
+                std::to_string(kMaxPacketSize) + " bytes");
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  addrinfo *result = nullptr;
+  std::string port = std::to_string(config_.port);
+  int rc = getaddrinfo(config_.host.c_str(), port.c_str(), &hints, &result);
+  if (rc != 0) {
+    throw Error("Cannot resolve '" + config_.host + "': " + gai_strerror(rc));
+  }
+
+  for (addrinfo *ai = result; ai; ai = ai->ai_next) {
+    fd_ = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd_ < 0) {
+      continue;
+    }
+    if (connect(fd_, ai->ai_addr, ai->ai_addrlen) == 0) {
+      family_ = ai->ai_family;
+      char numeric[NI_MAXHOST];
+      if (getnameinfo(ai->ai_addr, ai->ai_addrlen, numeric, sizeof(numeric), nullptr, 0, NI_NUMERICHOST) == 0) {
+        address_ = numeric;
+      }
+      break;
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+  freeaddrinfo(result);
+  if (fd_ < 0) {
+    throw_errno("Cannot open UDP socket to '" + config_.host + "'");
+  }
+
+  // Room for a whole IDR frame, so its burst rarely blocks on the socket.
+  setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &kSendBufferBytes, sizeof(kSendBufferBytes));
+
+  // Probe UDP_SEGMENT (Linux 4.18+); the size itself is passed per message.
+  if (config_.gso) {
+    int segment = static_cast<int>(config_.packet_size);
+    if (setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == 0) {
+      segment = 0;
+      setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment));
+      gso_ = true;
+    }
+  }
+
+  std::random_device random;
+  sequence_ = static_cast<uint16_t>(random());
+  ssrc_ = random();
+}
+
+RtpSender::~RtpSender() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+std::string RtpSender::sdp() const {
+  const char *family = family_ == AF_INET6 ? "IP6" : "IP4";
+  const std::string &address = address_.empty() ? config_.host : address_;
+  char text[512];
+  std::snprintf(text, sizeof(text),
+                "v=0\n"
+                "o=- %u 0 IN %s %s\n"
+                "s=picam\n"
+                "c=IN %s %s\n"
+                "t=0 0\n"
+                "m=video %u RTP/AVP %u\n"
+                "a=rtpmap:%u H264/90000\n"
+                "a=fmtp:%u packetization-mode=1\n",
+                ssrc_, family, address.c_str(), family, address.c_str(), config_.port, config_.payload_type,
+                config_.payload_type, config_.payload_type);
+  return text;
+}
+
+void RtpSender::add_packet(const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t payload_size,
+                           uint32_t rtp_timestamp) {
+  Packet packet;
+  packet.header[0] = 0x80; // version 2, no padding, extension or CSRCs
+  packet.header[1] = config_.payload_type;
+  put_u16(packet.header + 2, sequence_++);
+  put_u32(packet.header + 4, rtp_timestamp);
+  put_u32(packet.header + 8, ssrc_);
+  if (prefix_size > 0) {
+    std::memcpy(packet.header + kRtpHeaderSize, prefix, prefix_size);
+  }
+  packet.header_size = kRtpHeaderSize + prefix_size;
+  packet.payload = payload;
+  packet.payload_size = payload_size;
+  packets_.push_back(packet);
+}
+
+void RtpSender::add_nal(const uint8_t *nal, size_t size, uint32_t rtp_timestamp) {
+  const size_t max_payload = config_.packet_size - kRtpHeaderSize;
+  if (size <= max_payload) {
+    add_packet(nullptr, 0, nal, size, rtp_timestamp);
+    return;
+  }
+
+  // FU-A: the NAL header is split into the FU indicator (NRI) and FU header (type).
+  const size_t chunk = max_payload - 2;
+  const uint8_t indicator = static_cast<uint8_t>((nal[0] & 0xe0) | kFuA);
+  const uint8_t type = nal[0] & 0x1f;
+  const uint8_t *pos = nal + 1;
+  size_t remaining = size - 1;
+  bool first = true;
+  while (remaining > 0) {
+    size_t length = std::min(chunk, remaining);
+    uint8_t fu[2] = {indicator, type};
+    if (first) {
+      fu[1] |= 0x80;
+    }
+    if (length == remaining) {
+      fu[1] |= 0x40;
+    }
+    add_packet(fu, sizeof(fu), pos, length, rtp_timestamp);
+    pos += length;
+    remaining -= length;
+    first = false;
+  }
+}
+
+void RtpSender::send_access_unit(const uint8_t *data, size_t size, int64_t timestamp_us) {
+  packets_.clear();
+  const uint32_t rtp_timestamp = static_cast<uint32_t>(static_cast<uint64_t>(timestamp_us) * 9 / 100);
+
+  h264::NalReader reader(data, size);
+  h264::NalUnit nal;
+  while (reader.next(nal)) {
+    // The marker bit already delimits access units.
+    if (nal.type != h264::kNalAud) {
+      add_nal(nal.data, nal.size, rtp_timestamp);
+    }
+  }
+  if (packets_.empty()) {
+    return;
+  }
+  packets_.back().header[1] |= 0x80;
+
+  if (config_.pace_bps == 0) {
+    send_batch(0, packets_.size());
+    return;
+  }
+
+  const size_t burst_bytes =
+      std::max<size_t>(config_.packet_size, config_.pace_bps / 8 * kPaceBurstNs / 1000000000ull);
+  size_t first = 0;
+  while (first < packets_.size()) {
+    size_t count = 0;
+    size_t bytes = 0;
+    while (first + count < packets_.size() &&
+           (count == 0 || bytes + packets_[first + count].wire_size() <= burst_bytes)) {
+      bytes += packets_[first + count].wire_size();
+      ++count;
+    }
+
+    uint64_t now = monotonic_ns();
+    if (next_send_ns_ > now) {
+      sleep_until_ns(next_send_ns_);
+    }
+    send_batch(first, count);
+    next_send_ns_ = std::max(now, next_send_ns_) + bytes * 8 * 1000000000ull / config_.pace_bps;
+    first += count;
+  }
+}
+
+void RtpSender::send_batch(size_t first, size_t count) {
+  const size_t end = first + count;
+  const size_t control_space = CMSG_SPACE(sizeof(uint16_t));
+
+  // Pointers into these vectors are taken below, so size them first.
+  iovecs_.clear();
+  iovecs_.reserve(2 * count);
+  messages_.clear();
+  messages_.reserve(count);
+  message_first_.clear();
+  message_first_.reserve(count + 1);
+  control_.assign(count * control_space, 0);
+
+  size_t i = first;
+  while (i < end) {
+    // A GSO send is cut every segment_size bytes: all segments but the last
+    // must be exactly that long, the last one may be shorter.
+    const size_t segment_size = packets_[i].wire_size();
+    size_t run = 1;
+    size_t bytes = segment_size;
+    while (gso_ && i + run < end && run < kMaxGsoSegments &&
+           packets_[i + run - 1].wire_size() == segment_size && packets_[i + run].wire_size() <= segment_size &&
+           bytes + packets_[i + run].wire_size() <= kMaxGsoBytes) {
+      bytes += packets_[i + run].wire_size();
+      ++run;
+    }
+
+    mmsghdr message{};
+    message.msg_hdr.msg_iov = iovecs_.data() + iovecs_.size();
+    message.msg_hdr.msg_iovlen = 2 * run;
+    for (size_t p = i; p < i + run; ++p) {
+      iovecs_.push_back({packets_[p].header, packets_[p].header_size});
+      iovecs_.push_back({const_cast<uint8_t *>(packets_[p].payload), packets_[p].payload_size});
+    }
+    if (run > 1) {
+      uint8_t *control = control_.data() + messages_.size() * control_space;
+      message.msg_hdr.msg_control = control;
+      message.msg_hdr.msg_controllen = control_space;
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&message.msg_hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      uint16_t gso_size = static_cast<uint16_t>(segment_size);
+      std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+    messages_.push_back(message);
+    message_first_.push_back(i);
+    i += run;
+  }
+  message_first_.push_back(end);
+
+  size_t sent = 0;
+  while (sent < messages_.size()) {
+    int rc = sendmmsg(fd_, messages_.data() + sent, static_cast<unsigned>(messages_.size() - sent), 0);
+    if (rc > 0) {
+      packets_sent_ += message_first_[sent + rc] - message_first_[sent];
+      sent += static_cast<size_t>(rc);
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (gso_ && messages_[sent].msg_hdr.msg_controllen > 0 && gso_unsupported(errno)) {
+      // Usually a NIC without checksum offload; fall back to one datagram per packet.
+      warn_errno("UDP GSO send failed, sending packets individually");
+      gso_ = false;
+      size_t resume = message_first_[sent];
+      send_batch(resume, end - resume);
+      return;
+    }
+    ++send_errors_;
+    if (errno == ECONNREFUSED) {
+      // ICMP port unreachable from an earlier packet: nobody listens yet.
+      continue;
+    }
+    // Out of buffer space or no route: lose the rest of this frame, not the stream.
+    return;
+  }
+}
+
+} // namespace picam
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace picam {
+
+struct RtpConfig {
+  std::string host;
+  uint16_t port = 0;
+  // Largest UDP payload, RTP header included.
+  size_t packet_size = 1400;
+  uint8_t payload_type = 96;
+  // Caps the send rate in bits per second so IDR bursts are spread out; 0 sends at line rate.
+  uint64_t pace_bps = 0;
+  bool gso = true;
+};
+
+// Packetizes H.264 access units into RTP (RFC 6184, packetization-mode=1:
+// single NAL unit packets and FU-A fragments) and sends each access unit with
+// as few sendmmsg calls as possible. FU-A fragments of one NAL unit all have
+// the same size, so they go out as one UDP GSO super-packet when the kernel
+// supports UDP_SEGMENT. Payloads are referenced in place, never copied.
+class RtpSender {
+public:
+  explicit RtpSender(const RtpConfig &config);
+  ~RtpSender();
+
+  RtpSender(const RtpSender &) = delete;
+  RtpSender &operator=(const RtpSender &) = delete;
+
+  void send_access_unit(const uint8_t *data, size_t size, int64_t timestamp_us);
+
+  uint64_t packets_sent() const { return packets_sent_; }
+  uint64_t send_errors() const { return send_errors_; }
+  bool gso_active() const { return gso_; }
+  // Session description for the receiver (ffplay, VLC, GStreamer).
+  std::string sdp() const;
+
+private:
+  struct Packet {
+    uint8_t header[14];
+    size_t header_size;
+    const uint8_t *payload;
+    size_t payload_size;
+    size_t wire_size() const { return header_size + payload_size; }
+  };
+
+  void add_nal(const uint8_t *nal, size_t size, uint32_t rtp_timestamp);
+  void add_packet(const uint8_t *prefix, size_t prefix_size, const uint8_t *payload, size_t payload_size,
+                  uint32_t rtp_timestamp);
+  void send_batch(size_t first, size_t count);
+
+  RtpConfig config_;
+  int fd_ = -1;
+  int family_ = AF_INET;
+  std::string address_;
+  bool gso_ = false;
+  uint16_t sequence_;
+  uint32_t ssrc_;
+  uint64_t next_send_ns_ = 0;
+  uint64_t packets_sent_ = 0;
+  uint64_t send_errors_ = 0;
+
+  std::vector<Packet> packets_;
+  std::vector<iovec> iovecs_;
+  std::vector<mmsghdr> messages_;
+  std::vector<size_t> message_first_;
+  std::vector<uint8_t> control_;
+};
+
+} // namespace picam
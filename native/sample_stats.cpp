@@ -0,0 +1,28 @@
+#include "sample_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace picam {
+
+double percentile(const std::vector<float> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+double mean(const std::vector<float> &values) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  double sum = 0.0;
+  for (float value : values) {
+    sum += value;
+  }
+  return sum / values.size();
+}
+
+} // namespace picam
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+namespace picam {
+
+// Nearest-rank percentile (p in 0..100) of an ascending vector; 0 when empty.
+double percentile(const std::vector<float> &sorted, double p);
+double mean(const std::vector<float> &values);
+
+} // namespace picam
@@ -0,0 +1,325 @@
+#include "segment_recorder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// About 16 s of a 4 Mbit/s stream before frames are dropped.
+constexpr size_t kQueueBytes = 8 << 20;
+constexpr size_t kBufferCount = 4;
+constexpr size_t kBufferSize = 256 << 10;
+// O_DIRECT wants block-aligned buffers, offsets and lengths.
+constexpr size_t kDirectAlign = 4096;
+// First segment's preallocation, per second of segment; later ones follow the real size.
+constexpr uint64_t kInitialBytesPerSecond = 1 << 20;
+constexpr uint64_t kLatencyWindowNs = 1000000000ull;
+constexpr uint64_t kStopReaper = ~0ull;
+// A hole this long in the timestamps is a pause; what follows starts a new segment.
+constexpr int64_t kPauseGapUs = 1000000;
+
+size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+} // namespace
+
+SegmentRecorder::SegmentRecorder(const std::string &directory, unsigned segment_seconds)
+    : directory_(directory), segment_us_(static_cast<int64_t>(segment_seconds) * 1000000),
+      queue_(ShmRing::create(kQueueBytes)), writer_(kBufferCount + 1),
+      prealloc_bytes_(kInitialBytesPerSecond * segment_seconds) {
+  struct stat st{};
+  if (stat(directory_.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+    throw Error("Recording directory '" + directory_ + "' does not exist");
+  }
+  if (segment_seconds == 0) {
+    throw Error("Segment length must be greater than zero");
+  }
+
+  buffers_.resize(kBufferCount);
+  for (Buffer &buffer : buffers_) {
+    buffer.data = static_cast<uint8_t *>(std::aligned_alloc(kDirectAlign, kBufferSize));
+    if (!buffer.data) {
+      throw Error("Cannot allocate recording buffers");
+    }
+  }
+  reaper_ = std::thread(&SegmentRecorder::reap, this);
+  thread_ = std::thread(&SegmentRecorder::run, this);
+}
+
+SegmentRecorder::~SegmentRecorder() {
+  queue_.close();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  writer_.submit_nop(kStopReaper);
+  if (reaper_.joinable()) {
+    reaper_.join();
+  }
+  for (Buffer &buffer : buffers_) {
+    std::free(buffer.data);
+  }
+
+  uint64_t writes = writes_.load();
+  RecorderStatus summary = status();
+  std::fprintf(stderr,
+               "picam-native: %" PRIu64 " segments recorded to %s (%s%s), writes mean %.1f ms max %.1f ms, "
+               "queue peak %.0f%%, %" PRIu64 " frames dropped\n",
+               summary.segments, directory_.c_str(), writer_.uses_io_uring() ? "io_uring" : "pwrite",
+               direct_ ? ", O_DIRECT" : "", writes ? write_total_ns_.load() / 1e6 / writes : 0.0,
+               write_max_ns_.load() / 1e6, summary.queue_peak_pct, summary.dropped_frames);
+}
+
+void SegmentRecorder::write(const EncodedFrame &frame) {
+  if (paused_.load(std::memory_order_relaxed)) {
+    wait_for_idr_ = true;
+    return;
+  }
+  if (wait_for_idr_) {
+    if (!frame.keyframe) {
+      return;
+    }
+    wait_for_idr_ = false;
+  }
+  queue_.publish(frame);
+  size_t used = queue_.used();
+  if (used > queue_peak_.load(std::memory_order_relaxed)) {
+    queue_peak_.store(used, std::memory_order_relaxed);
+  }
+}
+
+RecorderStatus SegmentRecorder::status() const {
+  RecorderStatus status;
+  status.segments = segments_.load(std::memory_order_relaxed);
+  status.dropped_frames = queue_.dropped();
+  status.write_ms = recent_write_ns_.load(std::memory_order_relaxed) / 1e6;
+  status.queue_peak_pct = 100.0 * queue_peak_.load(std::memory_order_relaxed) / queue_.capacity();
+  status.paused = paused_.load(std::memory_order_relaxed);
+  return status;
+}
+
+void SegmentRecorder::set_paused(bool paused) {
+  if (paused_.exchange(paused) != paused) {
+    std::fprintf(stderr, "picam-native: Recording %s\n", paused ? "paused" : "resumed at the next IDR");
+  }
+}
+
+void follow_record_message(RingMessage message, SegmentRecorder &recorder) {
+  switch (message) {
+  case RingMessage::kRecordStart:
+    recorder.set_paused(false);
+    break;
+  case RingMessage::kRecordStop:
+    recorder.set_paused(true);
+    break;
+  default:
+    break;
+  }
+}
+
+void SegmentRecorder::run() {
+  window_start_ns_ = monotonic_ns();
+  for (;;) {
+    RingRecord record;
+    RingStatus state = queue_.next(record, 200);
+    if (state == RingStatus::kClosed) {
+      break;
+    }
+    if (state == RingStatus::kRecord) {
+      if (!failed_) {
+        try {
+          this->record(record);
+        } catch (const std::exception &e) {
+          // Recording gives up on its own; the preview keeps running.
+          std::fprintf(stderr, "picam-native: Recording stopped: %s\n", e.what());
+          failed_ = true;
+        }
+      }
+      queue_.consume(record);
+    } else if (paused_.load(std::memory_order_relaxed) && fd_ >= 0 && !failed_) {
+      try {
+        close_segment();
+      } catch (const std::exception &e) {
+        std::fprintf(stderr, "picam-native: Cannot finish the segment: %s\n", e.what());
+        failed_ = true;
+      }
+    }
+
+    uint64_t now = monotonic_ns();
+    if (now - window_start_ns_ >= kLatencyWindowNs) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      recent_write_ns_.store(window_max_ns_, std::memory_order_relaxed);
+      window_max_ns_ = 0;
+      window_start_ns_ = now;
+    }
+  }
+
+  try {
+    close_segment();
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "picam-native: Cannot finish the last segment: %s\n", e.what());
+  }
+}
+
+void SegmentRecorder::record(const RingRecord &record) {
+  // The queue only hands out a keyframe first, so every segment opens on an IDR.
+  if (fd_ < 0 || (record.keyframe && (record.timestamp_us - segment_start_us_ >= segment_us_ ||
+                                      record.timestamp_us - last_timestamp_us_ >= kPauseGapUs))) {
+    close_segment();
+    open_segment();
+    segment_start_us_ = record.timestamp_us;
+    muxer_.reset();
+  }
+  packets_.clear();
+  muxer_.write(record.data, record.size, record.timestamp_us, record.keyframe, packets_);
+  append(packets_.data(), packets_.size());
+  last_timestamp_us_ = record.timestamp_us;
+}
+
+void SegmentRecorder::open_segment() {
+  char stamp[32];
+  time_t now = time(nullptr);
+  tm local{};
+  localtime_r(&now, &local);
+  std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+  char name[64];
+  std::snprintf(name, sizeof(name), "picam-%s-%04u.ts", stamp, sequence_++);
+  std::string path = directory_ + "/" + name;
+
+  // tmpfs and some FUSE mounts refuse O_DIRECT; those still get the background writes.
+  const int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+  fd_ = open(path.c_str(), flags | O_DIRECT, 0644);
+  direct_ = fd_ >= 0;
+  if (fd_ < 0 && errno == EINVAL) {
+    fd_ = open(path.c_str(), flags, 0644);
+  }
+  if (fd_ < 0) {
+    throw_errno("Cannot create segment '" + path + "'");
+  }
+  // Reserve the blocks up front so the card does not allocate while we stream.
+  fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(prealloc_bytes_));
+
+  file_offset_ = 0;
+  logical_size_ = 0;
+  segments_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SegmentRecorder::close_segment() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (buffers_[current_].used > 0) {
+    submit_current(true);
+  }
+  wait_for_writes();
+  // The tail was written padded to the block size; trim it (and the preallocation).
+  if (ftruncate(fd_, static_cast<off_t>(logical_size_)) < 0) {
+    warn_errno("Cannot trim segment");
+  }
+  close(fd_);
+  fd_ = -1;
+  prealloc_bytes_ = std::max(prealloc_bytes_, logical_size_ + logical_size_ / 4);
+}
+
+void SegmentRecorder::append(const uint8_t *data, size_t size) {
+  while (size > 0) {
+    Buffer &buffer = buffers_[current_];
+    size_t length = std::min(size, kBufferSize - buffer.used);
+    std::memcpy(buffer.data + buffer.used, data, length);
+    buffer.used += length;
+    data += length;
+    size -= length;
+    if (buffer.used == kBufferSize) {
+      submit_current(false);
+    }
+  }
+}
+
+void SegmentRecorder::submit_current(bool final) {
+  Buffer &buffer = buffers_[current_];
+  size_t length = align_up(buffer.used, kDirectAlign);
+  std::memset(buffer.data + buffer.used, 0, length - buffer.used);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer.busy = true;
+    buffer.submitted = length;
+    buffer.submitted_ns = monotonic_ns();
+  }
+  writer_.submit(fd_, buffer.data, length, file_offset_, current_);
+  logical_size_ += buffer.used;
+  file_offset_ += length;
+  buffer.used = 0;
+
+  if (!final) {
+    current_ = take_free_buffer();
+  }
+}
+
+size_t SegmentRecorder::take_free_buffer() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (!write_error_.empty()) {
+      throw Error(write_error_);
+    }
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+      if (!buffers_[i].busy) {
+        return i;
+      }
+    }
+    buffer_free_.wait(lock);
+  }
+}
+
+void SegmentRecorder::wait_for_writes() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  buffer_free_.wait(lock, [this] {
+    return std::none_of(buffers_.begin(), buffers_.end(), [](const Buffer &buffer) { return buffer.busy; });
+  });
+  if (!write_error_.empty()) {
+    throw Error(write_error_);
+  }
+}
+
+void SegmentRecorder::reap() {
+  for (;;) {
+    WriteCompletion completion = writer_.wait();
+    if (completion.tag == kStopReaper) {
+      return;
+    }
+    uint64_t now = monotonic_ns();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Buffer &buffer = buffers_[completion.tag];
+    uint64_t latency_ns = now - buffer.submitted_ns;
+    writes_.fetch_add(1, std::memory_order_relaxed);
+    write_total_ns_.fetch_add(latency_ns, std::memory_order_relaxed);
+    if (latency_ns > write_max_ns_.load(std::memory_order_relaxed)) {
+      write_max_ns_.store(latency_ns, std::memory_order_relaxed);
+    }
+    window_max_ns_ = std::max(window_max_ns_, latency_ns);
+
+    if (completion.result < 0 && write_error_.empty()) {
+      write_error_ = std::string("Cannot write segment: ") + std::strerror(static_cast<int>(-completion.result));
+    } else if (completion.result >= 0 && static_cast<size_t>(completion.result) != buffer.submitted &&
+               write_error_.empty()) {
+      write_error_ = "Short write to segment";
+    }
+    buffer.busy = false;
+    buffer_free_.notify_all();
+  }
+}
+
+} // namespace picam
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_writer.hpp"
+#include "frame.hpp"
+#include "ring_socket.hpp"
+#include "shm_ring.hpp"
+#include "ts_muxer.hpp"
+
+namespace picam {
+
+struct RecorderStatus {
+  uint64_t segments = 0;
+  uint64_t dropped_frames = 0;
+  // Slowest write completion over the last second.
+  double write_ms = 0.0;
+  // Queue high-water mark since the start, in percent of its capacity.
+  double queue_peak_pct = 0.0;
+  bool paused = false;
+};
+
+// Tee stage that records the stream as IDR-aligned MPEG-TS segments next to
+// the preview. write() only copies the access unit into an in-process
+// ShmRing, which drops up to the next IDR instead of waiting when the disk
+// falls behind; a background thread muxes and writes preallocated segment
+// files with O_DIRECT through io_uring, so writeback stalls on the SD card
+// never reach the thread that feeds the preview. A second thread reaps the
+// completions as they arrive, which is what the write latency is timed by.
+class SegmentRecorder : public FrameSink {
+public:
+  SegmentRecorder(const std::string &directory, unsigned segment_seconds);
+  ~SegmentRecorder() override;
+
+  SegmentRecorder(const SegmentRecorder &) = delete;
+  SegmentRecorder &operator=(const SegmentRecorder &) = delete;
+
+  void write(const EncodedFrame &frame) override;
+  RecorderStatus status() const;
+
+  // Stopping closes the open segment once the queue has drained; starting
+  // again waits for the next IDR and begins a new segment. Any thread.
+  void set_paused(bool paused);
+
+private:
+  struct Buffer {
+    uint8_t *data = nullptr;
+    size_t used = 0;
+    // Guarded by mutex_ while a write is in flight.
+    bool busy = false;
+    size_t submitted = 0;
+    uint64_t submitted_ns = 0;
+  };
+
+  void run();
+  void reap();
+  void record(const RingRecord &record);
+  void open_segment();
+  void close_segment();
+  void append(const uint8_t *data, size_t size);
+  void submit_current(bool final);
+  size_t take_free_buffer();
+  void wait_for_writes();
+
+  std::string directory_;
+  int64_t segment_us_;
+  std::atomic<bool> paused_{false};
+  // Caller of write() only.
+  bool wait_for_idr_ = false;
+
+  ShmRing queue_;
+  std::atomic<size_t> queue_peak_{0};
+
+  // Writer thread only.
+  AsyncWriter writer_;
+  TsMuxer muxer_;
+  std::vector<uint8_t> packets_;
+  std::vector<Buffer> buffers_;
+  size_t current_ = 0;
+  int fd_ = -1;
+  bool direct_ = false;
+  uint64_t file_offset_ = 0;
+  uint64_t logical_size_ = 0;
+  uint64_t prealloc_bytes_;
+  int64_t segment_start_us_ = 0;
+  int64_t last_timestamp_us_ = 0;
+  unsigned sequence_ = 0;
+  bool failed_ = false;
+  uint64_t window_start_ns_ = 0;
+
+  // Shared with the reaper thread.
+  std::mutex mutex_;
+  std::condition_variable buffer_free_;
+  std::string write_error_;
+  uint64_t window_max_ns_ = 0;
+
+  std::atomic<uint64_t> segments_{0};
+  std::atomic<uint64_t> write_max_ns_{0};
+  std::atomic<uint64_t> write_total_ns_{0};
+  std::atomic<uint64_t> writes_{0};
+  std::atomic<uint64_t> recent_write_ns_{0};
+
+  std::thread thread_;
+  std::thread reaper_;
+};
+
+// Pauses or resumes on the record messages a producer forwards from its
+// control socket; other messages are not the recorder's.
+void follow_record_message(RingMessage message, SegmentRecorder &recorder);
+
+} // namespace picam
@@ -0,0 +1,164 @@
+#include "sensor_modes.hpp"
+
+#include <cctype>
+#include <cstdio>
+
+#include "util.hpp"
+
+namespace picam {
+
+using namespace libcamera;
+
+namespace {
+
+// Sensor modes are quoted at nominal rates (30 fps may be 29.99).
+constexpr double kFpsTolerance = 0.99;
+// A readout narrower or shorter than this share of the pixel array is a crop.
+constexpr double kFullFieldOfView = 0.95;
+
+// Bayer and mono raw formats carry the depth in their name: SRGGB10_CSI2P,
+// SBGGR12, R10_CSI2P, ...
+unsigned format_bit_depth(const PixelFormat &format) {
+  const std::string name = format.toString();
+  size_t digits = 0;
+  while (digits < name.size() && !std::isdigit(static_cast<unsigned char>(name[digits]))) {
+    ++digits;
+  }
+  unsigned depth = 0;
+  for (; digits < name.size() && std::isdigit(static_cast<unsigned char>(name[digits])); ++digits) {
+    depth = depth * 10 + static_cast<unsigned>(name[digits] - '0');
+  }
+  return depth;
+}
+
+uint64_t area(const SensorMode &mode) {
+  return static_cast<uint64_t>(mode.width) * mode.height;
+}
+
+bool fast_enough(const SensorMode &mode, unsigned framerate) {
+  return mode.max_fps >= framerate * kFpsTolerance;
+}
+
+} // namespace
+
+std::vector<SensorMode> list_sensor_modes(Camera &camera) {
+  std::unique_ptr<CameraConfiguration> raw = camera.generateConfiguration({StreamRole::Raw});
+  if (!raw) {
+    throw Error("Camera '" + camera.id() + "' has no raw stream to list sensor modes from");
+  }
+  const Size pixel_array = camera.properties().get(properties::PixelArraySize).value_or(Size());
+  const StreamFormats formats = raw->at(0).formats();
+
+  std::vector<SensorMode> modes;
+  for (const PixelFormat &format : formats.pixelformats()) {
+    const unsigned bit_depth = format_bit_depth(format);
+    if (bit_depth == 0) {
+      continue;
+    }
+    for (const Size &size : formats.sizes(format)) {
+      // Packed and unpacked variants of one mode read out the same pixels.
+      if (find_sensor_mode(modes, size.width, size.height, bit_depth)) {
+        continue;
+      }
+      raw->at(0).pixelFormat = format;
+      raw->at(0).size = size;
+      if (raw->validate() == CameraConfiguration::Invalid || camera.configure(raw.get()) < 0) {
+        continue;
+      }
+
+      SensorMode mode;
+      mode.width = size.width;
+      mode.height = size.height;
+      mode.bit_depth = bit_depth;
+      mode.format = format;
+      auto limits = camera.controls().find(&controls::FrameDurationLimits);
+      if (limits != camera.controls().end()) {
+        int64_t min_us = limits->second.min().get<int64_t>();
+        mode.max_fps = min_us > 0 ? 1e6 / static_cast<double>(min_us) : 0.0;
+      }
+      mode.crop = camera.properties().get(properties::ScalerCropMaximum).value_or(Rectangle());
+      mode.cropped = pixel_array.width > 0 && (mode.crop.width < pixel_array.width * kFullFieldOfView ||
+                                               mode.crop.height < pixel_array.height * kFullFieldOfView);
+      modes.push_back(mode);
+    }
+  }
+  if (modes.empty()) {
+    throw Error("Camera '" + camera.id() + "' reported no raw sensor modes");
+  }
+  return modes;
+}
+
+const SensorMode *select_sensor_mode(const std::vector<SensorMode> &modes, unsigned width, unsigned height,
+                                     unsigned framerate) {
+  const SensorMode *best = nullptr;
+  for (const auto &mode : modes) {
+    if (mode.width >= width && mode.height >= height && fast_enough(mode, framerate) &&
+        (!best || csi_bitrate(mode, framerate) < csi_bitrate(*best, framerate))) {
+      best = &mode;
+    }
+  }
+  if (best) {
+    return best;
+  }
+  for (const auto &mode : modes) {
+    if (fast_enough(mode, framerate) && (!best || area(mode) > area(*best))) {
+      best = &mode;
+    }
+  }
+  if (best) {
+    return best;
+  }
+  for (const auto &mode : modes) {
+    if (!best || mode.max_fps > best->max_fps) {
+      best = &mode;
+    }
+  }
+  return best;
+}
+
+const SensorMode *find_sensor_mode(const std::vector<SensorMode> &modes, unsigned width, unsigned height,
+                                   unsigned bit_depth) {
+  const SensorMode *best = nullptr;
+  for (const auto &mode : modes) {
+    if (mode.width != width || mode.height != height) {
+      continue;
+    }
+    if (bit_depth != 0 ? mode.bit_depth == bit_depth : !best || mode.bit_depth > best->bit_depth) {
+      best = &mode;
+    }
+  }
+  return best;
+}
+
+double csi_bitrate(const SensorMode &mode, unsigned framerate) {
+  return static_cast<double>(mode.width) * mode.height * mode.bit_depth * framerate;
+}
+
+std::string describe_sensor_mode(const SensorMode &mode) {
+  char text[160];
+  std::snprintf(text, sizeof(text), "%ux%u %u-bit (%s), up to %.1f fps, crop %ux%u+%d+%d%s", mode.width, mode.height,
+                mode.bit_depth, mode.format.toString().c_str(), mode.max_fps, mode.crop.width, mode.crop.height,
+                mode.crop.x, mode.crop.y, mode.cropped ? " (cropped field of view)" : "");
+  return text;
+}
+
+void write_sensor_mode_report(const std::string &path, const SensorMode &mode, unsigned framerate,
+                              unsigned output_width, unsigned output_height) {
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw_errno("Cannot write sensor mode report '" + path + "'");
+  }
+  const bool scaled = output_width != mode.width || output_height != mode.height;
+  std::fprintf(file,
+               "{\n  \"width\": %u,\n  \"height\": %u,\n  \"bit_depth\": %u,\n  \"format\": \"%s\",\n"
+               "  \"max_fps\": %.2f,\n  \"crop\": [%d, %d, %u, %u],\n  \"cropped\": %s,\n  \"framerate\": %u,\n"
+               "  \"csi_mbps\": %.1f,\n  \"output_width\": %u,\n  \"output_height\": %u,\n  \"isp_scaled\": %s\n}\n",
+               mode.width, mode.height, mode.bit_depth, mode.format.toString().c_str(), mode.max_fps, mode.crop.x,
+               mode.crop.y, mode.crop.width, mode.crop.height, mode.cropped ? "true" : "false", framerate,
+               csi_bitrate(mode, framerate) / 1e6, output_width, output_height, scaled ? "true" : "false");
+  if (std::fclose(file) != 0) {
+    throw_errno("Cannot write sensor mode report '" + path + "'");
+  }
+}
+
+} // namespace picam
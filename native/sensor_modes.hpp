@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+namespace picam {
+
+// One readout mode of the sensor, as the Raw stream of the camera lists it.
+struct SensorMode {
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned bit_depth = 0;
+  libcamera::PixelFormat format;
+  double max_fps = 0.0;
+  // Part of the pixel array the mode reads out.
+  libcamera::Rectangle crop;
+  bool cropped = false;
+};
+
+// Every mode with its frame-rate ceiling and field of view. Each mode is
+// configured once to read those, so the camera has to be acquired and stopped.
+std::vector<SensorMode> list_sensor_modes(libcamera::Camera &camera);
+
+// The mode that is cheapest on the CSI link while still covering width x
+// height at framerate: the smallest readout in bits per second among the
+// modes large and fast enough, so a binned mode wins over full readout
+// whenever it keeps up. Failing that, the largest mode that is fast enough,
+// then simply the fastest. Null only for an empty list.
+const SensorMode *select_sensor_mode(const std::vector<SensorMode> &modes, unsigned width, unsigned height,
+                                     unsigned framerate);
+// The mode of exactly this size; with bit_depth 0, the deepest one.
+const SensorMode *find_sensor_mode(const std::vector<SensorMode> &modes, unsigned width, unsigned height,
+                                   unsigned bit_depth);
+
+// Pixel payload the sensor sends over CSI-2 at framerate, in bits per second.
+double csi_bitrate(const SensorMode &mode, unsigned framerate);
+
+std::string describe_sensor_mode(const SensorMode &mode);
+
+// Chosen mode, link load and what the ISP does on top, as JSON.
+void write_sensor_mode_report(const std::string &path, const SensorMode &mode, unsigned framerate,
+                              unsigned output_width, unsigned output_height);
+
+} // namespace picam
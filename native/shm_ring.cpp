@@ -0,0 +1,240 @@
+#include "shm_ring.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr uint32_t kRingMagic = 0x50435247; // "PCRG"
+constexpr uint32_t kRingVersion = 1;
+constexpr size_t kSlotAlign = 64;
+constexpr uint32_t kRecordKeyframe = 1u << 0;
+
+struct RecordHeader {
+  uint32_t size;
+  uint32_t flags;
+  int64_t timestamp_us;
+};
+static_assert(sizeof(RecordHeader) == 16, "record header layout is shared between processes");
+
+size_t page_size() {
+  static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+long futex(std::atomic<uint32_t> *word, int op, uint32_t value, const timespec *timeout) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, value, timeout, nullptr, 0);
+}
+
+} // namespace
+
+struct ShmRing::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+
+  alignas(64) std::atomic<uint64_t> head;
+  std::atomic<uint32_t> head_seq;
+  std::atomic<uint32_t> consumer_waiting;
+
+  alignas(64) std::atomic<uint64_t> tail;
+
+  alignas(64) std::atomic<uint64_t> published;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint32_t> closed;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions must be lock-free across processes");
+
+ShmRing ShmRing::create(size_t capacity) {
+  capacity = align_up(capacity, page_size());
+  int fd = memfd_create("picam-ring", MFD_CLOEXEC);
+  if (fd < 0) {
+    throw_errno("memfd_create failed");
+  }
+  if (ftruncate(fd, static_cast<off_t>(page_size() + capacity)) < 0) {
+    int saved = errno;
+    ::close(fd);
+    errno = saved;
+    throw_errno("Cannot size the shared ring");
+  }
+  return ShmRing(fd, capacity, true);
+}
+
+ShmRing ShmRing::attach(int fd) {
+  struct stat st{};
+  if (fstat(fd, &st) < 0) {
+    throw_errno("Cannot stat the shared ring");
+  }
+  if (static_cast<size_t>(st.st_size) <= page_size()) {
+    throw Error("Shared ring is too small");
+  }
+  return ShmRing(fd, static_cast<size_t>(st.st_size) - page_size(), false);
+}
+
+ShmRing::ShmRing(int fd, size_t capacity, bool owner) : fd_(fd), capacity_(capacity) {
+  size_t header_size = page_size();
+  void *reserve = mmap(nullptr, header_size + 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserve == MAP_FAILED) {
+    ::close(fd);
+    throw_errno("Cannot reserve address space for the shared ring");
+  }
+  base_ = static_cast<uint8_t *>(reserve);
+
+  bool mapped = mmap(base_, header_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+                mmap(base_ + header_size, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+                     static_cast<off_t>(header_size)) != MAP_FAILED &&
+                mmap(base_ + header_size + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+                     static_cast<off_t>(header_size)) != MAP_FAILED;
+  if (!mapped) {
+    int saved = errno;
+    munmap(base_, header_size + 2 * capacity);
+    ::close(fd);
+    errno = saved;
+    throw_errno("Cannot map the shared ring");
+  }
+
+  header_ = reinterpret_cast<Header *>(base_);
+  data_ = base_ + header_size;
+
+  if (owner) {
+    new (header_) Header{};
+    header_->magic = kRingMagic;
+    header_->version = kRingVersion;
+    header_->capacity = capacity;
+  } else if (header_->magic != kRingMagic || header_->version != kRingVersion || header_->capacity != capacity) {
+    munmap(base_, header_size + 2 * capacity);
+    ::close(fd);
+    throw Error("Shared ring has an unexpected layout");
+  } else {
+    // Start at the producer's current position; anything older is stale.
+    header_->tail.store(header_->head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+}
+
+ShmRing::ShmRing(ShmRing &&other) noexcept
+    : fd_(other.fd_), capacity_(other.capacity_), base_(other.base_), header_(other.header_), data_(other.data_),
+      need_keyframe_(other.need_keyframe_) {
+  other.fd_ = -1;
+  other.base_ = nullptr;
+}
+
+ShmRing::~ShmRing() {
+  if (base_) {
+    munmap(base_, page_size() + 2 * capacity_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+bool ShmRing::publish(const EncodedFrame &frame) {
+  size_t needed = align_up(sizeof(RecordHeader) + frame.size, kSlotAlign);
+  if (need_keyframe_ && !frame.keyframe) {
+    header_->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_acquire);
+  if (needed > capacity_ - (head - tail)) {
+    need_keyframe_ = true;
+    header_->dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  need_keyframe_ = false;
+
+  uint8_t *slot = data_ + head % capacity_;
+  RecordHeader record{static_cast<uint32_t>(frame.size), frame.keyframe ? kRecordKeyframe : 0u, frame.timestamp_us};
+  std::memcpy(slot, &record, sizeof(record));
+  std::memcpy(slot + sizeof(record), frame.data, frame.size);
+
+  header_->head.store(head + needed, std::memory_order_release);
+  header_->published.fetch_add(1, std::memory_order_relaxed);
+  header_->head_seq.fetch_add(1, std::memory_order_seq_cst);
+  if (header_->consumer_waiting.load(std::memory_order_seq_cst)) {
+    futex(&header_->head_seq, FUTEX_WAKE, INT_MAX, nullptr);
+  }
+  return true;
+}
+
+void ShmRing::close() {
+  header_->closed.store(1, std::memory_order_release);
+  header_->head_seq.fetch_add(1, std::memory_order_seq_cst);
+  futex(&header_->head_seq, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+RingStatus ShmRing::next(RingRecord &record, int timeout_ms) {
+  for (;;) {
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    if (head != tail) {
+      RecordHeader rh;
+      const uint8_t *slot = data_ + tail % capacity_;
+      std::memcpy(&rh, slot, sizeof(rh));
+      record.data = slot + sizeof(rh);
+      record.size = rh.size;
+      record.timestamp_us = rh.timestamp_us;
+      record.keyframe = (rh.flags & kRecordKeyframe) != 0;
+      record.next_position = tail + align_up(sizeof(rh) + rh.size, kSlotAlign);
+      if (need_keyframe_ && !record.keyframe) {
+        consume(record);
+        continue;
+      }
+      need_keyframe_ = false;
+      return RingStatus::kRecord;
+    }
+
+    if (header_->closed.load(std::memory_order_acquire)) {
+      return RingStatus::kClosed;
+    }
+
+    header_->consumer_waiting.store(1, std::memory_order_seq_cst);
+    uint32_t seq = header_->head_seq.load(std::memory_order_seq_cst);
+    if (header_->head.load(std::memory_order_seq_cst) != tail || header_->closed.load(std::memory_order_acquire)) {
+      header_->consumer_waiting.store(0, std::memory_order_relaxed);
+      continue;
+    }
+    timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    long ret = futex(&header_->head_seq, FUTEX_WAIT, seq, &timeout);
+    header_->consumer_waiting.store(0, std::memory_order_relaxed);
+    if (ret < 0 && errno == ETIMEDOUT) {
+      return RingStatus::kTimeout;
+    }
+  }
+}
+
+void ShmRing::consume(const RingRecord &record) {
+  header_->tail.store(record.next_position, std::memory_order_release);
+}
+
+uint64_t ShmRing::published() const {
+  return header_->published.load(std::memory_order_relaxed);
+}
+
+uint64_t ShmRing::dropped() const {
+  return header_->dropped.load(std::memory_order_relaxed);
+}
+
+size_t ShmRing::used() const {
+  return static_cast<size_t>(header_->head.load(std::memory_order_acquire) -
+                             header_->tail.load(std::memory_order_acquire));
+}
+
+} // namespace picam
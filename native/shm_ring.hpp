@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "frame.hpp"
+
+namespace picam {
+
+struct RingRecord {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  int64_t timestamp_us = 0;
+  bool keyframe = false;
+  uint64_t next_position = 0;
+};
+
+enum class RingStatus { kRecord, kTimeout, kClosed };
+
+// Lock-free single-producer/single-consumer ring of encoded access units in a
+// memfd. Each record starts on a 64-byte slot boundary and the data area is
+// mapped twice back to back, so a record is always contiguous in memory and
+// both sides can use it in place. The producer never blocks: when the consumer
+// falls behind it drops frames up to the next IDR, so the stream stays
+// decodable. The consumer sleeps on a process-shared futex.
+class ShmRing {
+public:
+  static ShmRing create(size_t capacity);
+  static ShmRing attach(int fd);
+
+  ShmRing(ShmRing &&other) noexcept;
+  ShmRing &operator=(ShmRing &&) = delete;
+  ~ShmRing();
+
+  int fd() const { return fd_; }
+  size_t capacity() const { return capacity_; }
+
+  // Producer side.
+  bool publish(const EncodedFrame &frame);
+  void close();
+
+  // Consumer side. A freshly attached consumer skips to the next keyframe.
+  RingStatus next(RingRecord &record, int timeout_ms);
+  void consume(const RingRecord &record);
+
+  uint64_t published() const;
+  uint64_t dropped() const;
+  // Bytes currently queued, record padding included.
+  size_t used() const;
+
+private:
+  struct Header;
+
+  ShmRing(int fd, size_t capacity, bool owner);
+
+  int fd_ = -1;
+  size_t capacity_ = 0;
+  uint8_t *base_ = nullptr;
+  Header *header_ = nullptr;
+  uint8_t *data_ = nullptr;
+  bool need_keyframe_ = true;
+};
+
+} // namespace picam
@@ -0,0 +1,165 @@
+#include "soak_report.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// Resolution each metric is bucketed at.
+constexpr double kFpsUnit = 0.01;
+constexpr double kLatencyUnit = 0.01;
+constexpr double kCpuUnit = 0.1;
+constexpr double kMbpsUnit = 0.001;
+
+const char *const kMetricNames[] = {"fps", "latency_ms", "cpu_pct", "mbps"};
+const double kPercentiles[] = {1, 50, 95, 99};
+
+std::string utc_now() {
+  char text[32];
+  std::time_t now = std::time(nullptr);
+  std::tm tm{};
+  gmtime_r(&now, &tm);
+  std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  return text;
+}
+
+} // namespace
+
+SoakReport::Metrics::Metrics()
+    : fps(kFpsUnit), latency_ms(kLatencyUnit), cpu_pct(kCpuUnit), mbps(kMbpsUnit) {}
+
+void SoakReport::Metrics::reset() {
+  fps.reset();
+  latency_ms.reset();
+  cpu_pct.reset();
+  mbps.reset();
+  dropped = 0;
+  throttled = 0;
+  temperature_max_c = 0.0;
+}
+
+void SoakReport::Metrics::merge(const Metrics &other) {
+  fps.merge(other.fps);
+  latency_ms.merge(other.latency_ms);
+  cpu_pct.merge(other.cpu_pct);
+  mbps.merge(other.mbps);
+  dropped += other.dropped;
+  throttled |= other.throttled;
+  temperature_max_c = std::max(temperature_max_c, other.temperature_max_c);
+}
+
+SoakReport::SoakReport(const std::string &directory, unsigned rollup_seconds)
+    : directory_(directory), rollup_s_(rollup_seconds) {
+  const std::string path = directory_ + "/rollups.csv";
+  rollups_ = std::fopen(path.c_str(), "a");
+  if (!rollups_) {
+    throw_errno("Cannot open soak rollups '" + path + "'");
+  }
+  if (std::ftell(rollups_) == 0) {
+    std::fprintf(rollups_, "start_s,end_s,end_utc,samples,dropped,throttled,temp_max_c");
+    for (const char *name : kMetricNames) {
+      std::fprintf(rollups_, ",%s_min", name);
+      for (double p : kPercentiles) {
+        std::fprintf(rollups_, ",%s_p%.0f", name, p);
+      }
+      std::fprintf(rollups_, ",%s_max,%s_mean", name, name);
+    }
+    std::fprintf(rollups_, "\n");
+    std::fflush(rollups_);
+  }
+}
+
+SoakReport::~SoakReport() {
+  std::fclose(rollups_);
+}
+
+void SoakReport::add(const SoakSample &sample, double elapsed_s) {
+  if (elapsed_s - period_start_s_ >= rollup_s_) {
+    roll_up(elapsed_s);
+  }
+  period_.fps.record(sample.fps);
+  if (sample.latency_ms > 0) {
+    period_.latency_ms.record(sample.latency_ms);
+  }
+  period_.cpu_pct.record(sample.cpu_pct);
+  period_.mbps.record(sample.mbps);
+  // A restarted pipeline starts its counters over.
+  if (has_dropped_) {
+    period_.dropped += sample.dropped >= last_dropped_ ? sample.dropped - last_dropped_ : sample.dropped;
+  }
+  last_dropped_ = sample.dropped;
+  has_dropped_ = true;
+  period_.throttled |= sample.throttled & 0xf;
+  period_.temperature_max_c = std::max(period_.temperature_max_c, sample.temperature_c);
+}
+
+void SoakReport::finish(double elapsed_s) {
+  if (period_.fps.count() > 0) {
+    roll_up(elapsed_s);
+  }
+}
+
+void SoakReport::roll_up(double elapsed_s) {
+  const Histogram *histograms[] = {&period_.fps, &period_.latency_ms, &period_.cpu_pct, &period_.mbps};
+  std::fprintf(rollups_, "%.0f,%.0f,%s,%llu,%llu,0x%x,%.1f", period_start_s_, elapsed_s, utc_now().c_str(),
+               static_cast<unsigned long long>(period_.fps.count()),
+               static_cast<unsigned long long>(period_.dropped), period_.throttled, period_.temperature_max_c);
+  for (const Histogram *histogram : histograms) {
+    std::fprintf(rollups_, ",%.3f", histogram->min());
+    for (double p : kPercentiles) {
+      std::fprintf(rollups_, ",%.3f", histogram->percentile(p));
+    }
+    std::fprintf(rollups_, ",%.3f,%.3f", histogram->max(), histogram->mean());
+  }
+  std::fprintf(rollups_, "\n");
+  if (std::fflush(rollups_) != 0) {
+    warn_errno("Cannot write soak rollups");
+  }
+
+  total_.merge(period_);
+  period_.reset();
+  period_start_s_ = elapsed_s;
+  periods_ += 1;
+  write_summary(elapsed_s);
+}
+
+// Replaced whole through a rename, so a power cut leaves the previous one.
+void SoakReport::write_summary(double elapsed_s) {
+  const std::string path = directory_ + "/soak.json";
+  const std::string partial = path + ".tmp";
+  FILE *file = std::fopen(partial.c_str(), "w");
+  if (!file) {
+    warn_errno("Cannot write soak summary '" + partial + "'");
+    return;
+  }
+  std::fprintf(file,
+               "{\n  \"elapsed_s\": %.0f,\n  \"updated_utc\": \"%s\",\n  \"periods\": %llu,\n  \"samples\": %llu,\n"
+               "  \"dropped\": %llu,\n  \"throttled\": \"0x%x\",\n  \"temp_max_c\": %.1f",
+               elapsed_s, utc_now().c_str(), static_cast<unsigned long long>(periods_),
+               static_cast<unsigned long long>(total_.fps.count()), static_cast<unsigned long long>(total_.dropped),
+               total_.throttled, total_.temperature_max_c);
+  const Histogram *histograms[] = {&total_.fps, &total_.latency_ms, &total_.cpu_pct, &total_.mbps};
+  for (size_t i = 0; i < sizeof(histograms) / sizeof(histograms[0]); ++i) {
+    const Histogram &histogram = *histograms[i];
+    std::fprintf(file, ",\n  \"%s\": {\"min\": %.3f", kMetricNames[i], histogram.min());
+    for (double p : kPercentiles) {
+      std::fprintf(file, ", \"p%.0f\": %.3f", p, histogram.percentile(p));
+    }
+    std::fprintf(file, ", \"max\": %.3f, \"mean\": %.3f}", histogram.max(), histogram.mean());
+  }
+  std::fprintf(file, "\n}\n");
+  if (std::fclose(file) != 0) {
+    warn_errno("Cannot write soak summary '" + partial + "'");
+    return;
+  }
+  if (std::rename(partial.c_str(), path.c_str()) != 0) {
+    warn_errno("Cannot replace soak summary '" + path + "'");
+  }
+}
+
+} // namespace picam
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "histogram.hpp"
+
+namespace picam {
+
+// One metrics interval as the soak report takes it.
+struct SoakSample {
+  double fps = 0.0;
+  double latency_ms = 0.0;
+  double cpu_pct = 0.0;
+  double mbps = 0.0;
+  double temperature_c = 0.0;
+  // Cumulative, as the counters report them.
+  uint64_t dropped = 0;
+  uint32_t throttled = 0;
+};
+
+// Long-run aggregation for soak tests in constant memory and constant disk
+// writes: every sample goes into streaming histograms rather than a log, and
+// once per rollup period a row with the period's distribution is appended to
+// <directory>/rollups.csv and <directory>/soak.json is replaced with the
+// distribution over the whole run. A day at one-second samples is 24 rows.
+class SoakReport {
+public:
+  // Throws when the rollup file cannot be opened.
+  SoakReport(const std::string &directory, unsigned rollup_seconds);
+  ~SoakReport();
+
+  SoakReport(const SoakReport &) = delete;
+  SoakReport &operator=(const SoakReport &) = delete;
+
+  // elapsed_s is the sample's time since the start of the run.
+  void add(const SoakSample &sample, double elapsed_s);
+  // Writes the last, partial period.
+  void finish(double elapsed_s);
+
+private:
+  struct Metrics {
+    Metrics();
+    void reset();
+    void merge(const Metrics &other);
+
+    Histogram fps;
+    Histogram latency_ms;
+    Histogram cpu_pct;
+    Histogram mbps;
+    uint64_t dropped = 0;
+    uint32_t throttled = 0;
+    double temperature_max_c = 0.0;
+  };
+
+  void roll_up(double elapsed_s);
+  void write_summary(double elapsed_s);
+
+  std::string directory_;
+  double rollup_s_;
+  FILE *rollups_ = nullptr;
+  Metrics period_;
+  Metrics total_;
+  double period_start_s_ = 0.0;
+  uint64_t last_dropped_ = 0;
+  bool has_dropped_ = false;
+  uint64_t periods_ = 0;
+};
+
+} // namespace picam
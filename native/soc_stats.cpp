@@ -0,0 +1,124 @@
+#include "soc_stats.hpp"
+
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace picam {
+
+namespace {
+
+// Property channel of the VideoCore mailbox (linux/drivers/char/broadcom/vcio.c).
+const unsigned long kMailboxProperty = _IOWR(100, 0, char *);
+constexpr uint32_t kMailboxSuccess = 0x80000000;
+constexpr uint32_t kTagGetThrottled = 0x00030046;
+constexpr uint32_t kTagGetClockMeasured = 0x00030047;
+constexpr uint32_t kClockArm = 3;
+constexpr uint32_t kClockCore = 4;
+
+// Reads a small sysfs file from the start and parses it as a number.
+bool read_number(int fd, int base, unsigned long long &value) {
+  char buf[64];
+  ssize_t len = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+  if (len <= 0) {
+    return false;
+  }
+  buf[len] = '\0';
+  char *end = nullptr;
+  value = std::strtoull(buf, &end, base);
+  return end != buf;
+}
+
+} // namespace
+
+SocStats::SocStats() {
+  vcio_fd_ = open("/dev/vcio", O_RDWR | O_CLOEXEC);
+  temp_fd_ = open("/sys/class/thermal/thermal_zone0/temp", O_RDONLY | O_CLOEXEC);
+  cpufreq_fd_ = open("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", O_RDONLY | O_CLOEXEC);
+  if (vcio_fd_ < 0) {
+    throttled_fd_ = open("/sys/devices/platform/soc/soc:firmware/get_throttled", O_RDONLY | O_CLOEXEC);
+  }
+}
+
+SocStats::~SocStats() {
+  for (int fd : {vcio_fd_, temp_fd_, cpufreq_fd_, throttled_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+// One tag per call: buffer size, request code, tag, value size, tag
+// request code, values, end tag.
+bool SocStats::mailbox(uint32_t tag, uint32_t *values, unsigned count) {
+  if (vcio_fd_ < 0 || count > 2) {
+    return false;
+  }
+  alignas(16) uint32_t message[8] = {};
+  message[0] = sizeof(message);
+  message[2] = tag;
+  message[3] = count * sizeof(uint32_t);
+  for (unsigned i = 0; i < count; ++i) {
+    message[5 + i] = values[i];
+  }
+  if (ioctl(vcio_fd_, kMailboxProperty, message) < 0 || message[1] != kMailboxSuccess) {
+    return false;
+  }
+  for (unsigned i = 0; i < count; ++i) {
+    values[i] = message[5 + i];
+  }
+  return true;
+}
+
+SocSample SocStats::sample() {
+  SocSample result;
+  unsigned long long value = 0;
+  if (read_number(temp_fd_, 10, value)) {
+    result.temperature_c = static_cast<double>(value) / 1000.0;
+  }
+
+  uint32_t throttled[1] = {0};
+  if (mailbox(kTagGetThrottled, throttled, 1)) {
+    result.throttled = throttled[0];
+    result.has_throttled = true;
+  } else if (read_number(throttled_fd_, 16, value)) {
+    result.throttled = static_cast<uint32_t>(value);
+    result.has_throttled = true;
+  }
+
+  uint32_t arm[2] = {kClockArm, 0};
+  uint32_t core[2] = {kClockCore, 0};
+  if (mailbox(kTagGetClockMeasured, arm, 2)) {
+    result.arm_mhz = arm[1] / 1000000;
+  } else if (read_number(cpufreq_fd_, 10, value)) {
+    result.arm_mhz = static_cast<unsigned>(value / 1000);
+  }
+  if (mailbox(kTagGetClockMeasured, core, 2)) {
+    result.core_mhz = core[1] / 1000000;
+  }
+  return result;
+}
+
+std::string describe_throttle_flags(uint32_t flags) {
+  static const struct {
+    uint32_t flag;
+    const char *name;
+  } kNames[] = {
+      {kUnderVoltage, "under-voltage"},
+      {kArmFrequencyCapped, "capped"},
+      {kThrottled, "throttled"},
+      {kSoftTemperatureLimit, "soft-limit"},
+  };
+  std::string text;
+  for (const auto &entry : kNames) {
+    if (flags & entry.flag) {
+      text += text.empty() ? "" : ", ";
+      text += entry.name;
+    }
+  }
+  return text;
+}
+
+} // namespace picam
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace picam {
+
+// Firmware throttling flags, as vcgencmd get_throttled prints them. The low
+// bits are the current state, the same bits shifted by 16 whether it has
+// happened since boot.
+enum ThrottleFlag : uint32_t {
+  kUnderVoltage = 1u << 0,
+  kArmFrequencyCapped = 1u << 1,
+  kThrottled = 1u << 2,
+  kSoftTemperatureLimit = 1u << 3,
+};
+constexpr uint32_t kThrottleNowMask = 0xf;
+constexpr int kThrottleOccurredShift = 16;
+
+struct SocSample {
+  // 0 where the board does not tell.
+  double temperature_c = 0.0;
+  unsigned arm_mhz = 0;
+  unsigned core_mhz = 0;
+  uint32_t throttled = 0;
+  bool has_throttled = false;
+};
+
+// SoC temperature, ARM and core clocks and the throttling flags. Asks the
+// VideoCore firmware through the /dev/vcio mailbox, which is what vcgencmd
+// reads too, minus the fork; without it falls back to the thermal zone,
+// cpufreq and the firmware's get_throttled node in sysfs. Files stay open
+// like ProcessStats' ones.
+class SocStats {
+public:
+  SocStats();
+  ~SocStats();
+
+  SocStats(const SocStats &) = delete;
+  SocStats &operator=(const SocStats &) = delete;
+
+  SocSample sample();
+
+private:
+  bool mailbox(uint32_t tag, uint32_t *values, unsigned count);
+
+  int vcio_fd_ = -1;
+  int temp_fd_ = -1;
+  int cpufreq_fd_ = -1;
+  int throttled_fd_ = -1;
+};
+
+// "under-voltage, throttled" for the bits set now; empty for none.
+std::string describe_throttle_flags(uint32_t flags);
+
+} // namespace picam
@@ -0,0 +1,221 @@
+#include "stream_counters.hpp"
+
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x43535450; // "PTSC"
+constexpr uint32_t kVersion = 10;
+
+// Doubles travel as fixed point so every field is a plain atomic integer.
+constexpr double kFixedScale = 1000.0;
+
+uint64_t to_fixed(double value) {
+  return value > 0 ? static_cast<uint64_t>(value * kFixedScale + 0.5) : 0;
+}
+
+double from_fixed(uint64_t value) {
+  return static_cast<double>(value) / kFixedScale;
+}
+
+} // namespace
+
+struct StreamCounters::Block {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  std::atomic<uint32_t> sequence;
+  uint32_t reserved;
+  std::atomic<uint64_t> access_units;
+  std::atomic<uint64_t> idr_frames;
+  std::atomic<uint64_t> dropped_frames;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> fps_instant;
+  std::atomic<uint64_t> fps_window;
+  std::atomic<uint64_t> gop_bitrate;
+  std::atomic<uint64_t> gop_frames;
+  std::atomic<uint64_t> updated_ns;
+  std::atomic<uint64_t> record_segments;
+  std::atomic<uint64_t> record_write_ms;
+  std::atomic<uint64_t> record_queue_peak_pct;
+  std::atomic<uint64_t> record_paused;
+  std::atomic<uint64_t> motion_frames;
+  std::atomic<uint64_t> motion_events;
+  std::atomic<uint64_t> motion_active;
+  std::atomic<uint64_t> motion_score_pct;
+  std::atomic<uint64_t> rate_bitrate;
+  std::atomic<uint64_t> rate_framerate;
+  std::atomic<uint64_t> first_frame_ms;
+  std::atomic<uint64_t> interval_jitter_ms;
+  std::atomic<uint64_t> interval_max_ms;
+  std::atomic<uint64_t> delivery_latency_ms;
+  std::atomic<uint64_t> frame_peak_bytes;
+  std::atomic<uint64_t> roi_x;
+  std::atomic<uint64_t> roi_y;
+  std::atomic<uint64_t> roi_width;
+  std::atomic<uint64_t> roi_height;
+};
+
+StreamCounters StreamCounters::create(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    throw_errno("Cannot open counter file '" + path + "'");
+  }
+  if (ftruncate(fd, sizeof(Block)) < 0) {
+    close(fd);
+    throw_errno("Cannot size counter file '" + path + "'");
+  }
+  void *mem = mmap(nullptr, sizeof(Block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    throw_errno("Cannot map counter file '" + path + "'");
+  }
+
+  std::memset(mem, 0, sizeof(Block));
+  StreamCounters counters;
+  counters.block_ = new (mem) Block;
+  counters.block_->version = kVersion;
+  counters.block_->magic.store(kMagic, std::memory_order_release);
+  return counters;
+}
+
+StreamCounters StreamCounters::open_existing(const std::string &path) {
+  StreamCounters counters;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return counters;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(Block))) {
+    close(fd);
+    return counters;
+  }
+  void *mem = mmap(nullptr, sizeof(Block), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    return counters;
+  }
+
+  Block *block = static_cast<Block *>(mem);
+  if (block->magic.load(std::memory_order_acquire) != kMagic || block->version != kVersion) {
+    munmap(mem, sizeof(Block));
+    return counters;
+  }
+  counters.block_ = block;
+  return counters;
+}
+
+StreamCounters::StreamCounters(StreamCounters &&other) noexcept : block_(std::exchange(other.block_, nullptr)) {}
+
+StreamCounters &StreamCounters::operator=(StreamCounters &&other) noexcept {
+  if (this != &other) {
+    if (block_) {
+      munmap(block_, sizeof(Block));
+    }
+    block_ = std::exchange(other.block_, nullptr);
+  }
+  return *this;
+}
+
+StreamCounters::~StreamCounters() {
+  if (block_) {
+    munmap(block_, sizeof(Block));
+  }
+}
+
+void StreamCounters::publish(const StreamSnapshot &snapshot) {
+  Block &block = *block_;
+  uint32_t sequence = block.sequence.load(std::memory_order_relaxed);
+  block.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  block.access_units.store(snapshot.access_units, std::memory_order_relaxed);
+  block.idr_frames.store(snapshot.idr_frames, std::memory_order_relaxed);
+  block.dropped_frames.store(snapshot.dropped_frames, std::memory_order_relaxed);
+  block.bytes.store(snapshot.bytes, std::memory_order_relaxed);
+  block.fps_instant.store(to_fixed(snapshot.fps_instant), std::memory_order_relaxed);
+  block.fps_window.store(to_fixed(snapshot.fps_window), std::memory_order_relaxed);
+  block.gop_bitrate.store(to_fixed(snapshot.gop_bitrate), std::memory_order_relaxed);
+  block.gop_frames.store(snapshot.gop_frames, std::memory_order_relaxed);
+  block.updated_ns.store(snapshot.updated_ns, std::memory_order_relaxed);
+  block.record_segments.store(snapshot.record_segments, std::memory_order_relaxed);
+  block.record_write_ms.store(to_fixed(snapshot.record_write_ms), std::memory_order_relaxed);
+  block.record_queue_peak_pct.store(to_fixed(snapshot.record_queue_peak_pct), std::memory_order_relaxed);
+  block.record_paused.store(snapshot.record_paused ? 1 : 0, std::memory_order_relaxed);
+  block.motion_frames.store(snapshot.motion_frames, std::memory_order_relaxed);
+  block.motion_events.store(snapshot.motion_events, std::memory_order_relaxed);
+  block.motion_active.store(snapshot.motion_active ? 1 : 0, std::memory_order_relaxed);
+  block.motion_score_pct.store(to_fixed(snapshot.motion_score_pct), std::memory_order_relaxed);
+  block.rate_bitrate.store(snapshot.rate_bitrate, std::memory_order_relaxed);
+  block.rate_framerate.store(snapshot.rate_framerate, std::memory_order_relaxed);
+  block.first_frame_ms.store(to_fixed(snapshot.first_frame_ms), std::memory_order_relaxed);
+  block.interval_jitter_ms.store(to_fixed(snapshot.interval_jitter_ms), std::memory_order_relaxed);
+  block.interval_max_ms.store(to_fixed(snapshot.interval_max_ms), std::memory_order_relaxed);
+  block.delivery_latency_ms.store(to_fixed(snapshot.delivery_latency_ms), std::memory_order_relaxed);
+  block.frame_peak_bytes.store(snapshot.frame_peak_bytes, std::memory_order_relaxed);
+  block.roi_x.store(snapshot.roi_x, std::memory_order_relaxed);
+  block.roi_y.store(snapshot.roi_y, std::memory_order_relaxed);
+  block.roi_width.store(snapshot.roi_width, std::memory_order_relaxed);
+  block.roi_height.store(snapshot.roi_height, std::memory_order_relaxed);
+
+  block.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool StreamCounters::read(StreamSnapshot &snapshot) const {
+  const Block &block = *block_;
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    uint32_t before = block.sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+
+    StreamSnapshot copy;
+    copy.access_units = block.access_units.load(std::memory_order_relaxed);
+    copy.idr_frames = block.idr_frames.load(std::memory_order_relaxed);
+    copy.dropped_frames = block.dropped_frames.load(std::memory_order_relaxed);
+    copy.bytes = block.bytes.load(std::memory_order_relaxed);
+    copy.fps_instant = from_fixed(block.fps_instant.load(std::memory_order_relaxed));
+    copy.fps_window = from_fixed(block.fps_window.load(std::memory_order_relaxed));
+    copy.gop_bitrate = from_fixed(block.gop_bitrate.load(std::memory_order_relaxed));
+    copy.gop_frames = block.gop_frames.load(std::memory_order_relaxed);
+    copy.updated_ns = block.updated_ns.load(std::memory_order_relaxed);
+    copy.record_segments = block.record_segments.load(std::memory_order_relaxed);
+    copy.record_write_ms = from_fixed(block.record_write_ms.load(std::memory_order_relaxed));
+    copy.record_queue_peak_pct = from_fixed(block.record_queue_peak_pct.load(std::memory_order_relaxed));
+    copy.record_paused = block.record_paused.load(std::memory_order_relaxed) != 0;
+    copy.motion_frames = block.motion_frames.load(std::memory_order_relaxed);
+    copy.motion_events = block.motion_events.load(std::memory_order_relaxed);
+    copy.motion_active = block.motion_active.load(std::memory_order_relaxed) != 0;
+    copy.motion_score_pct = from_fixed(block.motion_score_pct.load(std::memory_order_relaxed));
+    copy.rate_bitrate = block.rate_bitrate.load(std::memory_order_relaxed);
+    copy.rate_framerate = block.rate_framerate.load(std::memory_order_relaxed);
+    copy.first_frame_ms = from_fixed(block.first_frame_ms.load(std::memory_order_relaxed));
+    copy.interval_jitter_ms = from_fixed(block.interval_jitter_ms.load(std::memory_order_relaxed));
+    copy.interval_max_ms = from_fixed(block.interval_max_ms.load(std::memory_order_relaxed));
+    copy.delivery_latency_ms = from_fixed(block.delivery_latency_ms.load(std::memory_order_relaxed));
+    copy.frame_peak_bytes = block.frame_peak_bytes.load(std::memory_order_relaxed);
+    copy.roi_x = block.roi_x.load(std::memory_order_relaxed);
+    copy.roi_y = block.roi_y.load(std::memory_order_relaxed);
+    copy.roi_width = block.roi_width.load(std::memory_order_relaxed);
+    copy.roi_height = block.roi_height.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (block.sequence.load(std::memory_order_relaxed) == before) {
+      snapshot = copy;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace picam
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace picam {
+
+struct StreamSnapshot {
+  uint64_t access_units = 0;
+  uint64_t idr_frames = 0;
+  uint64_t dropped_frames = 0;
+  uint64_t bytes = 0;
+  double fps_instant = 0.0;
+  double fps_window = 0.0;
+  double gop_bitrate = 0.0;
+  uint64_t gop_frames = 0;
+  uint64_t updated_ns = 0;
+  // Filled in only while a SegmentRecorder tees the stream to disk.
+  uint64_t record_segments = 0;
+  double record_write_ms = 0.0;
+  double record_queue_peak_pct = 0.0;
+  // Recording stopped from the capture's control socket ("record stop").
+  bool record_paused = false;
+  // Filled in from the motion SEI of 'capture --motion'; motion_frames stays 0 without it.
+  uint64_t motion_frames = 0;
+  uint64_t motion_events = 0;
+  bool motion_active = false;
+  double motion_score_pct = 0.0;
+  // Setting of 'capture --adaptive' or '--control-socket' from the rate SEI;
+  // 0 while the rate is fixed.
+  uint64_t rate_bitrate = 0;
+  uint64_t rate_framerate = 0;
+  // Wall time from the start of the run (PICAM_START_US, else the monitor's
+  // own start) to the first picture; 0 until that picture arrives.
+  double first_frame_ms = 0.0;
+  // Spread (standard deviation) and longest of the intervals at which
+  // pictures reached the monitor over the last second. Sensor timestamps
+  // stay regular; these show what scheduling did to delivery.
+  double interval_jitter_ms = 0.0;
+  double interval_max_ms = 0.0;
+  // Mean time from the sensor timestamp to the monitor over the last second:
+  // capture, encode and the hop to the stage that runs the monitor. 0 for
+  // byte streams, which carry no timestamps.
+  double delivery_latency_ms = 0.0;
+  // Largest picture over the last second. Next to the stream's mean it tells
+  // how bursty it is: an IDR every second stands out, intra refresh does not.
+  uint64_t frame_peak_bytes = 0;
+  // ISP crop in sensor pixels from the ROI SEI of 'capture --roi' or
+  // '--control-socket'; roi_width stays 0 without it.
+  uint64_t roi_x = 0;
+  uint64_t roi_y = 0;
+  uint64_t roi_width = 0;
+  uint64_t roi_height = 0;
+};
+
+// Counter block in a shared file (normally on /dev/shm) written by the
+// stream monitor and read by 'picam-native metrics'. Updates are published
+// with a sequence lock: the writer never waits and readers simply retry.
+class StreamCounters {
+public:
+  // Writer side: truncates the file to the block size and initialises it.
+  static StreamCounters create(const std::string &path);
+  // Reader side: returns an unmapped object if the writer has not set the
+  // file up yet; check with valid() and try again later.
+  static StreamCounters open_existing(const std::string &path);
+
+  StreamCounters(StreamCounters &&other) noexcept;
+  StreamCounters &operator=(StreamCounters &&other) noexcept;
+  ~StreamCounters();
+
+  bool valid() const { return block_ != nullptr; }
+
+  void publish(const StreamSnapshot &snapshot);
+  bool read(StreamSnapshot &snapshot) const;
+
+private:
+  struct Block;
+
+  StreamCounters() = default;
+
+  Block *block_ = nullptr;
+};
+
+} // namespace picam
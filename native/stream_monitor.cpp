@@ -0,0 +1,301 @@
+#include "stream_monitor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "motion.hpp"
+#include "rate_controller.hpp"
+#include "roi.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr int64_t kWindowUs = 1000000;
+// Above this, the timestamps are not on the monitor's clock after all.
+constexpr int64_t kMaxLatencyUs = 10000000;
+
+bool is_slice(uint8_t type) {
+  return type == h264::kNalSlice || type == h264::kNalIdrSlice;
+}
+
+int64_t arrival_us() {
+  return static_cast<int64_t>(monotonic_ns() / 1000);
+}
+
+// Wall clock, so that the start time can come from another process.
+int64_t realtime_us() {
+  timespec ts{};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t run_start_us() {
+  const char *start = std::getenv("PICAM_START_US");
+  if (start) {
+    char *end = nullptr;
+    long long value = std::strtoll(start, &end, 10);
+    if (end != start && *end == '\0' && value > 0) {
+      return value;
+    }
+  }
+  return realtime_us();
+}
+
+} // namespace
+
+StreamMonitor::StreamMonitor(const std::string &counters_path, unsigned framerate, Codec codec)
+    : counters_(StreamCounters::create(counters_path)),
+      frame_interval_us_(framerate > 0 ? 1000000 / framerate : 0), start_realtime_us_(run_start_us()),
+      intra_only_(codec_intra_only(codec)) {}
+
+void StreamMonitor::track_parameter_sets(const h264::NalUnit &nal) {
+  if (nal.type == h264::kNalSps) {
+    h264::parse_sps(nal, sps_);
+  }
+}
+
+// Every reference picture bumps frame_num by one; anything else after a
+// reference picture means pictures went missing upstream.
+uint64_t StreamMonitor::frame_num_gap(const h264::NalUnit &nal, const h264::SliceInfo &slice) {
+  uint64_t missing = 0;
+  const unsigned max_frame_num = 1u << sps_.log2_max_frame_num;
+  if (nal.type == h264::kNalIdrSlice) {
+    have_ref_frame_num_ = false;
+  } else if (have_ref_frame_num_) {
+    unsigned expected = (prev_ref_frame_num_ + 1) % max_frame_num;
+    missing = (slice.frame_num + max_frame_num - expected) % max_frame_num;
+  }
+  bool reference = (nal.data[0] & 0x60) != 0;
+  if (reference) {
+    prev_ref_frame_num_ = slice.frame_num;
+    have_ref_frame_num_ = true;
+  }
+  return missing;
+}
+
+void StreamMonitor::count_picture(const Picture &picture) {
+  if (snapshot_.access_units == 0) {
+    snapshot_.first_frame_ms = std::max<int64_t>(realtime_us() - start_realtime_us_, 1) / 1000.0;
+    std::fprintf(stderr, "picam-native: First frame %.0f ms after start\n", snapshot_.first_frame_ms);
+  }
+  snapshot_.access_units += 1;
+  snapshot_.bytes += picture.bytes;
+  snapshot_.dropped_frames += picture.missing;
+  snapshot_.updated_ns = monotonic_ns();
+
+  if (have_last_time_ && picture.time_us > last_time_us_) {
+    snapshot_.fps_instant = 1e6 / static_cast<double>(picture.time_us - last_time_us_);
+  }
+  last_time_us_ = picture.time_us;
+  have_last_time_ = true;
+
+  window_.push_back(picture.time_us);
+  while (window_.size() > 1 && picture.time_us - window_.front() > kWindowUs) {
+    window_.pop_front();
+  }
+  if (window_.size() > 1 && window_.back() > window_.front()) {
+    snapshot_.fps_window =
+        static_cast<double>(window_.size() - 1) * 1e6 / static_cast<double>(window_.back() - window_.front());
+  }
+
+  update_jitter(arrival_us());
+  update_frame_peak(picture);
+
+  if (picture.idr) {
+    snapshot_.idr_frames += 1;
+  }
+  // Intra-only streams have no GOP; a one-second span stands in for it.
+  const bool gop_boundary =
+      picture.idr && (!intra_only_ || !gop_open_ || picture.time_us - gop_start_us_ >= kWindowUs);
+  if (gop_boundary) {
+    if (gop_open_ && picture.time_us > gop_start_us_) {
+      snapshot_.gop_bitrate = static_cast<double>(gop_bytes_) * 8.0 * 1e6 /
+                              static_cast<double>(picture.time_us - gop_start_us_);
+      snapshot_.gop_frames = gop_pictures_;
+    }
+    gop_open_ = true;
+    gop_start_us_ = picture.time_us;
+    gop_bytes_ = 0;
+    gop_pictures_ = 0;
+  }
+  gop_bytes_ += picture.bytes;
+  gop_pictures_ += 1;
+
+  counters_.publish(snapshot_);
+}
+
+void StreamMonitor::update_jitter(int64_t now_us) {
+  arrivals_.push_back(now_us);
+  while (arrivals_.size() > 2 && now_us - arrivals_.front() > kWindowUs) {
+    arrivals_.pop_front();
+  }
+  if (arrivals_.size() < 3) {
+    return;
+  }
+  const size_t intervals = arrivals_.size() - 1;
+  const double mean_us = static_cast<double>(arrivals_.back() - arrivals_.front()) / static_cast<double>(intervals);
+  double sum_sq = 0.0;
+  int64_t longest_us = 0;
+  for (size_t i = 1; i < arrivals_.size(); ++i) {
+    const int64_t interval_us = arrivals_[i] - arrivals_[i - 1];
+    sum_sq += (interval_us - mean_us) * (interval_us - mean_us);
+    longest_us = std::max(longest_us, interval_us);
+  }
+  snapshot_.interval_jitter_ms = std::sqrt(sum_sq / static_cast<double>(intervals)) / 1000.0;
+  snapshot_.interval_max_ms = static_cast<double>(longest_us) / 1000.0;
+}
+
+void StreamMonitor::update_frame_peak(const Picture &picture) {
+  sizes_.emplace_back(picture.time_us, picture.bytes);
+  while (sizes_.size() > 1 && picture.time_us - sizes_.front().first > kWindowUs) {
+    sizes_.pop_front();
+  }
+  uint64_t peak = 0;
+  for (const auto &entry : sizes_) {
+    peak = std::max(peak, entry.second);
+  }
+  snapshot_.frame_peak_bytes = peak;
+}
+
+// Sensor timestamps are CLOCK_MONOTONIC, the clock arrivals are taken on, so
+// their difference is the time the picture took to get here.
+void StreamMonitor::update_latency(int64_t now_us, int64_t timestamp_us) {
+  const int64_t latency_us = now_us - timestamp_us;
+  if (timestamp_us <= 0 || latency_us < 0 || latency_us > kMaxLatencyUs) {
+    return;
+  }
+  latencies_.emplace_back(now_us, latency_us);
+  latency_sum_us_ += latency_us;
+  while (latencies_.size() > 1 && now_us - latencies_.front().first > kWindowUs) {
+    latency_sum_us_ -= latencies_.front().second;
+    latencies_.pop_front();
+  }
+  snapshot_.delivery_latency_ms =
+      static_cast<double>(latency_sum_us_) / static_cast<double>(latencies_.size()) / 1000.0;
+}
+
+void StreamMonitor::set_recording(const RecorderStatus &status) {
+  snapshot_.record_segments = status.segments;
+  snapshot_.record_write_ms = status.write_ms;
+  snapshot_.record_queue_peak_pct = status.queue_peak_pct;
+  snapshot_.record_paused = status.paused;
+}
+
+// Picture type and the motion and rate SEI of an H.264 access unit.
+void StreamMonitor::parse_access_unit(const uint8_t *data, size_t size, Picture &picture) {
+  h264::NalReader reader(data, size);
+  h264::NalUnit nal;
+  while (reader.next(nal)) {
+    track_parameter_sets(nal);
+    if (is_slice(nal.type)) {
+      picture.idr = nal.type == h264::kNalIdrSlice;
+      break;
+    }
+  }
+
+  MotionState motion;
+  if (find_motion_sei(data, size, motion)) {
+    snapshot_.motion_frames += 1;
+    snapshot_.motion_events += motion.active && !snapshot_.motion_active;
+    snapshot_.motion_active = motion.active;
+    snapshot_.motion_score_pct = motion.score_pct;
+  }
+  RateSetting rate;
+  if (find_rate_sei(data, size, rate) && rate.framerate > 0) {
+    // An adaptive encoder changes the frame rate; a longer interval is not a drop.
+    frame_interval_us_ = 1000000 / rate.framerate;
+    snapshot_.rate_bitrate = rate.bitrate;
+    snapshot_.rate_framerate = rate.framerate;
+  }
+  CropRect crop;
+  if (find_roi_sei(data, size, crop)) {
+    snapshot_.roi_x = crop.x;
+    snapshot_.roi_y = crop.y;
+    snapshot_.roi_width = crop.width;
+    snapshot_.roi_height = crop.height;
+  }
+}
+
+void StreamMonitor::access_unit(const uint8_t *data, size_t size, int64_t timestamp_us) {
+  Picture picture;
+  picture.bytes = size;
+  picture.time_us = timestamp_us;
+  update_latency(arrival_us(), timestamp_us);
+
+  if (intra_only_) {
+    picture.idr = true;
+  } else {
+    parse_access_unit(data, size, picture);
+  }
+
+  if (frame_interval_us_ > 0 && have_last_time_ && timestamp_us > last_time_us_) {
+    double intervals = static_cast<double>(timestamp_us - last_time_us_) / frame_interval_us_;
+    if (intervals > 1.5) {
+      picture.missing = static_cast<uint64_t>(std::llround(intervals)) - 1;
+    }
+  }
+  count_picture(picture);
+}
+
+void StreamMonitor::on_nal(const h264::NalUnit &nal, size_t wire_size) {
+  track_parameter_sets(nal);
+  if (!is_slice(nal.type)) {
+    prefix_bytes_ += wire_size;
+    return;
+  }
+
+  h264::SliceInfo slice;
+  if (!h264::parse_slice_header(nal, sps_, slice)) {
+    current_.bytes += wire_size;
+    return;
+  }
+  if (slice.first_mb != 0 && picture_open_) {
+    current_.bytes += prefix_bytes_ + wire_size;
+    prefix_bytes_ = 0;
+    return;
+  }
+
+  // First slice of a new picture: the previous one is complete now.
+  if (picture_open_) {
+    count_picture(current_);
+  }
+  current_ = Picture{};
+  current_.idr = nal.type == h264::kNalIdrSlice;
+  current_.time_us = arrival_us();
+  current_.bytes = prefix_bytes_ + wire_size;
+  current_.missing = sps_.valid ? frame_num_gap(nal, slice) : 0;
+  prefix_bytes_ = 0;
+  picture_open_ = true;
+}
+
+void StreamMonitor::feed(const uint8_t *data, size_t size) {
+  pending_.insert(pending_.end(), data, data + size);
+
+  // Only NAL units followed by another start code are known to be complete.
+  h264::NalReader reader(pending_.data(), pending_.size());
+  h264::NalUnit nal;
+  h264::NalUnit previous;
+  bool have_previous = false;
+  size_t consumed = 0;
+  while (reader.next(nal)) {
+    if (have_previous) {
+      on_nal(previous, nal.start_code_offset - previous.start_code_offset);
+      consumed = nal.start_code_offset;
+    }
+    previous = nal;
+    have_previous = true;
+  }
+  if (consumed > 0) {
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(consumed));
+  } else if (!have_previous && pending_.size() > 4) {
+    // No start code yet (mid-stream attach): keep just enough to find one.
+    pending_.erase(pending_.begin(), pending_.end() - 3);
+  }
+}
+
+} // namespace picam
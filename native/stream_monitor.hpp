@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "codec.hpp"
+#include "h264.hpp"
+#include "segment_recorder.hpp"
+#include "stream_counters.hpp"
+
+namespace picam {
+
+// Parser stage between capture and display. It counts access units and IDRs,
+// spots dropped frames, measures instantaneous and one-second FPS plus the
+// bitrate of each GOP, and publishes everything through a StreamCounters
+// block after every picture, along with the jitter of the intervals at
+// which pictures arrive. The first picture also stamps the time to
+// first frame, counted from PICAM_START_US (microseconds of CLOCK_REALTIME,
+// exported by picam.sh at startup) or else from the monitor's construction.
+// MJPEG and raw YUV records are counted without parsing: each is a picture
+// of its own, and the bitrate is taken over one-second spans instead of GOPs.
+class StreamMonitor {
+public:
+  StreamMonitor(const std::string &counters_path, unsigned framerate, Codec codec = Codec::kH264);
+
+  // One complete access unit stamped with its capture time (ring readers).
+  // Drops are found from gaps between timestamps, at the frame rate of the
+  // rate SEI when 'capture --adaptive' sends one.
+  void access_unit(const uint8_t *data, size_t size, int64_t timestamp_us);
+
+  // Any chunk of an Annex B byte stream without timestamps (FIFO tap).
+  // Drops are found from frame_num gaps; FPS uses arrival times.
+  void feed(const uint8_t *data, size_t size);
+
+  // Recorder state to carry in the next published snapshot.
+  void set_recording(const RecorderStatus &status);
+
+private:
+  struct Picture {
+    bool idr = false;
+    uint64_t bytes = 0;
+    int64_t time_us = 0;
+    uint64_t missing = 0;
+  };
+
+  void track_parameter_sets(const h264::NalUnit &nal);
+  uint64_t frame_num_gap(const h264::NalUnit &nal, const h264::SliceInfo &slice);
+  void parse_access_unit(const uint8_t *data, size_t size, Picture &picture);
+  void on_nal(const h264::NalUnit &nal, size_t wire_size);
+  void count_picture(const Picture &picture);
+  void update_jitter(int64_t now_us);
+  void update_latency(int64_t now_us, int64_t timestamp_us);
+  void update_frame_peak(const Picture &picture);
+
+  StreamCounters counters_;
+  StreamSnapshot snapshot_;
+  int64_t frame_interval_us_;
+  int64_t start_realtime_us_;
+  bool intra_only_;
+
+  h264::SpsInfo sps_;
+  bool have_ref_frame_num_ = false;
+  unsigned prev_ref_frame_num_ = 0;
+
+  bool have_last_time_ = false;
+  int64_t last_time_us_ = 0;
+  std::deque<int64_t> window_;
+  // Arrival times (monotonic) of the pictures of the last second.
+  std::deque<int64_t> arrivals_;
+  // (arrival, sensor-to-arrival) pairs of the last second, and their sum.
+  std::deque<std::pair<int64_t, int64_t>> latencies_;
+  int64_t latency_sum_us_ = 0;
+  // (timestamp, size) of the pictures of the last second.
+  std::deque<std::pair<int64_t, uint64_t>> sizes_;
+
+  bool gop_open_ = false;
+  int64_t gop_start_us_ = 0;
+  uint64_t gop_bytes_ = 0;
+  uint64_t gop_pictures_ = 0;
+
+  // Byte-stream state: the picture being assembled and what precedes it.
+  std::vector<uint8_t> pending_;
+  bool picture_open_ = false;
+  Picture current_;
+  uint64_t prefix_bytes_ = 0;
+};
+
+} // namespace picam
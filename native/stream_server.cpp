@@ -0,0 +1,342 @@
+#include "stream_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr size_t kTsPacketSize = 188;
+constexpr unsigned kMinBacklogFrames = 8;
+constexpr size_t kMaxRequestBytes = 4096;
+// Slots handed to one sendmsg; a client that is caught up needs one or two.
+constexpr size_t kMaxIov = 16;
+
+constexpr char kStreamResponse[] = "HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: video/mp2t\r\n"
+                                   "Cache-Control: no-cache\r\n"
+                                   "Access-Control-Allow-Origin: *\r\n"
+                                   "Connection: close\r\n"
+                                   "\r\n";
+constexpr char kNotFoundResponse[] = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
+constexpr char kBusyResponse[] = "HTTP/1.0 503 Service Unavailable\r\nRetry-After: 5\r\nConnection: close\r\n\r\n";
+
+// Best effort: a refusal is tiny and the socket buffer is empty.
+void send_and_close(int fd, const char *response) {
+  send(fd, response, std::strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(fd);
+}
+
+bool stream_path(const std::string &request) {
+  if (request.compare(0, 4, "GET ") != 0) {
+    return false;
+  }
+  size_t end = request.find_first_of(" ?", 4);
+  std::string path = request.substr(4, end == std::string::npos ? std::string::npos : end - 4);
+  return path == "/" || path == "/stream.ts";
+}
+
+} // namespace
+
+StreamServer::StreamServer(const StreamServerConfig &config)
+    : config_(config), slots_(std::max(config.backlog_frames, kMinBacklogFrames)) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_PASSIVE;
+  addrinfo *result = nullptr;
+  std::string port = std::to_string(config_.port);
+  int rc = getaddrinfo(config_.host.empty() ? nullptr : config_.host.c_str(), port.c_str(), &hints, &result);
+  if (rc != 0) {
+    throw Error("Cannot resolve '" + config_.host + "': " + gai_strerror(rc));
+  }
+
+  int error = 0;
+  for (addrinfo *ai = result; ai; ai = ai->ai_next) {
+    listen_fd_ = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (listen_fd_ < 0) {
+      error = errno;
+      continue;
+    }
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd_, ai->ai_addr, ai->ai_addrlen) == 0 && listen(listen_fd_, 16) == 0) {
+      break;
+    }
+    error = errno;
+    close(listen_fd_);
+    listen_fd_ = -1;
+  }
+  freeaddrinfo(result);
+  if (listen_fd_ < 0) {
+    errno = error;
+    throw_errno("Cannot listen on " + address());
+  }
+  clients_.reserve(config_.max_clients);
+  pollfds_.reserve(config_.max_clients + 1);
+}
+
+StreamServer::~StreamServer() {
+  for (auto &client : clients_) {
+    if (client.fd >= 0) {
+      close(client.fd);
+    }
+  }
+  close(listen_fd_);
+}
+
+std::string StreamServer::address() const {
+  std::string host = config_.host.empty() ? "*" : config_.host;
+  if (host.find(':') != std::string::npos) {
+    host = "[" + host + "]";
+  }
+  return host + ":" + std::to_string(config_.port);
+}
+
+void StreamServer::write(const EncodedFrame &frame) {
+  const uint64_t sequence = head_;
+  Slot &next = slot(sequence);
+  if (next.refs > 0) {
+    // The pool wrapped onto a unit someone still has to send.
+    for (auto &client : clients_) {
+      if (client.state == ClientState::kStreaming && client.cursor + slots_.size() <= sequence) {
+        skip_to_keyframe(client);
+      }
+    }
+  }
+
+  next.data.clear();
+  muxer_.write(frame.data, frame.size, frame.timestamp_us, frame.keyframe, next.data);
+  next.sequence = sequence;
+  next.keyframe = frame.keyframe;
+  next.refs = 0;
+  for (auto &client : clients_) {
+    if (client.state == ClientState::kWaitKeyframe && frame.keyframe) {
+      client.state = ClientState::kStreaming;
+      client.cursor = sequence;
+      client.offset = 0;
+    }
+    next.refs += client.state == ClientState::kStreaming;
+  }
+  head_ = sequence + 1;
+
+  for (auto &client : clients_) {
+    if (client.fd >= 0 && !flush(client)) {
+      close_client(client);
+    }
+  }
+  remove_closed();
+}
+
+void StreamServer::service() {
+  pollfds_.clear();
+  pollfds_.push_back({listen_fd_, POLLIN, 0});
+  for (const auto &client : clients_) {
+    pollfds_.push_back({client.fd, POLLIN, 0});
+  }
+  if (poll(pollfds_.data(), pollfds_.size(), 0) <= 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    Client &client = clients_[i];
+    if (!(pollfds_[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+      continue;
+    }
+    if (client.state == ClientState::kRequest) {
+      read_request(client);
+      continue;
+    }
+    // Viewers have nothing more to say; input here means they hung up.
+    char scratch[256];
+    ssize_t len = recv(client.fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+    if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+      close_client(client);
+    }
+  }
+  for (auto &client : clients_) {
+    if (client.fd >= 0 && !flush(client)) {
+      close_client(client);
+    }
+  }
+  remove_closed();
+
+  if (pollfds_[0].revents & POLLIN) {
+    accept_clients();
+  }
+}
+
+void StreamServer::accept_clients() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+        warn_errno("Cannot accept a viewer");
+      }
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    if (clients_.size() >= config_.max_clients) {
+      ++stats_.refused;
+      send_and_close(fd, kBusyResponse);
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Client client;
+    client.fd = fd;
+    clients_.push_back(std::move(client));
+  }
+}
+
+void StreamServer::read_request(Client &client) {
+  char buf[1024];
+  for (;;) {
+    ssize_t len = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (len > 0) {
+      client.request.append(buf, static_cast<size_t>(len));
+      continue;
+    }
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    }
+    close_client(client);
+    return;
+  }
+
+  if (client.request.find("\r\n\r\n") == std::string::npos) {
+    if (client.request.size() > kMaxRequestBytes) {
+      close_client(client);
+    }
+    return;
+  }
+  if (!stream_path(client.request)) {
+    send_and_close(client.fd, kNotFoundResponse);
+    client.fd = -1;
+    return;
+  }
+  client.request.clear();
+  client.request.shrink_to_fit();
+  client.pending = kStreamResponse;
+  client.pending_offset = 0;
+  client.state = ClientState::kWaitKeyframe;
+  ++stats_.served;
+}
+
+// Sends the pending bytes and then as many whole or partial slots as the
+// socket takes, releasing each slot as soon as it is fully sent.
+bool StreamServer::flush(Client &client) {
+  for (;;) {
+    iovec iov[kMaxIov + 1];
+    size_t count = 0;
+    size_t total = 0;
+    if (client.pending_offset < client.pending.size()) {
+      iov[count].iov_base = &client.pending[client.pending_offset];
+      iov[count].iov_len = client.pending.size() - client.pending_offset;
+      total += iov[count++].iov_len;
+    }
+    if (client.state == ClientState::kStreaming) {
+      size_t offset = client.offset;
+      for (uint64_t sequence = client.cursor; sequence < head_ && count <= kMaxIov; ++sequence) {
+        Slot &unit = slot(sequence);
+        iov[count].iov_base = unit.data.data() + offset;
+        iov[count].iov_len = unit.data.size() - offset;
+        total += iov[count++].iov_len;
+        offset = 0;
+      }
+    }
+    if (total == 0) {
+      return true;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t sent = sendmsg(client.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    size_t left = static_cast<size_t>(sent);
+    if (client.pending_offset < client.pending.size()) {
+      size_t used = std::min(left, client.pending.size() - client.pending_offset);
+      client.pending_offset += used;
+      left -= used;
+      if (client.pending_offset == client.pending.size()) {
+        client.pending.clear();
+        client.pending_offset = 0;
+      }
+    }
+    while (left > 0) {
+      Slot &unit = slot(client.cursor);
+      size_t rest = unit.data.size() - client.offset;
+      if (left < rest) {
+        client.offset += left;
+        break;
+      }
+      left -= rest;
+      --unit.refs;
+      ++client.cursor;
+      client.offset = 0;
+    }
+    if (static_cast<size_t>(sent) < total) {
+      return true;
+    }
+  }
+}
+
+void StreamServer::release(Client &client) {
+  if (client.state != ClientState::kStreaming) {
+    return;
+  }
+  for (uint64_t sequence = client.cursor; sequence < head_; ++sequence) {
+    --slot(sequence).refs;
+  }
+  client.state = ClientState::kWaitKeyframe;
+}
+
+void StreamServer::skip_to_keyframe(Client &client) {
+  // Finish the TS packet already on the wire so the viewer stays in sync.
+  if (client.offset % kTsPacketSize != 0) {
+    const Slot &unit = slot(client.cursor);
+    size_t rest = kTsPacketSize - client.offset % kTsPacketSize;
+    client.pending.assign(reinterpret_cast<const char *>(unit.data.data() + client.offset), rest);
+    client.pending_offset = 0;
+  }
+  release(client);
+  client.offset = 0;
+  ++stats_.skips;
+}
+
+void StreamServer::close_client(Client &client) {
+  release(client);
+  if (client.fd >= 0) {
+    close(client.fd);
+    client.fd = -1;
+  }
+}
+
+void StreamServer::remove_closed() {
+  clients_.erase(std::remove_if(clients_.begin(), clients_.end(), [](const Client &client) { return client.fd < 0; }),
+                 clients_.end());
+  stats_.clients = static_cast<unsigned>(clients_.size());
+}
+
+} // namespace picam
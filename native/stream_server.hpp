@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+#include "frame.hpp"
+#include "ts_muxer.hpp"
+
+namespace picam {
+
+struct StreamServerConfig {
+  std::string host;
+  uint16_t port = 8080;
+  unsigned max_clients = 10;
+  // Access units buffered for all clients together; a client further behind
+  // than this skips ahead to the next IDR.
+  unsigned backlog_frames = 60;
+};
+
+struct StreamServerStats {
+  unsigned clients = 0;
+  uint64_t served = 0;
+  uint64_t skips = 0;
+  uint64_t refused = 0;
+};
+
+// HTTP server that fans one encode out to many viewers as MPEG-TS. Each
+// access unit is muxed once into a slot of a fixed pool; a slot counts the
+// clients that still have to send it and is only reused once that count is
+// zero, so every client sends straight out of the shared slot with its own
+// cursor and no copy. When the pool wraps onto a slot a slow client still
+// holds, that client alone drops its backlog and resumes at the next IDR.
+// Everything runs on the caller's thread with non-blocking sockets.
+class StreamServer : public FrameSink {
+public:
+  explicit StreamServer(const StreamServerConfig &config);
+  ~StreamServer() override;
+
+  StreamServer(const StreamServer &) = delete;
+  StreamServer &operator=(const StreamServer &) = delete;
+
+  // Publishes one access unit to every client and sends what the sockets take.
+  void write(const EncodedFrame &frame) override;
+  // Accepts clients, reads their requests and flushes pending data; call
+  // this regularly even while no frames arrive.
+  void service();
+
+  const StreamServerStats &stats() const { return stats_; }
+  std::string address() const;
+
+private:
+  struct Slot {
+    std::vector<uint8_t> data;
+    uint64_t sequence = 0;
+    bool keyframe = false;
+    unsigned refs = 0;
+  };
+
+  enum class ClientState { kRequest, kWaitKeyframe, kStreaming };
+
+  struct Client {
+    int fd = -1;
+    ClientState state = ClientState::kRequest;
+    std::string request;
+    // Response header, or the rest of a TS packet cut short by a skip.
+    std::string pending;
+    size_t pending_offset = 0;
+    uint64_t cursor = 0;
+    size_t offset = 0;
+  };
+
+  Slot &slot(uint64_t sequence) { return slots_[sequence % slots_.size()]; }
+  void accept_clients();
+  void read_request(Client &client);
+  bool flush(Client &client);
+  void release(Client &client);
+  void skip_to_keyframe(Client &client);
+  void close_client(Client &client);
+  void remove_closed();
+
+  StreamServerConfig config_;
+  int listen_fd_ = -1;
+  std::vector<Slot> slots_;
+  uint64_t head_ = 0;
+  std::vector<Client> clients_;
+  std::vector<pollfd> pollfds_;
+  TsMuxer muxer_;
+  StreamServerStats stats_;
+};
+
+} // namespace picam
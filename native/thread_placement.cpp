@@ -0,0 +1,73 @@
+#include "thread_placement.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+bool place_current_thread(const ThreadPlacement &placement, const std::string &name) {
+  // pthread calls return the error instead of setting errno.
+  bool placed = true;
+  if (placement.cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement.cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+      std::fprintf(stderr, "picam-native: Cannot pin the %s thread to CPU %d: %s\n", name.c_str(), placement.cpu,
+                   std::strerror(err));
+      placed = false;
+    }
+  }
+  if (placement.fifo_priority > 0) {
+    sched_param param{};
+    param.sched_priority = placement.fifo_priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0) {
+      std::fprintf(stderr, "picam-native: Cannot run the %s thread at SCHED_FIFO %d: %s\n", name.c_str(),
+                   placement.fifo_priority, std::strerror(err));
+      placed = false;
+    }
+  }
+  return placed;
+}
+
+std::string describe_placement(const ThreadPlacement &placement) {
+  std::string text = placement.cpu >= 0 ? "CPU " + std::to_string(placement.cpu) : "any CPU";
+  if (placement.fifo_priority > 0) {
+    text += ", SCHED_FIFO " + std::to_string(placement.fifo_priority);
+  }
+  return text;
+}
+
+bool lock_memory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    warn_errno("Cannot lock memory (mlockall)");
+    return false;
+  }
+  return true;
+}
+
+int parse_cpu_index(const char *value) {
+  unsigned cpu = parse_unsigned(value, "CPU index");
+  if (cpu >= CPU_SETSIZE) {
+    throw Error("CPU index must be below " + std::to_string(CPU_SETSIZE));
+  }
+  return static_cast<int>(cpu);
+}
+
+int parse_fifo_priority(const char *value) {
+  unsigned priority = parse_unsigned(value, "SCHED_FIFO priority");
+  if (priority < 1 || priority > 99) {
+    throw Error("SCHED_FIFO priority must be between 1 and 99");
+  }
+  return static_cast<int>(priority);
+}
+
+} // namespace picam
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+namespace picam {
+
+// Where a latency-sensitive thread runs: pinned to one CPU and/or scheduled
+// SCHED_FIFO above every normal (SCHED_OTHER) task. Both are optional.
+struct ThreadPlacement {
+  int cpu = -1;
+  int fifo_priority = 0;
+
+  bool empty() const { return cpu < 0 && fifo_priority == 0; }
+};
+
+// Applies the placement to the calling thread. SCHED_FIFO needs
+// CAP_SYS_NICE or an RLIMIT_RTPRIO allowance, so failures are reported as
+// warnings naming the thread and the run carries on with normal scheduling.
+bool place_current_thread(const ThreadPlacement &placement, const std::string &name);
+
+std::string describe_placement(const ThreadPlacement &placement);
+
+// mlockall(MCL_CURRENT | MCL_FUTURE), so neither the ring, the buffers nor
+// any stack is ever paged out under a frame. Needs CAP_IPC_LOCK or a large
+// enough RLIMIT_MEMLOCK; a failure is a warning.
+bool lock_memory();
+
+// Range checks for --cpu and --fifo-priority style options; throw Error.
+int parse_cpu_index(const char *value);
+int parse_fifo_priority(const char *value);
+
+} // namespace picam
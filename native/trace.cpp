@@ -0,0 +1,160 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+namespace {
+
+// Per thread; a frame makes about half a dozen events per process, so this
+// keeps the last several minutes at 30 fps.
+constexpr size_t kEventsPerThread = size_t{1} << 17;
+
+struct TraceEvent {
+  const char *name;
+  // 'X' for a slice, 'b'/'e' for the ends of a cross-thread stage.
+  char phase;
+  uint64_t ns;
+  uint64_t end_ns;
+  int64_t frame_us;
+};
+
+// Written only by its thread; the head is published with release so the
+// writer at exit sees complete events.
+struct TraceBuffer {
+  explicit TraceBuffer(long thread_id) : tid(thread_id), events(kEventsPerThread) {}
+
+  long tid;
+  const char *name = nullptr;
+  std::vector<TraceEvent> events;
+  std::atomic<uint64_t> head{0};
+};
+
+struct Tracer {
+  std::atomic<bool> enabled{false};
+  std::string path;
+  const char *process_name = "";
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+Tracer &tracer() {
+  static Tracer instance;
+  return instance;
+}
+
+thread_local TraceBuffer *t_buffer = nullptr;
+
+// The registry lock is only taken the first time a thread records.
+TraceBuffer &thread_buffer() {
+  if (!t_buffer) {
+    Tracer &state = tracer();
+    auto buffer = std::make_unique<TraceBuffer>(syscall(SYS_gettid));
+    t_buffer = buffer.get();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.buffers.push_back(std::move(buffer));
+  }
+  return *t_buffer;
+}
+
+void record(const char *name, char phase, uint64_t ns, uint64_t end_ns, int64_t frame_us) {
+  if (!tracer().enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  TraceBuffer &buffer = thread_buffer();
+  const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  buffer.events[head % buffer.events.size()] = {name, phase, ns, end_ns, frame_us};
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+} // namespace
+
+void start_tracing(const std::string &path, const char *process_name) {
+  Tracer &state = tracer();
+  state.path = path;
+  state.process_name = process_name;
+  state.enabled.store(true);
+}
+
+bool tracing_enabled() {
+  return tracer().enabled.load(std::memory_order_relaxed);
+}
+
+void name_trace_thread(const char *name) {
+  if (tracing_enabled()) {
+    thread_buffer().name = name;
+  }
+}
+
+void trace_slice(const char *name, uint64_t begin_ns, uint64_t end_ns, int64_t frame_us) {
+  record(name, 'X', begin_ns, end_ns, frame_us);
+}
+
+void trace_begin(const char *name, int64_t frame_us, uint64_t ns) {
+  record(name, 'b', ns, 0, frame_us);
+}
+
+void trace_end(const char *name, int64_t frame_us, uint64_t ns) {
+  record(name, 'e', ns, 0, frame_us);
+}
+
+void write_trace() {
+  Tracer &state = tracer();
+  if (!state.enabled.exchange(false)) {
+    return;
+  }
+  FILE *file = std::fopen(state.path.c_str(), "w");
+  if (!file) {
+    warn_errno("Cannot write trace '" + state.path + "'");
+    return;
+  }
+  const int pid = static_cast<int>(getpid());
+  // One event per line and a comma after all but the last, so picam.sh can
+  // merge the traces of a pipeline's processes line by line.
+  std::fprintf(file, "[\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}", pid,
+               state.process_name);
+  uint64_t lost = 0;
+  uint64_t total = 0;
+  std::lock_guard<std::mutex> lock(state.mutex);
+  for (const auto &buffer : state.buffers) {
+    if (buffer->name) {
+      std::fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %ld, \"args\": "
+                   "{\"name\": \"%s\"}}", pid, buffer->tid, buffer->name);
+    }
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    const uint64_t size = buffer->events.size();
+    const uint64_t first = head > size ? head - size : 0;
+    lost += first;
+    total += head - first;
+    for (uint64_t i = first; i < head; ++i) {
+      const TraceEvent &event = buffer->events[i % size];
+      std::fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"frame\", \"ph\": \"%c\", \"ts\": %.3f, ", event.name,
+                   event.phase, event.ns / 1e3);
+      if (event.phase == 'X') {
+        std::fprintf(file, "\"dur\": %.3f, ", event.end_ns > event.ns ? (event.end_ns - event.ns) / 1e3 : 0.0);
+      } else {
+        std::fprintf(file, "\"id\": %lld, ", static_cast<long long>(event.frame_us));
+      }
+      std::fprintf(file, "\"pid\": %d, \"tid\": %ld, \"args\": {\"frame\": %lld}}", pid, buffer->tid,
+                   static_cast<long long>(event.frame_us));
+    }
+  }
+  std::fprintf(file, "\n]\n");
+  if (std::fclose(file) != 0) {
+    warn_errno("Cannot write trace '" + state.path + "'");
+    return;
+  }
+  std::fprintf(stderr, "picam-native: %llu trace events written to %s%s\n", static_cast<unsigned long long>(total),
+               state.path.c_str(), lost > 0 ? " (oldest ones overwritten)" : "");
+}
+
+} // namespace picam
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace picam {
+
+// Per-frame stage timing for offline inspection. Every thread records into
+// its own fixed ring of events without locks; write_trace() turns them into
+// a Chrome JSON trace that ui.perfetto.dev and chrome://tracing open. Times
+// are CLOCK_MONOTONIC like the sensor timestamps, so traces of the separate
+// pipeline processes line up when merged. When a thread records more
+// events than its ring holds, the oldest ones go.
+//
+// Names have to be string literals; only the pointer is kept.
+
+// Enables tracing for this process; the trace goes to path on write_trace().
+void start_tracing(const std::string &path, const char *process_name);
+bool tracing_enabled();
+
+// Labels the calling thread's track.
+void name_trace_thread(const char *name);
+
+// Work done on the calling thread, between two instants.
+void trace_slice(const char *name, uint64_t begin_ns, uint64_t end_ns, int64_t frame_us);
+// A stage a frame spends across threads (exposure, ISP, encoder). Begin and
+// end may come from different threads; frame_us, the sensor timestamp,
+// pairs them up and identifies the frame in every process.
+void trace_begin(const char *name, int64_t frame_us, uint64_t ns);
+void trace_end(const char *name, int64_t frame_us, uint64_t ns);
+
+// Writes the recorded events once the worker threads are gone. Runs on the
+// way out, also after errors, so it warns instead of throwing.
+void write_trace();
+
+} // namespace picam
@@ -0,0 +1,159 @@
+#include "ts_muxer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "h264.hpp"
+
+namespace picam {
+
+namespace {
+
+constexpr size_t kPacketSize = 188;
+constexpr uint16_t kPatPid = 0x0000;
+constexpr uint16_t kPmtPid = 0x1000;
+constexpr uint16_t kVideoPid = 0x0100;
+constexpr uint8_t kStreamTypeH264 = 0x1b;
+// PTS runs this far ahead of the PCR to give players a decode buffer.
+constexpr uint64_t kPtsDelay = 9000;
+constexpr uint64_t kTimestampMask = (1ull << 33) - 1;
+
+enum Counter { kPatCounter, kPmtCounter, kVideoCounter };
+
+uint32_t crc32_mpeg(const uint8_t *data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= static_cast<uint32_t>(data[i]) << 24;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 0x80000000 ? crc << 1 ^ 0x04c11db7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void put_crc(std::vector<uint8_t> &section) {
+  uint32_t crc = crc32_mpeg(section.data(), section.size());
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    section.push_back(static_cast<uint8_t>(crc >> shift));
+  }
+}
+
+void put_timestamp(uint8_t *out, uint8_t prefix, uint64_t ts) {
+  out[0] = static_cast<uint8_t>(prefix << 4 | (ts >> 29 & 0x0e) | 1);
+  out[1] = static_cast<uint8_t>(ts >> 22);
+  out[2] = static_cast<uint8_t>((ts >> 14 & 0xfe) | 1);
+  out[3] = static_cast<uint8_t>(ts >> 7);
+  out[4] = static_cast<uint8_t>((ts << 1 & 0xfe) | 1);
+}
+
+uint8_t *begin_packet(std::vector<uint8_t> &out, uint16_t pid, bool unit_start, uint8_t &counter) {
+  size_t offset = out.size();
+  out.resize(offset + kPacketSize, 0xff);
+  uint8_t *packet = out.data() + offset;
+  packet[0] = 0x47;
+  packet[1] = static_cast<uint8_t>((unit_start ? 0x40 : 0) | (pid >> 8 & 0x1f));
+  packet[2] = static_cast<uint8_t>(pid);
+  packet[3] = static_cast<uint8_t>(0x10 | (counter++ & 0x0f));
+  return packet;
+}
+
+} // namespace
+
+void TsMuxer::reset() {
+  have_origin_ = false;
+  std::fill(std::begin(continuity_), std::end(continuity_), 0);
+}
+
+void TsMuxer::write_section(uint16_t pid, const uint8_t *section, size_t size, std::vector<uint8_t> &out) {
+  uint8_t &counter = continuity_[pid == kPatPid ? kPatCounter : kPmtCounter];
+  uint8_t *packet = begin_packet(out, pid, true, counter);
+  packet[4] = 0; // pointer_field
+  std::memcpy(packet + 5, section, size);
+}
+
+void TsMuxer::write_tables(std::vector<uint8_t> &out) {
+  std::vector<uint8_t> pat = {0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0x00, 0x00,
+                              0x00, 0x01, static_cast<uint8_t>(0xe0 | kPmtPid >> 8), static_cast<uint8_t>(kPmtPid)};
+  put_crc(pat);
+  write_section(kPatPid, pat.data(), pat.size(), out);
+
+  std::vector<uint8_t> pmt = {0x02, 0xb0, 18, 0x00, 0x01, 0xc1, 0x00, 0x00,
+                              static_cast<uint8_t>(0xe0 | kVideoPid >> 8), static_cast<uint8_t>(kVideoPid),
+                              0xf0, 0x00, kStreamTypeH264,
+                              static_cast<uint8_t>(0xe0 | kVideoPid >> 8), static_cast<uint8_t>(kVideoPid),
+                              0xf0, 0x00};
+  put_crc(pmt);
+  write_section(kPmtPid, pmt.data(), pmt.size(), out);
+}
+
+void TsMuxer::write(const uint8_t *data, size_t size, int64_t timestamp_us, bool keyframe,
+                    std::vector<uint8_t> &out) {
+  if (!have_origin_) {
+    origin_us_ = timestamp_us;
+    have_origin_ = true;
+  }
+  const uint64_t pcr = static_cast<uint64_t>(std::max<int64_t>(timestamp_us - origin_us_, 0)) * 9 / 100;
+  const uint64_t pts = (pcr + kPtsDelay) & kTimestampMask;
+
+  if (keyframe) {
+    write_tables(out);
+  }
+
+  // PES header; H.264 in TS wants every access unit to open with an AUD.
+  pes_.clear();
+  const uint8_t pes_header[] = {0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x84, 0x80, 0x05};
+  pes_.insert(pes_.end(), pes_header, pes_header + sizeof(pes_header));
+  pes_.resize(pes_.size() + 5);
+  put_timestamp(pes_.data() + pes_.size() - 5, 0x2, pts);
+  h264::NalReader reader(data, size);
+  h264::NalUnit first;
+  if (!reader.next(first) || first.type != h264::kNalAud) {
+    const uint8_t aud[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+    pes_.insert(pes_.end(), aud, aud + sizeof(aud));
+  }
+  pes_.insert(pes_.end(), data, data + size);
+
+  size_t pos = 0;
+  bool first_packet = true;
+  while (pos < pes_.size()) {
+    uint8_t *packet = begin_packet(out, kVideoPid, first_packet, continuity_[kVideoCounter]);
+    size_t header = 4;
+    size_t remaining = pes_.size() - pos;
+
+    // The adaptation field carries the PCR and random access flag on the
+    // first packet of a keyframe, and stuffing on the last packet.
+    size_t adaptation = 0;
+    if (first_packet && keyframe) {
+      adaptation = 8;
+    }
+    size_t room = kPacketSize - header - adaptation;
+    if (remaining < room) {
+      adaptation = kPacketSize - header - remaining;
+    }
+    if (adaptation > 0) {
+      packet[3] |= 0x20;
+      packet[4] = static_cast<uint8_t>(adaptation - 1);
+      if (adaptation > 1) {
+        packet[5] = 0x00;
+        if (first_packet && keyframe) {
+          packet[5] = 0x50; // random_access_indicator | PCR_flag
+          uint64_t base = pcr & kTimestampMask;
+          packet[6] = static_cast<uint8_t>(base >> 25);
+          packet[7] = static_cast<uint8_t>(base >> 17);
+          packet[8] = static_cast<uint8_t>(base >> 9);
+          packet[9] = static_cast<uint8_t>(base >> 1);
+          packet[10] = static_cast<uint8_t>((base & 1) << 7 | 0x7e);
+          packet[11] = 0x00;
+        }
+      }
+      header += adaptation;
+    }
+
+    size_t length = kPacketSize - header;
+    std::memcpy(packet + header, pes_.data() + pos, length);
+    pos += length;
+    first_packet = false;
+  }
+}
+
+} // namespace picam
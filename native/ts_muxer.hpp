@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace picam {
+
+// Minimal single-program MPEG-TS muxer for an H.264 elementary stream. Each
+// access unit becomes one PES packet with a PTS; PAT/PMT and a PCR precede
+// every keyframe, so each segment that starts at an IDR plays on its own and
+// a truncated file stays readable up to the last complete packet.
+class TsMuxer {
+public:
+  // Starts a new file: timestamps restart near zero and continuity counters reset.
+  void reset();
+  // Appends the TS packets for one access unit to `out`.
+  void write(const uint8_t *data, size_t size, int64_t timestamp_us, bool keyframe, std::vector<uint8_t> &out);
+
+private:
+  void write_section(uint16_t pid, const uint8_t *section, size_t size, std::vector<uint8_t> &out);
+  void write_tables(std::vector<uint8_t> &out);
+
+  bool have_origin_ = false;
+  int64_t origin_us_ = 0;
+  uint8_t continuity_[3] = {0, 0, 0};
+  std::vector<uint8_t> pes_;
+};
+
+} // namespace picam
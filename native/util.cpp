@@ -0,0 +1,124 @@
+#include "util.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <linux/dma-buf.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace picam {
+
+void throw_errno(const std::string &what) {
+  throw Error(what + ": " + std::strerror(errno));
+}
+
+void warn_errno(const std::string &what) {
+  std::fprintf(stderr, "picam-native: %s: %s\n", what.c_str(), std::strerror(errno));
+}
+
+int xioctl(int fd, unsigned long request, void *arg) {
+  int ret;
+  do {
+    ret = ioctl(fd, request, arg);
+  } while (ret == -1 && errno == EINTR);
+  return ret;
+}
+
+void dmabuf_begin_cpu_access(int fd) {
+  dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+  xioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+void dmabuf_end_cpu_access(int fd) {
+  dma_buf_sync sync{};
+  sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+  xioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+uint64_t monotonic_ns() {
+  timespec ts{};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+unsigned parse_unsigned(const char *value, const char *label) {
+  char *end = nullptr;
+  errno = 0;
+  unsigned long parsed = std::strtoul(value, &end, 10);
+  if (errno != 0 || end == value || *end != '\0' || value[0] == '-' || parsed > 0xffffffffu) {
+    throw Error(std::string("Invalid ") + label + ": '" + value + "'. Provide a positive integer.");
+  }
+  return static_cast<unsigned>(parsed);
+}
+
+static sigset_t stop_signal_set() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  return set;
+}
+
+void block_stop_signals() {
+  sigset_t set = stop_signal_set();
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+}
+
+void wait_for_stop() {
+  sigset_t set = stop_signal_set();
+  int sig = 0;
+  sigwait(&set, &sig);
+}
+
+bool wait_for_stop_until(uint64_t deadline_ns) {
+  sigset_t set = stop_signal_set();
+  for (;;) {
+    uint64_t now = monotonic_ns();
+    if (now >= deadline_ns) {
+      return false;
+    }
+    uint64_t left = deadline_ns - now;
+    timespec timeout{static_cast<time_t>(left / 1000000000ull), static_cast<long>(left % 1000000000ull)};
+    if (sigtimedwait(&set, nullptr, &timeout) > 0) {
+      return true;
+    }
+    if (errno != EINTR && errno != EAGAIN) {
+      return false;
+    }
+  }
+}
+
+bool stop_pending() {
+  sigset_t pending;
+  sigpending(&pending);
+  return sigismember(&pending, SIGINT) == 1 || sigismember(&pending, SIGTERM) == 1;
+}
+
+void request_stop() {
+  kill(getpid(), SIGTERM);
+}
+
+void block_event_signal() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+bool take_event_signal() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  timespec timeout{0, 0};
+  return sigtimedwait(&set, nullptr, &timeout) == SIGUSR1;
+}
+
+} // namespace picam
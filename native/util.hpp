@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace picam {
+
+class Error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] void throw_errno(const std::string &what);
+
+// For worker threads, which report and stop the pipeline instead of throwing.
+void warn_errno(const std::string &what);
+
+int xioctl(int fd, unsigned long request, void *arg);
+
+// Brackets CPU access to a dmabuf so caches stay coherent with the ISP/encoder.
+void dmabuf_begin_cpu_access(int fd);
+void dmabuf_end_cpu_access(int fd);
+
+uint64_t monotonic_ns();
+
+unsigned parse_unsigned(const char *value, const char *label);
+
+// SIGINT/SIGTERM are blocked in every thread and collected by wait_for_stop(),
+// so this must run before any worker (including libcamera's) is started.
+void block_stop_signals();
+void wait_for_stop();
+// Sleeps until the monotonic deadline; returns true if a stop was requested.
+bool wait_for_stop_until(uint64_t deadline_ns);
+// Non-blocking check for loops that cannot park in wait_for_stop().
+bool stop_pending();
+void request_stop();
+
+// SIGUSR1 asks the DVR for an event dump; blocked like the stop signals and
+// picked up without waiting by take_event_signal().
+void block_event_signal();
+bool take_event_signal();
+
+} // namespace picam
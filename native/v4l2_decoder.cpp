@@ -0,0 +1,293 @@
+#include "v4l2_decoder.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util.hpp"
+
+namespace picam {
+
+V4l2Decoder::V4l2Decoder(const std::string &device, unsigned width, unsigned height) {
+  fd_ = open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw_errno("Cannot open decoder device '" + device + "'");
+  }
+
+  try {
+    v4l2_format fmt{};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = kBitstreamBufferSize;
+    if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+      throw_errno("Decoder VIDIOC_S_FMT (output) failed");
+    }
+
+    v4l2_requestbuffers reqbufs{};
+    reqbufs.count = kBitstreamBuffers;
+    reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    reqbufs.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+      throw_errno("Decoder VIDIOC_REQBUFS (output) failed");
+    }
+    for (unsigned i = 0; i < reqbufs.count; ++i) {
+      v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+      v4l2_buffer buf{};
+      buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+      buf.memory = V4L2_MEMORY_MMAP;
+      buf.index = i;
+      buf.length = 1;
+      buf.m.planes = planes;
+      if (xioctl(fd_, VIDIOC_QUERYBUF, &buf) < 0) {
+        throw_errno("Decoder VIDIOC_QUERYBUF failed");
+      }
+      BitstreamBuffer buffer;
+      buffer.length = planes[0].length;
+      buffer.mem = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, planes[0].m.mem_offset);
+      if (buffer.mem == MAP_FAILED) {
+        throw_errno("Cannot mmap decoder bitstream buffer");
+      }
+      bitstream_.push_back(buffer);
+      free_bitstream_.push_back(i);
+    }
+
+    v4l2_event_subscription sub{};
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    if (xioctl(fd_, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0) {
+      throw_errno("Decoder VIDIOC_SUBSCRIBE_EVENT failed");
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+      throw_errno("Decoder VIDIOC_STREAMON (output) failed");
+    }
+  } catch (...) {
+    for (auto &buffer : bitstream_) {
+      munmap(buffer.mem, buffer.length);
+    }
+    close(fd_);
+    throw;
+  }
+}
+
+V4l2Decoder::~V4l2Decoder() {
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  xioctl(fd_, VIDIOC_STREAMOFF, &type);
+  release_capture();
+  for (auto &buffer : bitstream_) {
+    munmap(buffer.mem, buffer.length);
+  }
+  close(fd_);
+}
+
+bool V4l2Decoder::reclaim_bitstream_buffer() {
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.length = 1;
+  buf.m.planes = planes;
+  if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(bitstream_mutex_);
+  free_bitstream_.push_back(buf.index);
+  return true;
+}
+
+bool V4l2Decoder::queue_bitstream(const uint8_t *data, size_t size, int64_t timestamp_us, int timeout_ms) {
+  uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ull;
+  unsigned index;
+  for (;;) {
+    while (reclaim_bitstream_buffer()) {
+    }
+    {
+      std::lock_guard<std::mutex> lock(bitstream_mutex_);
+      if (!free_bitstream_.empty()) {
+        index = free_bitstream_.back();
+        free_bitstream_.pop_back();
+        break;
+      }
+    }
+    uint64_t now = monotonic_ns();
+    if (now >= deadline) {
+      return false;
+    }
+    pollfd pfd{fd_, POLLOUT, 0};
+    poll(&pfd, 1, static_cast<int>((deadline - now) / 1000000ull) + 1);
+  }
+
+  BitstreamBuffer &buffer = bitstream_[index];
+  if (size > buffer.length) {
+    std::lock_guard<std::mutex> lock(bitstream_mutex_);
+    free_bitstream_.push_back(index);
+    throw Error("Access unit of " + std::to_string(size) + " bytes does not fit a decoder buffer");
+  }
+  std::memcpy(buffer.mem, data, size);
+
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
+  buf.field = V4L2_FIELD_NONE;
+  buf.timestamp.tv_sec = timestamp_us / 1000000;
+  buf.timestamp.tv_usec = timestamp_us % 1000000;
+  buf.length = 1;
+  buf.m.planes = planes;
+  planes[0].bytesused = static_cast<uint32_t>(size);
+  planes[0].length = static_cast<uint32_t>(buffer.length);
+  if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    std::lock_guard<std::mutex> lock(bitstream_mutex_);
+    free_bitstream_.push_back(index);
+    throw_errno("Decoder VIDIOC_QBUF (output) failed");
+  }
+  return true;
+}
+
+void V4l2Decoder::release_capture() {
+  if (capture_streaming_) {
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    xioctl(fd_, VIDIOC_STREAMOFF, &type);
+    capture_streaming_ = false;
+  }
+  for (int fd : frame_fds_) {
+    close(fd);
+  }
+  frame_fds_.clear();
+  v4l2_requestbuffers reqbufs{};
+  reqbufs.count = 0;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+}
+
+void V4l2Decoder::setup_capture() {
+  release_capture();
+
+  v4l2_format fmt{};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  if (xioctl(fd_, VIDIOC_G_FMT, &fmt) < 0) {
+    throw_errno("Decoder VIDIOC_G_FMT (capture) failed");
+  }
+  if (fmt.fmt.pix_mp.pixelformat != V4L2_PIX_FMT_YUV420) {
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+    if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+      throw_errno("Decoder cannot produce YUV420 frames");
+    }
+  }
+  format_.stride = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+  format_.coded_height = fmt.fmt.pix_mp.height;
+  format_.width = fmt.fmt.pix_mp.width;
+  format_.height = fmt.fmt.pix_mp.height;
+
+  // Coded sizes are macroblock aligned (1088 for 1080p); the compose rectangle
+  // is the visible picture.
+  v4l2_selection selection{};
+  selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  selection.target = V4L2_SEL_TGT_COMPOSE;
+  if (xioctl(fd_, VIDIOC_G_SELECTION, &selection) == 0) {
+    format_.width = selection.r.width;
+    format_.height = selection.r.height;
+  }
+
+  v4l2_control min_buffers{};
+  min_buffers.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+  unsigned count = kExtraFrameBuffers;
+  if (xioctl(fd_, VIDIOC_G_CTRL, &min_buffers) == 0) {
+    count += static_cast<unsigned>(min_buffers.value);
+  }
+
+  v4l2_requestbuffers reqbufs{};
+  reqbufs.count = count;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    throw_errno("Decoder VIDIOC_REQBUFS (capture) failed");
+  }
+
+  for (unsigned i = 0; i < reqbufs.count; ++i) {
+    v4l2_exportbuffer expbuf{};
+    expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    expbuf.index = i;
+    expbuf.plane = 0;
+    expbuf.flags = O_RDONLY | O_CLOEXEC;
+    if (xioctl(fd_, VIDIOC_EXPBUF, &expbuf) < 0) {
+      throw_errno("Decoder VIDIOC_EXPBUF failed");
+    }
+    frame_fds_.push_back(expbuf.fd);
+    requeue_frame(i);
+  }
+
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    throw_errno("Decoder VIDIOC_STREAMON (capture) failed");
+  }
+  capture_streaming_ = true;
+}
+
+V4l2Decoder::Result V4l2Decoder::dequeue_frame(DecodedFrame &frame, int timeout_ms) {
+  pollfd pfd{fd_, POLLIN | POLLPRI, 0};
+  if (poll(&pfd, 1, timeout_ms) <= 0) {
+    return Result::kTimeout;
+  }
+
+  if (pfd.revents & POLLPRI) {
+    v4l2_event event{};
+    bool changed = false;
+    while (xioctl(fd_, VIDIOC_DQEVENT, &event) == 0) {
+      if (event.type == V4L2_EVENT_SOURCE_CHANGE && (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+        changed = true;
+      }
+    }
+    if (changed) {
+      setup_capture();
+      return Result::kFormatChanged;
+    }
+  }
+
+  if (!capture_streaming_) {
+    return Result::kTimeout;
+  }
+
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.length = 1;
+  buf.m.planes = planes;
+  if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return Result::kTimeout;
+  }
+  if (planes[0].bytesused == 0) {
+    requeue_frame(buf.index);
+    return Result::kTimeout;
+  }
+  frame.index = buf.index;
+  frame.timestamp_us = static_cast<int64_t>(buf.timestamp.tv_sec) * 1000000 + buf.timestamp.tv_usec;
+  return Result::kFrame;
+}
+
+void V4l2Decoder::requeue_frame(unsigned index) {
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.index = index;
+  buf.length = 1;
+  buf.m.planes = planes;
+  if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    throw_errno("Decoder VIDIOC_QBUF (capture) failed");
+  }
+}
+
+} // namespace picam
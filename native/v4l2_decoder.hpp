@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace picam {
+
+struct DecoderFormat {
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned stride = 0;
+  unsigned coded_height = 0;
+};
+
+struct DecodedFrame {
+  unsigned index = 0;
+  int64_t timestamp_us = 0;
+};
+
+// Stateful H.264 decoder on the bcm2835 V4L2 mem2mem device. Bitstream goes in
+// through mmapped OUTPUT buffers; decoded YUV420 frames come back on CAPTURE
+// buffers that are exported as dmabufs, so they can be scanned out directly.
+// queue_bitstream() and dequeue_frame() may run on different threads.
+class V4l2Decoder {
+public:
+  enum class Result { kFrame, kFormatChanged, kTimeout };
+
+  V4l2Decoder(const std::string &device, unsigned width, unsigned height);
+  ~V4l2Decoder();
+
+  V4l2Decoder(const V4l2Decoder &) = delete;
+  V4l2Decoder &operator=(const V4l2Decoder &) = delete;
+
+  // Returns false if no bitstream buffer became free within the timeout.
+  bool queue_bitstream(const uint8_t *data, size_t size, int64_t timestamp_us, int timeout_ms);
+
+  // kFormatChanged means the CAPTURE buffers were (re)allocated and the
+  // dmabufs from frame_fds() must be imported again.
+  Result dequeue_frame(DecodedFrame &frame, int timeout_ms);
+  void requeue_frame(unsigned index);
+
+  const DecoderFormat &format() const { return format_; }
+  const std::vector<int> &frame_fds() const { return frame_fds_; }
+
+private:
+  static constexpr unsigned kBitstreamBuffers = 6;
+  static constexpr unsigned kBitstreamBufferSize = 1024 << 10;
+  static constexpr unsigned kExtraFrameBuffers = 4;
+
+  struct BitstreamBuffer {
+    void *mem = nullptr;
+    size_t length = 0;
+  };
+
+  void setup_capture();
+  void release_capture();
+  bool reclaim_bitstream_buffer();
+
+  int fd_ = -1;
+  std::vector<BitstreamBuffer> bitstream_;
+  std::mutex bitstream_mutex_;
+  std::vector<unsigned> free_bitstream_;
+  bool capture_streaming_ = false;
+  DecoderFormat format_;
+  std::vector<int> frame_fds_;
+};
+
+} // namespace picam
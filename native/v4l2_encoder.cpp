@@ -0,0 +1,412 @@
+#include "v4l2_encoder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "trace.hpp"
+#include "util.hpp"
+
+namespace picam {
+
+V4l2Encoder::V4l2Encoder(const EncoderConfig &config, OutputCallback on_output, ReleaseCallback on_release)
+    : codec_(config.codec), on_output_(std::move(on_output)), on_release_(std::move(on_release)) {
+  fd_ = open(config.device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw_errno("Cannot open encoder device '" + config.device + "'");
+  }
+
+  try {
+    if (codec_ == Codec::kMjpeg) {
+      set_control(V4L2_CID_JPEG_COMPRESSION_QUALITY, static_cast<int32_t>(config.quality), "JPEG quality");
+    } else {
+      configure_h264(config);
+    }
+
+    configure_formats(config);
+    setup_capture_buffers(config.output_buffers);
+
+    v4l2_requestbuffers reqbufs{};
+    reqbufs.count = config.input_buffers;
+    reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    reqbufs.memory = V4L2_MEMORY_DMABUF;
+    if (xioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+      throw_errno("Encoder VIDIOC_REQBUFS (output) failed");
+    }
+    for (unsigned i = 0; i < reqbufs.count; ++i) {
+      free_inputs_.push_back(i);
+    }
+    input_cookies_.resize(reqbufs.count);
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+      throw_errno("Encoder VIDIOC_STREAMON (output) failed");
+    }
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+      throw_errno("Encoder VIDIOC_STREAMON (capture) failed");
+    }
+  } catch (...) {
+    for (auto &buffer : capture_buffers_) {
+      munmap(buffer.mem, buffer.length);
+    }
+    close(fd_);
+    throw;
+  }
+
+  poll_thread_ = std::thread(&V4l2Encoder::poll_loop, this, config.placement);
+}
+
+V4l2Encoder::~V4l2Encoder() {
+  abort_ = true;
+  if (poll_thread_.joinable()) {
+    poll_thread_.join();
+  }
+
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  xioctl(fd_, VIDIOC_STREAMOFF, &type);
+  type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  xioctl(fd_, VIDIOC_STREAMOFF, &type);
+
+  for (auto &buffer : capture_buffers_) {
+    munmap(buffer.mem, buffer.length);
+  }
+
+  v4l2_requestbuffers reqbufs{};
+  reqbufs.count = 0;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_DMABUF;
+  xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+
+  close(fd_);
+}
+
+void V4l2Encoder::set_control(uint32_t id, int32_t value, const char *label) {
+  v4l2_control ctrl{};
+  ctrl.id = id;
+  ctrl.value = value;
+  if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0) {
+    throw_errno(std::string("Failed to set encoder ") + label);
+  }
+}
+
+bool V4l2Encoder::try_control(uint32_t id, int32_t value) {
+  v4l2_control ctrl{};
+  ctrl.id = id;
+  ctrl.value = value;
+  return xioctl(fd_, VIDIOC_S_CTRL, &ctrl) == 0;
+}
+
+namespace {
+
+int32_t v4l2_profile(H264Profile profile) {
+  switch (profile) {
+  case H264Profile::kBaseline:
+    return V4L2_MPEG_VIDEO_H264_PROFILE_CONSTRAINED_BASELINE;
+  case H264Profile::kMain:
+    return V4L2_MPEG_VIDEO_H264_PROFILE_MAIN;
+  case H264Profile::kHigh:
+    break;
+  }
+  return V4L2_MPEG_VIDEO_H264_PROFILE_HIGH;
+}
+
+int32_t v4l2_level(unsigned level) {
+  static const std::pair<unsigned, int32_t> kLevels[] = {
+      {10, V4L2_MPEG_VIDEO_H264_LEVEL_1_0}, {11, V4L2_MPEG_VIDEO_H264_LEVEL_1_1}, {12, V4L2_MPEG_VIDEO_H264_LEVEL_1_2},
+      {13, V4L2_MPEG_VIDEO_H264_LEVEL_1_3}, {20, V4L2_MPEG_VIDEO_H264_LEVEL_2_0}, {21, V4L2_MPEG_VIDEO_H264_LEVEL_2_1},
+      {22, V4L2_MPEG_VIDEO_H264_LEVEL_2_2}, {30, V4L2_MPEG_VIDEO_H264_LEVEL_3_0}, {31, V4L2_MPEG_VIDEO_H264_LEVEL_3_1},
+      {32, V4L2_MPEG_VIDEO_H264_LEVEL_3_2}, {40, V4L2_MPEG_VIDEO_H264_LEVEL_4_0}, {41, V4L2_MPEG_VIDEO_H264_LEVEL_4_1},
+      {42, V4L2_MPEG_VIDEO_H264_LEVEL_4_2},
+  };
+  for (const auto &entry : kLevels) {
+    if (entry.first == level) {
+      return entry.second;
+    }
+  }
+  throw Error("Unsupported H.264 level " + std::to_string(level / 10) + "." + std::to_string(level % 10));
+}
+
+} // namespace
+
+void V4l2Encoder::configure_h264(const EncoderConfig &config) {
+  set_control(V4L2_CID_MPEG_VIDEO_BITRATE, static_cast<int32_t>(config.bitrate), "bitrate");
+  set_control(V4L2_CID_MPEG_VIDEO_H264_PROFILE, v4l2_profile(config.profile), "H.264 profile");
+  set_control(V4L2_CID_MPEG_VIDEO_H264_LEVEL, v4l2_level(config.level), "H.264 level");
+  // With intra refresh the first IDR is the only one unless asked for more;
+  // request_keyframe() still gives new ring readers theirs.
+  int32_t idr_period = static_cast<int32_t>(config.idr_period);
+  if (idr_period == 0) {
+    idr_period = config.intra_refresh > 0 ? INT32_MAX : static_cast<int32_t>(config.framerate);
+  }
+  set_control(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, idr_period, "IDR period");
+  // Equivalent of libcamera-vid --inline: SPS/PPS in front of every IDR.
+  set_control(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1, "inline headers");
+
+  const unsigned macroblocks = ((config.width + 15) / 16) * ((config.height + 15) / 16);
+  if (config.slices > 1) {
+    set_control(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MODE, V4L2_MPEG_VIDEO_MULTI_SLICE_MODE_MAX_MB, "slice mode");
+    set_control(V4L2_CID_MPEG_VIDEO_MULTI_SLICE_MAX_MB,
+                static_cast<int32_t>((macroblocks + config.slices - 1) / config.slices), "slice count");
+  }
+  if (config.intra_refresh > 0) {
+    // Newer kernels take the period itself; older ones the macroblocks
+    // refreshed per frame, which comes to the same sweep.
+    bool applied = false;
+#ifdef V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD
+    applied = try_control(V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD_TYPE,
+                          V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD_TYPE_CYCLIC) &&
+              try_control(V4L2_CID_MPEG_VIDEO_INTRA_REFRESH_PERIOD, static_cast<int32_t>(config.intra_refresh));
+#endif
+    if (!applied) {
+      set_control(V4L2_CID_MPEG_VIDEO_CYCLIC_INTRA_REFRESH_MB,
+                  static_cast<int32_t>((macroblocks + config.intra_refresh - 1) / config.intra_refresh),
+                  "intra refresh");
+    }
+  }
+}
+
+bool V4l2Encoder::set_bitrate(unsigned bitrate) {
+  if (codec_ != Codec::kH264) {
+    return false;
+  }
+  v4l2_control ctrl{};
+  ctrl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+  ctrl.value = static_cast<int32_t>(bitrate);
+  return xioctl(fd_, VIDIOC_S_CTRL, &ctrl) == 0;
+}
+
+// Only informs the rate control of the new frame interval; the camera sets
+// the actual rate.
+bool V4l2Encoder::set_framerate(unsigned framerate) {
+  if (codec_ != Codec::kH264) {
+    return false;
+  }
+  v4l2_streamparm parm{};
+  parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  parm.parm.output.timeperframe.numerator = 1000;
+  parm.parm.output.timeperframe.denominator = framerate * 1000;
+  return xioctl(fd_, VIDIOC_S_PARM, &parm) == 0;
+}
+
+bool V4l2Encoder::request_keyframe() {
+  if (codec_intra_only(codec_)) {
+    return true;
+  }
+  v4l2_control ctrl{};
+  ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+  return xioctl(fd_, VIDIOC_S_CTRL, &ctrl) == 0;
+}
+
+unsigned V4l2Encoder::queued_inputs() {
+  std::lock_guard<std::mutex> lock(input_mutex_);
+  return static_cast<unsigned>(input_cookies_.size() - free_inputs_.size());
+}
+
+void V4l2Encoder::configure_formats(const EncoderConfig &config) {
+  v4l2_format fmt{};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  fmt.fmt.pix_mp.width = config.width;
+  fmt.fmt.pix_mp.height = config.height;
+  fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_YUV420;
+  fmt.fmt.pix_mp.plane_fmt[0].bytesperline = config.stride;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+  fmt.fmt.pix_mp.colorspace = codec_ == Codec::kMjpeg ? V4L2_COLORSPACE_JPEG : V4L2_COLORSPACE_REC709;
+  fmt.fmt.pix_mp.num_planes = 1;
+  if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    throw_errno("Encoder VIDIOC_S_FMT (output) failed");
+  }
+
+  fmt = {};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  fmt.fmt.pix_mp.width = config.width;
+  fmt.fmt.pix_mp.height = config.height;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+  fmt.fmt.pix_mp.colorspace = V4L2_COLORSPACE_DEFAULT;
+  fmt.fmt.pix_mp.num_planes = 1;
+  if (codec_ == Codec::kMjpeg) {
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_JPEG;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage =
+        std::max(kCaptureBufferSize, config.width * config.height * kJpegBytesPerPixel);
+  } else {
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = kCaptureBufferSize;
+  }
+  if (xioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    throw_errno("Encoder VIDIOC_S_FMT (capture) failed");
+  }
+  // The JPEG encoder codes each picture alone and takes no frame interval.
+  if (codec_ == Codec::kMjpeg) {
+    return;
+  }
+
+  v4l2_streamparm parm{};
+  parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  parm.parm.output.timeperframe.numerator = 1000;
+  parm.parm.output.timeperframe.denominator = config.framerate * 1000;
+  if (xioctl(fd_, VIDIOC_S_PARM, &parm) < 0) {
+    throw_errno("Encoder VIDIOC_S_PARM failed");
+  }
+}
+
+void V4l2Encoder::setup_capture_buffers(unsigned count) {
+  v4l2_requestbuffers reqbufs{};
+  reqbufs.count = count;
+  reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  reqbufs.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd_, VIDIOC_REQBUFS, &reqbufs) < 0) {
+    throw_errno("Encoder VIDIOC_REQBUFS (capture) failed");
+  }
+
+  for (unsigned i = 0; i < reqbufs.count; ++i) {
+    v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    buf.length = 1;
+    buf.m.planes = planes;
+    if (xioctl(fd_, VIDIOC_QUERYBUF, &buf) < 0) {
+      throw_errno("Encoder VIDIOC_QUERYBUF failed");
+    }
+
+    CaptureBuffer buffer;
+    buffer.length = buf.m.planes[0].length;
+    buffer.mem = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+                      buf.m.planes[0].m.mem_offset);
+    if (buffer.mem == MAP_FAILED) {
+      throw_errno("Cannot mmap encoder capture buffer");
+    }
+    capture_buffers_.push_back(buffer);
+
+    if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+      throw_errno("Encoder VIDIOC_QBUF (capture) failed");
+    }
+  }
+}
+
+bool V4l2Encoder::encode(const CameraFrame &frame) {
+  unsigned index;
+  {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    if (free_inputs_.empty()) {
+      return false;
+    }
+    index = free_inputs_.back();
+    free_inputs_.pop_back();
+    input_cookies_[index] = frame.id;
+  }
+
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = V4L2_MEMORY_DMABUF;
+  buf.index = index;
+  buf.field = V4L2_FIELD_NONE;
+  buf.timestamp.tv_sec = frame.timestamp_us / 1000000;
+  buf.timestamp.tv_usec = frame.timestamp_us % 1000000;
+  buf.length = 1;
+  buf.m.planes = planes;
+  planes[0].m.fd = frame.fd;
+  planes[0].bytesused = frame.size;
+  planes[0].length = frame.size;
+  if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    free_inputs_.push_back(index);
+    return false;
+  }
+  if (tracing_enabled()) {
+    trace_begin("encode", frame.timestamp_us, monotonic_ns());
+  }
+  return true;
+}
+
+void V4l2Encoder::poll_loop(ThreadPlacement placement) {
+  name_trace_thread("encoder");
+  if (!placement.empty()) {
+    place_current_thread(placement, "encoder");
+  }
+  while (!abort_) {
+    pollfd pfd{};
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    int ret = poll(&pfd, 1, 200);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      warn_errno("Encoder poll failed");
+      request_stop();
+      return;
+    }
+    while (dequeue_input()) {
+    }
+    while (dequeue_capture()) {
+    }
+  }
+}
+
+bool V4l2Encoder::dequeue_input() {
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+  buf.memory = V4L2_MEMORY_DMABUF;
+  buf.length = 1;
+  buf.m.planes = planes;
+  if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return false;
+  }
+
+  uint64_t cookie;
+  {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    cookie = input_cookies_[buf.index];
+    free_inputs_.push_back(buf.index);
+  }
+  on_release_(cookie);
+  return true;
+}
+
+bool V4l2Encoder::dequeue_capture() {
+  v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+  v4l2_buffer buf{};
+  buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.length = 1;
+  buf.m.planes = planes;
+  if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0) {
+    return false;
+  }
+
+  EncodedFrame frame;
+  frame.data = static_cast<const uint8_t *>(capture_buffers_[buf.index].mem);
+  frame.size = buf.m.planes[0].bytesused;
+  frame.timestamp_us = static_cast<int64_t>(buf.timestamp.tv_sec) * 1000000 + buf.timestamp.tv_usec;
+  frame.keyframe = codec_intra_only(codec_) || (buf.flags & V4L2_BUF_FLAG_KEYFRAME) != 0;
+  if (tracing_enabled()) {
+    trace_end("encode", frame.timestamp_us, monotonic_ns());
+  }
+  if (frame.size > 0) {
+    on_output_(frame);
+  }
+
+  buf.m.planes[0].bytesused = 0;
+  if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    warn_errno("Encoder VIDIOC_QBUF (capture) failed");
+    request_stop();
+    return false;
+  }
+  return true;
+}
+
+} // namespace picam
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "codec.hpp"
+#include "frame.hpp"
+#include "thread_placement.hpp"
+
+namespace picam {
+
+struct EncoderConfig {
+  // H.264 or MJPEG; raw YUV never reaches an encoder.
+  Codec codec = Codec::kH264;
+  std::string device = "/dev/video11";
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned stride = 0;
+  unsigned framerate = 30;
+  unsigned bitrate = 4000000;
+  // JPEG quality (1-100) for MJPEG, which has no rate control.
+  unsigned quality = 80;
+  // H.264 stream shape. level is in tenths (41 for 4.1); idr_period is in
+  // frames, 0 for one IDR a second, or only the first with intra_refresh.
+  H264Profile profile = H264Profile::kHigh;
+  unsigned level = 41;
+  unsigned idr_period = 0;
+  // Slices per picture; each starts a new NAL, so a lost packet spoils less.
+  unsigned slices = 1;
+  // Frames over which a sweep of intra macroblocks refreshes the whole
+  // picture, which spreads the cost of an IDR over that many frames; 0 off.
+  unsigned intra_refresh = 0;
+  // Camera frames the encoder may hold at once (OUTPUT slots; the dmabufs
+  // are the camera's) and encoded-data buffers it owns (CAPTURE, in CMA).
+  unsigned input_buffers = 6;
+  unsigned output_buffers = 12;
+  // CPU and SCHED_FIFO priority of the thread that dequeues encoded frames
+  // and runs the output callback.
+  ThreadPlacement placement;
+};
+
+// H.264 or JPEG encoder on a bcm2835 V4L2 mem2mem device (video11 and
+// video31). Camera dmabufs are queued on the OUTPUT side as-is; encoded data
+// comes back on mmapped CAPTURE buffers.
+class V4l2Encoder {
+public:
+  using OutputCallback = std::function<void(const EncodedFrame &)>;
+  using ReleaseCallback = std::function<void(uint64_t cookie)>;
+
+  V4l2Encoder(const EncoderConfig &config, OutputCallback on_output, ReleaseCallback on_release);
+  ~V4l2Encoder();
+
+  V4l2Encoder(const V4l2Encoder &) = delete;
+  V4l2Encoder &operator=(const V4l2Encoder &) = delete;
+
+  // Returns false when every input slot is still owned by the encoder; the
+  // caller keeps ownership of the frame in that case.
+  bool encode(const CameraFrame &frame);
+
+  // Rate control changes while streaming; false when the driver refuses,
+  // and always for MJPEG.
+  bool set_bitrate(unsigned bitrate);
+  bool set_framerate(unsigned framerate);
+  // Makes the next encoded frame an IDR; safe to call from any thread. Every
+  // JPEG already is one.
+  bool request_keyframe();
+  // Input frames handed to the encoder and not yet returned.
+  unsigned queued_inputs();
+  unsigned input_slots() const { return static_cast<unsigned>(input_cookies_.size()); }
+  unsigned output_buffers() const { return static_cast<unsigned>(capture_buffers_.size()); }
+  size_t output_buffer_bytes() const { return capture_buffers_.empty() ? 0 : capture_buffers_[0].length; }
+
+private:
+  static constexpr unsigned kCaptureBufferSize = 1024 << 10;
+  // A JPEG of a busy scene at high quality approaches a byte per pixel.
+  static constexpr unsigned kJpegBytesPerPixel = 1;
+
+  struct CaptureBuffer {
+    void *mem = nullptr;
+    size_t length = 0;
+  };
+
+  void set_control(uint32_t id, int32_t value, const char *label);
+  bool try_control(uint32_t id, int32_t value);
+  void configure_h264(const EncoderConfig &config);
+  void configure_formats(const EncoderConfig &config);
+  void setup_capture_buffers(unsigned count);
+  void poll_loop(ThreadPlacement placement);
+  bool dequeue_input();
+  bool dequeue_capture();
+
+  Codec codec_;
+  int fd_ = -1;
+  OutputCallback on_output_;
+  ReleaseCallback on_release_;
+
+  std::mutex input_mutex_;
+  std::vector<unsigned> free_inputs_;
+  std::vector<uint64_t> input_cookies_;
+  std::vector<CaptureBuffer> capture_buffers_;
+
+  std::atomic<bool> abort_{false};
+  std::thread poll_thread_;
+};
+
+} // namespace picam
@@ -7,9 +7,20 @@ DEFAULT_RESOLUTION="1280x720"
 DEFAULT_FPS="30"
 DEFAULT_BITRATE="4000000"
 DEFAULT_CORNER="top-left"
+DEFAULT_ROLLUP_SECONDS="3600"
+DEFAULT_LOG_LINES="2000"
 
 SCRIPT_NAME=$(basename "$0")
 SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+NATIVE_SOURCE_DIR="${SCRIPT_DIR}/native"
+NATIVE_BUILD_DIR="${PICAM_NATIVE_BUILD_DIR:-${XDG_CACHE_HOME:-${HOME}/.cache}/picam_h264}"
+NATIVE_BIN="${NATIVE_BUILD_DIR}/picam-native"
+NATIVE_PKG_MODULES=(libcamera freetype2 libdrm)
+# Optional: picam-native gets the GLES renderer only when all of these exist.
+NATIVE_GL_PKG_MODULES=(egl glesv2 gbm)
+DEPS_MANIFEST="${XDG_CACHE_HOME:-${HOME}/.cache}/picam_h264/deps.manifest"
+# Ring socket, PID, command line and log of the --daemon capture process.
+DAEMON_DIR="${XDG_RUNTIME_DIR:-/tmp}/picam_h264-${UID}"
 die() {
   local msg="$1"
   echo "${SCRIPT_NAME}: ${msg}" >&2
@@ -22,13 +33,124 @@ Usage: ${SCRIPT_NAME} [options]
 
 Options:
   -m, --method <name>         Capture method to use (default: ${DEFAULT_METHOD})
+                              Methods: h264_sdl_preview, h264_native, h264_drm_preview,
+                              h264_gl_preview, h264_null, h264_rtp, h264_http, mjpeg_native,
+                              yuv_native
   -r, --resolution WxH        Video resolution, e.g. 1920x1080 (default: ${DEFAULT_RESOLUTION})
   -f, --fps <number>          Frame rate in frames per second (default: ${DEFAULT_FPS})
   -b, --bitrate <bits>        Target bitrate in bits per second (default: ${DEFAULT_BITRATE})
+      --idr-period <frames>   Frames between IDRs (default: one second's worth; only the first with
+                              --intra-refresh)
+      --profile <name>        H.264 profile: baseline, main or high (default: high)
+      --level <level>         H.264 level (default: 4.1; libcamera-vid takes 4, 4.1 or 4.2)
+      --slices <number>       Slices per picture (native methods only; default: 1)
+      --intra-refresh <frames> Refresh the picture with a sweep of intra macroblocks over this many
+                              frames instead of periodic IDRs, which removes the IDR-sized bursts
+                              behind FIFO stalls and Wi-Fi spikes (native methods only)
   -c, --corner <position>     Overlay corner: top-left, top-right, bottom-left, bottom-right (default: ${DEFAULT_CORNER})
+  -d, --duration <seconds>    Stop capturing after this many seconds (default: 0, run until Ctrl+C)
+      --samples <file>        Append one CSV row per second (elapsed_s,fps,cpu_pct,mem_pct,dropped,
+                              first_frame_ms,jitter_ms,max_interval_ms,latency_ms,mbps,rss_mib,
+                              pss_mib,cma_mib,cache_mib,temp_c,arm_mhz,core_mhz,throttled,
+                              peak_kib); first_frame_ms is the time to first frame, 0 until known;
+                              jitter_ms and max_interval_ms are the spread and longest gap between
+                              frames reaching the stream parser over the last second, latency_ms
+                              the mean time from the sensor to it and mbps the stream bandwidth
+                              (all 0 without picam-native); then the watched processes' RSS and
+                              PSS, CMA in use and the page cache in MiB, the SoC temperature, ARM
+                              and core clocks and the firmware's throttling flags (vcgencmd
+                              get_throttled), which the overlay shows too, and the largest frame
+                              of the last second in KiB
+      --soak <dir>            Long-run mode: keep FPS, latency, CPU and bitrate histograms in fixed
+                              memory, append their distribution to <dir>/rollups.csv once per
+                              --rollup period with the whole run's in <dir>/soak.json, and keep the
+                              newest --log-lines lines of every stage's output in <dir>/picam.log
+                              (needs picam-native; --samples still grows one row per second)
+      --rollup <seconds>      Soak rollup period (default: ${DEFAULT_ROLLUP_SECONDS})
+      --log-lines <number>    Lines kept of ffmpeg's log and the soak log (default: ${DEFAULT_LOG_LINES})
+      --latency-report <file> Measure glass-to-glass latency (h264_drm_preview and h264_gl_preview):
+                              frames carry their sensor timestamp in an SEI NAL, p50/p95/p99 per
+                              stage are shown in the overlay and written to <file> as JSON on exit
+      --encode-report <file>  Write encoder FPS, bitrate, CPU and per-frame encode time percentiles
+                              to <file> as JSON on exit (native methods only)
+      --rtp-dest <host:port>  Receiver for h264_rtp (IPv6 as [addr]:port)
+      --rtp-pace <bits>       Pace h264_rtp packets to at most this rate so IDR bursts do not
+                              overflow Wi-Fi queues (default: 0, no pacing)
+      --rtp-sdp <file>        Write the session description for the receiver (ffplay, VLC)
+      --http-listen <[host:]port> Address h264_http serves /stream.ts on (default: 8080)
+      --max-clients <number>  Viewers h264_http serves at once from the one encode (default: 10)
+      --record <dir>          Also record the stream into <dir> as IDR-aligned MPEG-TS segments;
+                              the overlay shows the write latency and queue high-water mark
+      --segment <seconds>     Length of one --record segment (default: 60)
+      --dvr <dir>             Keep the last --pre-event seconds in RAM (SDL methods only) and save
+                              them with --post-event more seconds to <dir> on 'kill -USR1' or GPIO
+      --pre-event <seconds>   Stream kept before a trigger (default: 10)
+      --post-event <seconds>  Stream saved after the last trigger (default: 10)
+      --dvr-arena <MiB>       Fixed memory for the pre-event stream (default: 32)
+      --trigger-gpio <path>   sysfs GPIO value file whose rising edge saves an event
+      --motion                Detect motion on a small secondary camera stream (native methods
+                              only); the overlay shows MOTION and, with --dvr, motion saves events
+      --motion-threshold <pct> Changed share of the picture that counts as motion (default: 2)
+      --adaptive              Lower bitrate and FPS on the fly (native methods only) when the CPU
+                              saturates or the consumer (Wi-Fi, decoder) falls behind, and raise
+                              them back up to --bitrate/--fps once it keeps up
+      --min-bitrate <bits>    Floor for --adaptive (default: a quarter of --bitrate)
+      --min-fps <number>      Floor for --adaptive (default: a third of --fps)
+      --sensor-mode <mode>    Sensor readout mode for picam-native (native methods only): 'auto'
+                              for the cheapest mode covering --resolution and --fps (binned over
+                              full readout when it keeps up), or WxH[:bits] from --list-sensor-modes
+      --mode-report <file>    Write the chosen sensor mode, its CSI-2 load and the ISP scaling to
+                              <file> as JSON (needs --sensor-mode)
+      --roi <x,y,w,h>         Have the ISP crop to this region, as fractions of the sensor's field of
+                              view, and scale it to --resolution, e.g. 0.25,0.25,0.5,0.5 for a 2x zoom
+                              on the centre; no CPU is spent on the pixels left out
+      --control-socket <path> Take commands while running on this UNIX socket (native methods):
+                              bitrate, fps, corner, idr, record start|stop, roi and metrics, e.g.
+                              'picam-native control --socket <path> bitrate 2000000'; with several
+                              --cameras each listens on <path>.<index>
+      --replay <file.h264>    Play a recorded H.264 elementary stream in place of the camera (native
+                              H.264 methods), looping until --duration or Ctrl+C, so decode, display
+                              and streaming can be benchmarked on the same input on every Pi
+      --replay-fps <number>   Pace --replay at this rate instead of the file's own (its SPS timing
+                              info, else 30); --fps is set to whichever is used
+      --capture-buffers <n>   Camera frame buffers of picam-native (native methods; default: 6); each
+                              is a full-size dmabuf from the CMA pool
+      --encode-input-buffers <n> Camera frames the encoder may hold at once (default: 6)
+      --encode-output-buffers <n> Encoded-data buffers of the encoder, 1 MiB each in CMA (default: 12)
+      --ring-size <MiB>       Capacity of the shared-memory ring between capture and the stream
+                              readers (ring-based native methods; default: 8, four frames for yuv)
+      --buffer-report <file>  Write the count and size of every stage's buffers and the CMA they
+                              take to <file> as JSON (native methods only); the overlay shows PSS
+                              and CMA use and --samples gains rss_mib,pss_mib,cma_mib,cache_mib
+      --trace <file>          Record when every frame passes each stage (exposure, ISP, encode,
+                              ring/FIFO write, decode and present) in every picam-native process
+                              and merge them into <file> on exit, a Chrome JSON trace for
+                              ui.perfetto.dev (native methods only; not with --daemon)
+      --list-sensor-modes     List the sensor's modes (first --cameras entry), mark the one 'auto'
+                              picks for --resolution and --fps, and exit
+      --cameras <list>        Comma-separated libcamera camera indices (default: 0). Several run one
+                              pipeline each, with its own encoder, for h264_null and h264_native;
+                              overlay and --samples add them up, with a line and columns per camera
+      --capture-cpus <list>   Pin the capture thread of each --cameras entry to these CPUs, one per
+                              camera; libcamera-vid is pinned as a whole
+      --capture-priority <1-99> Run the capture threads under SCHED_FIFO at this priority (needs root,
+                              CAP_SYS_NICE or an rtprio limit); libcamera-vid runs under chrt
+      --encode-cpus <list>    Pin the encoder thread of each camera to these CPUs (native methods;
+                              libcamera-vid gets them added to its --capture-cpus set)
+      --encode-priority <1-99> SCHED_FIFO priority of the encoder threads (native methods; for
+                              libcamera-vid the higher of this and --capture-priority)
+      --display-cpus <cpus>   Pin the stages reading the stream (ffmpeg, drm-preview, rtp-send,
+                              serve, ring-cat) to this taskset CPU list, e.g. 0 or 0-1
+      --mlock                 Lock the memory of every picam-native stage (mlockall) so rings and
+                              buffers are never paged out; needs CAP_IPC_LOCK or a memlock limit
+      --daemon                Leave the capture process running after this run (ring-based native
+                              methods only), camera configured and encoder open; the next run with
+                              the same capture settings attaches to it and gets frames right away
+      --stop-daemon           Stop the capture process left by --daemon and exit
       --no-menu               Skip the interactive whiptail wizard
       --menu                  Force showing the wizard even if arguments are provided
-      --check-deps            Only verify dependencies and exit
+      --check-deps            Only verify dependencies and exit; always runs the full check, while
+                              normal runs skip it as long as nothing it found has changed
   -h, --help                  Show this help message and exit
 
 Examples:
@@ -46,6 +168,30 @@ REQUIRED_COMMANDS=(
   stdbuf
 )
 
+method_is_native() {
+  case "$1" in
+    h264_native|h264_drm_preview|h264_gl_preview|h264_null|h264_rtp|h264_http|mjpeg_native|yuv_native)
+      return 0
+      ;;
+  esac
+  return 1
+}
+
+# What picam-native capture --codec produces for a method.
+method_codec() {
+  case "$1" in
+    mjpeg_*)
+      echo mjpeg
+      ;;
+    yuv_*)
+      echo yuv
+      ;;
+    *)
+      echo h264
+      ;;
+  esac
+}
+
 build_dependency_command() {
   local require_whiptail="$1"
   local mode="$2"
@@ -63,21 +209,151 @@ build_dependency_command() {
   if [[ "$require_whiptail" -eq 1 ]]; then
     _out+=(--require-whiptail)
   fi
+  if [[ "$METHOD" == "h264_gl_preview" ]]; then
+    _out+=(--require-gl)
+  elif method_is_native "$METHOD"; then
+    _out+=(--require-native)
+  fi
 }
 
-check_dependencies() {
-  local missing=()
-  for cmd in "${REQUIRED_COMMANDS[@]}"; do
-    if ! command -v "$cmd" >/dev/null 2>&1; then
-      missing+=("$cmd")
-    fi
+# The helper is also rebuilt once the GL modules show up, so installing them
+# later enables the GLES renderer.
+native_helper_is_stale() {
+  [[ -x "$NATIVE_BIN" ]] || return 0
+  [[ -n $(find "$NATIVE_SOURCE_DIR" -newer "$NATIVE_BIN" -print -quit) ]] && return 0
+  [[ ! -e "${NATIVE_BIN}.gl" ]] && native_gl_available
+}
+
+native_gl_available() {
+  command -v pkg-config >/dev/null 2>&1 && pkg-config --exists "${NATIVE_GL_PKG_MODULES[@]}"
+}
+
+native_toolchain_available() {
+  command -v c++ >/dev/null 2>&1 && command -v pkg-config >/dev/null 2>&1 && \
+    pkg-config --exists "${NATIVE_PKG_MODULES[@]}"
+}
+
+# Used by stages that have a shell fallback: build the helper when possible,
+# otherwise settle for an existing binary.
+native_helper_ready() {
+  if native_toolchain_available; then
+    ensure_native_helper
+    return 0
+  fi
+  [[ -x "$NATIVE_BIN" ]]
+}
+
+ensure_native_helper() {
+  native_helper_is_stale || return 0
+
+  command -v c++ >/dev/null 2>&1 || \
+    die "A C++ compiler is required to build picam-native. Run '${SCRIPT_DIR}/dep.sh --require-native'."
+  command -v pkg-config >/dev/null 2>&1 || \
+    die "pkg-config is required to build picam-native. Run '${SCRIPT_DIR}/dep.sh --require-native'."
+  local module
+  for module in "${NATIVE_PKG_MODULES[@]}"; do
+    pkg-config --exists "$module" || \
+      die "Development files for '${module}' were not found. Run '${SCRIPT_DIR}/dep.sh --require-native'."
   done
 
-  if [[ ${#missing[@]} -gt 0 ]]; then
-    die "Required dependency '${missing[0]}' was not found."
+  local modules=("${NATIVE_PKG_MODULES[@]}") defines=() with_gl=0
+  if native_gl_available; then
+    modules+=("${NATIVE_GL_PKG_MODULES[@]}")
+    defines+=(-DPICAM_HAVE_GL)
+    with_gl=1
+  fi
+
+  local cflags=() libs=()
+  read -ra cflags <<<"$(pkg-config --cflags "${modules[@]}")"
+  read -ra libs <<<"$(pkg-config --libs "${modules[@]}")"
+
+  mkdir -p "$NATIVE_BUILD_DIR"
+  echo "Building picam-native in ${NATIVE_BUILD_DIR}..."
+  if ! c++ -std=c++17 -O2 -pthread "${defines[@]}" "${cflags[@]}" -o "${NATIVE_BIN}.tmp" \
+      "$NATIVE_SOURCE_DIR"/*.cpp "${libs[@]}"; then
+    rm -f "${NATIVE_BIN}.tmp"
+    die "Failed to build picam-native."
+  fi
+  mv -f "${NATIVE_BIN}.tmp" "$NATIVE_BIN"
+  # Marks a helper that has the GLES renderer.
+  if (( with_gl )); then
+    touch "${NATIVE_BIN}.gl"
+  else
+    rm -f "${NATIVE_BIN}.gl"
+  fi
+}
+
+# Files a passing dep.sh check depends on: dep.sh itself, every command it
+# looked up and, for native methods, the pkg-config files of the modules.
+dependency_manifest_files() {
+  local -n _files="$1"
+  local require_whiptail="$2"
+  local commands=("${REQUIRED_COMMANDS[@]}")
+  if [[ "$require_whiptail" -eq 1 ]]; then
+    commands+=(whiptail)
+  fi
+  if method_is_native "$METHOD"; then
+    commands+=(c++ pkg-config)
+  fi
+
+  _files=("${SCRIPT_DIR}/dep.sh")
+  local cmd path module
+  for cmd in "${commands[@]}"; do
+    path=$(type -P "$cmd") || return 1
+    _files+=("$path")
+  done
+  if method_is_native "$METHOD"; then
+    local modules=("${NATIVE_PKG_MODULES[@]}")
+    if [[ "$METHOD" == "h264_gl_preview" ]]; then
+      modules+=("${NATIVE_GL_PKG_MODULES[@]}")
+    fi
+    for module in "${modules[@]}"; do
+      path=$(pkg-config --variable=pcfiledir "$module") || return 1
+      _files+=("${path}/${module}.pc")
+    done
   fi
 }
 
+# Records a passing check: the dep.sh call, PATH, then inode, mtime and path
+# of each file it depends on. Best effort; without it dep.sh just runs again.
+write_dependency_manifest() {
+  local -n _check_cmd="$1"
+  local require_whiptail="$2"
+  local files=()
+  dependency_manifest_files files "$require_whiptail" || return 0
+  mkdir -p "$(dirname "$DEPS_MANIFEST")" 2>/dev/null || return 0
+  if {
+    printf 'check=%s\n' "${_check_cmd[*]}"
+    printf 'path=%s\n' "$PATH"
+    stat -L -c '%i %Y %n' -- "${files[@]}"
+  } >"${DEPS_MANIFEST}.tmp" 2>/dev/null; then
+    mv -f "${DEPS_MANIFEST}.tmp" "$DEPS_MANIFEST"
+  else
+    rm -f "${DEPS_MANIFEST}.tmp"
+  fi
+}
+
+# True when the manifest matches this call and PATH and no recorded file was
+# replaced, moved or removed since; costs a single stat.
+dependency_manifest_current() {
+  local -n _check_cmd="$1"
+  [[ -r "$DEPS_MANIFEST" ]] || return 1
+  local check_line="" path_line=""
+  local recorded=()
+  {
+    read -r check_line || true
+    read -r path_line || true
+    mapfile -t recorded
+  } <"$DEPS_MANIFEST"
+  [[ "$check_line" == "check=${_check_cmd[*]}" && "$path_line" == "path=${PATH}" ]] || return 1
+  (( ${#recorded[@]} > 0 )) || return 1
+
+  local files=("${recorded[@]#* * }")
+  local current
+  current=$(stat -L -c '%i %Y %n' -- "${files[@]}" 2>/dev/null) || return 1
+  [[ "$current" == "$(printf '%s\n' "${recorded[@]}")" ]]
+}
+
 parse_resolution() {
   local res="$1"
   if [[ ! $res =~ ^([0-9]+)x([0-9]+)$ ]]; then
@@ -89,7 +365,7 @@ parse_resolution() {
 
 parse_arguments() {
   local parsed
-  parsed=$(getopt -o m:r:f:b:c:h --long method:,resolution:,fps:,bitrate:,corner:,help,menu,no-menu,check-deps -- "$@") || {
+  parsed=$(getopt -o m:r:f:b:c:d:h --long method:,resolution:,fps:,bitrate:,idr-period:,profile:,level:,slices:,intra-refresh:,corner:,duration:,samples:,soak:,rollup:,log-lines:,latency-report:,encode-report:,rtp-dest:,rtp-pace:,rtp-sdp:,http-listen:,max-clients:,record:,segment:,dvr:,pre-event:,post-event:,dvr-arena:,trigger-gpio:,motion,motion-threshold:,adaptive,min-bitrate:,min-fps:,sensor-mode:,mode-report:,roi:,control-socket:,replay:,replay-fps:,capture-buffers:,encode-input-buffers:,encode-output-buffers:,ring-size:,buffer-report:,trace:,list-sensor-modes,cameras:,capture-cpus:,capture-priority:,encode-cpus:,encode-priority:,display-cpus:,mlock,daemon,stop-daemon,help,menu,no-menu,check-deps -- "$@") || {
     usage
     exit 1
   }
@@ -113,10 +389,214 @@ parse_arguments() {
         BITRATE="$2"
         shift 2
         ;;
+      --idr-period)
+        IDR_PERIOD="$2"
+        shift 2
+        ;;
+      --profile)
+        H264_PROFILE="$2"
+        shift 2
+        ;;
+      --level)
+        H264_LEVEL="$2"
+        shift 2
+        ;;
+      --slices)
+        SLICES="$2"
+        shift 2
+        ;;
+      --intra-refresh)
+        INTRA_REFRESH="$2"
+        shift 2
+        ;;
       -c|--corner)
         OVERLAY_CORNER="$2"
         shift 2
         ;;
+      -d|--duration)
+        DURATION="$2"
+        shift 2
+        ;;
+      --samples)
+        SAMPLES_FILE="$2"
+        shift 2
+        ;;
+      --soak)
+        SOAK_DIR="$2"
+        shift 2
+        ;;
+      --rollup)
+        ROLLUP_SECONDS="$2"
+        shift 2
+        ;;
+      --log-lines)
+        LOG_LINES="$2"
+        shift 2
+        ;;
+      --latency-report)
+        LATENCY_REPORT="$2"
+        shift 2
+        ;;
+      --encode-report)
+        ENCODE_REPORT="$2"
+        shift 2
+        ;;
+      --rtp-dest)
+        RTP_DEST="$2"
+        shift 2
+        ;;
+      --rtp-pace)
+        RTP_PACE="$2"
+        shift 2
+        ;;
+      --rtp-sdp)
+        RTP_SDP="$2"
+        shift 2
+        ;;
+      --http-listen)
+        HTTP_LISTEN="$2"
+        shift 2
+        ;;
+      --max-clients)
+        MAX_CLIENTS="$2"
+        shift 2
+        ;;
+      --record)
+        RECORD_DIR="$2"
+        shift 2
+        ;;
+      --segment)
+        SEGMENT_SECONDS="$2"
+        shift 2
+        ;;
+      --dvr)
+        DVR_DIR="$2"
+        shift 2
+        ;;
+      --pre-event)
+        PRE_EVENT_SECONDS="$2"
+        shift 2
+        ;;
+      --post-event)
+        POST_EVENT_SECONDS="$2"
+        shift 2
+        ;;
+      --dvr-arena)
+        DVR_ARENA_MB="$2"
+        shift 2
+        ;;
+      --trigger-gpio)
+        TRIGGER_GPIO="$2"
+        shift 2
+        ;;
+      --motion)
+        MOTION=1
+        shift
+        ;;
+      --motion-threshold)
+        MOTION_THRESHOLD="$2"
+        shift 2
+        ;;
+      --adaptive)
+        ADAPTIVE=1
+        shift
+        ;;
+      --min-bitrate)
+        MIN_BITRATE="$2"
+        shift 2
+        ;;
+      --min-fps)
+        MIN_FPS="$2"
+        shift 2
+        ;;
+      --sensor-mode)
+        SENSOR_MODE="$2"
+        shift 2
+        ;;
+      --mode-report)
+        MODE_REPORT="$2"
+        shift 2
+        ;;
+      --roi)
+        ROI="$2"
+        shift 2
+        ;;
+      --control-socket)
+        CONTROL_SOCKET="$2"
+        shift 2
+        ;;
+      --replay)
+        REPLAY="$2"
+        shift 2
+        ;;
+      --replay-fps)
+        REPLAY_FPS="$2"
+        shift 2
+        ;;
+      --capture-buffers)
+        CAPTURE_BUFFERS="$2"
+        shift 2
+        ;;
+      --encode-input-buffers)
+        ENCODE_INPUT_BUFFERS="$2"
+        shift 2
+        ;;
+      --encode-output-buffers)
+        ENCODE_OUTPUT_BUFFERS="$2"
+        shift 2
+        ;;
+      --ring-size)
+        RING_SIZE_MB="$2"
+        shift 2
+        ;;
+      --buffer-report)
+        BUFFER_REPORT="$2"
+        shift 2
+        ;;
+      --trace)
+        TRACE_FILE="$2"
+        shift 2
+        ;;
+      --list-sensor-modes)
+        LIST_SENSOR_MODES=1
+        shift
+        ;;
+      --cameras)
+        CAMERAS="$2"
+        shift 2
+        ;;
+      --capture-cpus)
+        CAPTURE_CPUS="$2"
+        shift 2
+        ;;
+      --capture-priority)
+        CAPTURE_PRIORITY="$2"
+        shift 2
+        ;;
+      --encode-cpus)
+        ENCODE_CPUS="$2"
+        shift 2
+        ;;
+      --encode-priority)
+        ENCODE_PRIORITY="$2"
+        shift 2
+        ;;
+      --display-cpus)
+        DISPLAY_CPUS="$2"
+        shift 2
+        ;;
+      --mlock)
+        USE_MLOCK=1
+        shift
+        ;;
+      --daemon)
+        USE_DAEMON=1
+        shift
+        ;;
+      --stop-daemon)
+        STOP_DAEMON=1
+        shift
+        ;;
       --menu)
         FORCE_MENU=1
         shift
@@ -166,16 +646,460 @@ validate_configuration() {
   parse_resolution "$RESOLUTION"
   validate_numeric "$FPS" "FPS"
   validate_numeric "$BITRATE" "bitrate"
+  validate_numeric "$DURATION" "duration"
+  validate_numeric "$RTP_PACE" "RTP pacing rate"
+  if [[ "$METHOD" == "h264_rtp" && -z "$RTP_DEST" ]]; then
+    die "--method h264_rtp needs a receiver; pass --rtp-dest <host:port>."
+  fi
+  validate_numeric "$MAX_CLIENTS" "client limit"
+  if (( MAX_CLIENTS == 0 )); then
+    die "Invalid client limit: '0'. Provide a positive integer."
+  fi
   validate_corner "$OVERLAY_CORNER"
+  if [[ -n "$LATENCY_REPORT" && "$METHOD" != "h264_drm_preview" && "$METHOD" != "h264_gl_preview" ]]; then
+    die "--latency-report needs a display path that sees every frame; use --method h264_drm_preview."
+  fi
+  if [[ -n "$ENCODE_REPORT" ]] && ! method_is_native "$METHOD"; then
+    die "--encode-report times the picam-native encoder; use a native method such as h264_null."
+  fi
+  validate_numeric "$SEGMENT_SECONDS" "segment length"
+  if [[ -n "$RECORD_DIR" ]]; then
+    if [[ "$METHOD" == "h264_null" ]]; then
+      die "--record needs a stream consumer; h264_null has none."
+    fi
+    if [[ "$(method_codec "$METHOD")" != h264 ]]; then
+      die "--record writes H.264 MPEG-TS segments; use an h264_* method."
+    fi
+    if (( SEGMENT_SECONDS == 0 )); then
+      die "Invalid segment length: '0'. Provide a positive integer."
+    fi
+    mkdir -p "$RECORD_DIR" || die "Cannot create recording directory '${RECORD_DIR}'."
+  fi
+  validate_numeric "$PRE_EVENT_SECONDS" "pre-event length"
+  validate_numeric "$POST_EVENT_SECONDS" "post-event length"
+  validate_numeric "$DVR_ARENA_MB" "DVR arena size"
+  if [[ -n "$DVR_DIR" ]]; then
+    case "$METHOD" in
+      h264_sdl_preview|h264_native)
+        ;;
+      *)
+        die "--dvr runs in the SDL preview path; use --method h264_sdl_preview or h264_native."
+        ;;
+    esac
+    if (( DVR_ARENA_MB == 0 )); then
+      die "Invalid DVR arena size: '0'. Provide a positive integer."
+    fi
+    if [[ -n "$TRIGGER_GPIO" && ! -r "$TRIGGER_GPIO" ]]; then
+      die "Cannot read GPIO '${TRIGGER_GPIO}'. Export the pin and pass its value file."
+    fi
+    mkdir -p "$DVR_DIR" || die "Cannot create event directory '${DVR_DIR}'."
+  fi
+  validate_numeric "$MOTION_THRESHOLD" "motion threshold"
+  if (( MOTION )); then
+    if ! method_is_native "$METHOD" || [[ "$(method_codec "$METHOD")" != h264 ]]; then
+      die "--motion reads the secondary stream of picam-native; use a native method such as h264_native."
+    fi
+    if (( MOTION_THRESHOLD == 0 || MOTION_THRESHOLD > 100 )); then
+      die "Invalid motion threshold: '${MOTION_THRESHOLD}'. Provide a percentage between 1 and 100."
+    fi
+  fi
+  if (( ADAPTIVE )); then
+    if ! method_is_native "$METHOD" || [[ "$(method_codec "$METHOD")" != h264 ]]; then
+      die "--adaptive steers the picam-native H.264 encoder; use a native method such as h264_rtp."
+    fi
+    if [[ -n "$MIN_BITRATE" ]]; then
+      validate_numeric "$MIN_BITRATE" "minimum bitrate"
+      if (( MIN_BITRATE == 0 || MIN_BITRATE > BITRATE )); then
+        die "Invalid minimum bitrate: '${MIN_BITRATE}'. Provide a value between 1 and --bitrate."
+      fi
+    fi
+    if [[ -n "$MIN_FPS" ]]; then
+      validate_numeric "$MIN_FPS" "minimum FPS"
+      if (( MIN_FPS == 0 || MIN_FPS > FPS )); then
+        die "Invalid minimum FPS: '${MIN_FPS}'. Provide a value between 1 and --fps."
+      fi
+    fi
+  fi
+  if [[ -n "$SENSOR_MODE" ]]; then
+    if ! method_is_native "$METHOD"; then
+      die "--sensor-mode configures the picam-native camera; use a native method such as h264_native."
+    fi
+    if [[ "$SENSOR_MODE" != "auto" && ! "$SENSOR_MODE" =~ ^[0-9]+x[0-9]+(:[0-9]+)?$ ]]; then
+      die "Invalid sensor mode '${SENSOR_MODE}'. Use auto, WxH or WxH:bits (see --list-sensor-modes)."
+    fi
+  fi
+  if [[ -n "$MODE_REPORT" && -z "$SENSOR_MODE" ]]; then
+    die "--mode-report describes the mode --sensor-mode picks; pass --sensor-mode auto."
+  fi
+  validate_buffers
+  validate_cameras
+  validate_soak
+  validate_h264_shape
+  validate_roi
+  validate_replay
+  if (( USE_DAEMON )); then
+    case "$METHOD" in
+      h264_native|h264_drm_preview|h264_gl_preview|h264_rtp|h264_http|mjpeg_native|yuv_native)
+        ;;
+      *)
+        die "--daemon keeps picam-native capture publishing into its ring; use a ring-based native method such as h264_native."
+        ;;
+    esac
+    if [[ -n "$ENCODE_REPORT" ]]; then
+      die "--encode-report is written when capture exits, which a daemon does not; drop --daemon."
+    fi
+    if [[ -n "$TRACE_FILE" ]]; then
+      die "--trace is written when capture exits, which a daemon does not; drop --daemon."
+    fi
+    mkdir -p -m 700 "$DAEMON_DIR" || die "Cannot create daemon directory '${DAEMON_DIR}'."
+  fi
+}
+
+# Pool sizes only exist in picam-native; libcamera-vid keeps its own.
+validate_buffers() {
+  local option
+  for option in "${CAPTURE_BUFFERS}:--capture-buffers:camera buffer count" \
+      "${ENCODE_INPUT_BUFFERS}:--encode-input-buffers:encoder input buffer count" \
+      "${ENCODE_OUTPUT_BUFFERS}:--encode-output-buffers:encoder output buffer count" \
+      "${RING_SIZE_MB}:--ring-size:ring size"; do
+    local value="${option%%:*}"
+    [[ -n "$value" ]] || continue
+    local rest="${option#*:}"
+    if ! method_is_native "$METHOD"; then
+      die "${rest%%:*} sizes a picam-native buffer pool; use a native method such as h264_native."
+    fi
+    validate_numeric "$value" "${rest#*:}"
+    if (( value == 0 )); then
+      die "Invalid ${rest#*:}: '0'. Provide a positive integer."
+    fi
+  done
+  if [[ -n "$RING_SIZE_MB" && "$METHOD" == "h264_null" ]]; then
+    die "--ring-size sizes the ring to the stream readers; h264_null has none."
+  fi
+  if [[ -n "$TRACE_FILE" ]] && ! method_is_native "$METHOD"; then
+    die "--trace records the picam-native stages; use a native method such as h264_drm_preview."
+  fi
+  if [[ -n "$BUFFER_REPORT" ]] && ! method_is_native "$METHOD"; then
+    die "--buffer-report describes the picam-native buffer pools; use a native method such as h264_native."
+  fi
+}
+
+# IDR period, profile and level go to either encoder; slices and intra
+# refresh only exist in picam-native's.
+validate_h264_shape() {
+  local option
+  for option in "${IDR_PERIOD:+1}:--idr-period" "${H264_PROFILE:+1}:--profile" "${H264_LEVEL:+1}:--level" \
+      "${SLICES:+1}:--slices" "${INTRA_REFRESH:+1}:--intra-refresh"; do
+    if [[ "${option%%:*}" == 1 && "$(method_codec "$METHOD")" != h264 ]]; then
+      die "${option#*:} shapes the H.264 stream; use an h264_* method."
+    fi
+  done
+  for option in "${IDR_PERIOD}:IDR period" "${SLICES}:slice count" "${INTRA_REFRESH}:intra refresh period"; do
+    local value="${option%%:*}"
+    [[ -n "$value" ]] || continue
+    validate_numeric "$value" "${option#*:}"
+    if (( value == 0 )); then
+      die "Invalid ${option#*:}: '0'. Provide a positive integer."
+    fi
+  done
+  case "$H264_PROFILE" in
+    ""|baseline|main|high)
+      ;;
+    *)
+      die "Unknown H.264 profile '${H264_PROFILE}'. Use baseline, main or high."
+      ;;
+  esac
+  if [[ -n "$H264_LEVEL" && ! "$H264_LEVEL" =~ ^[1-4](\.[0-9])?$ ]]; then
+    die "Invalid H.264 level '${H264_LEVEL}'. Use 1.0 to 4.2, e.g. 4.1."
+  fi
+  if ! method_is_native "$METHOD"; then
+    if [[ -n "$H264_LEVEL" && ! "$H264_LEVEL" =~ ^4(\.[12])?$ ]]; then
+      die "libcamera-vid takes H.264 level 4, 4.1 or 4.2; use a native method such as h264_native for others."
+    fi
+    if [[ -n "$SLICES" || -n "$INTRA_REFRESH" ]]; then
+      die "--slices and --intra-refresh set the picam-native encoder; use a native method such as h264_native."
+    fi
+  fi
+  if [[ -n "$INTRA_REFRESH" && -z "$IDR_PERIOD" ]] && \
+      [[ -n "$RECORD_DIR" || -n "$DVR_DIR" || "$METHOD" == "h264_http" ]]; then
+    die "--record, --dvr and h264_http cut the stream at IDRs; with --intra-refresh add --idr-period."
+  fi
+}
+
+# Fractions of the field of view, as libcamera-vid --roi takes them too;
+# picam-native checks that the region lies inside it.
+validate_roi() {
+  if [[ -n "$ROI" && ! "$ROI" =~ ^(0|1|0?\.[0-9]+|1\.0*)(,(0|1|0?\.[0-9]+|1\.0*)){3}$ ]]; then
+    die "Invalid region of interest '${ROI}'. Use x,y,w,h as fractions between 0 and 1, e.g. 0.25,0.25,0.5,0.5."
+  fi
+  if [[ -n "$CONTROL_SOCKET" ]] && ! method_is_native "$METHOD"; then
+    die "--control-socket is served by picam-native capture; use a native method such as h264_native."
+  fi
+}
+
+# A recording replaces 'picam-native capture' in front of the ring, so
+# whatever configures the camera or the encoder has nothing to act on.
+validate_replay() {
+  if [[ -z "$REPLAY" ]]; then
+    [[ -z "$REPLAY_FPS" ]] || die "--replay-fps paces --replay; pass the recording with --replay <file>."
+    return 0
+  fi
+  [[ -r "$REPLAY" ]] || die "Cannot read recording '${REPLAY}'."
+  # Annex B opens with a start code; 0x47 is the MPEG-TS sync byte.
+  if [[ $(od -An -tx1 -N1 -- "$REPLAY" | tr -d ' \n') == 47 ]]; then
+    die "'${REPLAY}' is MPEG-TS; --replay takes raw H.264, e.g. 'ffmpeg -i ${REPLAY} -c:v copy -f h264 out.h264'."
+  fi
+  case "$METHOD" in
+    h264_native|h264_drm_preview|h264_gl_preview|h264_null|h264_rtp|h264_http)
+      ;;
+    *)
+      die "--replay feeds the ring of a native H.264 method such as h264_native or h264_drm_preview."
+      ;;
+  esac
+  if [[ -n "$REPLAY_FPS" ]]; then
+    validate_numeric "$REPLAY_FPS" "replay FPS"
+    (( REPLAY_FPS > 0 )) || die "Invalid replay FPS: '0'. Provide a positive integer."
+  fi
+  local option
+  for option in "$USE_DAEMON:--daemon" "$MOTION:--motion" "$ADAPTIVE:--adaptive" "${ROI:+1}:--roi" \
+      "${CONTROL_SOCKET:+1}:--control-socket" "${SENSOR_MODE:+1}:--sensor-mode" \
+      "${ENCODE_REPORT:+1}:--encode-report" "$(( ${#CAMERA_LIST[@]} > 1 )):--cameras"; do
+    if [[ "${option%%:*}" == 1 ]]; then
+      die "${option#*:} does not apply to --replay, which stands in for the camera."
+    fi
+  done
+}
+
+# Paced at what the stages behind the ring, the overlay and --samples are
+# told the frame rate is.
+resolve_replay_fps() {
+  ensure_native_helper
+  if [[ -n "$REPLAY_FPS" ]]; then
+    FPS="$REPLAY_FPS"
+  else
+    FPS=$("$NATIVE_BIN" replay --input "$REPLAY" --print-framerate) || die "Cannot read recording '${REPLAY}'."
+  fi
+  echo "Replaying ${REPLAY} at ${FPS} fps in place of the camera."
+}
+
+# The control socket of one camera's capture process.
+control_socket_path() {
+  local slot="$1"
+  if (( ${#CAMERA_LIST[@]} > 1 )); then
+    echo "${CONTROL_SOCKET}.${CAMERA_LIST[slot]}"
+  else
+    echo "$CONTROL_SOCKET"
+  fi
+}
+
+validate_soak() {
+  validate_numeric "$LOG_LINES" "log length"
+  if (( LOG_LINES == 0 )); then
+    die "Invalid log length: '0'. Provide a positive integer."
+  fi
+  [[ -n "$SOAK_DIR" ]] || return 0
+  validate_numeric "$ROLLUP_SECONDS" "rollup period"
+  if (( ROLLUP_SECONDS == 0 )); then
+    die "Invalid rollup period: '0'. Provide a positive integer."
+  fi
+  mkdir -p "$SOAK_DIR" || die "Cannot create soak directory '${SOAK_DIR}'."
+}
+
+validate_index_list() {
+  local value="$1"
+  local label="$2"
+  if [[ ! "$value" =~ ^[0-9]+(,[0-9]+)*$ ]]; then
+    die "Invalid ${label}: '${value}'. Provide comma-separated non-negative integers."
+  fi
+}
+
+validate_priority() {
+  local value="$1"
+  local label="$2"
+  validate_numeric "$value" "$label"
+  if (( value < 1 || value > 99 )); then
+    die "Invalid ${label}: '${value}'. Provide a SCHED_FIFO priority between 1 and 99."
+  fi
+}
+
+# Fills CAMERA_LIST, CAPTURE_CPU_LIST and ENCODE_CPU_LIST (the latter two
+# empty unless given).
+validate_cameras() {
+  CAMERA_LIST=(0)
+  CAPTURE_CPU_LIST=()
+  ENCODE_CPU_LIST=()
+  if [[ -n "$CAMERAS" ]]; then
+    validate_index_list "$CAMERAS" "camera list"
+    IFS=, read -ra CAMERA_LIST <<<"$CAMERAS"
+    if [[ $(printf '%s\n' "${CAMERA_LIST[@]}" | sort -u | wc -l) -ne ${#CAMERA_LIST[@]} ]]; then
+      die "Camera list '${CAMERAS}' names a camera twice."
+    fi
+  fi
+  if [[ -n "$CAPTURE_CPUS" ]]; then
+    validate_index_list "$CAPTURE_CPUS" "capture CPU list"
+    IFS=, read -ra CAPTURE_CPU_LIST <<<"$CAPTURE_CPUS"
+    if (( ${#CAPTURE_CPU_LIST[@]} != ${#CAMERA_LIST[@]} )); then
+      die "--capture-cpus needs one CPU per camera (${#CAMERA_LIST[@]})."
+    fi
+  fi
+  if [[ -n "$ENCODE_CPUS" ]]; then
+    validate_index_list "$ENCODE_CPUS" "encode CPU list"
+    IFS=, read -ra ENCODE_CPU_LIST <<<"$ENCODE_CPUS"
+    if (( ${#ENCODE_CPU_LIST[@]} != ${#CAMERA_LIST[@]} )); then
+      die "--encode-cpus needs one CPU per camera (${#CAMERA_LIST[@]})."
+    fi
+  fi
+  [[ -z "$CAPTURE_PRIORITY" ]] || validate_priority "$CAPTURE_PRIORITY" "capture priority"
+  [[ -z "$ENCODE_PRIORITY" ]] || validate_priority "$ENCODE_PRIORITY" "encode priority"
+  if [[ -n "$DISPLAY_CPUS" && ! "$DISPLAY_CPUS" =~ ^[0-9]+(-[0-9]+)?(,[0-9]+(-[0-9]+)?)*$ ]]; then
+    die "Invalid display CPU list: '${DISPLAY_CPUS}'. Use a taskset list such as 0, 0-1 or 0,2."
+  fi
+  # picam-native pins its own threads; everything else goes through taskset.
+  local needs_taskset=0
+  [[ -z "$DISPLAY_CPUS" ]] || needs_taskset=1
+  if [[ -n "$CAPTURE_CPUS$ENCODE_CPUS" ]] && ! method_is_native "$METHOD"; then
+    needs_taskset=1
+  fi
+  if (( needs_taskset )) && ! command -v taskset >/dev/null 2>&1; then
+    die "Pinning ffmpeg, libcamera-vid and the stream readers needs taskset (util-linux)."
+  fi
+  # picam-native warns and carries on without SCHED_FIFO; chrt would refuse
+  # to start libcamera-vid at all, so that is checked up front.
+  if [[ -n "$CAPTURE_PRIORITY$ENCODE_PRIORITY" ]] && ! method_is_native "$METHOD"; then
+    chrt -f "$(stage_priority)" true 2>/dev/null ||
+      die "SCHED_FIFO for libcamera-vid needs root, CAP_SYS_NICE or an rtprio limit (see 'ulimit -r')."
+  fi
+
+  (( ${#CAMERA_LIST[@]} > 1 )) || return 0
+  case "$METHOD" in
+    h264_null|h264_native)
+      ;;
+    *)
+      die "Several cameras run as h264_null (throughput) or h264_native (a preview window each)."
+      ;;
+  esac
+  local option
+  for option in "$USE_DAEMON:--daemon" "${RECORD_DIR:+1}:--record" "${DVR_DIR:+1}:--dvr" \
+      "${ENCODE_REPORT:+1}:--encode-report" "${MODE_REPORT:+1}:--mode-report" \
+      "${BUFFER_REPORT:+1}:--buffer-report"; do
+    if [[ "${option%%:*}" == 1 ]]; then
+      die "${option#*:} runs with one camera; drop it or pass a single --cameras entry."
+    fi
+  done
+}
+
+# SCHED_FIFO priority for a process that captures and encodes in one: the
+# higher of --capture-priority and --encode-priority, empty for neither.
+stage_priority() {
+  local priority="${CAPTURE_PRIORITY:-0}"
+  if (( ${ENCODE_PRIORITY:-0} > priority )); then
+    priority="$ENCODE_PRIORITY"
+  fi
+  (( priority > 0 )) && echo "$priority"
+  return 0
+}
+
+# Prefixes the command in the named array with taskset and chrt for a CPU
+# list and a SCHED_FIFO priority; either may be empty.
+place_stage() {
+  local -n _stage="$1"
+  local cpus="$2"
+  local priority="$3"
+  if [[ -n "$priority" ]]; then
+    _stage=(chrt -f "$priority" "${_stage[@]}")
+  fi
+  if [[ -n "$cpus" ]]; then
+    _stage=(taskset -c "$cpus" "${_stage[@]}")
+  fi
+}
+
+# Stages reading the stream share the --display-cpus set.
+place_display_stage() {
+  place_stage "$1" "$DISPLAY_CPUS" ""
+}
+
+# Keeps the once-per-second sampler from competing with the pinned and
+# real-time stages it is measuring.
+demote_monitor() {
+  local pid="$1"
+  [[ -n "$pid" ]] || return 0
+  if [[ -n "$CAPTURE_CPUS$CAPTURE_PRIORITY$ENCODE_CPUS$ENCODE_PRIORITY$DISPLAY_CPUS" ]] || (( USE_MLOCK )); then
+    renice -n 19 -p "$pid" >/dev/null 2>&1 || true
+  fi
+}
+
+# Appends the recorder options for the stage that reads the stream.
+append_soak_args() {
+  local -n _args="$1"
+  if [[ -n "$SOAK_DIR" ]]; then
+    _args+=(--soak "$SOAK_DIR" --rollup "$ROLLUP_SECONDS")
+  fi
+}
+
+# tee for logs that must not grow: copies stdin into log_file line by line,
+# ffmpeg's '\r' progress updates counting as lines, and whenever the file
+# holds twice max_lines cuts it back to the newest max_lines. The disk sees
+# the same writes per hour on the first day of a run as on the tenth.
+bounded_log() {
+  local log_file="$1"
+  local max_lines="$2"
+  local lines=0 line
+  if [[ -s "$log_file" ]]; then
+    lines=$(wc -l <"$log_file")
+  fi
+  stdbuf -oL tr '\r' '\n' | while IFS= read -r line; do
+    printf '%s\n' "$line" >>"$log_file"
+    lines=$((lines + 1))
+    if (( lines >= 2 * max_lines )); then
+      tail -n "$max_lines" "$log_file" >"${log_file}.tmp" && mv -f "${log_file}.tmp" "$log_file"
+      lines=$max_lines
+    fi
+  done
+}
+
+append_record_args() {
+  local -n _args="$1"
+  if [[ -n "$RECORD_DIR" ]]; then
+    _args+=(--record "$RECORD_DIR" --segment "$SEGMENT_SECONDS")
+  fi
+}
+
+append_dvr_args() {
+  local -n _args="$1"
+  if [[ -n "$DVR_DIR" ]]; then
+    _args+=(--dvr "$DVR_DIR" --pre-event "$PRE_EVENT_SECONDS" --post-event "$POST_EVENT_SECONDS"
+      --dvr-arena "$DVR_ARENA_MB")
+    if [[ -n "$TRIGGER_GPIO" ]]; then
+      _args+=(--trigger-gpio "$TRIGGER_GPIO")
+    fi
+    if (( MOTION )); then
+      _args+=(--motion-trigger)
+    fi
+  fi
 }
 
 show_whiptail_wizard() {
   local menu_choice
   menu_choice=$(whiptail --title "PiCam Benchmark" --menu "Select capture method" 20 78 10 \
     "h264_sdl_preview" "libcamera-vid -> H264 -> ffmpeg SDL preview" \
+    "h264_native" "libcamera + V4L2 M2M H264 (picam-native) -> SDL" \
+    "h264_drm_preview" "picam-native H264 -> V4L2 decoder -> DRM/KMS planes" \
+    "h264_gl_preview" "picam-native H264 -> V4L2 decoder -> GLES shader -> KMS" \
+    "h264_null" "picam-native H264 encode only, no display (encoder benchmark)" \
+    "h264_rtp" "picam-native H264 -> RTP/UDP to a remote viewer" \
+    "h264_http" "picam-native H264 -> MPEG-TS over HTTP to many viewers" \
+    "mjpeg_native" "libcamera + V4L2 M2M JPEG (picam-native) -> SDL" \
+    "yuv_native" "libcamera raw YUV420 over shared memory (picam-native) -> SDL" \
     3>&1 1>&2 2>&3) || exit 1
   METHOD="$menu_choice"
 
+  if [[ "$METHOD" == "h264_rtp" ]]; then
+    local dest_choice
+    dest_choice=$(whiptail --title "RTP receiver" --inputbox "Enter receiver address (host:port)" 8 60 "$RTP_DEST" \
+      3>&1 1>&2 2>&3) || exit 1
+    RTP_DEST="$dest_choice"
+  fi
+
   local res_choice
   res_choice=$(whiptail --title "Resolution" --inputbox "Enter resolution (WIDTHxHEIGHT)" 8 60 "$RESOLUTION" \
     3>&1 1>&2 2>&3) || exit 1
@@ -191,6 +1115,11 @@ show_whiptail_wizard() {
     3>&1 1>&2 2>&3) || exit 1
   BITRATE="$bitrate_choice"
 
+  if [[ "$(method_codec "$METHOD")" == h264 ]] && whiptail --title "H.264 encoder" --defaultno \
+      --yesno "Tune the H.264 stream (IDR period, profile, level, slices, intra refresh)?" 8 78; then
+    show_h264_wizard
+  fi
+
   local corner_choice
   corner_choice=$(whiptail --title "Overlay position" --menu "Select overlay corner" 15 60 4 \
     "top-left" "Top left corner" \
@@ -201,6 +1130,41 @@ show_whiptail_wizard() {
   OVERLAY_CORNER="$corner_choice"
 }
 
+show_h264_wizard() {
+  local idr_choice
+  idr_choice=$(whiptail --title "IDR period" --inputbox "Frames between IDRs (empty: one per second)" 8 60 \
+    "$IDR_PERIOD" 3>&1 1>&2 2>&3) || exit 1
+  IDR_PERIOD="$idr_choice"
+
+  local profile_choice
+  profile_choice=$(whiptail --title "H.264 profile" --default-item "${H264_PROFILE:-high}" \
+    --menu "Select H.264 profile" 12 60 3 \
+    "high" "Best compression (default)" \
+    "main" "No 8x8 transform" \
+    "baseline" "Constrained baseline, for the simplest decoders" \
+    3>&1 1>&2 2>&3) || exit 1
+  H264_PROFILE="$profile_choice"
+
+  local level_choice
+  level_choice=$(whiptail --title "H.264 level" --inputbox "Enter H.264 level" 8 60 "${H264_LEVEL:-4.1}" \
+    3>&1 1>&2 2>&3) || exit 1
+  H264_LEVEL="$level_choice"
+
+  # libcamera-vid's encoder has neither.
+  method_is_native "$METHOD" || return 0
+
+  local slices_choice
+  slices_choice=$(whiptail --title "Slices" --inputbox "Slices per picture" 8 60 "${SLICES:-1}" \
+    3>&1 1>&2 2>&3) || exit 1
+  SLICES="$slices_choice"
+
+  local refresh_choice
+  refresh_choice=$(whiptail --title "Intra refresh" \
+    --inputbox "Frames per intra refresh sweep in place of periodic IDRs (empty: off)" 8 78 "$INTRA_REFRESH" \
+    3>&1 1>&2 2>&3) || exit 1
+  INTRA_REFRESH="$refresh_choice"
+}
+
 overlay_position() {
   local corner="$1"
   case "$corner" in
@@ -258,53 +1222,411 @@ format_resource_usage() {
     awk 'BEGIN{cpu=0; mem=0} {cpu+=$1; mem+=$2} END{printf "%.1f %.1f\n", cpu, mem}'
 }
 
-monitor_metrics() {
-  local stats_file="$1"
-  local ffmpeg_log="$2"
-  local width="$3"
-  local height="$4"
-  local bitrate_target="$5"
-  local fps_target="$6"
-  shift 6
-  local pids=("$@")
-
-  local fps_value="$fps_target"
-  local bitrate_value
-  bitrate_value=$(awk -v b="$bitrate_target" 'BEGIN{printf "%.1f Mbps", b / 1000000}')
+monitor_metrics() {
+  local stats_file="$1"
+  local ffmpeg_log="$2"
+  local width="$3"
+  local height="$4"
+  local bitrate_target="$5"
+  local fps_target="$6"
+  local samples_file="$7"
+  shift 7
+  local pids=("$@")
+
+  local fps_value="$fps_target"
+  local bitrate_value
+  bitrate_value=$(awk -v b="$bitrate_target" 'BEGIN{printf "%.1f Mbps", b / 1000000}')
+  local frame_count="" last_frame_count="" dropped=0
+  local start_seconds=$SECONDS last_seconds=$SECONDS
+
+  if [[ -n "$samples_file" && ! -s "$samples_file" ]]; then
+    echo "elapsed_s,fps,cpu_pct,mem_pct,dropped,first_frame_ms,jitter_ms,max_interval_ms,latency_ms,mbps,rss_mib,pss_mib,cma_mib,cache_mib,temp_c,arm_mhz,core_mhz,throttled,peak_kib" \
+      >"$samples_file"
+  fi
+
+  while any_pid_alive "${pids[@]}"; do
+    [[ -f "$stats_file" ]] || break
+
+    if [[ -s "$ffmpeg_log" ]]; then
+      local latest_line
+      latest_line=$(tail -n 5 "$ffmpeg_log" | tr '\r' '\n' | tail -n 1)
+      if [[ $latest_line =~ fps=([0-9.]+) ]]; then
+        fps_value="${BASH_REMATCH[1]}"
+      fi
+      if [[ $latest_line =~ bitrate=([^ ]+) ]]; then
+        bitrate_value="${BASH_REMATCH[1]}"
+      fi
+      if [[ $latest_line =~ frame=\ *([0-9]+) ]]; then
+        frame_count="${BASH_REMATCH[1]}"
+      fi
+      if [[ $latest_line =~ drop=([0-9]+) ]]; then
+        dropped="${BASH_REMATCH[1]}"
+      fi
+    fi
+
+    local usage
+    usage=$(format_resource_usage "${pids[@]}")
+    local cpu_usage mem_usage
+    cpu_usage=$(awk '{print $1}' <<<"$usage")
+    mem_usage=$(awk '{print $2}' <<<"$usage")
+    local temp_c arm_mhz core_mhz throttled
+    read -r temp_c arm_mhz core_mhz throttled <<<"$(soc_sample)"
+
+    if [[ -n "$samples_file" ]] && (( SECONDS > last_seconds )); then
+      # ffmpeg's fps= is a running average; the frame counter delta is per interval.
+      local sample_fps="$fps_value"
+      if [[ -n "$frame_count" && -n "$last_frame_count" ]]; then
+        sample_fps=$(awk -v f=$((frame_count - last_frame_count)) -v s=$((SECONDS - last_seconds)) \
+          'BEGIN{printf "%.2f", f / s}')
+      fi
+      # ffmpeg's log tells neither when the first frame arrived nor how regularly,
+      # nor how old it was.
+      echo "$((SECONDS - start_seconds)),${sample_fps},${cpu_usage},${mem_usage},${dropped},0,0,0,0,0,0,0,0,0,${temp_c},${arm_mhz},${core_mhz},${throttled},0" \
+        >>"$samples_file"
+      last_seconds=$SECONDS
+      last_frame_count="$frame_count"
+    elif [[ -z "$last_frame_count" ]]; then
+      last_frame_count="$frame_count"
+    fi
+
+    {
+      printf "FPS: %s\n" "$fps_value"
+      printf "RES: %sx%s\n" "$width" "$height"
+      printf "BitRate: %s\n" "$bitrate_value"
+      printf "CPU: %s%%%%\n" "$cpu_usage"
+      printf "MEM: %s%%%%\n" "$mem_usage"
+      printf "SOC: %s C ARM %s MHz CORE %s MHz\n" "$temp_c" "$arm_mhz" "$core_mhz"
+      if (( throttled & 0xf )); then
+        printf "THROTTLED: %s\n" "$throttled"
+      fi
+    } >"$stats_file"
+
+    sleep 1
+  done
+}
+
+# Prints "temp_c arm_mhz core_mhz throttled" for the shell monitor, 0 for
+# what the board does not tell. picam-native metrics asks the firmware's
+# mailbox directly; here vcgencmd does, when it is installed.
+soc_sample() {
+  local temp=0 arm=0 core=0 throttled=0x0 value
+  if read -r value 2>/dev/null </sys/class/thermal/thermal_zone0/temp; then
+    temp=$(awk -v t="$value" 'BEGIN{printf "%.1f", t / 1000}')
+  fi
+  if read -r value 2>/dev/null </sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq; then
+    arm=$((value / 1000))
+  fi
+  if command -v vcgencmd >/dev/null 2>&1; then
+    value=$(vcgencmd get_throttled 2>/dev/null) && throttled="${value#throttled=}"
+    value=$(vcgencmd measure_clock core 2>/dev/null) && core=$(( ${value#*=} / 1000000 ))
+  elif read -r value 2>/dev/null </sys/devices/platform/soc/soc:firmware/get_throttled; then
+    throttled="0x${value}"
+  fi
+  echo "$temp $arm $core $throttled"
+}
+
+# The optional fourth argument picks the --cameras entry (default: the first).
+build_camera_command() {
+  local backend="$1"
+  local video_target="$2"
+  local -n _out="$3"
+  local slot="${4:-0}"
+
+  case "$backend" in
+    libcamera-vid)
+      _out=(stdbuf -oL libcamera-vid --inline --codec h264 -t 0
+        --camera "${CAMERA_LIST[slot]}"
+        --width "$WIDTH" --height "$HEIGHT" --framerate "$FPS"
+        --bitrate "$BITRATE" -o "$video_target")
+      [[ -z "$IDR_PERIOD" ]] || _out+=(--intra "$IDR_PERIOD")
+      [[ -z "$H264_PROFILE" ]] || _out+=(--profile "$H264_PROFILE")
+      [[ -z "$H264_LEVEL" ]] || _out+=(--level "$H264_LEVEL")
+      [[ -z "$ROI" ]] || _out+=(--roi "$ROI")
+      # Capture and encode share one process here, so it is placed whole.
+      local cpus="${CAPTURE_CPU_LIST[slot]:-}"
+      if [[ -n "${ENCODE_CPU_LIST[slot]:-}" && "${ENCODE_CPU_LIST[slot]}" != "$cpus" ]]; then
+        cpus+="${cpus:+,}${ENCODE_CPU_LIST[slot]}"
+      fi
+      place_stage _out "$cpus" "$(stage_priority)"
+      ;;
+    native)
+      # Everything behind the ring runs as it would for the camera.
+      if [[ -n "$REPLAY" ]]; then
+        _out=("$NATIVE_BIN" replay --input "$REPLAY" --framerate "$FPS" --loops 0)
+        if [[ -n "$video_target" ]]; then
+          _out+=(--ring-socket "$video_target")
+          [[ -z "$RING_SIZE_MB" ]] || _out+=(--ring-size "$RING_SIZE_MB")
+        else
+          _out+=(--null)
+        fi
+        place_stage _out "${CAPTURE_CPU_LIST[slot]:-}" "$CAPTURE_PRIORITY"
+        return 0
+      fi
+      _out=("$NATIVE_BIN" capture --camera "${CAMERA_LIST[slot]}"
+        --width "$WIDTH" --height "$HEIGHT" --framerate "$FPS"
+        --bitrate "$BITRATE")
+      local codec
+      codec=$(method_codec "$METHOD")
+      if [[ "$codec" != h264 ]]; then
+        _out+=(--codec "$codec")
+      fi
+      [[ -z "$IDR_PERIOD" ]] || _out+=(--idr-period "$IDR_PERIOD")
+      [[ -z "$H264_PROFILE" ]] || _out+=(--profile "$H264_PROFILE")
+      [[ -z "$H264_LEVEL" ]] || _out+=(--level "$H264_LEVEL")
+      [[ -z "$SLICES" ]] || _out+=(--slices "$SLICES")
+      [[ -z "$INTRA_REFRESH" ]] || _out+=(--intra-refresh "$INTRA_REFRESH")
+      [[ -z "$ROI" ]] || _out+=(--roi "$ROI")
+      [[ -z "$CONTROL_SOCKET" ]] || _out+=(--control-socket "$(control_socket_path "$slot")")
+      if (( ${#CAPTURE_CPU_LIST[@]} > 0 )); then
+        _out+=(--cpu "${CAPTURE_CPU_LIST[slot]}")
+      fi
+      if [[ -n "$CAPTURE_PRIORITY" ]]; then
+        _out+=(--fifo-priority "$CAPTURE_PRIORITY")
+      fi
+      if (( ${#ENCODE_CPU_LIST[@]} > 0 )); then
+        _out+=(--encoder-cpu "${ENCODE_CPU_LIST[slot]}")
+      fi
+      if [[ -n "$ENCODE_PRIORITY" ]]; then
+        _out+=(--encoder-fifo-priority "$ENCODE_PRIORITY")
+      fi
+      # Without a target the stream is discarded inside picam-native.
+      if [[ -n "$video_target" ]]; then
+        _out+=(--ring-socket "$video_target")
+      else
+        _out+=(--null)
+      fi
+      if [[ -n "$ENCODE_REPORT" ]]; then
+        _out+=(--encode-report "$ENCODE_REPORT")
+      fi
+      if (( MOTION )); then
+        _out+=(--motion --motion-threshold "$MOTION_THRESHOLD")
+      fi
+      if [[ -n "$SENSOR_MODE" ]]; then
+        _out+=(--sensor-mode "$SENSOR_MODE")
+      fi
+      # A daemon writes its report once, when it starts; runs attaching to
+      # it get a copy (see wait_for_pipeline).
+      if [[ -n "$MODE_REPORT" ]]; then
+        if (( USE_DAEMON )); then
+          _out+=(--mode-report "${DAEMON_DIR}/mode.json")
+        else
+          _out+=(--mode-report "$MODE_REPORT")
+        fi
+      fi
+      [[ -z "$CAPTURE_BUFFERS" ]] || _out+=(--buffers "$CAPTURE_BUFFERS")
+      [[ -z "$ENCODE_INPUT_BUFFERS" ]] || _out+=(--encoder-inputs "$ENCODE_INPUT_BUFFERS")
+      [[ -z "$ENCODE_OUTPUT_BUFFERS" ]] || _out+=(--encoder-outputs "$ENCODE_OUTPUT_BUFFERS")
+      if [[ -n "$RING_SIZE_MB" && -n "$video_target" ]]; then
+        _out+=(--ring-size "$RING_SIZE_MB")
+      fi
+      if [[ -n "$BUFFER_REPORT" ]]; then
+        if (( USE_DAEMON )); then
+          _out+=(--buffer-report "${DAEMON_DIR}/buffers.json")
+        else
+          _out+=(--buffer-report "$BUFFER_REPORT")
+        fi
+      fi
+      if (( ADAPTIVE )); then
+        _out+=(--adaptive)
+        [[ -z "$MIN_BITRATE" ]] || _out+=(--min-bitrate "$MIN_BITRATE")
+        [[ -z "$MIN_FPS" ]] || _out+=(--min-framerate "$MIN_FPS")
+      fi
+      ;;
+    *)
+      die "Unknown camera backend '$backend'"
+      ;;
+  esac
+}
+
+# picam-native capture burns the stats into the pictures before encoding.
+append_capture_overlay() {
+  local -n _capture="$1"
+  local stats_file="$2"
+  local font_path="$3"
+  if [[ -n "$REPLAY" ]]; then
+    echo "${SCRIPT_NAME}: The pictures of --replay are encoded already; the overlay is left out." >&2
+  elif [[ -n "$font_path" ]]; then
+    _capture+=(--overlay-stats "$stats_file" --overlay-font "$font_path" --overlay-corner "$OVERLAY_CORNER")
+  else
+    echo "${SCRIPT_NAME}: No DejaVu font found; the native overlay is disabled." >&2
+  fi
+}
+
+find_overlay_font() {
+  if [[ -f /usr/share/fonts/truetype/dejavu/DejaVuSans.ttf ]]; then
+    echo "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+  elif [[ -f /usr/share/fonts/truetype/dejavu/DejaVuSans-Bold.ttf ]]; then
+    echo "/usr/share/fonts/truetype/dejavu/DejaVuSans-Bold.ttf"
+  fi
+}
+
+# Ends the camera (or cameras) after --duration seconds; the rest of the
+# pipeline then drains on EOF exactly as it does after Ctrl+C. With --daemon
+# the camera keeps running and the consumer is passed in instead.
+start_duration_timer() {
+  DURATION_TIMER_PID=""
+  (( DURATION > 0 )) || return 0
+  (sleep "$DURATION" && kill "$@" 2>/dev/null) &
+  DURATION_TIMER_PID=$!
+}
+
+stop_process() {
+  local pid="$1"
+  [[ -n "$pid" ]] || return 0
+  kill "$pid" 2>/dev/null || true
+  wait "$pid" 2>/dev/null || true
+}
+
+# The stream counter block lives in tmpfs so publishing never touches disk.
+make_counters_file() {
+  mktemp /dev/shm/picam_counters.XXXXXX 2>/dev/null || mktemp /tmp/picam_counters.XXXXXX
+}
+
+# The ring and the overlay stats file of a capture daemon outlive the run, so
+# they sit at fixed paths; otherwise every run gets fresh ones.
+make_ring_path() {
+  if (( USE_DAEMON )); then
+    echo "${DAEMON_DIR}/capture.sock"
+  else
+    mktemp -u /tmp/picam_ring.XXXXXX
+  fi
+}
+
+make_stats_file() {
+  if (( USE_DAEMON )); then
+    : >"${DAEMON_DIR}/stats"
+    echo "${DAEMON_DIR}/stats"
+  else
+    mktemp /tmp/picam_stats.XXXXXX
+  fi
+}
+
+# Removes the files from make_ring_path and make_stats_file unless the capture
+# daemon still uses them.
+remove_capture_files() {
+  (( USE_DAEMON )) || rm -f "$@"
+}
+
+# Prints the PID of the capture daemon if one is running.
+capture_daemon_pid() {
+  local pid
+  pid=$(cat "${DAEMON_DIR}/capture.pid" 2>/dev/null) || return 0
+  [[ "$pid" =~ ^[0-9]+$ && -S "${DAEMON_DIR}/capture.sock" ]] || return 0
+  if [[ "$(tr '\0' ' ' <"/proc/${pid}/cmdline" 2>/dev/null)" == *picam-native\ capture* ]]; then
+    echo "$pid"
+  fi
+}
+
+stop_capture_daemon() {
+  local pid
+  pid=$(capture_daemon_pid)
+  if [[ -n "$pid" ]]; then
+    kill "$pid" 2>/dev/null || true
+    local tries=0
+    while kill -0 "$pid" 2>/dev/null && (( tries < 50 )); do
+      sleep 0.1
+      tries=$((tries + 1))
+    done
+    echo "${SCRIPT_NAME}: Stopped capture daemon ${pid}" >&2
+  fi
+  rm -f "${DAEMON_DIR}/capture.pid" "${DAEMON_DIR}/capture.args" "${DAEMON_DIR}/capture.sock"
+}
 
-  while any_pid_alive "${pids[@]}"; do
-    [[ -f "$stats_file" ]] || break
+# Starts the capture stage. Sets CAMERA_PID for metrics and CAMERA_CHILD_PID
+# for the run to wait on and stop; the latter is empty with --daemon, where a
+# daemon started with the same command line is reused (camera configured,
+# AGC/AWB settled, encoder open) and any other one is replaced.
+start_camera() {
+  local -n _camera_cmd="$1"
+  if (( ! USE_DAEMON )); then
+    "${_camera_cmd[@]}" &
+    CAMERA_PID=$!
+    CAMERA_CHILD_PID=$CAMERA_PID
+    return
+  fi
 
-    if [[ -s "$ffmpeg_log" ]]; then
-      local latest_line
-      latest_line=$(tail -n 5 "$ffmpeg_log" | tr '\r' '\n' | tail -n 1)
-      if [[ $latest_line =~ fps=([0-9.]+) ]]; then
-        fps_value="${BASH_REMATCH[1]}"
-      fi
-      if [[ $latest_line =~ bitrate=([^ ]+) ]]; then
-        bitrate_value="${BASH_REMATCH[1]}"
-      fi
-    fi
+  CAMERA_CHILD_PID=""
+  local signature pid
+  signature=$(printf '%s\n' "${_camera_cmd[@]}")
+  pid=$(capture_daemon_pid)
+  if [[ -n "$pid" && "$(cat "${DAEMON_DIR}/capture.args" 2>/dev/null)" == "$signature" ]]; then
+    echo "${SCRIPT_NAME}: Attaching to capture daemon ${pid}" >&2
+  else
+    stop_capture_daemon
+    # A session of its own keeps Ctrl+C in this terminal away from it.
+    setsid "${_camera_cmd[@]}" </dev/null >>"${DAEMON_DIR}/capture.log" 2>&1 &
+    pid=$!
+    echo "$pid" >"${DAEMON_DIR}/capture.pid"
+    printf '%s\n' "$signature" >"${DAEMON_DIR}/capture.args"
+    echo "${SCRIPT_NAME}: Started capture daemon ${pid}; log in ${DAEMON_DIR}/capture.log" >&2
+  fi
+  CAMERA_PID=$pid
+}
 
-    local usage
-    usage=$(format_resource_usage "${pids[@]}")
-    local cpu_usage mem_usage
-    cpu_usage=$(awk '{print $1}' <<<"$usage")
-    mem_usage=$(awk '{print $2}' <<<"$usage")
+# Waits for the run to end. A capture daemon never does, so there the
+# consumer ending is the end of the run and the cleanup stops the monitor.
+wait_for_pipeline() {
+  local camera_pid="$1"
+  local consumer_pid="$2"
+  local monitor_pid="$3"
+  if [[ -n "$camera_pid" ]]; then
+    wait "$camera_pid" 2>/dev/null || true
+  fi
+  wait "$consumer_pid" 2>/dev/null || true
+  if (( ! USE_DAEMON )); then
+    wait "$monitor_pid" 2>/dev/null || true
+    return 0
+  fi
+  if [[ -n "$MODE_REPORT" ]]; then
+    cp "${DAEMON_DIR}/mode.json" "$MODE_REPORT" 2>/dev/null ||
+      echo "${SCRIPT_NAME}: The capture daemon wrote no sensor mode report" >&2
+  fi
+  if [[ -n "$BUFFER_REPORT" ]]; then
+    cp "${DAEMON_DIR}/buffers.json" "$BUFFER_REPORT" 2>/dev/null ||
+      echo "${SCRIPT_NAME}: The capture daemon wrote no buffer report" >&2
+  fi
+}
 
-    {
-      printf "FPS: %s\n" "$fps_value"
-      printf "RES: %sx%s\n" "$width" "$height"
-      printf "BitRate: %s\n" "$bitrate_value"
-      printf "CPU: %s%%%%\n" "$cpu_usage"
-      printf "MEM: %s%%%%\n" "$mem_usage"
-    } >"$stats_file"
+# Joins the per-process traces, one event per line each, into one JSON array
+# so the stages of all processes show on one timeline.
+merge_traces() {
+  local trace_dir="$1"
+  local output="$2"
+  local traces=("$trace_dir"/*.json)
+  if [[ ! -e "${traces[0]}" ]]; then
+    echo "${SCRIPT_NAME}: No picam-native stage wrote a trace" >&2
+    return 0
+  fi
+  awk 'FNR == 1 || $0 == "]" { next }
+    { sub(/,$/, ""); printf "%s%s", (events++ ? ",\n" : "[\n"), $0 }
+    END { print (events ? "\n]" : "[]") }' "${traces[@]}" >"$output" ||
+    die "Cannot write trace '${output}'."
+  echo "${SCRIPT_NAME}: Trace of ${#traces[@]} stages written to ${output}" >&2
+}
 
-    sleep 1
-  done
+# ffmpeg input options for what the ring carries. Raw frames have no
+# headers, so their geometry and rate have to be spelled out.
+stream_input_format() {
+  local codec="$1"
+  local width="$2"
+  local height="$3"
+  local fps="$4"
+  local -n _format="$5"
+  case "$codec" in
+    mjpeg)
+      _format=(-f mjpeg -framerate "$fps")
+      ;;
+    yuv)
+      _format=(-f rawvideo -pix_fmt yuv420p -video_size "${width}x${height}" -framerate "$fps")
+      ;;
+    *)
+      _format=(-f h264)
+      ;;
+  esac
 }
 
-run_h264_sdl_preview() {
+run_sdl_preview_pipeline() {
+  local camera_backend="$1"
   parse_resolution "$RESOLUTION"
   local width="$WIDTH"
   local height="$HEIGHT"
@@ -315,38 +1637,50 @@ run_h264_sdl_preview() {
   local overlay_x="$OVERLAY_X"
   local overlay_y="$OVERLAY_Y"
 
-  local font_path=""
-  if [[ -f /usr/share/fonts/truetype/dejavu/DejaVuSans.ttf ]]; then
-    font_path="/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
-  elif [[ -f /usr/share/fonts/truetype/dejavu/DejaVuSans-Bold.ttf ]]; then
-    font_path="/usr/share/fonts/truetype/dejavu/DejaVuSans-Bold.ttf"
-  fi
+  local font_path
+  font_path=$(find_overlay_font)
 
-  local video_fifo
-  video_fifo=$(mktemp -u /tmp/picam_video.XXXXXX)
-  mkfifo "$video_fifo"
+  # Native capture publishes into a shared-memory ring that never blocks the
+  # encoder; libcamera-vid can only write to a file, so it keeps the FIFO.
+  local video_fifo=""
+  local video_ring=""
+  local video_target
+  if [[ "$camera_backend" == "native" ]]; then
+    video_ring=$(make_ring_path)
+    video_target="$video_ring"
+  else
+    video_fifo=$(mktemp -u /tmp/picam_video.XXXXXX)
+    mkfifo "$video_fifo"
+    video_target="$video_fifo"
+  fi
 
   local stats_file
-  stats_file=$(mktemp /tmp/picam_stats.XXXXXX)
-  local ffmpeg_log
-  ffmpeg_log=$(mktemp /tmp/picam_ffmpeg.XXXXXX)
+  stats_file=$(make_stats_file)
+
+  # With the helper available, a parser stage counts the stream into shared
+  # memory; otherwise the shell monitor falls back to scraping ffmpeg's log.
+  local counters_file=""
+  local ffmpeg_log=""
+  if native_helper_ready; then
+    counters_file=$(make_counters_file)
+  else
+    [[ -z "$RECORD_DIR" ]] || die "--record needs picam-native; build it or drop --record."
+    [[ -z "$DVR_DIR" ]] || die "--dvr needs picam-native; build it or drop --dvr."
+    [[ -z "$SOAK_DIR" ]] || die "--soak needs picam-native; build it or drop --soak."
+    ffmpeg_log=$(mktemp /tmp/picam_ffmpeg.XXXXXX)
+  fi
 
   local ffmpeg_pid=""
   local camera_pid=""
   local monitor_pid=""
 
-  stop_process() {
-    local pid="$1"
-    [[ -n "$pid" ]] || return
-    kill "$pid" 2>/dev/null || true
-    wait "$pid" 2>/dev/null || true
-  }
-
   cleanup_pipeline() {
+    stop_process "${DURATION_TIMER_PID:-}"
     stop_process "$monitor_pid"
     stop_process "$camera_pid"
     stop_process "$ffmpeg_pid"
-    rm -f "$video_fifo" "$stats_file" "$ffmpeg_log"
+    remove_capture_files "$video_ring" "$stats_file"
+    rm -f "$video_fifo" "$ffmpeg_log" "$counters_file"
   }
 
   trap cleanup_pipeline EXIT INT TERM
@@ -358,34 +1692,498 @@ run_h264_sdl_preview() {
     drawtext="drawtext=textfile=$(escape_path_for_drawtext "$stats_file"):reload=1:x=${overlay_x}:y=${overlay_y}:fontcolor=white:fontsize=28:box=1:boxcolor=0x000000AA:boxborderw=8:line_spacing=6"
   fi
 
-  stdbuf -oL -eL ffmpeg -hide_banner -loglevel info -stats \
-    -fflags nobuffer -flags low_delay -framedrop \
-    -f h264 -i "$video_fifo" \
-    -vf "$drawtext" -an -f sdl "PiCam Preview" \
-    2> >(stdbuf -oL tee "$ffmpeg_log") &
+  # Native capture burns the overlay into the frames before encoding, so ffmpeg
+  # only has to decode and display.
+  local video_filter=(-vf "$drawtext")
+  if [[ "$camera_backend" == "native" ]]; then
+    video_filter=()
+  fi
+
+  local ffmpeg_input="pipe:0"
+  if [[ -n "$video_fifo" && -z "$counters_file" ]]; then
+    ffmpeg_input="$video_fifo"
+  fi
+  local codec
+  codec=$(method_codec "$METHOD")
+  local input_format=()
+  stream_input_format "$codec" "$width" "$height" "$fps" input_format
+  local ffmpeg_cmd=(stdbuf -oL -eL ffmpeg -hide_banner -loglevel info -stats
+    -fflags nobuffer -flags low_delay -framedrop
+    "${input_format[@]}" -i "$ffmpeg_input"
+    "${video_filter[@]}" -an -f sdl "PiCam Preview")
+
+  local tap_cmd=()
+  if [[ -n "$video_ring" ]]; then
+    tap_cmd=("$NATIVE_BIN" ring-cat --socket "$video_ring")
+  else
+    tap_cmd=("$NATIVE_BIN" h264-tap --input "$video_fifo")
+  fi
+  tap_cmd+=(--counters "$counters_file" --framerate "$fps")
+  if [[ "$codec" != h264 ]]; then
+    tap_cmd+=(--codec "$codec")
+  fi
+  append_record_args tap_cmd
+  append_dvr_args tap_cmd
+  place_display_stage tap_cmd
+  place_display_stage ffmpeg_cmd
+
+  # Camera first: replacing a daemon must not pull the ring from under the tap.
+  local camera_cmd=()
+  build_camera_command "$camera_backend" "$video_target" camera_cmd
+  if [[ "$camera_backend" == "native" ]]; then
+    append_capture_overlay camera_cmd "$stats_file" "$font_path"
+  fi
+  start_camera camera_cmd
+  camera_pid="$CAMERA_CHILD_PID"
+
+  if [[ -n "$counters_file" ]]; then
+    "${tap_cmd[@]}" | "${ffmpeg_cmd[@]}" &
+  else
+    "${ffmpeg_cmd[@]}" 2> >(stdbuf -oL tee >(bounded_log "$ffmpeg_log" "$LOG_LINES")) &
+  fi
   ffmpeg_pid=$!
+  start_duration_timer "${camera_pid:-$ffmpeg_pid}"
 
-  stdbuf -oL libcamera-vid --inline --codec h264 -t 0 \
-    --width "$width" --height "$height" --framerate "$fps" \
-    --bitrate "$bitrate" -o "$video_fifo" &
-  camera_pid=$!
+  if [[ -n "$counters_file" ]]; then
+    local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file" --counters "$counters_file"
+      --width "$width" --height "$height" --bitrate "$bitrate" --fps "$fps"
+      --pid "$CAMERA_PID" --pid "$ffmpeg_pid")
+    if [[ -n "$SAMPLES_FILE" ]]; then
+      metrics_cmd+=(--samples "$SAMPLES_FILE")
+    fi
+    append_soak_args metrics_cmd
+    "${metrics_cmd[@]}" &
+  else
+    monitor_metrics "$stats_file" "$ffmpeg_log" "$width" "$height" "$bitrate" "$fps" "$SAMPLES_FILE" \
+      "$camera_pid" "$ffmpeg_pid" &
+  fi
+  monitor_pid=$!
+  demote_monitor "$monitor_pid"
+
+  wait_for_pipeline "$camera_pid" "$ffmpeg_pid" "$monitor_pid"
+
+  trap - EXIT INT TERM
+  cleanup_pipeline
+}
 
-  monitor_metrics "$stats_file" "$ffmpeg_log" "$width" "$height" "$bitrate" "$fps" "$camera_pid" "$ffmpeg_pid" &
+run_h264_sdl_preview() {
+  run_sdl_preview_pipeline "libcamera-vid"
+}
+
+run_h264_native() {
+  ensure_native_helper
+  run_sdl_preview_pipeline "native"
+}
+
+# The same SDL path with a JPEG per frame from the bcm2835 image encoder
+# (/dev/video31), or with the raw YUV420 frames themselves in the ring: what
+# H.264 costs against what it saves in bandwidth.
+run_mjpeg_native() {
+  ensure_native_helper
+  run_sdl_preview_pipeline "native"
+}
+
+run_yuv_native() {
+  ensure_native_helper
+  run_sdl_preview_pipeline "native"
+}
+
+# Decodes on /dev/video10 and scans the dmabufs out on a KMS plane; the stats
+# box sits on its own plane, so nothing is burned into the stream. With the gl
+# renderer (h264_gl_preview) the GPU converts, scales and composites the box in
+# one shader pass instead. Needs the console (no desktop session holding the
+# display).
+run_h264_drm_preview() {
+  local renderer="$1"
+  ensure_native_helper
+  if [[ "$renderer" == "gl" && ! -e "${NATIVE_BIN}.gl" ]]; then
+    die "h264_gl_preview needs picam-native built with EGL, GLES and GBM. Run '${SCRIPT_DIR}/dep.sh --require-gl'."
+  fi
+  parse_resolution "$RESOLUTION"
+
+  local font_path
+  font_path=$(find_overlay_font)
+
+  local video_ring
+  video_ring=$(make_ring_path)
+  local stats_file
+  stats_file=$(make_stats_file)
+  local counters_file
+  counters_file=$(make_counters_file)
+
+  local preview_pid=""
+  local camera_pid=""
+  local monitor_pid=""
+
+  cleanup_drm_preview() {
+    stop_process "${DURATION_TIMER_PID:-}"
+    stop_process "$monitor_pid"
+    stop_process "$camera_pid"
+    stop_process "$preview_pid"
+    remove_capture_files "$video_ring" "$stats_file"
+    rm -f "$counters_file"
+  }
+
+  trap cleanup_drm_preview EXIT INT TERM
+
+  local preview_cmd=("$NATIVE_BIN" drm-preview --socket "$video_ring" --renderer "$renderer"
+    --width "$WIDTH" --height "$HEIGHT" --counters "$counters_file" --framerate "$FPS")
+  if [[ -n "$font_path" ]]; then
+    preview_cmd+=(--overlay-stats "$stats_file" --overlay-font "$font_path" --overlay-corner "$OVERLAY_CORNER")
+  else
+    echo "${SCRIPT_NAME}: No DejaVu font found; the overlay plane is disabled." >&2
+  fi
+  if [[ -n "$LATENCY_REPORT" ]]; then
+    preview_cmd+=(--latency-report "$LATENCY_REPORT")
+  fi
+  append_record_args preview_cmd
+  place_display_stage preview_cmd
+
+  # Camera first: replacing a daemon must not pull the ring from under a consumer.
+  local camera_cmd=()
+  build_camera_command native "$video_ring" camera_cmd
+  if [[ -n "$LATENCY_REPORT" ]]; then
+    camera_cmd+=(--latency-sei)
+  fi
+  start_camera camera_cmd
+  camera_pid="$CAMERA_CHILD_PID"
+
+  "${preview_cmd[@]}" &
+  preview_pid=$!
+  start_duration_timer "${camera_pid:-$preview_pid}"
+
+  local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file" --counters "$counters_file"
+    --width "$WIDTH" --height "$HEIGHT" --bitrate "$BITRATE" --fps "$FPS"
+    --pid "$CAMERA_PID" --pid "$preview_pid")
+  if [[ -n "$SAMPLES_FILE" ]]; then
+    metrics_cmd+=(--samples "$SAMPLES_FILE")
+  fi
+  append_soak_args metrics_cmd
+  "${metrics_cmd[@]}" &
   monitor_pid=$!
+  demote_monitor "$monitor_pid"
+
+  wait_for_pipeline "$camera_pid" "$preview_pid" "$monitor_pid"
+
+  trap - EXIT INT TERM
+  cleanup_drm_preview
+}
+
+# Capture and encode only. The access units are dropped in-process, so the
+# numbers are the encoder's ceiling with no decode or display cost mixed in.
+run_h264_null() {
+  ensure_native_helper
+  parse_resolution "$RESOLUTION"
+
+  local stats_file
+  stats_file=$(mktemp /tmp/picam_stats.XXXXXX)
+  local counters_file
+  counters_file=$(make_counters_file)
+
+  local camera_pid=""
+  local monitor_pid=""
+
+  cleanup_null() {
+    stop_process "${DURATION_TIMER_PID:-}"
+    stop_process "$monitor_pid"
+    stop_process "$camera_pid"
+    rm -f "$stats_file" "$counters_file"
+  }
+
+  trap cleanup_null EXIT INT TERM
+
+  local camera_cmd=()
+  build_camera_command native "" camera_cmd
+  camera_cmd+=(--counters "$counters_file")
+  "${camera_cmd[@]}" &
+  camera_pid=$!
+  start_duration_timer "$camera_pid"
+
+  # Nothing shows the overlay here; metrics only runs to record samples.
+  if [[ -n "$SAMPLES_FILE" || -n "$SOAK_DIR" ]]; then
+    local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file" --counters "$counters_file"
+      --width "$WIDTH" --height "$HEIGHT" --bitrate "$BITRATE" --fps "$FPS" --pid "$camera_pid")
+    if [[ -n "$SAMPLES_FILE" ]]; then
+      metrics_cmd+=(--samples "$SAMPLES_FILE")
+    fi
+    append_soak_args metrics_cmd
+    "${metrics_cmd[@]}" &
+    monitor_pid=$!
+    demote_monitor "$monitor_pid"
+  fi
 
   wait "$camera_pid" 2>/dev/null || true
-  wait "$ffmpeg_pid" 2>/dev/null || true
-  wait "$monitor_pid" 2>/dev/null || true
 
   trap - EXIT INT TERM
-  cleanup_pipeline
+  cleanup_null
+}
+
+# Same capture, overlay and metrics as h264_native, but the ring is sent to a
+# remote viewer as RTP instead of being decoded locally.
+run_h264_rtp() {
+  ensure_native_helper
+  parse_resolution "$RESOLUTION"
+
+  local font_path
+  font_path=$(find_overlay_font)
+
+  local video_ring
+  video_ring=$(make_ring_path)
+  local stats_file
+  stats_file=$(make_stats_file)
+  local counters_file
+  counters_file=$(make_counters_file)
+
+  local sender_pid=""
+  local camera_pid=""
+  local monitor_pid=""
+
+  cleanup_rtp() {
+    stop_process "${DURATION_TIMER_PID:-}"
+    stop_process "$monitor_pid"
+    stop_process "$camera_pid"
+    stop_process "$sender_pid"
+    remove_capture_files "$video_ring" "$stats_file"
+    rm -f "$counters_file"
+  }
+
+  trap cleanup_rtp EXIT INT TERM
+
+  local sender_cmd=("$NATIVE_BIN" rtp-send --socket "$video_ring" --dest "$RTP_DEST" --pace "$RTP_PACE"
+    --counters "$counters_file" --framerate "$FPS")
+  if [[ -n "$RTP_SDP" ]]; then
+    sender_cmd+=(--sdp "$RTP_SDP")
+    echo "${SCRIPT_NAME}: Receiver: ffplay -protocol_whitelist file,udp,rtp -fflags nobuffer ${RTP_SDP}" >&2
+  fi
+  append_record_args sender_cmd
+  place_display_stage sender_cmd
+
+  local camera_cmd=()
+  build_camera_command native "$video_ring" camera_cmd
+  append_capture_overlay camera_cmd "$stats_file" "$font_path"
+  start_camera camera_cmd
+  camera_pid="$CAMERA_CHILD_PID"
+
+  "${sender_cmd[@]}" &
+  sender_pid=$!
+  start_duration_timer "${camera_pid:-$sender_pid}"
+
+  local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file" --counters "$counters_file"
+    --width "$WIDTH" --height "$HEIGHT" --bitrate "$BITRATE" --fps "$FPS"
+    --pid "$CAMERA_PID" --pid "$sender_pid")
+  if [[ -n "$SAMPLES_FILE" ]]; then
+    metrics_cmd+=(--samples "$SAMPLES_FILE")
+  fi
+  append_soak_args metrics_cmd
+  "${metrics_cmd[@]}" &
+  monitor_pid=$!
+  demote_monitor "$monitor_pid"
+
+  wait_for_pipeline "$camera_pid" "$sender_pid" "$monitor_pid"
+
+  trap - EXIT INT TERM
+  cleanup_rtp
+}
+
+# One encode fanned out to many HTTP viewers by 'picam-native serve'; slow
+# viewers skip to the next IDR instead of holding the others back.
+run_h264_http() {
+  ensure_native_helper
+  parse_resolution "$RESOLUTION"
+
+  local font_path
+  font_path=$(find_overlay_font)
+
+  local video_ring
+  video_ring=$(make_ring_path)
+  local stats_file
+  stats_file=$(make_stats_file)
+  local counters_file
+  counters_file=$(make_counters_file)
+
+  local server_pid=""
+  local camera_pid=""
+  local monitor_pid=""
+
+  cleanup_http() {
+    stop_process "${DURATION_TIMER_PID:-}"
+    stop_process "$monitor_pid"
+    stop_process "$camera_pid"
+    stop_process "$server_pid"
+    remove_capture_files "$video_ring" "$stats_file"
+    rm -f "$counters_file"
+  }
+
+  trap cleanup_http EXIT INT TERM
+
+  local server_cmd=("$NATIVE_BIN" serve --socket "$video_ring" --listen "$HTTP_LISTEN" --max-clients "$MAX_CLIENTS"
+    --counters "$counters_file" --framerate "$FPS")
+  append_record_args server_cmd
+  place_display_stage server_cmd
+  echo "${SCRIPT_NAME}: Viewers: ffplay -fflags nobuffer http://<pi-address>:${HTTP_LISTEN##*:}/stream.ts" >&2
+
+  local camera_cmd=()
+  build_camera_command native "$video_ring" camera_cmd
+  append_capture_overlay camera_cmd "$stats_file" "$font_path"
+  start_camera camera_cmd
+  camera_pid="$CAMERA_CHILD_PID"
+
+  "${server_cmd[@]}" &
+  server_pid=$!
+  start_duration_timer "${camera_pid:-$server_pid}"
+
+  local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file" --counters "$counters_file"
+    --width "$WIDTH" --height "$HEIGHT" --bitrate "$BITRATE" --fps "$FPS"
+    --pid "$CAMERA_PID" --pid "$server_pid")
+  if [[ -n "$SAMPLES_FILE" ]]; then
+    metrics_cmd+=(--samples "$SAMPLES_FILE")
+  fi
+  append_soak_args metrics_cmd
+  "${metrics_cmd[@]}" &
+  monitor_pid=$!
+  demote_monitor "$monitor_pid"
+
+  wait_for_pipeline "$camera_pid" "$server_pid" "$monitor_pid"
+
+  trap - EXIT INT TERM
+  cleanup_http
+}
+
+# One capture process per --cameras entry, each with its own camera, ISP
+# and encoder context; a single metrics process adds their counters up, so
+# the samples' fps column is the total throughput of all cameras.
+run_multi_camera() {
+  ensure_native_helper
+  parse_resolution "$RESOLUTION"
+
+  local font_path=""
+  if [[ "$METHOD" == "h264_native" ]]; then
+    font_path=$(find_overlay_font)
+    [[ -n "$font_path" ]] || echo "${SCRIPT_NAME}: No DejaVu font found; the native overlay is disabled." >&2
+  fi
+  local stats_file
+  stats_file=$(mktemp /tmp/picam_stats.XXXXXX)
+
+  local counters_files=()
+  local rings=()
+  local camera_pids=()
+  local viewer_pids=()
+  local monitor_pid=""
+
+  cleanup_multi_camera() {
+    stop_process "${DURATION_TIMER_PID:-}"
+    stop_process "$monitor_pid"
+    local pid
+    for pid in "${camera_pids[@]}" "${viewer_pids[@]}"; do
+      stop_process "$pid"
+    done
+    rm -f "$stats_file" "${counters_files[@]}" "${rings[@]}"
+  }
+
+  trap cleanup_multi_camera EXIT INT TERM
+
+  local slot
+  for slot in "${!CAMERA_LIST[@]}"; do
+    local counters_file
+    counters_file=$(make_counters_file)
+    counters_files+=("$counters_file")
+
+    local camera_cmd=()
+    if [[ "$METHOD" == "h264_null" ]]; then
+      build_camera_command native "" camera_cmd "$slot"
+      camera_cmd+=(--counters "$counters_file")
+      "${camera_cmd[@]}" &
+      camera_pids+=($!)
+      continue
+    fi
+
+    local video_ring
+    video_ring=$(mktemp -u /tmp/picam_ring.XXXXXX)
+    rings+=("$video_ring")
+    build_camera_command native "$video_ring" camera_cmd "$slot"
+    if [[ -n "$font_path" ]]; then
+      camera_cmd+=(--overlay-stats "$stats_file" --overlay-font "$font_path" --overlay-corner "$OVERLAY_CORNER")
+    fi
+    "${camera_cmd[@]}" &
+    camera_pids+=($!)
+
+    local tap_cmd=("$NATIVE_BIN" ring-cat --socket "$video_ring" --counters "$counters_file" --framerate "$FPS")
+    local viewer_cmd=(stdbuf -oL -eL ffmpeg -hide_banner -loglevel info -stats -fflags nobuffer -flags low_delay
+      -framedrop -f h264 -i pipe:0 -an -f sdl "PiCam Preview (camera ${CAMERA_LIST[slot]})")
+    place_display_stage tap_cmd
+    place_display_stage viewer_cmd
+    "${tap_cmd[@]}" | "${viewer_cmd[@]}" &
+    viewer_pids+=($!)
+  done
+  start_duration_timer "${camera_pids[@]}"
+
+  local metrics_cmd=("$NATIVE_BIN" metrics --stats-file "$stats_file"
+    --width "$WIDTH" --height "$HEIGHT" --bitrate "$BITRATE" --fps "$FPS")
+  local counters_file pid
+  for counters_file in "${counters_files[@]}"; do
+    metrics_cmd+=(--counters "$counters_file")
+  done
+  for pid in "${camera_pids[@]}" "${viewer_pids[@]}"; do
+    metrics_cmd+=(--pid "$pid")
+  done
+  if [[ -n "$SAMPLES_FILE" ]]; then
+    metrics_cmd+=(--samples "$SAMPLES_FILE")
+  fi
+  append_soak_args metrics_cmd
+  # h264_null has no overlay; metrics then only runs to record samples.
+  if [[ "$METHOD" == "h264_native" || -n "$SAMPLES_FILE" || -n "$SOAK_DIR" ]]; then
+    "${metrics_cmd[@]}" &
+    monitor_pid=$!
+    demote_monitor "$monitor_pid"
+  fi
+
+  for pid in "${camera_pids[@]}" "${viewer_pids[@]}"; do
+    wait "$pid" 2>/dev/null || true
+  done
+  if [[ -n "$monitor_pid" ]]; then
+    wait "$monitor_pid" 2>/dev/null || true
+  fi
+
+  trap - EXIT INT TERM
+  cleanup_multi_camera
 }
 
 start_capture() {
+  if [[ -n "$REPLAY" ]]; then
+    resolve_replay_fps
+  fi
+  if (( ${#CAMERA_LIST[@]} > 1 )); then
+    run_multi_camera
+    return
+  fi
   case "$METHOD" in
     h264_sdl_preview)
       run_h264_sdl_preview
       ;;
+    h264_native)
+      run_h264_native
+      ;;
+    h264_drm_preview)
+      run_h264_drm_preview planes
+      ;;
+    h264_gl_preview)
+      run_h264_drm_preview gl
+      ;;
+    h264_null)
+      run_h264_null
+      ;;
+    h264_rtp)
+      run_h264_rtp
+      ;;
+    h264_http)
+      run_h264_http
+      ;;
+    mjpeg_native)
+      run_mjpeg_native
+      ;;
+    yuv_native)
+      run_yuv_native
+      ;;
     *)
       die "Unsupported method '$METHOD'"
       ;;
@@ -393,11 +2191,73 @@ start_capture() {
 }
 
 main() {
+  # Stream monitors report the time to first frame relative to this moment.
+  if [[ -n "${EPOCHREALTIME:-}" ]]; then
+    PICAM_START_US="${EPOCHREALTIME//[^0-9]/}"
+  else
+    PICAM_START_US=$(date +%s%6N)
+  fi
+  export PICAM_START_US
+
   METHOD="$DEFAULT_METHOD"
   RESOLUTION="$DEFAULT_RESOLUTION"
   FPS="$DEFAULT_FPS"
   BITRATE="$DEFAULT_BITRATE"
   OVERLAY_CORNER="$DEFAULT_CORNER"
+  DURATION=0
+  SAMPLES_FILE=""
+  LATENCY_REPORT=""
+  ENCODE_REPORT=""
+  RTP_DEST=""
+  RTP_PACE=0
+  RTP_SDP=""
+  HTTP_LISTEN=8080
+  MAX_CLIENTS=10
+  RECORD_DIR=""
+  SEGMENT_SECONDS=60
+  DVR_DIR=""
+  PRE_EVENT_SECONDS=10
+  POST_EVENT_SECONDS=10
+  DVR_ARENA_MB=32
+  TRIGGER_GPIO=""
+  MOTION=0
+  MOTION_THRESHOLD=2
+  ADAPTIVE=0
+  MIN_BITRATE=""
+  MIN_FPS=""
+  SENSOR_MODE=""
+  MODE_REPORT=""
+  ROI=""
+  CONTROL_SOCKET=""
+  REPLAY=""
+  REPLAY_FPS=""
+  CAPTURE_BUFFERS=""
+  ENCODE_INPUT_BUFFERS=""
+  ENCODE_OUTPUT_BUFFERS=""
+  RING_SIZE_MB=""
+  BUFFER_REPORT=""
+  TRACE_FILE=""
+  SOAK_DIR=""
+  IDR_PERIOD=""
+  H264_PROFILE=""
+  H264_LEVEL=""
+  SLICES=""
+  INTRA_REFRESH=""
+  ROLLUP_SECONDS="$DEFAULT_ROLLUP_SECONDS"
+  LOG_LINES="$DEFAULT_LOG_LINES"
+  LIST_SENSOR_MODES=0
+  CAMERAS=0
+  CAPTURE_CPUS=""
+  CAPTURE_PRIORITY=""
+  CAMERA_LIST=(0)
+  CAPTURE_CPU_LIST=()
+  ENCODE_CPUS=""
+  ENCODE_PRIORITY=""
+  DISPLAY_CPUS=""
+  USE_MLOCK=0
+  ENCODE_CPU_LIST=()
+  USE_DAEMON=0
+  STOP_DAEMON=0
   SKIP_MENU=0
   FORCE_MENU=0
   CHECK_DEPS_ONLY=0
@@ -415,12 +2275,19 @@ main() {
     fi
   fi
 
+  if (( STOP_DAEMON )); then
+    stop_capture_daemon
+    exit 0
+  fi
+
   if (( CHECK_DEPS_ONLY )); then
     local dep_check_cmd=()
     build_dependency_command "$require_whiptail" "check" dep_check_cmd
     if "${dep_check_cmd[@]}"; then
+      write_dependency_manifest dep_check_cmd "$require_whiptail"
       exit 0
     else
+      rm -f "$DEPS_MANIFEST"
       exit 1
     fi
   fi
@@ -428,7 +2295,13 @@ main() {
   local dep_check_cmd=()
   build_dependency_command "$require_whiptail" "check" dep_check_cmd
 
-  if ! "${dep_check_cmd[@]}"; then
+  # Skipped while nothing dep.sh looked at has changed since it last passed.
+  local deps_cached=0
+  if dependency_manifest_current dep_check_cmd; then
+    deps_cached=1
+  fi
+
+  if (( ! deps_cached )) && ! "${dep_check_cmd[@]}"; then
     echo "Missing dependencies detected."
     if [[ $EUID -eq 0 ]]; then
       local dep_install_cmd=()
@@ -456,14 +2329,45 @@ main() {
       die "Dependencies are still missing after attempting installation."
     fi
   fi
+  if (( ! deps_cached )); then
+    write_dependency_manifest dep_check_cmd "$require_whiptail"
+  fi
+
+  if (( LIST_SENSOR_MODES )); then
+    parse_resolution "$RESOLUTION"
+    validate_numeric "$FPS" "FPS"
+    ensure_native_helper
+    if [[ -n "$(capture_daemon_pid)" ]]; then
+      die "The capture daemon holds the camera; run '${SCRIPT_NAME} --stop-daemon' first."
+    fi
+    exec "$NATIVE_BIN" sensor-modes --camera "${CAMERAS%%,*}" --width "$WIDTH" --height "$HEIGHT" \
+      --framerate "$FPS"
+  fi
 
   if [[ "$show_menu" -eq 1 ]]; then
     show_whiptail_wizard
   fi
 
   validate_configuration
-  check_dependencies
+  if (( USE_MLOCK )); then
+    # Read by every picam-native stage at startup.
+    export PICAM_MLOCK=1
+  fi
+  local trace_dir=""
+  if [[ -n "$TRACE_FILE" ]]; then
+    # Every picam-native stage writes its own trace here when it exits.
+    trace_dir=$(mktemp -d /tmp/picam_trace.XXXXXX) || die "Cannot create a trace directory."
+    export PICAM_TRACE="$trace_dir"
+  fi
+  if [[ -n "$SOAK_DIR" ]]; then
+    # Every stage inherits this stderr, so one bounded log holds them all.
+    exec 2> >(stdbuf -oL tee >(bounded_log "${SOAK_DIR}/picam.log" "$LOG_LINES") >&2)
+  fi
   start_capture
+  if [[ -n "$trace_dir" ]]; then
+    merge_traces "$trace_dir" "$TRACE_FILE"
+    rm -rf "$trace_dir"
+  fi
 }
 
 main "$@"